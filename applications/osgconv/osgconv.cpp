@@ -16,10 +16,13 @@
 #include <osgDB/ReadFile>
 #include <osgDB/WriteFile>
 #include <osgDB/FileNameUtils>
+#include <osgDB/FileUtils>
 #include <osgDB/ReaderWriter>
 #include <osgDB/PluginQuery>
 
 #include <osgUtil/Optimizer>
+#include <osgUtil/MeshOptimizers>
+#include <osgUtil/PagedLODBuilder>
 #include <osgUtil/Simplifier>
 #include <osgUtil/SmoothingVisitor>
 
@@ -417,6 +420,76 @@ public:
 
 };
 
+/** Write the tiles of a paged database with the registry's options, called from the builder's threads.*/
+class WriteTileCallback : public osgUtil::PagedLODBuilder::WriteTileCallback
+{
+public:
+
+    virtual bool writeTile(const osg::Node& node, const std::string& fileName)
+    {
+        osgDB::makeDirectoryForFile(fileName);
+        return osgDB::writeNodeFile(node, fileName, osgDB::Registry::instance()->getOptions());
+    }
+};
+
+
+/** Time the smoothing and optimization of fresh copies of the input files run serially and with numThreads,
+  * and compare the results written as .osgt to check the threaded passes produce identical scene graphs.*/
+static void benchmarkOptimizer(FileNameList& fileNames, unsigned int numThreads, bool smooth)
+{
+    osgDB::ReaderWriter* rw = osgDB::Registry::instance()->getReaderWriterForExtension("osgt");
+    unsigned int threads[2] = { 1, numThreads };
+    double times[2] = { 0.0, 0.0 };
+    std::string results[2];
+
+    for(unsigned int i=0; i<2; ++i)
+    {
+        osg::ref_ptr<osg::Node> node = osgDB::readNodeFiles(fileNames);
+        if (!node)
+        {
+            osg::notify(osg::NOTICE)<<"Optimizer benchmark: unable to load input files."<<std::endl;
+            return;
+        }
+
+        osg::Timer_t startTick = osg::Timer::instance()->tick();
+
+        if (smooth)
+        {
+            osgUtil::SmoothingVisitor sv;
+            sv.setNumThreads(threads[i]);
+            node->accept(sv);
+        }
+
+        osgUtil::Optimizer optimizer;
+        optimizer.setNumThreads(threads[i]);
+        optimizer.optimize(node.get());
+
+        times[i] = osg::Timer::instance()->delta_m(startTick, osg::Timer::instance()->tick());
+
+        if (rw)
+        {
+            osg::ref_ptr<osgDB::Options> options = new osgDB::Options;
+            options->setPluginStringData("fileType", "Ascii");
+
+            std::ostringstream str;
+            rw->writeNode(*node, str, options.get());
+            results[i] = str.str();
+        }
+    }
+
+    osg::notify(osg::NOTICE)<<"Optimizer benchmark:"<<std::endl;
+    osg::notify(osg::NOTICE)<<"    1 thread   "<<times[0]<<" ms"<<std::endl;
+    osg::notify(osg::NOTICE)<<"    "<<numThreads<<" threads  "<<times[1]<<" ms, speedup "<<(times[1]>0.0 ? times[0]/times[1] : 0.0)<<std::endl;
+    if (rw) osg::notify(osg::NOTICE)<<"    results "<<(results[0]==results[1] ? "identical" : "DIFFER")<<std::endl;
+}
+
+static void printVertexCacheStatistics(osg::Node* node, const char* stage)
+{
+    osgUtil::VertexCacheMissVisitor vcmv;
+    node->accept(vcmv);
+    osg::notify(osg::NOTICE)<<"Vertex cache "<<stage<<": triangles "<<vcmv.triangles
+                            <<", ACMR "<<vcmv.getACMR()<<", ATVR "<<vcmv.getATVR()<<std::endl;
+}
 
 static void usage( const char *prog, const char *msg )
 {
@@ -524,6 +597,27 @@ static void usage( const char *prog, const char *msg )
                               "                         (--addMissingColours also accepted)."<< std::endl;
     osg::notify(osg::NOTICE)<<"    --overallNormal    - Replace normals with a single overall normal."<< std::endl;
     osg::notify(osg::NOTICE)<<"    --enable-object-cache - Enable caching of objects, images, etc."<< std::endl;
+    osg::notify(osg::NOTICE)<<"    --optimizer-threads n - Number of threads used by the smoothing, the per\n"
+                              "                         geometry optimizer passes and the simplifier, 0 uses\n"
+                              "                         one per processor."<< std::endl;
+    osg::notify(osg::NOTICE)<<"    --vertex-cache-stats - Print the post-transform vertex cache ACMR and ATVR of\n"
+                              "                         the geometry before and after optimization, use\n"
+                              "                         OSG_OPTIMIZER=\"DEFAULT INDEX_MESH VERTEX_POSTTRANSFORM\n"
+                              "                         REDUCE_OVERDRAW VERTEX_PRETRANSFORM\" to enable the\n"
+                              "                         mesh optimizations."<< std::endl;
+    osg::notify(osg::NOTICE)<<"    --optimizer-benchmark - Time the smoothing and optimization run serially and\n"
+                              "                         with --optimizer-threads, and check the results match."<< std::endl;
+    osg::notify(osg::NOTICE)<<"    --paged-lod        - Write the model as a paged database, an octree of tiles\n"
+                              "                         linked by PagedLOD nodes each holding a simplified copy\n"
+                              "                         of its children. The root is written to the output file\n"
+                              "                         and the tiles beside it, built using --optimizer-threads."<< std::endl;
+    osg::notify(osg::NOTICE)<<"    --paged-lod-triangles n - Maximum number of triangles in each tile, 16384 by\n"
+                              "                         default."<< std::endl;
+    osg::notify(osg::NOTICE)<<"    --paged-lod-depth n - Maximum depth of the octree of tiles, 10 by default."<< std::endl;
+    osg::notify(osg::NOTICE)<<"    --paged-lod-ratio r - Ratio each level of the database is simplified by, 0.25\n"
+                              "                         by default."<< std::endl;
+    osg::notify(osg::NOTICE)<<"    --paged-lod-range-factor f - Multiple of a tile's radius within which its\n"
+                              "                         children are paged in, 4 by default."<< std::endl;
 
     osg::notify( osg::NOTICE ) << std::endl;
     osg::notify( osg::NOTICE ) <<
@@ -748,6 +842,37 @@ int main( int argc, char **argv )
     bool enableObjectCache = false;
     while(arguments.read("--enable-object-cache")) { enableObjectCache = true; }
 
+    osgUtil::Optimizer optimizer;
+    unsigned int optimizerThreads = optimizer.getNumThreads();
+    while(arguments.read("--optimizer-threads", optimizerThreads)) {}
+    optimizer.setNumThreads(optimizerThreads);
+
+    bool vertexCacheStats = false;
+    while(arguments.read("--vertex-cache-stats")) { vertexCacheStats = true; }
+
+    bool benchmarkOptimizerThreads = false;
+    while(arguments.read("--optimizer-benchmark")) { benchmarkOptimizerThreads = true; }
+
+    bool pagedLOD = false;
+    osgUtil::PagedLODBuilder pagedLODBuilder;
+    while(arguments.read("--paged-lod")) { pagedLOD = true; }
+
+    unsigned int pagedLODTriangles = pagedLODBuilder.getMaximumNumTrianglesPerTile();
+    while(arguments.read("--paged-lod-triangles", pagedLODTriangles)) { pagedLOD = true; }
+    pagedLODBuilder.setMaximumNumTrianglesPerTile(pagedLODTriangles);
+
+    unsigned int pagedLODDepth = pagedLODBuilder.getMaximumDepth();
+    while(arguments.read("--paged-lod-depth", pagedLODDepth)) { pagedLOD = true; }
+    pagedLODBuilder.setMaximumDepth(pagedLODDepth);
+
+    float pagedLODRatio = pagedLODBuilder.getSampleRatio();
+    while(arguments.read("--paged-lod-ratio", pagedLODRatio)) { pagedLOD = true; }
+    pagedLODBuilder.setSampleRatio(pagedLODRatio);
+
+    float pagedLODRangeFactor = pagedLODBuilder.getRangeFactor();
+    while(arguments.read("--paged-lod-range-factor", pagedLODRangeFactor)) { pagedLOD = true; }
+    pagedLODBuilder.setRangeFactor(pagedLODRangeFactor);
+
     // any option left unread are converted into errors to write out later.
     arguments.reportRemainingOptionsAsUnrecognized();
 
@@ -779,6 +904,11 @@ int main( int argc, char **argv )
         fileNames.pop_back();
     }
 
+    if (benchmarkOptimizerThreads)
+    {
+        benchmarkOptimizer(fileNames, optimizerThreads, smooth);
+    }
+
     osg::Timer_t startTick = osg::Timer::instance()->tick();
 
     osg::ref_ptr<osg::Node> root = osgDB::readNodeFiles(fileNames);
@@ -808,6 +938,7 @@ int main( int argc, char **argv )
         if (smooth)
         {
             osgUtil::SmoothingVisitor sv;
+            sv.setNumThreads(optimizerThreads);
             root->accept(sv);
         }
 
@@ -817,10 +948,13 @@ int main( int argc, char **argv )
             root->accept(av);
         }
 
+        if (vertexCacheStats) printVertexCacheStatistics(root.get(), "before optimization");
+
         // optimize the scene graph, remove rendundent nodes and state etc.
-        osgUtil::Optimizer optimizer;
         optimizer.optimize(root.get());
 
+        if (vertexCacheStats) printVertexCacheStatistics(root.get(), "after optimization");
+
         if( do_convert )
             root = oc.convert( root.get() );
 
@@ -852,9 +986,26 @@ int main( int argc, char **argv )
             simple.setSmoothing( smooth );
             osg::notify( osg::ALWAYS ) << " smoothing: " << smooth << std::endl;
             simple.setSampleRatio( simplifyPercent );
+            simple.setNumThreads( optimizerThreads );
             root->accept( simple );
         }
 
+        if (pagedLOD)
+        {
+            pagedLODBuilder.setNumThreads(optimizerThreads);
+            pagedLODBuilder.setTileExtension(std::string(".")+osgDB::getFileExtension(fileNameOut));
+            pagedLODBuilder.setWriteTileCallback(new WriteTileCallback);
+            if (pagedLODBuilder.build(root.get(), fileNameOut))
+            {
+                osg::notify(osg::NOTICE)<<"Paged database of "<<pagedLODBuilder.getNumTilesWritten()<<" tiles in "<<pagedLODBuilder.getNumLevels()
+                                        <<" levels written to '"<<fileNameOut<<"'."<< std::endl;
+                return 0;
+            }
+
+            osg::notify(osg::NOTICE)<<"Error writing paged database to '"<<fileNameOut<<"'."<< std::endl;
+            return 1;
+        }
+
         osgDB::ReaderWriter::WriteResult result = osgDB::Registry::instance()->writeNode(*root,fileNameOut,osgDB::Registry::instance()->getOptions());
         if (result.success())
         {
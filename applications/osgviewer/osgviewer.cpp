@@ -31,8 +31,47 @@
 
 #include <osgGA/Device>
 
+#include <osgDB/DatabasePager>
+#include <osgDB/fstream>
+
+#include <OpenThreads/Mutex>
+#include <OpenThreads/ScopedLock>
+
 #include <iostream>
 
+// DatabasePager that records each requestNodeFile() call as a "frameNumber priority fileName" line,
+// the request trace format replayed by "osgunittests pager --pager-trace <filename>".
+class RecordingDatabasePager : public osgDB::DatabasePager
+{
+public:
+
+    RecordingDatabasePager(const std::string& filename):
+        _fout(filename.c_str()) {}
+
+    bool valid() const { return _fout.good(); }
+
+    virtual void requestNodeFile(const std::string& fileName, osg::NodePath& nodePath,
+                                 float priority, const osg::FrameStamp* framestamp,
+                                 osg::ref_ptr<osg::Referenced>& databaseRequest,
+                                 const osg::Referenced* options)
+    {
+        {
+            // requests are made from the cull traversals, which may run on several threads.
+            OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+            _fout<<(framestamp ? framestamp->getFrameNumber() : 0)<<" "<<priority<<" "<<fileName<<"\n";
+        }
+
+        osgDB::DatabasePager::requestNodeFile(fileName, nodePath, priority, framestamp, databaseRequest, options);
+    }
+
+protected:
+
+    virtual ~RecordingDatabasePager() {}
+
+    OpenThreads::Mutex  _mutex;
+    osgDB::ofstream     _fout;
+};
+
 
 int main(int argc, char** argv)
 {
@@ -48,6 +87,7 @@ int main(int argc, char** argv)
     arguments.getApplicationUsage()->addCommandLineOption("-p <filename>","Play specified camera path animation file, previously saved with 'z' key.");
     arguments.getApplicationUsage()->addCommandLineOption("--speed <factor>","Speed factor for animation playing (1 == normal speed).");
     arguments.getApplicationUsage()->addCommandLineOption("--device <device-name>","add named device to the viewer");
+    arguments.getApplicationUsage()->addCommandLineOption("--pager-record <filename>","Record the DatabasePager requests to file, in the trace format replayed by osgunittests pager.");
 
     osgViewer::Viewer viewer(arguments);
 
@@ -94,6 +134,20 @@ int main(int argc, char** argv)
         }
     }
 
+    std::string pagerRecordFile;
+    if (arguments.read("--pager-record", pagerRecordFile))
+    {
+        osg::ref_ptr<RecordingDatabasePager> pager = new RecordingDatabasePager(pagerRecordFile);
+        if (pager->valid())
+        {
+            viewer.setDatabasePager(pager.get());
+        }
+        else
+        {
+            std::cout << arguments.getApplicationName() <<": Unable to open DatabasePager record file "<<pagerRecordFile<< std::endl;
+        }
+    }
+
     // set up the camera manipulators.
     {
         osg::ref_ptr<osgGA::KeySwitchMatrixManipulator> keyswitchManipulator = new osgGA::KeySwitchMatrixManipulator;
@@ -0,0 +1,156 @@
+/* OpenSceneGraph example, osgbreadbenchmark.
+*
+*  Permission is hereby granted, free of charge, to any person obtaining a copy
+*  of this software and associated documentation files (the "Software"), to deal
+*  in the Software without restriction, including without limitation the rights
+*  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+*  copies of the Software, and to permit persons to whom the Software is
+*  furnished to do so, subject to the following conditions:
+*
+*  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+*  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+*  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+*  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+*  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+*  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+*  THE SOFTWARE.
+*/
+
+#include <osg/ArgumentParser>
+#include <osg/ApplicationUsage>
+#include <osg/Timer>
+#include <osg/Node>
+
+#include <osgDB/ReadFile>
+#include <osgDB/WriteFile>
+#include <osgDB/FileNameUtils>
+#include <osgDB/FileUtils>
+#include <osgDB/fstream>
+
+#include <iostream>
+#include <iomanip>
+#include <stdio.h>
+
+// Reads .osgb files repeatedly through the memory mapped read path and through the file stream read path,
+// selected with the NoMemoryMapping option, reporting the read throughput of each. Files in other formats are
+// first written out as temporary .osgb files.
+
+struct BenchmarkFile
+{
+    std::string filename;
+    bool        temporary;
+    double      sizeInMB;
+};
+
+static double readFiles(const std::vector<BenchmarkFile>& files, osgDB::Options* options, unsigned int numIterations, bool& failed)
+{
+    osg::Timer_t start = osg::Timer::instance()->tick();
+    for (unsigned int i=0; i<numIterations; ++i)
+    {
+        for (std::vector<BenchmarkFile>::const_iterator itr = files.begin(); itr != files.end(); ++itr)
+        {
+            osg::ref_ptr<osg::Node> node = osgDB::readNodeFile(itr->filename, options);
+            if (!node) failed = true;
+        }
+    }
+    return osg::Timer::instance()->delta_s(start, osg::Timer::instance()->tick());
+}
+
+int main(int argc, char** argv)
+{
+    osg::ArgumentParser arguments(&argc, argv);
+
+    arguments.getApplicationUsage()->setApplicationName(arguments.getApplicationName());
+    arguments.getApplicationUsage()->setDescription(arguments.getApplicationName()+" compares the read throughput of memory mapped and file stream reading of .osgb files.");
+    arguments.getApplicationUsage()->setCommandLineUsage(arguments.getApplicationName()+" [options] filename ...");
+    arguments.getApplicationUsage()->addCommandLineOption("-h or --help", "Display this information.");
+    arguments.getApplicationUsage()->addCommandLineOption("--iterations <num>", "Number of times each file is read with each read path, defaults to 10.");
+
+    if (arguments.read("-h") || arguments.read("--help"))
+    {
+        arguments.getApplicationUsage()->write(std::cout, osg::ApplicationUsage::COMMAND_LINE_OPTION);
+        return 1;
+    }
+
+    unsigned int numIterations = 10;
+    while (arguments.read("--iterations", numIterations)) {}
+    if (numIterations==0) numIterations = 1;
+
+    std::vector<BenchmarkFile> files;
+    double totalSizeInMB = 0.0;
+    for (int pos=1; pos<arguments.argc(); ++pos)
+    {
+        if (arguments.isOption(pos)) continue;
+
+        BenchmarkFile file;
+        file.filename = osgDB::findDataFile(arguments[pos]);
+        file.temporary = false;
+        if (file.filename.empty())
+        {
+            std::cout<<"Unable to find "<<arguments[pos]<<std::endl;
+            continue;
+        }
+
+        if (osgDB::getLowerCaseFileExtension(file.filename)!="osgb")
+        {
+            osg::ref_ptr<osg::Node> node = osgDB::readNodeFile(file.filename);
+            file.filename = osgDB::getSimpleFileName(osgDB::getNameLessExtension(file.filename)) + "_osgbreadbenchmark.osgb";
+            file.temporary = true;
+            if (!node || !osgDB::writeNodeFile(*node, file.filename))
+            {
+                std::cout<<"Unable to convert "<<arguments[pos]<<" to .osgb"<<std::endl;
+                continue;
+            }
+        }
+
+        file.sizeInMB = double(osgDB::ifstream(file.filename.c_str(), std::ios::in | std::ios::binary | std::ios::ate).tellg())/(1024.0*1024.0);
+        totalSizeInMB += file.sizeInMB;
+        files.push_back(file);
+    }
+
+    arguments.reportRemainingOptionsAsUnrecognized();
+    if (arguments.errors())
+    {
+        arguments.writeErrorMessages(std::cout);
+        return 1;
+    }
+
+    if (files.empty())
+    {
+        arguments.getApplicationUsage()->write(std::cout, osg::ApplicationUsage::COMMAND_LINE_OPTION);
+        return 1;
+    }
+
+    osg::ref_ptr<osgDB::Options> mappedOptions = new osgDB::Options;
+    mappedOptions->setObjectCacheHint(osgDB::Options::CACHE_NONE);
+
+    osg::ref_ptr<osgDB::Options> streamOptions = new osgDB::Options("NoMemoryMapping");
+    streamOptions->setObjectCacheHint(osgDB::Options::CACHE_NONE);
+
+    // read every file once so that both read paths start with the files in the operating system's file cache
+    bool failed = false;
+    readFiles(files, mappedOptions.get(), 1, failed);
+
+    double streamTime = readFiles(files, streamOptions.get(), numIterations, failed);
+    double mappedTime = readFiles(files, mappedOptions.get(), numIterations, failed);
+
+    for (std::vector<BenchmarkFile>::iterator itr = files.begin(); itr != files.end(); ++itr)
+    {
+        if (itr->temporary) remove(itr->filename.c_str());
+    }
+
+    if (failed)
+    {
+        std::cout<<"Failed to read files"<<std::endl;
+        return 1;
+    }
+
+    double totalRead = totalSizeInMB*double(numIterations);
+    std::cout<<std::fixed<<std::setprecision(2);
+    std::cout<<"Read "<<files.size()<<" files, "<<totalSizeInMB<<" MB, "<<numIterations<<" times with each read path."<<std::endl;
+    std::cout<<"  file stream   : "<<streamTime*1000.0/double(numIterations)<<" ms per iteration, "<<totalRead/streamTime<<" MB/s"<<std::endl;
+    std::cout<<"  memory mapped : "<<mappedTime*1000.0/double(numIterations)<<" ms per iteration, "<<totalRead/mappedTime<<" MB/s"<<std::endl;
+    std::cout<<"  speed up      : "<<streamTime/mappedTime<<std::endl;
+
+    return 0;
+}
@@ -0,0 +1,221 @@
+/* OpenSceneGraph example, osgcompressorbenchmark.
+*
+*  Permission is hereby granted, free of charge, to any person obtaining a copy
+*  of this software and associated documentation files (the "Software"), to deal
+*  in the Software without restriction, including without limitation the rights
+*  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+*  copies of the Software, and to permit persons to whom the Software is
+*  furnished to do so, subject to the following conditions:
+*
+*  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+*  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+*  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+*  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+*  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+*  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+*  THE SOFTWARE.
+*/
+
+#include <osg/ArgumentParser>
+#include <osg/ApplicationUsage>
+#include <osg/Timer>
+#include <osg/Node>
+
+#include <osgDB/ReadFile>
+#include <osgDB/Registry>
+#include <osgDB/ObjectWrapper>
+#include <osgDB/fstream>
+
+#include <iostream>
+#include <sstream>
+#include <iomanip>
+
+// Writes each of the loaded models to memory as .osgb with every registered compressor, then reads
+// them back repeatedly, reporting the compressed size and the read throughput of each compressor.
+
+typedef std::vector< osg::ref_ptr<osg::Node> > NodeList;
+typedef std::vector<std::string> BufferList;
+
+static bool loadDictionary(const std::string& filename, std::string& dictionary)
+{
+    osgDB::ifstream fin(filename.c_str(), std::ios::in | std::ios::binary);
+    if (!fin) return false;
+
+    std::ostringstream sstream;
+    sstream << fin.rdbuf();
+    dictionary = sstream.str();
+    return !dictionary.empty();
+}
+
+int main(int argc, char** argv)
+{
+    osg::ArgumentParser arguments(&argc, argv);
+
+    arguments.getApplicationUsage()->setApplicationName(arguments.getApplicationName());
+    arguments.getApplicationUsage()->setDescription(arguments.getApplicationName()+" reports the size and read throughput of .osgb files written with each of the available compressors.");
+    arguments.getApplicationUsage()->setCommandLineUsage(arguments.getApplicationName()+" [options] filename ...");
+    arguments.getApplicationUsage()->addCommandLineOption("-h or --help", "Display this information.");
+    arguments.getApplicationUsage()->addCommandLineOption("--iterations <num>", "Number of times each file is read back, defaults to 10.");
+    arguments.getApplicationUsage()->addCommandLineOption("--compressor <name>", "Only benchmark the named compressor, may be used more than once.");
+    arguments.getApplicationUsage()->addCommandLineOption("--dictionary <file>", "Prime the compressors that support dictionaries, such as zstd and lz4, with the contents of file.");
+
+    if (arguments.read("-h") || arguments.read("--help"))
+    {
+        arguments.getApplicationUsage()->write(std::cout, osg::ApplicationUsage::COMMAND_LINE_OPTION);
+        return 1;
+    }
+
+    unsigned int numIterations = 10;
+    while (arguments.read("--iterations", numIterations)) {}
+    if (numIterations==0) numIterations = 1;
+
+    std::vector<std::string> compressorNames;
+    std::string name;
+    while (arguments.read("--compressor", name)) compressorNames.push_back(name);
+
+    osgDB::ObjectWrapperManager* wrapperManager = osgDB::Registry::instance()->getObjectWrapperManager();
+
+    std::string dictionaryFile;
+    std::string dictionary;
+    while (arguments.read("--dictionary", dictionaryFile))
+    {
+        if (!loadDictionary(dictionaryFile, dictionary))
+        {
+            std::cout<<"Unable to read dictionary "<<dictionaryFile<<std::endl;
+            return 1;
+        }
+    }
+
+    NodeList nodes;
+    for (int pos=1; pos<arguments.argc(); ++pos)
+    {
+        if (arguments.isOption(pos)) continue;
+
+        osg::ref_ptr<osg::Node> node = osgDB::readNodeFile(arguments[pos]);
+        if (node.valid()) nodes.push_back(node);
+        else std::cout<<"Unable to load "<<arguments[pos]<<std::endl;
+    }
+
+    arguments.reportRemainingOptionsAsUnrecognized();
+    if (arguments.errors())
+    {
+        arguments.writeErrorMessages(std::cout);
+        return 1;
+    }
+
+    if (nodes.empty())
+    {
+        arguments.getApplicationUsage()->write(std::cout, osg::ApplicationUsage::COMMAND_LINE_OPTION);
+        return 1;
+    }
+
+    osgDB::ReaderWriter* rw = osgDB::Registry::instance()->getReaderWriterForExtension("osgb");
+    if (!rw)
+    {
+        std::cout<<"Unable to load the osgb plugin"<<std::endl;
+        return 1;
+    }
+
+    if (compressorNames.empty())
+    {
+        compressorNames.push_back("none");
+
+        const osgDB::ObjectWrapperManager::CompressorMap& compressors = wrapperManager->getCompressorMap();
+        for (osgDB::ObjectWrapperManager::CompressorMap::const_iterator itr = compressors.begin();
+             itr != compressors.end();
+             ++itr)
+        {
+            compressorNames.push_back(itr->first);
+        }
+    }
+
+    std::cout<<std::setw(12)<<"compressor"
+             <<std::setw(14)<<"size (bytes)"
+             <<std::setw(10)<<"ratio"
+             <<std::setw(14)<<"write (ms)"
+             <<std::setw(14)<<"read (ms)"
+             <<std::setw(14)<<"read (MB/s)"<<std::endl;
+
+    unsigned long long uncompressedSize = 0;
+    for (std::vector<std::string>::iterator nitr = compressorNames.begin();
+         nitr != compressorNames.end();
+         ++nitr)
+    {
+        osg::ref_ptr<osgDB::Options> options = new osgDB::Options;
+        if (*nitr!="none")
+        {
+            osgDB::BaseCompressor* compressor = wrapperManager->findCompressor(*nitr);
+            if (!compressor)
+            {
+                std::cout<<std::setw(12)<<*nitr<<"  not available"<<std::endl;
+                continue;
+            }
+
+            if (!dictionary.empty() && !compressor->setDictionary(dictionary))
+            {
+                std::cout<<std::setw(12)<<*nitr<<"  doesn't support dictionaries, benchmarking without."<<std::endl;
+            }
+
+            options->setPluginStringData("Compressor", *nitr);
+        }
+
+        osg::Timer_t startWrite = osg::Timer::instance()->tick();
+
+        BufferList buffers;
+        unsigned long long totalSize = 0;
+        bool writeFailed = false;
+        for (NodeList::iterator itr = nodes.begin(); itr != nodes.end(); ++itr)
+        {
+            std::stringstream sstream(std::ios::out | std::ios::binary);
+            if (!rw->writeNode(*(*itr), sstream, options.get()).success())
+            {
+                writeFailed = true;
+                break;
+            }
+            buffers.push_back(sstream.str());
+            totalSize += buffers.back().size();
+        }
+
+        osg::Timer_t endWrite = osg::Timer::instance()->tick();
+
+        if (writeFailed)
+        {
+            std::cout<<std::setw(12)<<*nitr<<"  failed to write"<<std::endl;
+            continue;
+        }
+
+        if (*nitr=="none") uncompressedSize = totalSize;
+
+        unsigned int numRead = 0;
+        osg::Timer_t startRead = osg::Timer::instance()->tick();
+        for (unsigned int i=0; i<numIterations; ++i)
+        {
+            for (BufferList::iterator itr = buffers.begin(); itr != buffers.end(); ++itr)
+            {
+                std::istringstream sstream(*itr, std::ios::in | std::ios::binary);
+                if (rw->readNode(sstream, options.get()).validNode()) ++numRead;
+            }
+        }
+        osg::Timer_t endRead = osg::Timer::instance()->tick();
+
+        if (numRead != numIterations*buffers.size())
+        {
+            std::cout<<std::setw(12)<<*nitr<<"  failed to read"<<std::endl;
+            continue;
+        }
+
+        double readTime = osg::Timer::instance()->delta_s(startRead, endRead);
+        double megabytesRead = double(uncompressedSize!=0 ? uncompressedSize : totalSize)*double(numIterations)/(1024.0*1024.0);
+
+        std::cout<<std::setw(12)<<*nitr
+                 <<std::setw(14)<<totalSize
+                 <<std::setw(10)<<std::fixed<<std::setprecision(2)<<(uncompressedSize!=0 ? double(uncompressedSize)/double(totalSize) : 1.0)
+                 <<std::setw(14)<<osg::Timer::instance()->delta_m(startWrite, endWrite)
+                 <<std::setw(14)<<readTime*1000.0/double(numIterations)
+                 <<std::setw(14)<<(readTime>0.0 ? megabytesRead/readTime : 0.0)<<std::endl;
+    }
+
+    std::cout<<std::endl<<"Read throughput is measured against the uncompressed size, write with osgconv -O Compressor=<name>."<<std::endl;
+
+    return 0;
+}
@@ -31,6 +31,7 @@
 
 #include <osgUtil/IntersectionVisitor>
 #include <osgUtil/LineSegmentIntersector>
+#include <osgUtil/LineSegmentBatchIntersector>
 #include <osgUtil/UpdateVisitor>
 
 #include <osgSim/LineOfSight>
@@ -42,20 +43,108 @@
 #include <osg/KdTree>
 
 #include <iostream>
+#include <math.h>
+
+// remove any KdTree assigned to the geometries so that they can be rebuilt with different options.
+class ClearKdTreesVisitor : public osg::NodeVisitor
+{
+public:
+    ClearKdTreesVisitor():
+        osg::NodeVisitor(osg::NodeVisitor::TRAVERSE_ALL_CHILDREN) {}
+
+    void apply(osg::Geometry& geometry)
+    {
+        if (dynamic_cast<osg::KdTree*>(geometry.getShape())) geometry.setShape(0);
+    }
+};
+
+static void buildAndTestKdTrees(osg::Node* scene, const osg::KdTree::BuildOptions& buildOptions, const std::string& name, unsigned int numIntersections)
+{
+    osg::Timer_t startTick = osg::Timer::instance()->tick();
+
+    ClearKdTreesVisitor clearKdTrees;
+    scene->accept(clearKdTrees);
+
+    osg::ref_ptr<osg::KdTreeBuilder> builder = new osg::KdTreeBuilder;
+    builder->_buildOptions = buildOptions;
+    scene->accept(*builder);
+
+    osg::Timer_t buildTick = osg::Timer::instance()->tick();
+
+    // fire a grid of vertical segments through the model, in scan line order so that neighbouring segments are coherent.
+    const osg::BoundingSphere& bs = scene->getBound();
+    unsigned int numColumns = static_cast<unsigned int>(ceil(sqrt(static_cast<double>(numIntersections))));
+
+    osgUtil::LineSegmentBatchIntersector::Vec3dList starts, ends;
+    for(unsigned int i=0; i<numIntersections; ++i)
+    {
+        double rx = (static_cast<double>(i%numColumns)+0.5)/static_cast<double>(numColumns)*2.0-1.0;
+        double ry = (static_cast<double>(i/numColumns)+0.5)/static_cast<double>(numColumns)*2.0-1.0;
+        starts.push_back(osg::Vec3d(bs.center().x()+rx*bs.radius(), bs.center().y()+ry*bs.radius(), bs.center().z()+bs.radius()));
+        ends.push_back(osg::Vec3d(starts.back().x(), starts.back().y(), bs.center().z()-bs.radius()));
+    }
+
+    unsigned int numHits = 0;
+    for(unsigned int i=0; i<numIntersections; ++i)
+    {
+        osg::ref_ptr<osgUtil::LineSegmentIntersector> intersector = new osgUtil::LineSegmentIntersector(starts[i], ends[i]);
+        intersector->setIntersectionLimit(osgUtil::Intersector::LIMIT_NEAREST);
+        osgUtil::IntersectionVisitor intersectionVisitor(intersector.get());
+        scene->accept(intersectionVisitor);
+
+        if (intersector->containsIntersections()) ++numHits;
+    }
+
+    osg::Timer_t batchTick = osg::Timer::instance()->tick();
+
+    osg::ref_ptr<osgUtil::LineSegmentBatchIntersector> batchIntersector = new osgUtil::LineSegmentBatchIntersector(osgUtil::Intersector::MODEL, starts, ends);
+    osgUtil::IntersectionVisitor batchIntersectionVisitor(batchIntersector.get());
+    scene->accept(batchIntersectionVisitor);
+
+    osg::Timer_t endTick = osg::Timer::instance()->tick();
+
+    std::cout<<name<<std::endl;
+    std::cout<<"    build time        = "<<osg::Timer::instance()->delta_m(startTick, buildTick)<<"ms"<<std::endl;
+    std::cout<<"    intersection time = "<<osg::Timer::instance()->delta_m(buildTick, batchTick)<<"ms for "<<numIntersections<<" segments, "<<numHits<<" hits"<<std::endl;
+    std::cout<<"    batch time        = "<<osg::Timer::instance()->delta_m(batchTick, endTick)<<"ms for "<<numIntersections<<" segments, "<<batchIntersector->getIntersections().numIntersections<<" hits"<<std::endl;
+}
 
 int main(int argc, char **argv)
 {
     // use an ArgumentParser object to manage the program arguments.
     osg::ArgumentParser arguments(&argc,argv);
     
-    int maxNumLevels = 16;
-    int targetNumIndicesPerLeaf = 16;
+    arguments.getApplicationUsage()->addCommandLineOption("--max <levels>","Maximum number of KdTree levels.");
+    arguments.getApplicationUsage()->addCommandLineOption("--leaf <num>","Target number of triangles per KdTree leaf.");
+    arguments.getApplicationUsage()->addCommandLineOption("--sah","Split KdTree nodes using the surface area heuristic rather than at the midpoint.");
+    arguments.getApplicationUsage()->addCommandLineOption("--bins <num>","Number of bins used by the surface area heuristic.");
+    arguments.getApplicationUsage()->addCommandLineOption("--threads <num>","Maximum number of threads used to build each KdTree.");
+    arguments.getApplicationUsage()->addCommandLineOption("--compare <num>","Build the KdTrees with the midpoint and surface area heuristic builders, reporting build times and the time taken for <num> intersections made one at a time and as a batch.");
+
+    osg::KdTree::BuildOptions buildOptions;
+
+    unsigned int maxNumLevels = buildOptions._maxNumLevels;
+    unsigned int targetNumIndicesPerLeaf = buildOptions._targetNumTrianglesPerLeaf;
 
     while (arguments.read("--max", maxNumLevels)) {}
     while (arguments.read("--leaf", targetNumIndicesPerLeaf)) {}
-    
-    osgDB::Registry::instance()->setBuildKdTreesHint(osgDB::ReaderWriter::Options::BUILD_KDTREES);
-    
+    while (arguments.read("--bins", buildOptions._numSAHBins)) {}
+    while (arguments.read("--threads", buildOptions._numThreads)) {}
+    while (arguments.read("--sah")) { buildOptions._splitMethod = osg::KdTree::BuildOptions::SURFACE_AREA_HEURISTIC; }
+
+    buildOptions._maxNumLevels = maxNumLevels;
+    buildOptions._targetNumTrianglesPerLeaf = targetNumIndicesPerLeaf;
+
+    unsigned int numIntersections = 0;
+    while (arguments.read("--compare", numIntersections)) {}
+    while (arguments.read("--compare")) { numIntersections = 10000; }
+
+    if (numIntersections==0)
+    {
+        osgDB::Registry::instance()->getKdTreeBuilder()->_buildOptions = buildOptions;
+        osgDB::Registry::instance()->setBuildKdTreesHint(osgDB::ReaderWriter::Options::BUILD_KDTREES);
+    }
+
     osg::ref_ptr<osg::Node> scene = osgDB::readNodeFiles(arguments);
     
     if (!scene) 
@@ -64,6 +153,19 @@ int main(int argc, char **argv)
         return 0;
     }
 
+    if (numIntersections>0)
+    {
+        osg::KdTree::BuildOptions midpointOptions = buildOptions;
+        midpointOptions._splitMethod = osg::KdTree::BuildOptions::SPLIT_AT_MIDPOINT;
+        buildAndTestKdTrees(scene.get(), midpointOptions, "Midpoint split KdTree", numIntersections);
+
+        osg::KdTree::BuildOptions sahOptions = buildOptions;
+        sahOptions._splitMethod = osg::KdTree::BuildOptions::SURFACE_AREA_HEURISTIC;
+        buildAndTestKdTrees(scene.get(), sahOptions, "Surface area heuristic KdTree", numIntersections);
+
+        return 0;
+    }
+
     osgViewer::Viewer viewer;
     viewer.setSceneData(scene.get());
     return viewer.run();
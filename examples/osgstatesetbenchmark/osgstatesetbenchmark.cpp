@@ -0,0 +1,239 @@
+/* OpenSceneGraph example, osgstatesetbenchmark.
+*
+*  Permission is hereby granted, free of charge, to any person obtaining a copy
+*  of this software and associated documentation files (the "Software"), to deal
+*  in the Software without restriction, including without limitation the rights
+*  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+*  copies of the Software, and to permit persons to whom the Software is
+*  furnished to do so, subject to the following conditions:
+*
+*  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+*  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+*  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+*  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+*  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+*  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+*  THE SOFTWARE.
+*/
+
+#include <osg/ArgumentParser>
+#include <osg/ApplicationUsage>
+#include <osg/Timer>
+#include <osg/Geode>
+#include <osg/Geometry>
+#include <osg/MatrixTransform>
+#include <osg/Material>
+#include <osg/BlendFunc>
+#include <osg/CullFace>
+#include <osg/PolygonOffset>
+#include <osg/PolygonMode>
+#include <osg/LineWidth>
+#include <osg/AlphaFunc>
+#include <osg/Depth>
+#include <osg/TexEnv>
+#include <osg/Texture2D>
+#include <osg/Image>
+
+#include <osgViewer/Viewer>
+#include <osgViewer/ViewerEventHandlers>
+
+#include <algorithm>
+#include <math.h>
+#include <iostream>
+#include <sstream>
+#include <stdlib.h>
+
+// Builds a scene in which every drawable has its own StateSet holding a mix of modes, attributes, texture
+// attributes and uniforms, so that both cull and draw traversals are dominated by StateSet and State handling.
+
+typedef std::vector< osg::ref_ptr<osg::StateSet> > StateSetList;
+
+static osg::Texture2D* createTexture(unsigned int i)
+{
+    osg::Image* image = new osg::Image;
+    image->allocateImage(4, 4, 1, GL_RGBA, GL_UNSIGNED_BYTE);
+    unsigned char* ptr = image->data();
+    for(unsigned int p=0; p<16; ++p)
+    {
+        *ptr++ = static_cast<unsigned char>(i*37);
+        *ptr++ = static_cast<unsigned char>(p*16);
+        *ptr++ = static_cast<unsigned char>(i*91+p);
+        *ptr++ = 255;
+    }
+
+    osg::Texture2D* texture = new osg::Texture2D(image);
+    texture->setFilter(osg::Texture::MIN_FILTER, osg::Texture::NEAREST);
+    texture->setFilter(osg::Texture::MAG_FILTER, osg::Texture::NEAREST);
+    return texture;
+}
+
+static osg::StateSet* createStateSet(unsigned int i, unsigned int numUniforms, const std::vector< osg::ref_ptr<osg::Texture2D> >& textures)
+{
+    osg::StateSet* stateset = new osg::StateSet;
+
+    osg::Material* material = new osg::Material;
+    material->setDiffuse(osg::Material::FRONT_AND_BACK, osg::Vec4(float(i%7)/7.0f, float(i%11)/11.0f, float(i%13)/13.0f, 1.0f));
+    stateset->setAttributeAndModes(material, osg::StateAttribute::ON);
+
+    stateset->setMode(GL_LIGHTING, (i%2) ? osg::StateAttribute::ON : osg::StateAttribute::OFF);
+    stateset->setMode(GL_NORMALIZE, (i%3) ? osg::StateAttribute::ON : osg::StateAttribute::OFF);
+    stateset->setMode(GL_DEPTH_TEST, osg::StateAttribute::ON);
+
+    if (i%2) stateset->setAttributeAndModes(new osg::CullFace((i%4)==1 ? osg::CullFace::BACK : osg::CullFace::FRONT_AND_BACK), osg::StateAttribute::ON);
+    if (i%3) stateset->setAttributeAndModes(new osg::PolygonOffset(float(i%5), 1.0f), osg::StateAttribute::ON);
+    if (i%5) stateset->setAttributeAndModes(new osg::AlphaFunc(osg::AlphaFunc::GREATER, float(i%10)/10.0f), osg::StateAttribute::ON);
+    if (i%7) stateset->setAttribute(new osg::PolygonMode(osg::PolygonMode::FRONT_AND_BACK, (i%7)==1 ? osg::PolygonMode::LINE : osg::PolygonMode::FILL));
+    if (i%4) stateset->setAttribute(new osg::LineWidth(float(1+i%3)));
+    if (i%6) stateset->setAttribute(new osg::Depth((i%6)==1 ? osg::Depth::LEQUAL : osg::Depth::LESS));
+    if (i%8) stateset->setAttributeAndModes(new osg::BlendFunc(osg::BlendFunc::SRC_ALPHA, osg::BlendFunc::ONE_MINUS_SRC_ALPHA), (i%8)==1 ? osg::StateAttribute::OFF : osg::StateAttribute::ON);
+
+    if (!textures.empty())
+    {
+        unsigned int numUnits = 1 + i%3;
+        for(unsigned int unit=0; unit<numUnits; ++unit)
+        {
+            stateset->setTextureAttributeAndModes(unit, textures[(i+unit)%textures.size()].get(), osg::StateAttribute::ON);
+            stateset->setTextureAttribute(unit, new osg::TexEnv(unit==0 ? osg::TexEnv::MODULATE : osg::TexEnv::DECAL));
+        }
+    }
+
+    for(unsigned int u=0; u<numUniforms; ++u)
+    {
+        std::ostringstream name;
+        name<<"uniform_"<<((i+u*17)%(numUniforms*4));
+        stateset->addUniform(new osg::Uniform(name.str().c_str(), float(i)));
+    }
+
+    return stateset;
+}
+
+static osg::Geometry* createQuad()
+{
+    osg::Geometry* geometry = osg::createTexturedQuadGeometry(osg::Vec3(-0.4f,-0.4f,0.0f), osg::Vec3(0.8f,0.0f,0.0f), osg::Vec3(0.0f,0.8f,0.0f));
+    geometry->setUseDisplayList(false);
+    geometry->setUseVertexBufferObjects(true);
+    return geometry;
+}
+
+struct LessStateSet
+{
+    bool operator() (const osg::ref_ptr<osg::StateSet>& lhs, const osg::ref_ptr<osg::StateSet>& rhs) const { return lhs->compare(*rhs, true)<0; }
+};
+
+// times the CPU side StateSet operations that don't require a graphics context.
+static void benchmarkStateSets(const StateSetList& statesets, unsigned int numIterations)
+{
+    osg::Timer_t startTick = osg::Timer::instance()->tick();
+
+    unsigned int numEqual = 0;
+    for(unsigned int iteration=0; iteration<numIterations; ++iteration)
+    {
+        StateSetList sorted(statesets);
+        std::sort(sorted.begin(), sorted.end(), LessStateSet());
+        for(unsigned int i=1; i<sorted.size(); ++i)
+        {
+            if (sorted[i-1]->compare(*sorted[i], true)==0) ++numEqual;
+        }
+    }
+
+    osg::Timer_t sortTick = osg::Timer::instance()->tick();
+
+    unsigned int numEntries = 0;
+    for(unsigned int iteration=0; iteration<numIterations; ++iteration)
+    {
+        osg::ref_ptr<osg::StateSet> merged = new osg::StateSet;
+        for(StateSetList::const_iterator itr = statesets.begin();
+            itr != statesets.end();
+            ++itr)
+        {
+            merged->merge(*(*itr));
+            if (merged->getAttribute(osg::StateAttribute::MATERIAL)) ++numEntries;
+            if (merged->getMode(GL_LIGHTING)==osg::StateAttribute::ON) ++numEntries;
+            if (merged->getUniform("uniform_0")) ++numEntries;
+        }
+        numEntries += merged->getAttributeList().size() + merged->getModeList().size() + merged->getUniformList().size();
+    }
+
+    osg::Timer_t endTick = osg::Timer::instance()->tick();
+
+    std::cout<<"StateSet compare and sort = "<<osg::Timer::instance()->delta_m(startTick, sortTick)/double(numIterations)<<"ms ("<<numEqual<<" equal)"<<std::endl;
+    std::cout<<"StateSet merge and lookup = "<<osg::Timer::instance()->delta_m(sortTick, endTick)/double(numIterations)<<"ms ("<<numEntries<<" entries)"<<std::endl;
+}
+
+int main(int argc, char** argv)
+{
+    osg::ArgumentParser arguments(&argc,argv);
+
+    arguments.getApplicationUsage()->setDescription(arguments.getApplicationName()+" builds a scene where every drawable has its own StateSet and reports the StateSet, cull and draw times.");
+    arguments.getApplicationUsage()->setCommandLineUsage(arguments.getApplicationName()+" [options]");
+    arguments.getApplicationUsage()->addCommandLineOption("-h or --help","Display this information.");
+    arguments.getApplicationUsage()->addCommandLineOption("--drawables <num>","Number of drawables, each with its own StateSet.");
+    arguments.getApplicationUsage()->addCommandLineOption("--uniforms <num>","Number of uniforms added to each StateSet.");
+    arguments.getApplicationUsage()->addCommandLineOption("--textures <num>","Number of textures shared between the StateSets, 0 for no textures.");
+    arguments.getApplicationUsage()->addCommandLineOption("--iterations <num>","Number of iterations of the StateSet compare and merge benchmark.");
+    arguments.getApplicationUsage()->addCommandLineOption("--frames <num>","Number of frames to render before reporting the averaged cull and draw times, 0 to skip rendering.");
+
+    if (arguments.read("-h") || arguments.read("--help"))
+    {
+        arguments.getApplicationUsage()->write(std::cout, osg::ApplicationUsage::COMMAND_LINE_OPTION);
+        return 1;
+    }
+
+    unsigned int numDrawables = 4096;
+    unsigned int numUniforms = 4;
+    unsigned int numTextures = 16;
+    unsigned int numIterations = 10;
+    unsigned int numFrames = 500;
+
+    while(arguments.read("--drawables", numDrawables)) {}
+    while(arguments.read("--uniforms", numUniforms)) {}
+    while(arguments.read("--textures", numTextures)) {}
+    while(arguments.read("--iterations", numIterations)) {}
+    while(arguments.read("--frames", numFrames)) {}
+
+    std::vector< osg::ref_ptr<osg::Texture2D> > textures;
+    for(unsigned int i=0; i<numTextures; ++i) textures.push_back(createTexture(i));
+
+    StateSetList statesets;
+    for(unsigned int i=0; i<numDrawables; ++i) statesets.push_back(createStateSet(i, numUniforms, textures));
+
+    benchmarkStateSets(statesets, numIterations);
+
+    if (numFrames==0) return 0;
+
+    osg::ref_ptr<osg::Group> root = new osg::Group;
+    unsigned int numColumns = static_cast<unsigned int>(ceil(sqrt(static_cast<double>(numDrawables))));
+    for(unsigned int i=0; i<numDrawables; ++i)
+    {
+        osg::Geode* geode = new osg::Geode;
+        osg::Geometry* geometry = createQuad();
+        geometry->setStateSet(statesets[i].get());
+        geode->addDrawable(geometry);
+
+        osg::MatrixTransform* transform = new osg::MatrixTransform(osg::Matrix::translate(float(i%numColumns), float(i/numColumns), 0.0f));
+        transform->addChild(geode);
+        root->addChild(transform);
+    }
+
+    osgViewer::Viewer viewer(arguments);
+    viewer.setThreadingModel(osgViewer::Viewer::SingleThreaded);
+    viewer.setSceneData(root.get());
+    viewer.addEventHandler(new osgViewer::StatsHandler);
+    viewer.realize();
+
+    viewer.getCamera()->getStats()->collectStats("rendering", true);
+
+    for(unsigned int i=0; i<numFrames && !viewer.done(); ++i)
+    {
+        viewer.frame();
+    }
+
+    double cullTime = 0.0, drawTime = 0.0;
+    viewer.getCamera()->getStats()->getAveragedAttribute("Cull traversal time taken", cullTime);
+    viewer.getCamera()->getStats()->getAveragedAttribute("Draw traversal time taken", drawTime);
+
+    std::cout<<"Cull traversal = "<<cullTime*1000.0<<"ms"<<std::endl;
+    std::cout<<"Draw traversal = "<<drawTime*1000.0<<"ms"<<std::endl;
+
+    return 0;
+}
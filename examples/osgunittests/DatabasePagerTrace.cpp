@@ -0,0 +1,216 @@
+/* -*-c++-*-
+*
+*  OpenSceneGraph example, osgunittests.
+*
+*  Permission is hereby granted, free of charge, to any person obtaining a copy
+*  of this software and associated documentation files (the "Software"), to deal
+*  in the Software without restriction, including without limitation the rights
+*  to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+*  copies of the Software, and to permit persons to whom the Software is
+*  furnished to do so, subject to the following conditions:
+*
+*  THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+*  IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+*  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+*  AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+*  LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+*  OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+*  THE SOFTWARE.
+*/
+
+#include <osg/Notify>
+#include <osg/ArgumentParser>
+#include <osg/FrameStamp>
+#include <osg/Timer>
+#include <osgDB/DatabasePager>
+#include <osgDB/fstream>
+
+#include <map>
+#include <set>
+#include <sstream>
+#include <stdlib.h>
+
+// A trace is a list of "frameNumber priority fileName" lines, in frame order, one line per requestNodeFile() call.
+struct TraceRequest
+{
+    TraceRequest(): frameNumber(0), priority(0.0f) {}
+    TraceRequest(unsigned int fn, float p, const std::string& name): frameNumber(fn), priority(p), fileName(name) {}
+
+    unsigned int    frameNumber;
+    float           priority;
+    std::string     fileName;
+};
+
+typedef std::vector<TraceRequest> RequestTrace;
+
+// DatabasePager that never starts its database threads, letting the trace replay take requests from the
+// file request queue itself so that only the cost of queue management is measured.
+class TraceDatabasePager : public osgDB::DatabasePager
+{
+public:
+
+    TraceDatabasePager()
+    {
+        _startThreadCalled = true;
+    }
+
+    std::string takeRequest()
+    {
+        osg::ref_ptr<DatabaseRequest> databaseRequest;
+        _fileRequestQueue->takeFirst(databaseRequest);
+        return databaseRequest.valid() ? databaseRequest->_fileName : std::string();
+    }
+};
+
+static bool readRequestTrace(const std::string& filename, RequestTrace& trace)
+{
+    osgDB::ifstream fin(filename.c_str());
+    if (!fin) return false;
+
+    std::string line;
+    while(std::getline(fin, line))
+    {
+        std::istringstream str(line);
+        TraceRequest request;
+        if (str >> request.frameNumber >> request.priority >> request.fileName)
+        {
+            trace.push_back(request);
+        }
+    }
+    return true;
+}
+
+static void writeRequestTrace(const std::string& filename, const RequestTrace& trace)
+{
+    osgDB::ofstream fout(filename.c_str());
+    for(RequestTrace::const_iterator itr = trace.begin();
+        itr != trace.end();
+        ++itr)
+    {
+        fout<<itr->frameNumber<<" "<<itr->priority<<" "<<itr->fileName<<std::endl;
+    }
+}
+
+// generate a synthetic trace emulating a camera panning across a tiled database, each frame requesting a sliding window of tiles.
+static void createRequestTrace(unsigned int numFrames, unsigned int numTilesPerFrame, unsigned int tilesMovedPerFrame, RequestTrace& trace)
+{
+    srand(1);
+    for(unsigned int frameNumber = 1; frameNumber <= numFrames; ++frameNumber)
+    {
+        unsigned int firstTile = frameNumber*tilesMovedPerFrame;
+        for(unsigned int i=0; i<numTilesPerFrame; ++i)
+        {
+            std::ostringstream name;
+            name<<"tile_"<<(firstTile+i)<<".osgb";
+            trace.push_back(TraceRequest(frameNumber, static_cast<float>(rand())/static_cast<float>(RAND_MAX), name.str()));
+        }
+    }
+}
+
+void runDatabasePagerTraceTest(osg::ArgumentParser& arguments)
+{
+    RequestTrace trace;
+
+    std::string traceFile;
+    if (arguments.read("--pager-trace", traceFile))
+    {
+        if (!readRequestTrace(traceFile, trace))
+        {
+            OSG_NOTICE<<"Unable to read DatabasePager trace file "<<traceFile<<std::endl;
+            return;
+        }
+    }
+    else
+    {
+        unsigned int numFrames = 200;
+        unsigned int numTilesPerFrame = 20000;
+        unsigned int tilesMovedPerFrame = 200;
+        while(arguments.read("--pager-frames", numFrames)) {}
+        while(arguments.read("--pager-tiles", numTilesPerFrame)) {}
+        while(arguments.read("--pager-tiles-moved", tilesMovedPerFrame)) {}
+
+        createRequestTrace(numFrames, numTilesPerFrame, tilesMovedPerFrame, trace);
+    }
+
+    std::string writeFile;
+    if (arguments.read("--pager-write-trace", writeFile))
+    {
+        writeRequestTrace(writeFile, trace);
+    }
+
+    unsigned int numReadsPerFrame = 8;
+    while(arguments.read("--pager-reads-per-frame", numReadsPerFrame)) {}
+
+    osg::ref_ptr<TraceDatabasePager> pager = new TraceDatabasePager;
+
+    osg::ref_ptr<osg::Group> group = new osg::Group;
+    osg::NodePath nodePath;
+    nodePath.push_back(group.get());
+
+    typedef std::map< std::string, osg::ref_ptr<osg::Referenced> > DatabaseRequestMap;
+    DatabaseRequestMap databaseRequests;
+    std::set<std::string> loadedFiles;
+
+    osg::ref_ptr<osg::FrameStamp> frameStamp = new osg::FrameStamp;
+
+    osg::Timer_t startTick = osg::Timer::instance()->tick();
+    double requestTime = 0.0;
+    double takeTime = 0.0;
+    unsigned int numFrames = 0;
+    unsigned int numRequests = 0;
+    unsigned int numTaken = 0;
+    unsigned int maxQueueSize = 0;
+
+    RequestTrace::iterator itr = trace.begin();
+    while(itr != trace.end())
+    {
+        unsigned int frameNumber = itr->frameNumber;
+        frameStamp->setFrameNumber(frameNumber);
+        frameStamp->setReferenceTime(static_cast<double>(frameNumber)/60.0);
+        pager->signalBeginFrame(frameStamp.get());
+
+        osg::Timer_t requestStartTick = osg::Timer::instance()->tick();
+        for(; itr != trace.end() && itr->frameNumber==frameNumber; ++itr)
+        {
+            if (loadedFiles.count(itr->fileName)!=0) continue;
+
+            pager->requestNodeFile(itr->fileName, nodePath, itr->priority, frameStamp.get(), databaseRequests[itr->fileName], 0);
+            ++numRequests;
+        }
+
+        osg::Timer_t takeStartTick = osg::Timer::instance()->tick();
+        for(unsigned int i=0; i<numReadsPerFrame; ++i)
+        {
+            std::string fileName = pager->takeRequest();
+            if (fileName.empty()) break;
+
+            loadedFiles.insert(fileName);
+            databaseRequests.erase(fileName);
+            ++numTaken;
+        }
+        osg::Timer_t endTick = osg::Timer::instance()->tick();
+
+        requestTime += osg::Timer::instance()->delta_m(requestStartTick, takeStartTick);
+        takeTime += osg::Timer::instance()->delta_m(takeStartTick, endTick);
+
+        unsigned int queueSize = pager->getFileRequestListSize();
+        if (queueSize>maxQueueSize) maxQueueSize = queueSize;
+
+        pager->signalEndFrame();
+        ++numFrames;
+    }
+
+    double totalTime = osg::Timer::instance()->delta_m(startTick, osg::Timer::instance()->tick());
+
+    OSG_NOTICE<<"DatabasePager request trace replay"<<std::endl;
+    OSG_NOTICE<<"    frames                  = "<<numFrames<<std::endl;
+    OSG_NOTICE<<"    requestNodeFile() calls = "<<numRequests<<std::endl;
+    OSG_NOTICE<<"    requests taken          = "<<numTaken<<std::endl;
+    OSG_NOTICE<<"    maximum queue size      = "<<maxQueueSize<<std::endl;
+    if (numFrames>0)
+    {
+        OSG_NOTICE<<"    requestNodeFile() time  = "<<requestTime<<"ms, "<<requestTime/static_cast<double>(numFrames)<<"ms per frame"<<std::endl;
+        OSG_NOTICE<<"    takeFirst() time        = "<<takeTime<<"ms, "<<takeTime/static_cast<double>(numFrames)<<"ms per frame"<<std::endl;
+    }
+    OSG_NOTICE<<"    total time              = "<<totalTime<<"ms"<<std::endl;
+}
@@ -34,6 +34,7 @@
 #include <iostream>
 
 extern void runFileNameUtilsTest(osg::ArgumentParser& arguments);
+extern void runDatabasePagerTraceTest(osg::ArgumentParser& arguments);
 
 void testFrustum(double left,double right,double bottom,double top,double zNear,double zFar)
 {
@@ -571,7 +572,15 @@ int main( int argc, char** argv )
     arguments.getApplicationUsage()->addCommandLineOption("sizeof","Display sizeof tests.");
     arguments.getApplicationUsage()->addCommandLineOption("matrix","Display qualified tests.");
     arguments.getApplicationUsage()->addCommandLineOption("performance","Display qualified tests.");
+    arguments.getApplicationUsage()->addCommandLineOption("math-performance","Run the Matrix, Quat and BoundingSphere micro benchmarks.");
     arguments.getApplicationUsage()->addCommandLineOption("read-threads <numthreads>","Run multi-thread reading test.");
+    arguments.getApplicationUsage()->addCommandLineOption("pager","Replay a DatabasePager request trace and report the time spent managing the request queue.");
+    arguments.getApplicationUsage()->addCommandLineOption("--pager-trace <filename>","Read the trace to replay, one \"frameNumber priority fileName\" line per request, as recorded by osgviewer --pager-record. Without it a synthetic trace is generated.");
+    arguments.getApplicationUsage()->addCommandLineOption("--pager-write-trace <filename>","Write the trace being replayed, typically the generated synthetic trace, to file.");
+    arguments.getApplicationUsage()->addCommandLineOption("--pager-frames <num>","Number of frames in the generated trace.");
+    arguments.getApplicationUsage()->addCommandLineOption("--pager-tiles <num>","Number of tiles requested each frame in the generated trace.");
+    arguments.getApplicationUsage()->addCommandLineOption("--pager-tiles-moved <num>","Number of tiles the generated trace moves on each frame.");
+    arguments.getApplicationUsage()->addCommandLineOption("--pager-reads-per-frame <num>","Number of requests taken from the queue each frame.");
  
 
     if (arguments.argc()<=1)
@@ -598,6 +607,9 @@ int main( int argc, char** argv )
     int numReadThreads = 0; 
     while (arguments.read("read-threads", numReadThreads)) {}
 
+    bool doDatabasePagerTraceTest = false;
+    while (arguments.read("pager")) doDatabasePagerTraceTest = true;
+
     bool printPolytopeTest = false; 
     while (arguments.read("polytope")) printPolytopeTest = true;
     
@@ -610,6 +622,9 @@ int main( int argc, char** argv )
     bool performanceTest = false; 
     while (arguments.read("p") || arguments.read("performance")) performanceTest = true; 
 
+    bool mathPerformanceTest = false;
+    while (arguments.read("math-performance")) mathPerformanceTest = true;
+
     // if user request help write it out to cout.
     if (arguments.read("-h") || arguments.read("--help"))
     {
@@ -618,6 +633,12 @@ int main( int argc, char** argv )
         return 1;
     }
 
+    if (doDatabasePagerTraceTest)
+    {
+        runDatabasePagerTraceTest(arguments);
+        return 0;
+    }
+
     // any option left unread are converted into errors to write out later.
     arguments.reportRemainingOptionsAsUnrecognized();
 
@@ -680,6 +701,13 @@ int main( int argc, char** argv )
         runPerformanceTests();
     }
 
+    if (mathPerformanceTest)
+    {
+        std::cout<<"**** math performance tests  ******"<<std::endl;
+
+        runMathPerformanceTests();
+    }
+
     if (numReadThreads>0)
     {
         runMultiThreadReadTests(numReadThreads, arguments);
@@ -25,6 +25,10 @@
 #include <osg/ref_ptr>
 #include <osg/MatrixTransform>
 #include <osg/Group>
+#include <osg/Matrixd>
+#include <osg/Matrixf>
+#include <osg/Quat>
+#include <osg/BoundingSphere>
 
 struct Benchmark
 {
@@ -221,3 +225,89 @@ void runPerformanceTests()
     RUN(benchmark, { m->accept(cnv); }, 10000)
     
 }
+
+// reference row by column multiplication, used to check that the Matrix kernels produce bit identical results.
+template<class M>
+static bool compareWithReferenceMult(const M& lhs, const M& rhs)
+{
+    M reference;
+    for(int row=0; row<4; ++row)
+    {
+        for(int col=0; col<4; ++col)
+        {
+            reference(row,col) = lhs(row,0)*rhs(0,col) + lhs(row,1)*rhs(1,col) + lhs(row,2)*rhs(2,col) + lhs(row,3)*rhs(3,col);
+        }
+    }
+
+    M result;
+    result.mult(lhs, rhs);
+    if (result!=reference) return false;
+
+    result = lhs;
+    result.postMult(rhs);
+    if (result!=reference) return false;
+
+    result = rhs;
+    result.preMult(lhs);
+    return result==reference;
+}
+
+void runMathPerformanceTests()
+{
+    Benchmark benchmark;
+
+    unsigned int iterations = 10000000;
+
+    osg::Matrixd md1 = osg::Matrixd::rotate(osg::DegreesToRadians(30.0), osg::Vec3d(0.0,0.6,0.8)) * osg::Matrixd::translate(1.0,2.0,3.0);
+    osg::Matrixd md2 = osg::Matrixd::perspective(45.0, 1.5, 1.0, 1000.0);
+    osg::Matrixd md3;
+    osg::Matrixf mf1(md1);
+    osg::Matrixf mf2(md2);
+    osg::Matrixf mf3;
+    osg::Vec3d vd(1.0,2.0,3.0);
+    osg::Vec3f vf(1.0f,2.0f,3.0f);
+    osg::Vec4d v4d(1.0,2.0,3.0,1.0);
+
+    std::cout<<"Matrixd and Matrixf mult results bit identical to reference: "<<
+        ((compareWithReferenceMult(md1, md2) && compareWithReferenceMult(mf1, mf2)) ? "yes" : "no")<<std::endl;
+
+    RUN(benchmark, md3.mult(md1, md2), iterations)
+    RUN(benchmark, md3.preMult(md1), iterations)
+    RUN(benchmark, md3.postMult(md2), iterations)
+    RUN(benchmark, md3.invert(md1), iterations)
+    RUN(benchmark, md3.invert(md2), iterations)
+    RUN(benchmark, vd = md1.preMult(vd), iterations)
+    RUN(benchmark, vd = md1.postMult(vd), iterations)
+    RUN(benchmark, v4d = md1.preMult(v4d), iterations)
+    RUN(benchmark, vd = osg::Matrixd::transform3x3(md1, vd), iterations)
+
+    RUN(benchmark, mf3.mult(mf1, mf2), iterations)
+    RUN(benchmark, mf3.preMult(mf1), iterations)
+    RUN(benchmark, mf3.postMult(mf2), iterations)
+    RUN(benchmark, mf3.invert(mf1), iterations)
+    RUN(benchmark, vf = mf1.preMult(vf), iterations)
+    RUN(benchmark, vf = osg::Matrixf::transform3x3(mf1, vf), iterations)
+
+    osg::Quat q1(osg::DegreesToRadians(30.0), osg::Vec3d(0.0,0.6,0.8));
+    osg::Quat q2(osg::DegreesToRadians(60.0), osg::Vec3d(1.0,0.0,0.0));
+    osg::Quat q3;
+    RUN(benchmark, q3 = q1*q2, iterations)
+    RUN(benchmark, vd = q1*vd, iterations)
+    RUN(benchmark, q3.slerp(0.3, q1, q2), iterations)
+    RUN(benchmark, q3.makeRotate(osg::Vec3d(1.0,0.0,0.0), vd), iterations)
+    RUN(benchmark, md3.makeRotate(q1), iterations)
+    RUN(benchmark, q3 = md1.getRotate(), iterations)
+
+    osg::BoundingSphere bs1(osg::Vec3(0.0f,0.0f,0.0f), 1.0f);
+    osg::BoundingSphere bs2(osg::Vec3(1.0f,2.0f,3.0f), 2.0f);
+    osg::BoundingSphere bs3;
+    bool intersects = false;
+    RUN(benchmark, { bs3 = bs1; bs3.expandBy(bs2); }, iterations)
+    RUN(benchmark, { bs3 = bs1; bs3.expandRadiusBy(bs2); }, iterations)
+    RUN(benchmark, { bs3 = bs1; bs3.expandBy(vf); }, iterations)
+    RUN(benchmark, intersects = bs1.intersects(bs2), iterations)
+    RUN(benchmark, intersects = bs1.contains(vf), iterations)
+
+    // output the results so that the compiler can't discard the benchmarked operations.
+    std::cout<<"checksum "<<md3(0,0)+mf3(0,0)+vd.x()+vf.x()+v4d.x()+q3.x()+bs3.radius()+(intersects ? 1.0 : 0.0)<<std::endl;
+}
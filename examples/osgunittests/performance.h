@@ -23,4 +23,6 @@
 
 extern void runPerformanceTests();
 
+extern void runMathPerformanceTests();
+
 #endif
@@ -12,6 +12,7 @@
  * OpenSceneGraph Public License for more details.
 */
 #include <stdio.h>
+#include <string.h>
 #include <math.h>
 #include <float.h>
 
@@ -56,12 +57,19 @@ GLBufferObject::GLBufferObject(unsigned int contextID, BufferObject* bufferObjec
     _allocatedSize(0),
     _dirty(true),
     _bufferObject(0),
+    _streamingSegmentSize(0),
+    _streamingSegment(0),
+    _streamingOffset(0),
+    _streamingStorageImmutable(false),
+    _streamingMappedPointer(0),
     _set(0),
     _previous(0),
     _next(0),
     _frameLastUsed(0),
     _extensions(0)
 {
+    for(unsigned int i=0; i<NUM_STREAMING_SEGMENTS; ++i) _streamingFences[i] = 0;
+
     assign(bufferObject);
 
     _extensions = GLBufferObject::getExtensions(contextID, true);
@@ -182,8 +190,20 @@ void GLBufferObject::compileBuffer()
         _bufferEntries.erase(_bufferEntries.begin()+i, _bufferEntries.end());
     }
 
+    bool streaming = _bufferObject->getStreaming() && _extensions->isMapBufferRangeSupported();
+    if (!streaming && _streamingSegmentSize>0)
+    {
+        releaseStreamingBuffer();
+    }
+
     _extensions->glBindBuffer(_profile._target, _glObjectID);
 
+    if (streaming)
+    {
+        compileStreamingBuffer(newTotalSize);
+        return;
+    }
+
     if (newTotalSize > _profile._size)
     {
         OSG_INFO<<"newTotalSize="<<newTotalSize<<", _profile._size="<<_profile._size<<std::endl;
@@ -199,6 +219,15 @@ void GLBufferObject::compileBuffer()
 
     if (_allocatedSize != _profile._size)
     {
+        if (_streamingStorageImmutable)
+        {
+            // storage allocated by glBufferStorage can't be respecified so replace the buffer object itself.
+            _extensions->glDeleteBuffers(1, &_glObjectID);
+            _extensions->glGenBuffers(1, &_glObjectID);
+            _extensions->glBindBuffer(_profile._target, _glObjectID);
+            _streamingStorageImmutable = false;
+        }
+
         _allocatedSize = _profile._size;
         _extensions->glBufferData(_profile._target, _profile._size, NULL, _profile._usage);
         compileAll = true;
@@ -234,13 +263,173 @@ void GLBufferObject::compileBuffer()
     }
 }
 
+static void copyToStreamingSegment(const GLBufferObject::Extensions* extensions, GLenum target, unsigned char* segmentPtr, unsigned int segmentOffset,
+                                   unsigned int offset, unsigned int size, const GLvoid* data)
+{
+    if (segmentPtr) memcpy(segmentPtr + offset, data, size);
+    else extensions->glBufferSubData(target, (GLintptrARB)(segmentOffset + offset), (GLsizeiptrARB)size, data);
+}
+
+void GLBufferObject::compileStreamingBuffer(unsigned int dataSize)
+{
+    const unsigned int segmentAlignment = 64;
+    unsigned int requiredSize = computeBufferAlignment(dataSize, segmentAlignment) * NUM_STREAMING_SEGMENTS;
+
+    if (requiredSize > _profile._size)
+    {
+        OSG_INFO<<"streaming requiredSize="<<requiredSize<<", _profile._size="<<_profile._size<<std::endl;
+
+        _profile._size = requiredSize;
+
+        if (_set)
+        {
+            _set->moveToSet(this, _set->getParent()->getGLBufferObjectSet(_profile));
+        }
+    }
+
+    if (_allocatedSize != _profile._size || _streamingSegmentSize==0)
+    {
+        releaseStreamingBuffer();
+
+        if (_streamingStorageImmutable)
+        {
+            _extensions->glDeleteBuffers(1, &_glObjectID);
+            _extensions->glGenBuffers(1, &_glObjectID);
+            _extensions->glBindBuffer(_profile._target, _glObjectID);
+            _streamingStorageImmutable = false;
+        }
+
+        _allocatedSize = _profile._size;
+        _streamingSegmentSize = ((_allocatedSize / NUM_STREAMING_SEGMENTS) / segmentAlignment) * segmentAlignment;
+
+        // persistent mapping relies on fences to avoid overwriting a segment the GPU is still reading from.
+        if (_extensions->isBufferStorageSupported() && _extensions->isSyncSupported())
+        {
+            GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+            _extensions->glBufferStorage(_profile._target, _allocatedSize, NULL, flags);
+            _streamingStorageImmutable = true;
+            _streamingMappedPointer = _extensions->glMapBufferRange(_profile._target, 0, _allocatedSize, flags);
+        }
+        else
+        {
+            _extensions->glBufferData(_profile._target, _allocatedSize, NULL, _profile._usage);
+        }
+
+        _streamingSegment = NUM_STREAMING_SEGMENTS-1;
+    }
+
+    if (_extensions->isSyncSupported())
+    {
+        // fence the segment that draws since the last upload have been sourcing from
+        GLsync& previousFence = _streamingFences[_streamingSegment];
+        if (previousFence) _extensions->glDeleteSync(previousFence);
+        previousFence = _extensions->glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    }
+
+    _streamingSegment = (_streamingSegment+1) % NUM_STREAMING_SEGMENTS;
+    _streamingOffset = _streamingSegment * _streamingSegmentSize;
+
+    GLsync& fence = _streamingFences[_streamingSegment];
+    if (fence)
+    {
+        const GLuint64 timeout = 1000000000; // 1 second in nanoseconds
+        GLenum result = _extensions->glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, timeout);
+        if (result==GL_TIMEOUT_EXPIRED || result==GL_WAIT_FAILED)
+        {
+            OSG_NOTICE<<"Warning: GLBufferObject::compileStreamingBuffer() timed out waiting for ring segment "<<_streamingSegment<<" to be released by the GPU."<<std::endl;
+        }
+        _extensions->glDeleteSync(fence);
+        fence = 0;
+    }
+
+    unsigned char* segmentPtr = 0;
+    if (_streamingMappedPointer)
+    {
+        segmentPtr = static_cast<unsigned char*>(_streamingMappedPointer) + _streamingOffset;
+    }
+    else
+    {
+        // without fences we can't tell when the GPU is done with a segment, so leave synchronization to the driver.
+        GLbitfield access = GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT;
+        if (_extensions->isSyncSupported()) access |= GL_MAP_UNSYNCHRONIZED_BIT;
+        segmentPtr = static_cast<unsigned char*>(_extensions->glMapBufferRange(_profile._target, _streamingOffset, _streamingSegmentSize, access));
+    }
+
+    unsigned int numBytesStreamed = 0;
+    for(BufferEntries::iterator itr = _bufferEntries.begin();
+        itr != _bufferEntries.end();
+        ++itr)
+    {
+        // every segment holds its own copy so all entries are written, not just the modified ones.
+        BufferEntry& entry = *itr;
+        if (!entry.dataSource) continue;
+
+        entry.numRead = 0;
+        entry.modifiedCount = entry.dataSource->getModifiedCount();
+
+        const osg::Image* image = entry.dataSource->asImage();
+        if (image && !(image->isDataContiguous()))
+        {
+            unsigned int offset = entry.offset;
+            for(osg::Image::DataIterator img_itr(image); img_itr.valid(); ++img_itr)
+            {
+                copyToStreamingSegment(_extensions, _profile._target, segmentPtr, _streamingOffset, offset, img_itr.size(), img_itr.data());
+                offset += img_itr.size();
+            }
+        }
+        else
+        {
+            copyToStreamingSegment(_extensions, _profile._target, segmentPtr, _streamingOffset, entry.offset, entry.dataSize, entry.dataSource->getDataPointer());
+        }
+
+        numBytesStreamed += entry.dataSize;
+    }
+
+    if (segmentPtr && !_streamingMappedPointer)
+    {
+        _extensions->glUnmapBuffer(_profile._target);
+    }
+
+    if (_set)
+    {
+        _set->getParent()->getNumberBytesStreamed() += numBytesStreamed;
+    }
+}
+
+void GLBufferObject::releaseStreamingBuffer()
+{
+    for(unsigned int i=0; i<NUM_STREAMING_SEGMENTS; ++i)
+    {
+        if (_streamingFences[i])
+        {
+            _extensions->glDeleteSync(_streamingFences[i]);
+            _streamingFences[i] = 0;
+        }
+    }
+
+    if (_streamingMappedPointer)
+    {
+        _extensions->glBindBuffer(_profile._target, _glObjectID);
+        _extensions->glUnmapBuffer(_profile._target);
+        _streamingMappedPointer = 0;
+    }
+
+    _allocatedSize = 0;
+    _streamingSegmentSize = 0;
+    _streamingSegment = 0;
+    _streamingOffset = 0;
+}
+
 void GLBufferObject::deleteGLObject()
 {
     OSG_INFO<<"GLBufferObject::deleteGLObject() "<<_glObjectID<<std::endl;
     if (_glObjectID!=0)
     {
+        if (_streamingSegmentSize>0) releaseStreamingBuffer();
+
         _extensions->glDeleteBuffers(1, &_glObjectID);
         _glObjectID = 0;
+        _streamingStorageImmutable = false;
 
         _allocatedSize = 0;
         _bufferEntries.clear();
@@ -305,7 +494,18 @@ GLBufferObject::Extensions::Extensions(const Extensions& rhs):
     _glBindBufferRange = rhs._glBindBufferRange;
     _glBindBufferBase = rhs._glBindBufferBase;
     _glTexBuffer = rhs._glTexBuffer;
+    _glMapBufferRange = rhs._glMapBufferRange;
+    _glBufferStorage = rhs._glBufferStorage;
+    _glFenceSync = rhs._glFenceSync;
+    _glClientWaitSync = rhs._glClientWaitSync;
+    _glDeleteSync = rhs._glDeleteSync;
 
+    _isPBOSupported = rhs._isPBOSupported;
+    _isUniformBufferObjectSupported = rhs._isUniformBufferObjectSupported;
+    _isTBOSupported = rhs._isTBOSupported;
+    _isMapBufferRangeSupported = rhs._isMapBufferRangeSupported;
+    _isBufferStorageSupported = rhs._isBufferStorageSupported;
+    _isSyncSupported = rhs._isSyncSupported;
 }
 
 
@@ -325,10 +525,18 @@ void GLBufferObject::Extensions::lowestCommonDenominator(const Extensions& rhs)
     if (!rhs._glBindBufferRange) _glBindBufferRange = rhs._glBindBufferRange;
     if (!rhs._glBindBufferBase) _glBindBufferBase = rhs._glBindBufferBase;
     if (!rhs._glTexBuffer) _glTexBuffer = rhs._glTexBuffer;
+    if (!rhs._glMapBufferRange) _glMapBufferRange = rhs._glMapBufferRange;
+    if (!rhs._glBufferStorage) _glBufferStorage = rhs._glBufferStorage;
+    if (!rhs._glFenceSync) _glFenceSync = rhs._glFenceSync;
+    if (!rhs._glClientWaitSync) _glClientWaitSync = rhs._glClientWaitSync;
+    if (!rhs._glDeleteSync) _glDeleteSync = rhs._glDeleteSync;
 
     _isPBOSupported = rhs._isPBOSupported;
     _isUniformBufferObjectSupported = rhs._isUniformBufferObjectSupported;
     _isTBOSupported = rhs._isTBOSupported;
+    if (!rhs._isMapBufferRangeSupported) _isMapBufferRangeSupported = false;
+    if (!rhs._isBufferStorageSupported) _isBufferStorageSupported = false;
+    if (!rhs._isSyncSupported) _isSyncSupported = false;
 }
 
 void GLBufferObject::Extensions::setupGLExtensions(unsigned int contextID)
@@ -347,10 +555,23 @@ void GLBufferObject::Extensions::setupGLExtensions(unsigned int contextID)
     setGLExtensionFuncPtr(_glBindBufferRange, "glBindBufferRange");
     setGLExtensionFuncPtr(_glBindBufferBase, "glBindBufferBase");
     setGLExtensionFuncPtr(_glTexBuffer, "glTexBuffer","glTexBufferARB" );
+    setGLExtensionFuncPtr(_glMapBufferRange, "glMapBufferRange","glMapBufferRangeEXT");
+    setGLExtensionFuncPtr(_glBufferStorage, "glBufferStorage","glBufferStorageEXT");
+    setGLExtensionFuncPtr(_glFenceSync, "glFenceSync");
+    setGLExtensionFuncPtr(_glClientWaitSync, "glClientWaitSync");
+    setGLExtensionFuncPtr(_glDeleteSync, "glDeleteSync");
 
     _isPBOSupported = OSG_GL3_FEATURES || osg::isGLExtensionSupported(contextID,"GL_ARB_pixel_buffer_object");
     _isUniformBufferObjectSupported = osg::isGLExtensionSupported(contextID, "GL_ARB_uniform_buffer_object");
     _isTBOSupported = osg::isGLExtensionSupported(contextID,"GL_ARB_texture_buffer_object");
+    _isMapBufferRangeSupported = _glMapBufferRange!=0 && _glUnmapBuffer!=0 &&
+                                 (osg::isGLExtensionOrVersionSupported(contextID, "GL_ARB_map_buffer_range", 3.0f) ||
+                                  osg::isGLExtensionSupported(contextID, "GL_EXT_map_buffer_range"));
+    _isBufferStorageSupported = _glBufferStorage!=0 &&
+                                (osg::isGLExtensionOrVersionSupported(contextID, "GL_ARB_buffer_storage", 4.4f) ||
+                                 osg::isGLExtensionSupported(contextID, "GL_EXT_buffer_storage"));
+    _isSyncSupported = _glFenceSync!=0 && _glClientWaitSync!=0 && _glDeleteSync!=0 &&
+                       osg::isGLExtensionOrVersionSupported(contextID, "GL_ARB_sync", 3.2f);
 }
 
 void GLBufferObject::Extensions::glGenBuffers(GLsizei n, GLuint *buffers) const
@@ -449,6 +670,48 @@ void GLBufferObject::Extensions::glTexBuffer( GLenum target, GLenum internalForm
     else OSG_WARN<<"Error: glTexBuffer not supported by OpenGL driver\n";
 }
 
+GLvoid* GLBufferObject::Extensions::glMapBufferRange (GLenum target, GLintptr offset, GLsizeiptr length, GLbitfield access) const
+{
+    if (_glMapBufferRange) return _glMapBufferRange(target, offset, length, access);
+    else
+    {
+        OSG_WARN<<"Error: glMapBufferRange not supported by OpenGL driver"<<std::endl;
+        return 0;
+    }
+}
+
+void GLBufferObject::Extensions::glBufferStorage (GLenum target, GLsizeiptr size, const GLvoid *data, GLbitfield flags) const
+{
+    if (_glBufferStorage) _glBufferStorage(target, size, data, flags);
+    else OSG_WARN<<"Error: glBufferStorage not supported by OpenGL driver"<<std::endl;
+}
+
+GLBufferObject::GLsync GLBufferObject::Extensions::glFenceSync (GLenum condition, GLbitfield flags) const
+{
+    if (_glFenceSync) return _glFenceSync(condition, flags);
+    else
+    {
+        OSG_WARN<<"Error: glFenceSync not supported by OpenGL driver"<<std::endl;
+        return 0;
+    }
+}
+
+GLenum GLBufferObject::Extensions::glClientWaitSync (GLsync sync, GLbitfield flags, GLuint64 timeout) const
+{
+    if (_glClientWaitSync) return _glClientWaitSync(sync, flags, timeout);
+    else
+    {
+        OSG_WARN<<"Error: glClientWaitSync not supported by OpenGL driver"<<std::endl;
+        return GL_WAIT_FAILED;
+    }
+}
+
+void GLBufferObject::Extensions::glDeleteSync (GLsync sync) const
+{
+    if (_glDeleteSync) _glDeleteSync(sync);
+    else OSG_WARN<<"Error: glDeleteSync not supported by OpenGL driver"<<std::endl;
+}
+
 //////////////////////////////////////////////////////////////////////////////////////////////////////
 //
 // GLBufferObjectSet
@@ -1041,7 +1304,8 @@ GLBufferObjectManager::GLBufferObjectManager(unsigned int contextID):
     _numGenerated(0),
     _generateTime(0.0),
     _numApplied(0),
-    _applyTime(0.0)
+    _applyTime(0.0),
+    _numBytesStreamed(0)
 {
 }
 
@@ -1179,6 +1443,7 @@ void GLBufferObjectManager::reportStats(std::ostream& out)
     out<<"   total _numGenerated="<<_numGenerated<<", _generateTime="<<_generateTime<<", averagePerFrame="<<_generateTime/numFrames*1000.0<<"ms"<<std::endl;
     out<<"   total _numDeleted="<<_numDeleted<<", _deleteTime="<<_deleteTime<<", averagePerFrame="<<_deleteTime/numFrames*1000.0<<"ms"<<std::endl;
     out<<"   total _numApplied="<<_numApplied<<", _applyTime="<<_applyTime<<", averagePerFrame="<<_applyTime/numFrames*1000.0<<"ms"<<std::endl;
+    out<<"   total _numBytesStreamed="<<_numBytesStreamed<<", averagePerFrame="<<double(_numBytesStreamed)/numFrames<<" bytes"<<std::endl;
     out<<"   getMaxGLBufferObjectPoolSize()="<<getMaxGLBufferObjectPoolSize()<<" current/max size = "<<double(_currGLBufferObjectPoolSize)/double(getMaxGLBufferObjectPoolSize())<<std::endl;;
 
     recomputeStats(out);
@@ -1196,6 +1461,8 @@ void GLBufferObjectManager::resetStats()
 
     _numApplied = 0;
     _applyTime = 0;
+
+    _numBytesStreamed = 0;
 }
 
 void GLBufferObjectManager::recomputeStats(std::ostream& out)
@@ -1278,13 +1545,15 @@ void GLBufferObject::releaseGLBufferObject(unsigned int contextID, GLBufferObjec
 // BufferObject
 //
 BufferObject::BufferObject():
-    _copyDataAndReleaseGLBufferObject(false)
+    _copyDataAndReleaseGLBufferObject(false),
+    _streaming(false)
 {
 }
 
 BufferObject::BufferObject(const BufferObject& bo,const CopyOp& copyop):
     Object(bo,copyop),
-    _copyDataAndReleaseGLBufferObject(bo._copyDataAndReleaseGLBufferObject)
+    _copyDataAndReleaseGLBufferObject(bo._copyDataAndReleaseGLBufferObject),
+    _streaming(bo._streaming)
 {
 }
 
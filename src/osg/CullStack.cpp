@@ -24,6 +24,8 @@ CullStack::CullStack()
     _bbCornerNear = 0;
     _bbCornerFar = 7;
     _currentReuseMatrixIndex=0;
+    _numberOfMatrixAllocations=0;
+    _numberOfMatrixReuses=0;
     _identity = new RefMatrix();
 
     _index_modelviewCullingStack = 0;
@@ -39,6 +41,8 @@ CullStack::CullStack(const CullStack& cs):
     _bbCornerNear = 0;
     _bbCornerFar = 7;
     _currentReuseMatrixIndex=0;
+    _numberOfMatrixAllocations=0;
+    _numberOfMatrixReuses=0;
     _identity = new RefMatrix();
 
     _index_modelviewCullingStack = 0;
@@ -86,6 +90,8 @@ void CullStack::reset()
     _bbCornerNear = (~_bbCornerFar)&7;
 
     _currentReuseMatrixIndex=0;
+    _numberOfMatrixAllocations=0;
+    _numberOfMatrixReuses=0;
 }
 
 
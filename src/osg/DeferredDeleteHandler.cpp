@@ -0,0 +1,103 @@
+/* -*-c++-*- OpenSceneGraph - Copyright (C) 1998-2006 Robert Osfield
+ *
+ * This library is open source and may be redistributed and/or modified under
+ * the terms of the OpenSceneGraph Public License (OSGPL) version 0.0 or
+ * (at your option) any later version.  The full license is in LICENSE file
+ * included with this distribution, and on the openscenegraph.org website.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * OpenSceneGraph Public License for more details.
+*/
+
+#include <osg/DeferredDeleteHandler>
+
+#include <OpenThreads/Thread>
+#include <OpenThreads/ScopedLock>
+
+namespace osg
+{
+
+DeferredDeleteHandler::DeferredDeleteHandler(int numberOfFramesToRetainObjects):
+    DeleteHandler(numberOfFramesToRetainObjects)
+{
+}
+
+DeferredDeleteHandler::~DeferredDeleteHandler()
+{
+}
+
+unsigned int DeferredDeleteHandler::getNumObjectsToDelete() const
+{
+    unsigned int numObjects = 0;
+    for(unsigned int i=0; i<NUM_BINS; ++i)
+    {
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_bins[i]._mutex);
+        numObjects += _bins[i]._objectsToDelete.size();
+    }
+    return numObjects;
+}
+
+void DeferredDeleteHandler::requestDelete(const osg::Referenced* object)
+{
+    // threads not created by OpenThreads, such as the main thread, all share the first bin.
+    size_t thread = reinterpret_cast<size_t>(OpenThreads::Thread::CurrentThread());
+    Bin& bin = _bins[((thread >> 4) ^ (thread >> 12)) % NUM_BINS];
+
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(bin._mutex);
+    bin._objectsToDelete.push_back(FrameNumberObjectPair(_currentFrameNumber, object));
+}
+
+void DeferredDeleteHandler::collectObjectsToDelete(unsigned int frameNumber, DeletionList& deletionList)
+{
+    for(unsigned int i=0; i<NUM_BINS; ++i)
+    {
+        Bin& bin = _bins[i];
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock(bin._mutex);
+
+        // keep the objects that are still to be retained at the front of the bin, in the order they were requested.
+        ObjectsToDeleteVector::iterator keep_itr = bin._objectsToDelete.begin();
+        for(ObjectsToDeleteVector::iterator itr = bin._objectsToDelete.begin();
+            itr != bin._objectsToDelete.end();
+            ++itr)
+        {
+            if (itr->first > frameNumber) *(keep_itr++) = *itr;
+            else deletionList.push_back(itr->second);
+        }
+        bin._objectsToDelete.erase(keep_itr, bin._objectsToDelete.end());
+    }
+}
+
+void DeferredDeleteHandler::deleteObjects(unsigned int frameNumber)
+{
+    DeletionList deletionList;
+    for(;;)
+    {
+        // delete the objects outside the bin mutexes as their destructors will request deletion of the objects they unref.
+        collectObjectsToDelete(frameNumber, deletionList);
+        if (deletionList.empty()) break;
+
+        for(DeletionList::iterator itr = deletionList.begin();
+            itr != deletionList.end();
+            ++itr)
+        {
+            doDelete(*itr);
+        }
+        deletionList.clear();
+    }
+}
+
+void DeferredDeleteHandler::flush()
+{
+    if (_numFramesToRetainObjects > _currentFrameNumber) return;
+
+    deleteObjects(_currentFrameNumber - _numFramesToRetainObjects);
+}
+
+void DeferredDeleteHandler::flushAll()
+{
+    deleteObjects(~0u);
+}
+
+} // end of namespace osg
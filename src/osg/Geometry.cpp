@@ -447,7 +447,7 @@ void Geometry::addVertexBufferObjectIfRequired(osg::Array* array)
     {
         if (!array->getVertexBufferObject())
         {
-            array->setVertexBufferObject(getOrCreateVertexBufferObject());
+            array->setVertexBufferObject(array->getStreaming() ? getOrCreateStreamingVertexBufferObject() : getOrCreateVertexBufferObject());
         }
     }
 }
@@ -475,12 +475,34 @@ osg::VertexBufferObject* Geometry::getOrCreateVertexBufferObject()
         ++vitr)
     {
         osg::Array* array = vitr->get();
-        if (array->getVertexBufferObject()) return array->getVertexBufferObject();
+        osg::VertexBufferObject* vbo = array->getVertexBufferObject();
+        if (vbo && !vbo->getStreaming()) return vbo;
     }
 
     return new osg::VertexBufferObject;
 }
 
+osg::VertexBufferObject* Geometry::getOrCreateStreamingVertexBufferObject()
+{
+    ArrayList arrayList;
+    getArrayList(arrayList);
+
+    ArrayList::iterator vitr;
+    for(vitr = arrayList.begin();
+        vitr != arrayList.end();
+        ++vitr)
+    {
+        osg::Array* array = vitr->get();
+        osg::VertexBufferObject* vbo = array->getVertexBufferObject();
+        if (vbo && vbo->getStreaming()) return vbo;
+    }
+
+    osg::VertexBufferObject* vbo = new osg::VertexBufferObject;
+    vbo->setUsage(GL_STREAM_DRAW_ARB);
+    vbo->setStreaming(true);
+    return vbo;
+}
+
 osg::ElementBufferObject* Geometry::getOrCreateElementBufferObject()
 {
     DrawElementsList drawElementsList;
@@ -532,7 +554,7 @@ void Geometry::setUseVertexBufferObjects(bool flag)
                 ++vitr)
             {
                 osg::Array* array = vitr->get();
-                if (array->getVertexBufferObject()) vbo = array->getVertexBufferObject();
+                if (array->getVertexBufferObject() && !array->getVertexBufferObject()->getStreaming()) vbo = array->getVertexBufferObject();
             }
 
             if (!vbo) vbo = new osg::VertexBufferObject;
@@ -542,7 +564,11 @@ void Geometry::setUseVertexBufferObjects(bool flag)
                 ++vitr)
             {
                 osg::Array* array = vitr->get();
-                if (!array->getVertexBufferObject()) array->setVertexBufferObject(vbo.get());
+                if (!array->getVertexBufferObject())
+                {
+                    if (array->getStreaming()) array->setVertexBufferObject(getOrCreateStreamingVertexBufferObject());
+                    else array->setVertexBufferObject(vbo.get());
+                }
             }
         }
 
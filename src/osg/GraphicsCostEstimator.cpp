@@ -18,10 +18,77 @@
 #include <osg/Texture>
 #include <osg/Program>
 #include <osg/Geode>
+#include <osg/Texture2D>
+#include <osg/Drawable>
+#include <osg/Timer>
+#include <osg/Notify>
 
 namespace osg
 {
 
+double computeCostRefinementFactor(double estimatedCost, double measuredCost, double weight)
+{
+    if (estimatedCost<=0.0 || measuredCost<0.0) return 1.0;
+
+    // clamp the ratio so one stalled upload can't skew the costs.
+    double ratio = osg::clampBetween(measuredCost/estimatedCost, 0.1, 10.0);
+    return 1.0 + weight*(ratio-1.0);
+}
+
+/** Times an upload to the current graphics context, with a GL_TIME_ELAPSED query for the GPU time where timer queries are supported,
+  * otherwise the GPU time is taken as the time the upload takes to complete after the GL call has returned.*/
+class UploadTimer
+{
+public:
+    UploadTimer(osg::State& state):
+        _extensions(osg::Drawable::getExtensions(state.getContextID(), true)),
+        _query(0),
+        _startTick(0)
+    {
+        if (_extensions && _extensions->isTimerQuerySupported()) _extensions->glGenQueries(1, &_query);
+    }
+
+    ~UploadTimer()
+    {
+        if (_query) _extensions->glDeleteQueries(1, &_query);
+    }
+
+    void start()
+    {
+        glFinish();
+        _startTick = osg::Timer::instance()->tick();
+        if (_query) _extensions->glBeginQuery(GL_TIME_ELAPSED, _query);
+    }
+
+    CostPair stop()
+    {
+        if (_query) _extensions->glEndQuery(GL_TIME_ELAPSED);
+        double cpuTime = osg::Timer::instance()->delta_s(_startTick, osg::Timer::instance()->tick());
+
+        glFinish();
+        double gpuTime = osg::Timer::instance()->delta_s(_startTick, osg::Timer::instance()->tick()) - cpuTime;
+        if (_query)
+        {
+            GLuint64 timeElapsed = 0;
+            _extensions->glGetQueryObjectui64v(_query, GL_QUERY_RESULT, &timeElapsed);
+            gpuTime = double(timeElapsed)*1e-9;
+        }
+        return CostPair(cpuTime, gpuTime);
+    }
+
+protected:
+    const osg::Drawable::Extensions*    _extensions;
+    GLuint                              _query;
+    osg::Timer_t                        _startTick;
+};
+
+/** Set the cost function from the costs of uploading a small and a large number of bytes.*/
+static void fitCostFunction(ClampedLinearCostFunction1D& function, unsigned int smallSize, double smallCost, unsigned int largeSize, double largeCost)
+{
+    double dcost_di = osg::maximum(largeCost-smallCost, 0.0)/double(largeSize-smallSize);
+    function.set(osg::maximum(smallCost, 0.0), dcost_di, smallSize);
+}
+
 /////////////////////////////////////////////////////////////////////////////////////////////
 //
 // GeometryCostEstimator
@@ -40,13 +107,50 @@ void GeometryCostEstimator::setDefaults()
     _primtiveSetCompileCost.set(min_time, 1.0/transfer_bandwidth, 256); // min time 1/10th of millisecond, min size 256
     _arrayDrawCost.set(min_time, 1.0/gpu_bandwidth, 256); // min time 1/10th of millisecond, min size 256;
     _primtiveSetDrawCost.set(min_time, 1.0/gpu_bandwidth, 256); // min time 1/10th of millisecond, min size 256;
+    _gpuCompileCost.set(0.0, 1.0/transfer_bandwidth, 256);
 
     _displayListCompileConstant = 0.0;
     _displayListCompileFactor = 10.0;
 }
 
-void GeometryCostEstimator::calibrate(osg::RenderInfo& /*renderInfo*/)
+static CostPair timeBufferUpload(osg::RenderInfo& renderInfo, UploadTimer& timer, unsigned int numVertices)
+{
+    osg::ref_ptr<osg::Geometry> geometry = new osg::Geometry;
+    geometry->setVertexArray(new osg::Vec4Array(numVertices));
+    geometry->setUseDisplayList(false);
+    geometry->setUseVertexBufferObjects(true);
+
+    timer.start();
+    geometry->compileGLObjects(renderInfo);
+    CostPair cost = timer.stop();
+
+    geometry->releaseGLObjects(renderInfo.getState());
+    return cost;
+}
+
+void GeometryCostEstimator::calibrate(osg::RenderInfo& renderInfo)
 {
+    osg::State* state = renderInfo.getState();
+    if (!state || !state->isVertexBufferObjectSupported()) return;
+
+    UploadTimer timer(*state);
+    unsigned int smallNumVertices = 256;
+    unsigned int largeNumVertices = 262144;
+    unsigned int smallSize = smallNumVertices*sizeof(osg::Vec4);
+    unsigned int largeSize = largeNumVertices*sizeof(osg::Vec4);
+
+    // upload each size twice and keep the faster, so the driver's first time set up isn't counted.
+    timeBufferUpload(renderInfo, timer, smallNumVertices);
+    CostPair smallCost = timeBufferUpload(renderInfo, timer, smallNumVertices);
+    CostPair largeCost = timeBufferUpload(renderInfo, timer, largeNumVertices);
+    CostPair secondLargeCost = timeBufferUpload(renderInfo, timer, largeNumVertices);
+    if (secondLargeCost.first+secondLargeCost.second < largeCost.first+largeCost.second) largeCost = secondLargeCost;
+
+    fitCostFunction(_arrayCompileCost, smallSize, smallCost.first, largeSize, largeCost.first);
+    fitCostFunction(_primtiveSetCompileCost, smallSize, smallCost.first, largeSize, largeCost.first);
+    fitCostFunction(_gpuCompileCost, smallSize, smallCost.second, largeSize, largeCost.second);
+
+    OSG_INFO<<"GeometryCostEstimator::calibrate(..) "<<largeSize<<" byte buffer upload CPU="<<largeCost.first*1000.0<<"ms, GPU="<<largeCost.second*1000.0<<"ms"<<std::endl;
 }
 
 CostPair GeometryCostEstimator::estimateCompileCost(const osg::Geometry* geometry) const
@@ -58,24 +162,25 @@ CostPair GeometryCostEstimator::estimateCompileCost(const osg::Geometry* geometr
     if (usesVBO || usesDL)
     {
         CostPair cost;
-        if (geometry->getVertexArray()) { cost.first += _arrayCompileCost(geometry->getVertexArray()->getTotalDataSize()); }
-        if (geometry->getNormalArray()) { cost.first += _arrayCompileCost(geometry->getNormalArray()->getTotalDataSize()); }
-        if (geometry->getColorArray()) { cost.first += _arrayCompileCost(geometry->getColorArray()->getTotalDataSize()); }
-        if (geometry->getSecondaryColorArray()) { cost.first += _arrayCompileCost(geometry->getSecondaryColorArray()->getTotalDataSize()); }
-        if (geometry->getFogCoordArray()) { cost.first += _arrayCompileCost(geometry->getFogCoordArray()->getTotalDataSize()); }
-        for(unsigned i=0; i<geometry->getNumTexCoordArrays(); ++i)
+        osg::Geometry::ArrayList arrays;
+        geometry->getArrayList(arrays);
+        for(osg::Geometry::ArrayList::const_iterator itr = arrays.begin();
+            itr != arrays.end();
+            ++itr)
         {
-            if (geometry->getTexCoordArray(i)) { cost.first += _arrayCompileCost(geometry->getTexCoordArray(i)->getTotalDataSize()); }
-        }
-        for(unsigned i=0; i<geometry->getNumVertexAttribArrays(); ++i)
-        {
-            if (geometry->getVertexAttribArray(i)) { cost.first += _arrayCompileCost(geometry->getVertexAttribArray(i)->getTotalDataSize()); }
+            unsigned int size = (*itr)->getTotalDataSize();
+            cost.first += _arrayCompileCost(size);
+            cost.second += _gpuCompileCost(size);
         }
         for(unsigned i=0; i<geometry->getNumPrimitiveSets(); ++i)
         {
             const osg::PrimitiveSet* primSet = geometry->getPrimitiveSet(i);
             const osg::DrawElements* drawElements = primSet ? primSet->getDrawElements() : 0;
-            if (drawElements) { cost.first += _primtiveSetCompileCost(drawElements->getTotalDataSize()); }
+            if (drawElements)
+            {
+                cost.first += _primtiveSetCompileCost(drawElements->getTotalDataSize());
+                cost.second += _gpuCompileCost(drawElements->getTotalDataSize());
+            }
         }
 
         if (usesDL)
@@ -91,11 +196,46 @@ CostPair GeometryCostEstimator::estimateCompileCost(const osg::Geometry* geometr
     }
 }
 
+void GeometryCostEstimator::updateCompileCost(const CostPair& estimatedCost, const CostPair& measuredCost, double weight)
+{
+    double cpuFactor = computeCostRefinementFactor(estimatedCost.first, measuredCost.first, weight);
+    _arrayCompileCost.scale(cpuFactor);
+    _primtiveSetCompileCost.scale(cpuFactor);
+
+    _gpuCompileCost.scale(computeCostRefinementFactor(estimatedCost.second, measuredCost.second, weight));
+}
+
 CostPair GeometryCostEstimator::estimateDrawCost(const osg::Geometry* /*geometry*/) const
 {
     return CostPair(0.0,0.0);
 }
 
+CostPair GeometryCostEstimator::estimateMemoryCost(const osg::Geometry* geometry) const
+{
+    double size = 0.0;
+
+    osg::Geometry::ArrayList arrays;
+    geometry->getArrayList(arrays);
+    for(osg::Geometry::ArrayList::const_iterator itr = arrays.begin();
+        itr != arrays.end();
+        ++itr)
+    {
+        size += double((*itr)->getTotalDataSize());
+    }
+
+    for(unsigned i=0; i<geometry->getNumPrimitiveSets(); ++i)
+    {
+        const osg::PrimitiveSet* primSet = geometry->getPrimitiveSet(i);
+        if (primSet) size += double(primSet->getTotalDataSize());
+    }
+
+    // the arrays are retained on the CPU, and either a VBO or a display list holds a copy of them on the GPU.
+    bool usesVBO = geometry->getUseVertexBufferObjects();
+    bool usesDL = !usesVBO && geometry->getUseDisplayList() && geometry->getSupportsDisplayList();
+
+    return CostPair(size, (usesVBO || usesDL) ? size : 0.0);
+}
+
 /////////////////////////////////////////////////////////////////////////////////////////////
 //
 // TextureCostEstimator
@@ -111,11 +251,53 @@ void TextureCostEstimator::setDefaults()
     double gpu_bandwidth = 50000000000.0; // 50 GB/second
     double min_time = 0.00001; // 10 nano seconds.
     _compileCost.set(min_time, 1.0/transfer_bandwidth, 256); // min time 1/10th of millisecond, min size 256
+    _gpuCompileCost.set(0.0, 1.0/transfer_bandwidth, 256);
     _drawCost.set(min_time, 1.0/gpu_bandwidth, 256); // min time 1/10th of millisecond, min size 256
 }
 
-void TextureCostEstimator::calibrate(osg::RenderInfo& /*renderInfo*/)
+static CostPair timeTextureUpload(osg::State& state, UploadTimer& timer, int s)
 {
+    osg::ref_ptr<osg::Image> image = new osg::Image;
+    image->allocateImage(s, s, 1, GL_RGBA, GL_UNSIGNED_BYTE);
+
+    osg::ref_ptr<osg::Texture2D> texture = new osg::Texture2D(image.get());
+    texture->setFilter(osg::Texture::MIN_FILTER, osg::Texture::LINEAR);
+    texture->setFilter(osg::Texture::MAG_FILTER, osg::Texture::LINEAR);
+
+    timer.start();
+    texture->apply(state);
+    CostPair cost = timer.stop();
+
+    // unbind the texture and let the State know it has to reapply the texture on this unit.
+    glBindTexture(GL_TEXTURE_2D, 0);
+    state.haveAppliedTextureAttribute(state.getActiveTextureUnit(), osg::StateAttribute::TEXTURE);
+
+    texture->releaseGLObjects(&state);
+    return cost;
+}
+
+void TextureCostEstimator::calibrate(osg::RenderInfo& renderInfo)
+{
+    osg::State* state = renderInfo.getState();
+    if (!state) return;
+
+    UploadTimer timer(*state);
+    int smallDimension = 32;
+    int largeDimension = 1024;
+    unsigned int smallSize = smallDimension*smallDimension*4;
+    unsigned int largeSize = largeDimension*largeDimension*4;
+
+    // upload each size twice and keep the faster, so the driver's first time set up isn't counted.
+    timeTextureUpload(*state, timer, smallDimension);
+    CostPair smallCost = timeTextureUpload(*state, timer, smallDimension);
+    CostPair largeCost = timeTextureUpload(*state, timer, largeDimension);
+    CostPair secondLargeCost = timeTextureUpload(*state, timer, largeDimension);
+    if (secondLargeCost.first+secondLargeCost.second < largeCost.first+largeCost.second) largeCost = secondLargeCost;
+
+    fitCostFunction(_compileCost, smallSize, smallCost.first, largeSize, largeCost.first);
+    fitCostFunction(_gpuCompileCost, smallSize, smallCost.second, largeSize, largeCost.second);
+
+    OSG_INFO<<"TextureCostEstimator::calibrate(..) "<<largeSize<<" byte texture upload CPU="<<largeCost.first*1000.0<<"ms, GPU="<<largeCost.second*1000.0<<"ms"<<std::endl;
 }
 
 CostPair TextureCostEstimator::estimateCompileCost(const osg::Texture* texture) const
@@ -124,17 +306,51 @@ CostPair TextureCostEstimator::estimateCompileCost(const osg::Texture* texture)
     for(unsigned int i=0; i<texture->getNumImages(); ++i)
     {
         const osg::Image* image = texture->getImage(i);
-        if (image) cost.first += _compileCost(image->getTotalDataSize());
+        if (image)
+        {
+            cost.first += _compileCost(image->getTotalDataSize());
+            cost.second += _gpuCompileCost(image->getTotalDataSize());
+        }
     }
-    OSG_NOTICE<<"TextureCostEstimator::estimateCompileCost(), size="<<cost.first<<std::endl;
     return cost;
 }
 
+void TextureCostEstimator::updateCompileCost(const CostPair& estimatedCost, const CostPair& measuredCost, double weight)
+{
+    _compileCost.scale(computeCostRefinementFactor(estimatedCost.first, measuredCost.first, weight));
+    _gpuCompileCost.scale(computeCostRefinementFactor(estimatedCost.second, measuredCost.second, weight));
+}
+
 CostPair TextureCostEstimator::estimateDrawCost(const osg::Texture* /*texture*/) const
 {
     return CostPair(0.0,0.0);
 }
 
+CostPair TextureCostEstimator::estimateMemoryCost(const osg::Texture* texture) const
+{
+    osg::Texture::FilterMode minFilter = texture->getFilter(osg::Texture::MIN_FILTER);
+    bool usesMipmaps = minFilter!=osg::Texture::LINEAR && minFilter!=osg::Texture::NEAREST;
+
+    CostPair cost(0.0,0.0);
+    for(unsigned int i=0; i<texture->getNumImages(); ++i)
+    {
+        const osg::Image* image = texture->getImage(i);
+        if (!image) continue;
+
+        double size = double(image->getTotalSizeInBytesIncludingMipmaps());
+        cost.first += size;
+
+        // mipmaps generated by the driver add a third to the size of the base level.
+        if (usesMipmaps && !image->isMipmap()) size *= 4.0/3.0;
+        cost.second += size;
+    }
+
+    // image data released once the texture has been applied no longer costs CPU memory.
+    if (texture->getUnRefImageDataAfterApply()) cost.first = 0.0;
+
+    return cost;
+}
+
 /////////////////////////////////////////////////////////////////////////////////////////////
 //
 // ProgramCostEstimator
@@ -166,7 +382,8 @@ CostPair ProgramCostEstimator::estimateDrawCost(const osg::Program* /*program*/)
 //
 // GeometryCostEstimator
 //
-GraphicsCostEstimator::GraphicsCostEstimator()
+GraphicsCostEstimator::GraphicsCostEstimator():
+    _calibrated(false)
 {
     _geometryEstimator = new GeometryCostEstimator;
     _textureEstimator = new TextureCostEstimator;
@@ -185,9 +402,15 @@ void GraphicsCostEstimator::setDefaults()
 }
 
 
-void GraphicsCostEstimator::calibrate(osg::RenderInfo& /*renderInfo*/)
+void GraphicsCostEstimator::calibrate(osg::RenderInfo& renderInfo)
 {
     OSG_INFO<<"GraphicsCostEstimator::calibrate(..)"<<std::endl;
+
+    _geometryEstimator->calibrate(renderInfo);
+    _textureEstimator->calibrate(renderInfo);
+    _programEstimator->calibrate(renderInfo);
+
+    _calibrated = true;
 }
 
 class CollectCompileCosts : public osg::NodeVisitor
@@ -324,6 +547,72 @@ public:
     CostPair    _costs;
 };
 
+class CollectMemoryCosts : public osg::NodeVisitor
+{
+public:
+    CollectMemoryCosts(const GraphicsCostEstimator* gce):
+        osg::NodeVisitor(osg::NodeVisitor::TRAVERSE_ALL_CHILDREN),
+        _gce(gce),
+        _costs(0.0,0.0)
+        {}
+
+    virtual void apply(osg::Node& node)
+    {
+        apply(node.getStateSet());
+        traverse(node);
+    }
+
+    virtual void apply(osg::Geode& geode)
+    {
+        apply(geode.getStateSet());
+        for(unsigned int i=0; i<geode.getNumDrawables(); ++i)
+        {
+            apply(geode.getDrawable(i)->getStateSet());
+            osg::Geometry* geometry = geode.getDrawable(i)->asGeometry();
+            if (geometry) apply(geometry);
+        }
+    }
+
+    void apply(osg::StateSet* stateset)
+    {
+        if (!stateset) return;
+        if (_statesets.count(stateset)) return;
+        _statesets.insert(stateset);
+
+        for(unsigned int i=0; i<stateset->getNumTextureAttributeLists(); ++i)
+        {
+            const osg::Texture* texture = dynamic_cast<const osg::Texture*>(stateset->getTextureAttribute(i, osg::StateAttribute::TEXTURE));
+            if (!texture || _textures.count(texture)) continue;
+            _textures.insert(texture);
+
+            CostPair cost = _gce->estimateMemoryCost(texture);
+            _costs.first += cost.first;
+            _costs.second += cost.second;
+        }
+    }
+
+    void apply(osg::Geometry* geometry)
+    {
+        if (!geometry) return;
+        if (_geometries.count(geometry)) return;
+        _geometries.insert(geometry);
+
+        CostPair cost = _gce->estimateMemoryCost(geometry);
+        _costs.first += cost.first;
+        _costs.second += cost.second;
+    }
+
+    typedef std::set<osg::StateSet*> StateSets;
+    typedef std::set<const osg::Texture*> Textures;
+    typedef std::set<osg::Geometry*> Geometries;
+
+    const GraphicsCostEstimator* _gce;
+    StateSets   _statesets;
+    Textures    _textures;
+    Geometries  _geometries;
+    CostPair    _costs;
+};
+
 CostPair GraphicsCostEstimator::estimateCompileCost(const osg::Node* node) const
 {
     if (!node) return CostPair(0.0,0.0);
@@ -340,4 +629,12 @@ CostPair GraphicsCostEstimator::estimateDrawCost(const osg::Node* node) const
     return cdc._costs;
 }
 
+CostPair GraphicsCostEstimator::estimateMemoryCost(const osg::Node* node) const
+{
+    if (!node) return CostPair(0.0,0.0);
+    CollectMemoryCosts cmc(this);
+    const_cast<osg::Node*>(node)->accept(cmc);
+    return cmc._costs;
+}
+
 }
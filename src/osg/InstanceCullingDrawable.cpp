@@ -0,0 +1,949 @@
+/* -*-c++-*- OpenSceneGraph - Copyright (C) 1998-2006 Robert Osfield
+ *
+ * This library is open source and may be redistributed and/or modified under
+ * the terms of the OpenSceneGraph Public License (OSGPL) version 0.0 or
+ * (at your option) any later version.  The full license is in LICENSE file
+ * included with this distribution, and on the openscenegraph.org website.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * OpenSceneGraph Public License for more details.
+*/
+#include <osg/InstanceCullingDrawable>
+#include <osg/Camera>
+#include <osg/FrameStamp>
+#include <osg/GLExtensions>
+#include <osg/GL2Extensions>
+#include <osg/Texture>
+#include <osg/Program>
+#include <osg/Uniform>
+#include <osg/Viewport>
+#include <osg/Notify>
+
+#include <algorithm>
+
+using namespace osg;
+
+#ifndef GL_SHADER_STORAGE_BUFFER
+    #define GL_SHADER_STORAGE_BUFFER 0x90D2
+#endif
+
+#ifndef GL_DRAW_INDIRECT_BUFFER
+    #define GL_DRAW_INDIRECT_BUFFER 0x8F3F
+#endif
+
+#ifndef GL_SAMPLE_BUFFERS
+    #define GL_SAMPLE_BUFFERS 0x80A8
+#endif
+
+#ifndef GL_DEPTH_COMPONENT24
+    #define GL_DEPTH_COMPONENT24 0x81A6
+#endif
+
+// number of GLuint's reserved for each indirect command, DrawElementsIndirectCommand {count, instanceCount, firstIndex, baseVertex, baseInstance}
+// with DrawArraysIndirectCommand {count, instanceCount, first, baseInstance} padded to the same size.
+static const unsigned int s_commandSize = 5;
+
+static const unsigned int s_cullWorkGroupSize = 64;
+static const unsigned int s_pyramidWorkGroupSize = 8;
+static const unsigned int s_maxWorkGroupCount = 65535;
+
+static const char* s_defaultProgramName = "InstanceCullingDrawable";
+
+static const char* s_vertexShaderSource =
+    "attribute mat4 osg_InstanceMatrix;\n"
+    "varying vec4 instanceColor;\n"
+    "#ifdef TEXTURED\n"
+    "varying vec2 texCoord;\n"
+    "#endif\n"
+    "void main()\n"
+    "{\n"
+    "    vec4 position = gl_ModelViewMatrix * (osg_InstanceMatrix * gl_Vertex);\n"
+    "    vec3 normal = normalize(gl_NormalMatrix * (mat3(osg_InstanceMatrix) * gl_Normal));\n"
+    "    vec3 lightDir = normalize(gl_LightSource[0].position.xyz - position.xyz * gl_LightSource[0].position.w);\n"
+    "    float diffuse = max(dot(normal, lightDir), 0.0);\n"
+    "    vec3 lighting = gl_LightModel.ambient.rgb + gl_LightSource[0].ambient.rgb + gl_LightSource[0].diffuse.rgb * diffuse;\n"
+    "    instanceColor = vec4(gl_Color.rgb * lighting, gl_Color.a);\n"
+    "#ifdef TEXTURED\n"
+    "    texCoord = gl_MultiTexCoord0.xy;\n"
+    "#endif\n"
+    "    gl_Position = gl_ProjectionMatrix * position;\n"
+    "}\n";
+
+static const char* s_fragmentShaderSource =
+    "varying vec4 instanceColor;\n"
+    "#ifdef TEXTURED\n"
+    "uniform sampler2D baseTexture;\n"
+    "varying vec2 texCoord;\n"
+    "#endif\n"
+    "void main()\n"
+    "{\n"
+    "#ifdef TEXTURED\n"
+    "    gl_FragColor = instanceColor * texture2D(baseTexture, texCoord);\n"
+    "#else\n"
+    "    gl_FragColor = instanceColor;\n"
+    "#endif\n"
+    "}\n";
+
+// Tests each instance's bounding sphere against the frustum planes, in the drawable's local coordinates, and
+// against the Hi-Z pyramid of the previous frame, appending the matrices of the visible instances to the
+// visible list and incrementing the instance count of every indirect command.
+static const char* s_cullShaderSource =
+    "#version 430\n"
+    "layout(local_size_x = 64) in;\n"
+    "layout(std430, binding = 0) readonly buffer InstanceSpheres { vec4 spheres[]; };\n"
+    "layout(std430, binding = 1) readonly buffer InstanceMatrices { mat4 matrices[]; };\n"
+    "layout(std430, binding = 2) writeonly buffer VisibleMatrices { mat4 visibleMatrices[]; };\n"
+    "layout(std430, binding = 3) buffer DrawCommands { uint commands[]; };\n"
+    "layout(binding = 0) uniform sampler2D hiZ;\n"
+    "uniform uint numInstances;\n"
+    "uniform uint numCommands;\n"
+    "uniform vec4 frustumPlanes[6];\n"
+    "uniform bool occlusionCulling;\n"
+    "uniform mat4 previousModelView;\n"
+    "uniform mat4 previousProjection;\n"
+    "uniform float previousScale;\n"
+    "uniform int hiZLevels;\n"
+    "\n"
+    "bool isOccluded(vec4 sphere)\n"
+    "{\n"
+    "    vec3 center = (previousModelView * vec4(sphere.xyz, 1.0)).xyz;\n"
+    "    float radius = sphere.w * previousScale;\n"
+    "\n"
+    "    // spheres that reach the near plane can't be tested against the depth pyramid.\n"
+    "    vec4 nearest = previousProjection * vec4(center.xy, center.z + radius, 1.0);\n"
+    "    if (nearest.w <= 0.0 || nearest.z < -nearest.w) return false;\n"
+    "\n"
+    "    vec2 minUV = vec2(1.0);\n"
+    "    vec2 maxUV = vec2(0.0);\n"
+    "    for(int i=0; i<8; ++i)\n"
+    "    {\n"
+    "        vec3 corner = center + radius * vec3((i&1)!=0 ? 1.0 : -1.0, (i&2)!=0 ? 1.0 : -1.0, (i&4)!=0 ? 1.0 : -1.0);\n"
+    "        vec4 clip = previousProjection * vec4(corner, 1.0);\n"
+    "        if (clip.w <= 0.0) return false;\n"
+    "        vec2 uv = (clip.xy / clip.w) * 0.5 + 0.5;\n"
+    "        minUV = min(minUV, uv);\n"
+    "        maxUV = max(maxUV, uv);\n"
+    "    }\n"
+    "\n"
+    "    float depth = (nearest.z / nearest.w) * 0.5 + 0.5;\n"
+    "\n"
+    "    // choose the level at which the sphere's screen extent spans at most two texels,\n"
+    "    // the last texel of each level also covers any odd row or column of the level below.\n"
+    "    ivec2 size = textureSize(hiZ, 0);\n"
+    "    ivec2 minPixel = ivec2(clamp(minUV, 0.0, 1.0) * vec2(size));\n"
+    "    ivec2 maxPixel = ivec2(clamp(maxUV, 0.0, 1.0) * vec2(size));\n"
+    "    ivec2 extent = maxPixel - minPixel;\n"
+    "    int level = clamp(int(ceil(log2(float(max(max(extent.x, extent.y), 1))))), 0, hiZLevels-1);\n"
+    "    ivec2 levelMax = textureSize(hiZ, level) - ivec2(1);\n"
+    "    ivec2 minTexel = min(minPixel >> level, levelMax);\n"
+    "    ivec2 maxTexel = min(maxPixel >> level, levelMax);\n"
+    "\n"
+    "    float occluderDepth = max(max(texelFetch(hiZ, minTexel, level).r, texelFetch(hiZ, ivec2(maxTexel.x, minTexel.y), level).r),\n"
+    "                              max(texelFetch(hiZ, ivec2(minTexel.x, maxTexel.y), level).r, texelFetch(hiZ, maxTexel, level).r));\n"
+    "    return depth > occluderDepth;\n"
+    "}\n"
+    "\n"
+    "void main()\n"
+    "{\n"
+    "    uint i = gl_GlobalInvocationID.y * gl_NumWorkGroups.x * gl_WorkGroupSize.x + gl_GlobalInvocationID.x;\n"
+    "    if (i >= numInstances) return;\n"
+    "\n"
+    "    vec4 sphere = spheres[i];\n"
+    "    for(int p=0; p<6; ++p)\n"
+    "    {\n"
+    "        if (dot(frustumPlanes[p].xyz, sphere.xyz) + frustumPlanes[p].w < -sphere.w) return;\n"
+    "    }\n"
+    "\n"
+    "    if (occlusionCulling && isOccluded(sphere)) return;\n"
+    "\n"
+    "    uint index = atomicAdd(commands[1], 1u);\n"
+    "    for(uint c=1u; c<numCommands; ++c)\n"
+    "    {\n"
+    "        atomicAdd(commands[c*5u+1u], 1u);\n"
+    "    }\n"
+    "    visibleMatrices[index] = matrices[i];\n"
+    "}\n";
+
+// Copies the depth buffer into level 0 of the Hi-Z pyramid.
+static const char* s_depthCopyShaderSource =
+    "#version 430\n"
+    "layout(local_size_x = 8, local_size_y = 8) in;\n"
+    "layout(binding = 0) uniform sampler2D depthTexture;\n"
+    "layout(r32f, binding = 0) writeonly uniform image2D destinationLevel;\n"
+    "void main()\n"
+    "{\n"
+    "    ivec2 texel = ivec2(gl_GlobalInvocationID.xy);\n"
+    "    if (any(greaterThanEqual(texel, imageSize(destinationLevel)))) return;\n"
+    "    imageStore(destinationLevel, texel, vec4(texelFetch(depthTexture, texel, 0).r));\n"
+    "}\n";
+
+// Builds the next Hi-Z level by taking the farthest depth of each 2x2 block, the last row and column
+// of the level also take in the odd row or column of the source level.
+static const char* s_downsampleShaderSource =
+    "#version 430\n"
+    "layout(local_size_x = 8, local_size_y = 8) in;\n"
+    "layout(r32f, binding = 0) readonly uniform image2D sourceLevel;\n"
+    "layout(r32f, binding = 1) writeonly uniform image2D destinationLevel;\n"
+    "void main()\n"
+    "{\n"
+    "    ivec2 texel = ivec2(gl_GlobalInvocationID.xy);\n"
+    "    ivec2 size = imageSize(destinationLevel);\n"
+    "    if (any(greaterThanEqual(texel, size))) return;\n"
+    "\n"
+    "    ivec2 sourceMax = imageSize(sourceLevel) - ivec2(1);\n"
+    "    ivec2 first = texel * 2;\n"
+    "    ivec2 last = min(first + ivec2(1), sourceMax);\n"
+    "    if (texel.x == size.x-1) last.x = sourceMax.x;\n"
+    "    if (texel.y == size.y-1) last.y = sourceMax.y;\n"
+    "\n"
+    "    float depth = 0.0;\n"
+    "    for(int y=first.y; y<=last.y; ++y)\n"
+    "    {\n"
+    "        for(int x=first.x; x<=last.x; ++x)\n"
+    "        {\n"
+    "            depth = max(depth, imageLoad(sourceLevel, ivec2(x,y)).r);\n"
+    "        }\n"
+    "    }\n"
+    "    imageStore(destinationLevel, texel, vec4(depth));\n"
+    "}\n";
+
+static GLuint compileComputeProgram(const GL2Extensions* extensions, const char* source, const char* name)
+{
+    GLuint shader = extensions->glCreateShader(GL_COMPUTE_SHADER);
+    extensions->glShaderSource(shader, 1, &source, 0);
+    extensions->glCompileShader(shader);
+
+    GLint compiled = GL_FALSE;
+    extensions->glGetShaderiv(shader, GL_COMPILE_STATUS, &compiled);
+    if (compiled!=GL_TRUE)
+    {
+        GLchar infoLog[1024];
+        extensions->glGetShaderInfoLog(shader, sizeof(infoLog), 0, infoLog);
+        OSG_WARN<<"InstanceCullingDrawable: failed to compile "<<name<<" compute shader:"<<std::endl<<infoLog<<std::endl;
+        extensions->glDeleteShader(shader);
+        return 0;
+    }
+
+    GLuint program = extensions->glCreateProgram();
+    extensions->glAttachShader(program, shader);
+    extensions->glLinkProgram(program);
+    extensions->glDeleteShader(shader);
+
+    GLint linked = GL_FALSE;
+    extensions->glGetProgramiv(program, GL_LINK_STATUS, &linked);
+    if (linked!=GL_TRUE)
+    {
+        GLchar infoLog[1024];
+        extensions->glGetProgramInfoLog(program, sizeof(infoLog), 0, infoLog);
+        OSG_WARN<<"InstanceCullingDrawable: failed to link "<<name<<" compute program:"<<std::endl<<infoLog<<std::endl;
+        extensions->glDeleteProgram(program);
+        return 0;
+    }
+
+    return program;
+}
+
+static void computeFrustumPlanes(const Matrix& modelView, const Matrix& projection, GLfloat planes[24])
+{
+    Polytope frustum;
+    frustum.setToUnitFrustum();
+    frustum.transformProvidingInverse(modelView*projection);
+
+    const Polytope::PlaneList& planeList = frustum.getPlaneList();
+    for(unsigned int p=0; p<6; ++p)
+    {
+        for(unsigned int c=0; c<4; ++c)
+        {
+            planes[p*4+c] = static_cast<GLfloat>(planeList[p][c]);
+        }
+    }
+}
+
+static float maximumScale(const Matrixf& matrix)
+{
+    Vec3f scale = matrix.getScale();
+    return osg::maximum(scale.x(), osg::maximum(scale.y(), scale.z()));
+}
+
+InstanceCullingDrawable::InstanceCullingDrawable():
+    _occlusionCulling(true),
+    _matrixAttributeLocation(12),
+    _modifiedCount(1),
+    _spheresModifiedCount(0)
+{
+    setSupportsDisplayList(false);
+    setUpStateSet();
+}
+
+InstanceCullingDrawable::InstanceCullingDrawable(const InstanceCullingDrawable& icd,const CopyOp& copyop):
+    Drawable(icd,copyop),
+    _geometry(icd._geometry.valid() ? static_cast<Geometry*>(copyop(static_cast<const Drawable*>(icd._geometry.get()))) : 0),
+    _instanceMatrices(icd._instanceMatrices),
+    _occlusionCulling(icd._occlusionCulling),
+    _matrixAttributeLocation(icd._matrixAttributeLocation),
+    _modifiedCount(1),
+    _spheresModifiedCount(0)
+{
+}
+
+InstanceCullingDrawable::~InstanceCullingDrawable()
+{
+    // GL objects are not deleted here as the graphics contexts may no longer be current,
+    // they are released along with the contexts, or explicitly via releaseGLObjects().
+}
+
+void InstanceCullingDrawable::setGeometry(Geometry* geometry)
+{
+    _geometry = geometry;
+    if (_geometry.valid())
+    {
+        _geometry->setUseDisplayList(false);
+        _geometry->setUseVertexBufferObjects(true);
+    }
+
+    setUpStateSet();
+    dirtyInstances();
+}
+
+void InstanceCullingDrawable::setMatrixAttributeLocation(unsigned int location)
+{
+    if (_matrixAttributeLocation==location) return;
+
+    _matrixAttributeLocation = location;
+    setUpStateSet();
+}
+
+void InstanceCullingDrawable::dirtyInstances()
+{
+    ++_modifiedCount;
+    dirtyBound();
+}
+
+Program* InstanceCullingDrawable::createDefaultProgram(unsigned int matrixAttributeLocation, bool textured)
+{
+    std::string header("#version 120\n");
+    if (textured) header += "#define TEXTURED\n";
+
+    Program* program = new Program;
+    program->setName(s_defaultProgramName);
+    program->addShader(new Shader(Shader::VERTEX, header+s_vertexShaderSource));
+    program->addShader(new Shader(Shader::FRAGMENT, header+s_fragmentShaderSource));
+    program->addBindAttribLocation("osg_InstanceMatrix", matrixAttributeLocation);
+    return program;
+}
+
+void InstanceCullingDrawable::setUpStateSet()
+{
+    StateSet* stateset = getOrCreateStateSet();
+
+    // leave any Program assigned by the application in place.
+    const Program* program = dynamic_cast<const Program*>(stateset->getAttribute(StateAttribute::PROGRAM));
+    if (program && program->getName()!=s_defaultProgramName) return;
+
+    bool textured = _geometry.valid() && _geometry->getTexCoordArray(0)!=0;
+    stateset->setAttributeAndModes(createDefaultProgram(_matrixAttributeLocation, textured));
+    if (textured) stateset->addUniform(new Uniform("baseTexture", 0));
+    else stateset->removeUniform("baseTexture");
+}
+
+void InstanceCullingDrawable::computeInstanceSpheres() const
+{
+    if (_spheresModifiedCount==_modifiedCount && _instanceSpheres.size()==_instanceMatrices.size()) return;
+
+    _instanceSpheres.clear();
+    _instanceSpheres.reserve(_instanceMatrices.size());
+
+    BoundingBox bb = _geometry.valid() ? _geometry->getBoundingBox() : BoundingBox();
+    Vec3f center = bb.valid() ? Vec3f(bb.center()) : Vec3f();
+    float radius = bb.valid() ? bb.radius() : 0.0f;
+
+    for(InstanceMatrixList::const_iterator itr = _instanceMatrices.begin();
+        itr != _instanceMatrices.end();
+        ++itr)
+    {
+        _instanceSpheres.push_back(Vec4f(center * (*itr), radius * maximumScale(*itr)));
+    }
+
+    _spheresModifiedCount = _modifiedCount;
+}
+
+BoundingBox InstanceCullingDrawable::computeBoundingBox() const
+{
+    BoundingBox bb;
+    if (!_geometry) return bb;
+
+    computeInstanceSpheres();
+
+    for(std::vector<Vec4f>::const_iterator itr = _instanceSpheres.begin();
+        itr != _instanceSpheres.end();
+        ++itr)
+    {
+        bb.expandBy(BoundingSphere(Vec3(itr->x(), itr->y(), itr->z()), itr->w()));
+    }
+
+    return bb;
+}
+
+InstanceCullingDrawable::PerContextData& InstanceCullingDrawable::getPerContextData(State& state) const
+{
+    ref_ptr<PerContextData>& pcd = _perContextData[state.getContextID()];
+    if (!pcd) pcd = new PerContextData;
+    return *pcd;
+}
+
+bool InstanceCullingDrawable::initialize(State& state, PerContextData& pcd) const
+{
+    unsigned int contextID = state.getContextID();
+
+    setGLExtensionFuncPtr(pcd.glMemoryBarrier, "glMemoryBarrier", "glMemoryBarrierEXT");
+    setGLExtensionFuncPtr(pcd.glDrawArraysIndirect, "glDrawArraysIndirect");
+    setGLExtensionFuncPtr(pcd.glDrawElementsIndirect, "glDrawElementsIndirect");
+
+    const GL2Extensions* gl2Extensions = GL2Extensions::Get(contextID, true);
+    const GLBufferObject::Extensions* bufferExtensions = GLBufferObject::getExtensions(contextID, true);
+    const Texture::Extensions* textureExtensions = Texture::getExtensions(contextID, true);
+
+    bool supported = isGLExtensionOrVersionSupported(contextID, "GL_ARB_compute_shader", 4.3f) &&
+                     isGLExtensionOrVersionSupported(contextID, "GL_ARB_shader_storage_buffer_object", 4.3f) &&
+                     isGLExtensionOrVersionSupported(contextID, "GL_ARB_shader_image_load_store", 4.2f) &&
+                     isGLExtensionOrVersionSupported(contextID, "GL_ARB_draw_indirect", 4.0f) &&
+                     pcd.glMemoryBarrier!=0 &&
+                     pcd.glDrawArraysIndirect!=0 &&
+                     pcd.glDrawElementsIndirect!=0 &&
+                     gl2Extensions && gl2Extensions->isGlslSupported() &&
+                     bufferExtensions && bufferExtensions->isBufferObjectSupported() &&
+                     textureExtensions && textureExtensions->isTexStorage2DSupported() && textureExtensions->isBindImageTextureSupported();
+
+    if (!supported)
+    {
+        OSG_INFO<<"InstanceCullingDrawable: GPU culling not supported for contextID "<<contextID<<", culling instances on the CPU."<<std::endl;
+        return false;
+    }
+
+    pcd.cullProgram = compileComputeProgram(gl2Extensions, s_cullShaderSource, "cull");
+    pcd.depthCopyProgram = compileComputeProgram(gl2Extensions, s_depthCopyShaderSource, "depth copy");
+    pcd.downsampleProgram = compileComputeProgram(gl2Extensions, s_downsampleShaderSource, "downsample");
+
+    if (!pcd.cullProgram || !pcd.depthCopyProgram || !pcd.downsampleProgram)
+    {
+        if (pcd.cullProgram) gl2Extensions->glDeleteProgram(pcd.cullProgram);
+        if (pcd.depthCopyProgram) gl2Extensions->glDeleteProgram(pcd.depthCopyProgram);
+        if (pcd.downsampleProgram) gl2Extensions->glDeleteProgram(pcd.downsampleProgram);
+        pcd.cullProgram = pcd.depthCopyProgram = pcd.downsampleProgram = 0;
+        return false;
+    }
+
+    pcd.numInstancesLocation = gl2Extensions->glGetUniformLocation(pcd.cullProgram, "numInstances");
+    pcd.numCommandsLocation = gl2Extensions->glGetUniformLocation(pcd.cullProgram, "numCommands");
+    pcd.frustumPlanesLocation = gl2Extensions->glGetUniformLocation(pcd.cullProgram, "frustumPlanes");
+    pcd.occlusionCullingLocation = gl2Extensions->glGetUniformLocation(pcd.cullProgram, "occlusionCulling");
+    pcd.previousModelViewLocation = gl2Extensions->glGetUniformLocation(pcd.cullProgram, "previousModelView");
+    pcd.previousProjectionLocation = gl2Extensions->glGetUniformLocation(pcd.cullProgram, "previousProjection");
+    pcd.previousScaleLocation = gl2Extensions->glGetUniformLocation(pcd.cullProgram, "previousScale");
+    pcd.hiZLevelsLocation = gl2Extensions->glGetUniformLocation(pcd.cullProgram, "hiZLevels");
+
+    GLuint buffers[4];
+    bufferExtensions->glGenBuffers(4, buffers);
+    pcd.sphereBuffer = buffers[0];
+    pcd.matrixBuffer = buffers[1];
+    pcd.visibleBuffer = buffers[2];
+    pcd.commandBuffer = buffers[3];
+
+    return true;
+}
+
+void InstanceCullingDrawable::uploadInstances(State& state, PerContextData& pcd) const
+{
+    if (pcd.modifiedCount==_modifiedCount) return;
+
+    computeInstanceSpheres();
+
+    const GLBufferObject::Extensions* extensions = GLBufferObject::getExtensions(state.getContextID(), true);
+
+    unsigned int numInstances = getNumInstances();
+
+    extensions->glBindBuffer(GL_SHADER_STORAGE_BUFFER, pcd.sphereBuffer);
+    extensions->glBufferData(GL_SHADER_STORAGE_BUFFER, numInstances*sizeof(Vec4f), &_instanceSpheres.front(), GL_STATIC_DRAW_ARB);
+
+    extensions->glBindBuffer(GL_SHADER_STORAGE_BUFFER, pcd.matrixBuffer);
+    extensions->glBufferData(GL_SHADER_STORAGE_BUFFER, numInstances*sizeof(Matrixf), _instanceMatrices.front().ptr(), GL_STATIC_DRAW_ARB);
+
+    if (numInstances>pcd.instanceCapacity)
+    {
+        extensions->glBindBuffer(GL_SHADER_STORAGE_BUFFER, pcd.visibleBuffer);
+        extensions->glBufferData(GL_SHADER_STORAGE_BUFFER, numInstances*sizeof(Matrixf), 0, GL_DYNAMIC_COPY_ARB);
+        pcd.instanceCapacity = numInstances;
+    }
+
+    extensions->glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+    pcd.modifiedCount = _modifiedCount;
+}
+
+void InstanceCullingDrawable::cullInstances(RenderInfo& renderInfo, PerContextData& pcd, const HiZPyramid* pyramid) const
+{
+    State& state = *renderInfo.getState();
+    unsigned int contextID = state.getContextID();
+
+    GLBufferObject::Extensions* extensions = GLBufferObject::getExtensions(contextID, true);
+    const GL2Extensions* gl2Extensions = GL2Extensions::Get(contextID, true);
+
+    // set up one indirect command per primitive set with a zero instance count, the instance counts are accumulated by the cull shader.
+    pcd.commands.clear();
+
+    const Geometry::PrimitiveSetList& primitives = _geometry->getPrimitiveSetList();
+    for(Geometry::PrimitiveSetList::const_iterator itr = primitives.begin();
+        itr != primitives.end();
+        ++itr)
+    {
+        const PrimitiveSet* primitiveSet = itr->get();
+        GLuint command[s_commandSize] = { 0, 0, 0, 0, 0 };
+
+        const DrawElements* drawElements = primitiveSet->getDrawElements();
+        if (primitiveSet->getType()==PrimitiveSet::DrawArraysPrimitiveType)
+        {
+            const DrawArrays* drawArrays = static_cast<const DrawArrays*>(primitiveSet);
+            command[0] = drawArrays->getCount();
+            command[2] = drawArrays->getFirst();
+        }
+        else if (drawElements && drawElements->getNumIndices()>0)
+        {
+            unsigned int elementSize = drawElements->getTotalDataSize()/drawElements->getNumIndices();
+
+            GLBufferObject* ebo = drawElements->getOrCreateGLBufferObject(contextID);
+            state.bindElementBufferObject(ebo);
+
+            GLsizeiptrARB offset = ebo->getOffset(drawElements->getBufferIndex());
+            if (offset%elementSize==0)
+            {
+                command[0] = drawElements->getNumIndices();
+                command[2] = static_cast<GLuint>(offset/elementSize);
+            }
+        }
+
+        pcd.commands.insert(pcd.commands.end(), command, command+s_commandSize);
+    }
+
+    state.unbindElementBufferObject();
+
+    extensions->glBindBuffer(GL_SHADER_STORAGE_BUFFER, pcd.commandBuffer);
+    extensions->glBufferData(GL_SHADER_STORAGE_BUFFER, pcd.commands.size()*sizeof(GLuint), &pcd.commands.front(), GL_DYNAMIC_DRAW_ARB);
+    extensions->glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+    unsigned int numInstances = getNumInstances();
+
+    GLfloat planes[24];
+    computeFrustumPlanes(state.getModelViewMatrix(), state.getProjectionMatrix(), planes);
+
+    gl2Extensions->glUseProgram(pcd.cullProgram);
+    gl2Extensions->glUniform1ui(pcd.numInstancesLocation, numInstances);
+    gl2Extensions->glUniform1ui(pcd.numCommandsLocation, static_cast<GLuint>(primitives.size()));
+    gl2Extensions->glUniform4fv(pcd.frustumPlanesLocation, 6, planes);
+    gl2Extensions->glUniform1i(pcd.occlusionCullingLocation, pyramid ? 1 : 0);
+
+    if (pyramid)
+    {
+        // the pyramid is shared between drawables so only records the view, the drawable's model transform
+        // is taken from the current modelview and placed in the pyramid's view.
+        Matrixf previousModelView = state.getModelViewMatrix() * state.getInitialInverseViewMatrix() * Matrix(pyramid->view);
+
+        gl2Extensions->glUniformMatrix4fv(pcd.previousModelViewLocation, 1, GL_FALSE, previousModelView.ptr());
+        gl2Extensions->glUniformMatrix4fv(pcd.previousProjectionLocation, 1, GL_FALSE, pyramid->projection.ptr());
+        gl2Extensions->glUniform1f(pcd.previousScaleLocation, maximumScale(previousModelView));
+        gl2Extensions->glUniform1i(pcd.hiZLevelsLocation, pyramid->numLevels);
+
+        state.setActiveTextureUnit(0);
+        glBindTexture(GL_TEXTURE_2D, pyramid->pyramidTexture);
+    }
+
+    extensions->glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, pcd.sphereBuffer);
+    extensions->glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, pcd.matrixBuffer);
+    extensions->glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, pcd.visibleBuffer);
+    extensions->glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, pcd.commandBuffer);
+
+    // spread the work groups over a second dimension when there are more than the minimum maximum work group count allows.
+    unsigned int numGroups = (numInstances+s_cullWorkGroupSize-1)/s_cullWorkGroupSize;
+    unsigned int numGroupsX = osg::minimum(numGroups, s_maxWorkGroupCount);
+    unsigned int numGroupsY = (numGroups+numGroupsX-1)/numGroupsX;
+    gl2Extensions->glDispatchCompute(numGroupsX, numGroupsY, 1);
+
+    pcd.glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT);
+
+    for(GLuint binding=0; binding<4; ++binding)
+    {
+        extensions->glBindBufferBase(GL_SHADER_STORAGE_BUFFER, binding, 0);
+    }
+
+    if (pyramid) restoreTextureUnit(state);
+
+    const Program::PerContextProgram* lastProgram = state.getLastAppliedProgramObject();
+    if (lastProgram) lastProgram->useProgram();
+    else gl2Extensions->glUseProgram(0);
+}
+
+void InstanceCullingDrawable::drawInstances(RenderInfo& renderInfo, PerContextData& pcd) const
+{
+    State& state = *renderInfo.getState();
+    unsigned int contextID = state.getContextID();
+
+    const GLBufferObject::Extensions* extensions = GLBufferObject::getExtensions(contextID, true);
+    const GL2Extensions* gl2Extensions = GL2Extensions::Get(contextID, true);
+
+    _geometry->drawVertexArraysImplementation(renderInfo);
+
+    // keep osg::State's record of the bound buffer objects in step with the direct binds below.
+    state.unbindVertexBufferObject();
+
+    extensions->glBindBuffer(GL_ARRAY_BUFFER_ARB, pcd.visibleBuffer);
+    for(unsigned int c=0; c<4; ++c)
+    {
+        state.setVertexAttribPointer(_matrixAttributeLocation+c, 4, GL_FLOAT, GL_FALSE, sizeof(Matrixf), reinterpret_cast<const GLvoid*>(c*4*sizeof(float)));
+        gl2Extensions->glVertexAttribDivisor(_matrixAttributeLocation+c, 1);
+    }
+    extensions->glBindBuffer(GL_ARRAY_BUFFER_ARB, 0);
+
+    extensions->glBindBuffer(GL_DRAW_INDIRECT_BUFFER, pcd.commandBuffer);
+
+    const Geometry::PrimitiveSetList& primitives = _geometry->getPrimitiveSetList();
+    for(unsigned int i=0; i<primitives.size(); ++i)
+    {
+        if (pcd.commands[i*s_commandSize]==0) continue;
+
+        const PrimitiveSet* primitiveSet = primitives[i].get();
+        const GLvoid* indirect = reinterpret_cast<const GLvoid*>(i*s_commandSize*sizeof(GLuint));
+
+        const DrawElements* drawElements = primitiveSet->getDrawElements();
+        if (drawElements)
+        {
+            GLenum type = GL_UNSIGNED_INT;
+            if (primitiveSet->getType()==PrimitiveSet::DrawElementsUBytePrimitiveType) type = GL_UNSIGNED_BYTE;
+            else if (primitiveSet->getType()==PrimitiveSet::DrawElementsUShortPrimitiveType) type = GL_UNSIGNED_SHORT;
+
+            state.bindElementBufferObject(drawElements->getOrCreateGLBufferObject(contextID));
+            pcd.glDrawElementsIndirect(primitiveSet->getMode(), type, indirect);
+        }
+        else
+        {
+            pcd.glDrawArraysIndirect(primitiveSet->getMode(), indirect);
+        }
+    }
+
+    extensions->glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+
+    for(unsigned int c=0; c<4; ++c)
+    {
+        state.disableVertexAttribPointer(_matrixAttributeLocation+c);
+        gl2Extensions->glVertexAttribDivisor(_matrixAttributeLocation+c, 0);
+    }
+
+    state.unbindVertexBufferObject();
+    state.unbindElementBufferObject();
+}
+
+void InstanceCullingDrawable::buildHiZPyramid(State& state, PerContextData& pcd, HiZPyramid& pyramid) const
+{
+    const Viewport* viewport = state.getCurrentViewport();
+    int width = viewport ? static_cast<int>(viewport->width()) : 0;
+    int height = viewport ? static_cast<int>(viewport->height()) : 0;
+    if (width<=0 || height<=0)
+    {
+        pyramid.valid = false;
+        return;
+    }
+
+    // the depth of a multisampled framebuffer can't be copied into a texture, so fall back to frustum culling only.
+    GLint sampleBuffers = 0;
+    glGetIntegerv(GL_SAMPLE_BUFFERS, &sampleBuffers);
+    if (sampleBuffers!=0)
+    {
+        pyramid.valid = false;
+        return;
+    }
+
+    unsigned int contextID = state.getContextID();
+    const GL2Extensions* gl2Extensions = GL2Extensions::Get(contextID, true);
+    const Texture::Extensions* textureExtensions = Texture::getExtensions(contextID, true);
+
+    state.setActiveTextureUnit(0);
+
+    if (width!=pyramid.width || height!=pyramid.height)
+    {
+        if (pyramid.depthTexture) glDeleteTextures(1, &pyramid.depthTexture);
+        if (pyramid.pyramidTexture) glDeleteTextures(1, &pyramid.pyramidTexture);
+
+        pyramid.width = width;
+        pyramid.height = height;
+        pyramid.numLevels = 1;
+        while((osg::maximum(width, height) >> pyramid.numLevels) > 0) ++pyramid.numLevels;
+
+        glGenTextures(1, &pyramid.depthTexture);
+        glBindTexture(GL_TEXTURE_2D, pyramid.depthTexture);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT24, width, height, 0, GL_DEPTH_COMPONENT, GL_UNSIGNED_INT, 0);
+
+        glGenTextures(1, &pyramid.pyramidTexture);
+        glBindTexture(GL_TEXTURE_2D, pyramid.pyramidTexture);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        textureExtensions->glTexStorage2D(GL_TEXTURE_2D, pyramid.numLevels, GL_R32F, width, height);
+    }
+
+    glBindTexture(GL_TEXTURE_2D, pyramid.depthTexture);
+    glCopyTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, static_cast<GLint>(viewport->x()), static_cast<GLint>(viewport->y()), width, height);
+
+    gl2Extensions->glUseProgram(pcd.depthCopyProgram);
+    textureExtensions->glBindImageTexture(0, pyramid.pyramidTexture, 0, GL_FALSE, 0, GL_WRITE_ONLY_ARB, GL_R32F);
+    gl2Extensions->glDispatchCompute((width+s_pyramidWorkGroupSize-1)/s_pyramidWorkGroupSize, (height+s_pyramidWorkGroupSize-1)/s_pyramidWorkGroupSize, 1);
+    pcd.glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+
+    gl2Extensions->glUseProgram(pcd.downsampleProgram);
+    for(int level=1; level<pyramid.numLevels; ++level)
+    {
+        int levelWidth = osg::maximum(width >> level, 1);
+        int levelHeight = osg::maximum(height >> level, 1);
+
+        textureExtensions->glBindImageTexture(0, pyramid.pyramidTexture, level-1, GL_FALSE, 0, GL_READ_ONLY_ARB, GL_R32F);
+        textureExtensions->glBindImageTexture(1, pyramid.pyramidTexture, level, GL_FALSE, 0, GL_WRITE_ONLY_ARB, GL_R32F);
+        gl2Extensions->glDispatchCompute((levelWidth+s_pyramidWorkGroupSize-1)/s_pyramidWorkGroupSize, (levelHeight+s_pyramidWorkGroupSize-1)/s_pyramidWorkGroupSize, 1);
+        pcd.glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+    }
+
+    pcd.glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+
+    pyramid.view = state.getInitialViewMatrix();
+    pyramid.projection = state.getProjectionMatrix();
+    pyramid.valid = true;
+    pyramid.builtFrame = pyramid.drawFrame;
+
+    restoreTextureUnit(state);
+
+    const Program::PerContextProgram* lastProgram = state.getLastAppliedProgramObject();
+    if (lastProgram) lastProgram->useProgram();
+    else gl2Extensions->glUseProgram(0);
+}
+
+void InstanceCullingDrawable::restoreTextureUnit(State& state) const
+{
+    state.setActiveTextureUnit(0);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    const StateAttribute* texture = state.getLastAppliedTextureAttribute(0, StateAttribute::TEXTURE);
+    if (texture) texture->apply(state);
+}
+
+void InstanceCullingDrawable::drawWithoutGPUCulling(RenderInfo& renderInfo) const
+{
+    State& state = *renderInfo.getState();
+
+    const GL2Extensions* gl2Extensions = GL2Extensions::Get(state.getContextID(), true);
+    if (!gl2Extensions || !gl2Extensions->isGlslSupported()) return;
+
+    computeInstanceSpheres();
+
+    Polytope frustum;
+    frustum.setToUnitFrustum();
+    frustum.transformProvidingInverse(state.getModelViewMatrix()*state.getProjectionMatrix());
+
+    _geometry->drawVertexArraysImplementation(renderInfo);
+
+    for(unsigned int i=0; i<_instanceMatrices.size(); ++i)
+    {
+        const Vec4f& sphere = _instanceSpheres[i];
+        if (!frustum.contains(BoundingSphere(Vec3(sphere.x(), sphere.y(), sphere.z()), sphere.w()))) continue;
+
+        // with the attribute array disabled the matrix is passed as a constant vertex attribute.
+        const float* matrix = _instanceMatrices[i].ptr();
+        for(unsigned int c=0; c<4; ++c)
+        {
+            gl2Extensions->glVertexAttrib4fv(_matrixAttributeLocation+c, matrix+c*4);
+        }
+
+        _geometry->drawPrimitivesImplementation(renderInfo);
+    }
+
+    state.unbindVertexBufferObject();
+    state.unbindElementBufferObject();
+}
+
+void InstanceCullingDrawable::drawImplementation(RenderInfo& renderInfo) const
+{
+    if (!_geometry || _instanceMatrices.empty()) return;
+
+    State& state = *renderInfo.getState();
+
+    PerContextData& pcd = getPerContextData(state);
+    if (!pcd.initialized)
+    {
+        pcd.supported = initialize(state, pcd);
+        pcd.initialized = true;
+    }
+
+    if (!pcd.supported)
+    {
+        drawWithoutGPUCulling(renderInfo);
+        return;
+    }
+
+    uploadInstances(state, pcd);
+
+    unsigned int drawIndex = 0;
+    HiZPyramid* pyramid = _occlusionCulling ? &getHiZPyramid(renderInfo, pcd, drawIndex) : 0;
+
+    // only cull against a pyramid built during the previous or current frame, an older one may hide newly visible objects.
+    bool usePyramid = pyramid && pyramid->valid && pyramid->builtFrame+1>=pyramid->drawFrame;
+
+    cullInstances(renderInfo, pcd, usePyramid ? pyramid : 0);
+
+    drawInstances(renderInfo, pcd);
+
+    // capture the depth buffer for culling next frame's instances once the Camera has drawn as many
+    // InstanceCullingDrawables as it did in the previous frame, so the pyramid is normally built once per frame.
+    if (pyramid && drawIndex+1>=pyramid->previousDrawCount) buildHiZPyramid(state, pcd, *pyramid);
+}
+
+InstanceCullingDrawable::HiZPyramidSetList& InstanceCullingDrawable::getHiZPyramidSets()
+{
+    static HiZPyramidSetList s_hiZPyramidSets;
+    return s_hiZPyramidSets;
+}
+
+InstanceCullingDrawable::HiZPyramid& InstanceCullingDrawable::getHiZPyramid(RenderInfo& renderInfo, PerContextData& pcd, unsigned int& drawIndex)
+{
+    State& state = *renderInfo.getState();
+    Camera* camera = renderInfo.getCurrentCamera();
+    unsigned int frameNumber = state.getFrameStamp() ? state.getFrameStamp()->getFrameNumber() : 0;
+
+    ref_ptr<HiZPyramidSet>& pyramidSet = getHiZPyramidSets()[state.getContextID()];
+
+    // a set created for another State belongs to a graphics context that has been closed and its contextID
+    // reused, its textures died with that context so the set is dropped without any GL calls.
+    if (!pyramidSet || pyramidSet->state.get()!=&state)
+    {
+        pyramidSet = new HiZPyramidSet;
+        pyramidSet->state = &state;
+        pyramidSet->frameNumber = frameNumber;
+    }
+
+    pcd.pyramidSet = pyramidSet;
+
+    if (pyramidSet->frameNumber!=frameNumber)
+    {
+        pyramidSet->frameNumber = frameNumber;
+
+        for(HiZPyramidMap::iterator itr = pyramidSet->pyramids.begin();
+            itr != pyramidSet->pyramids.end();)
+        {
+            if ((itr->first && !itr->second.camera.valid()) || itr->second.drawFrame+1<frameNumber)
+            {
+                deleteHiZPyramidTextures(itr->second);
+                pyramidSet->pyramids.erase(itr++);
+            }
+            else ++itr;
+        }
+    }
+
+    HiZPyramid& pyramid = pyramidSet->pyramids[camera];
+    if (pyramid.camera.get()!=camera)
+    {
+        // a new Camera, or a new one allocated at the address of a deleted Camera.
+        deleteHiZPyramidTextures(pyramid);
+        pyramid = HiZPyramid();
+        pyramid.camera = camera;
+        pyramid.drawFrame = frameNumber;
+    }
+
+    if (pyramid.drawFrame!=frameNumber)
+    {
+        pyramid.previousDrawCount = pyramid.drawCount;
+        pyramid.drawCount = 0;
+        pyramid.drawFrame = frameNumber;
+    }
+
+    drawIndex = pyramid.drawCount++;
+    return pyramid;
+}
+
+void InstanceCullingDrawable::deleteHiZPyramidTextures(HiZPyramid& pyramid)
+{
+    if (pyramid.depthTexture) glDeleteTextures(1, &pyramid.depthTexture);
+    if (pyramid.pyramidTexture) glDeleteTextures(1, &pyramid.pyramidTexture);
+    pyramid.depthTexture = 0;
+    pyramid.pyramidTexture = 0;
+    pyramid.width = 0;
+    pyramid.height = 0;
+    pyramid.valid = false;
+}
+
+void InstanceCullingDrawable::releaseHiZPyramids(State* state, PerContextData& pcd)
+{
+    if (!pcd.pyramidSet) return;
+
+    ref_ptr<HiZPyramidSet>& pyramidSet = getHiZPyramidSets()[state->getContextID()];
+
+    // the set is referenced by the list and by the PerContextData of every drawable that uses it.
+    bool lastReference = pyramidSet==pcd.pyramidSet && pyramidSet->referenceCount()==2;
+    pcd.pyramidSet = 0;
+    if (!lastReference) return;
+
+    for(HiZPyramidMap::iterator itr = pyramidSet->pyramids.begin();
+        itr != pyramidSet->pyramids.end();
+        ++itr)
+    {
+        deleteHiZPyramidTextures(itr->second);
+    }
+    pyramidSet = 0;
+}
+
+void InstanceCullingDrawable::resizeGLObjectBuffers(unsigned int maxSize)
+{
+    Drawable::resizeGLObjectBuffers(maxSize);
+
+    if (_geometry.valid()) _geometry->resizeGLObjectBuffers(maxSize);
+
+    _perContextData.resize(maxSize);
+}
+
+void InstanceCullingDrawable::releaseGLObjects(State* state) const
+{
+    Drawable::releaseGLObjects(state);
+
+    if (_geometry.valid()) _geometry->releaseGLObjects(state);
+
+    if (!state)
+    {
+        // without a current graphics context the GL objects can't be deleted, so just forget them
+        // and let them be released along with their contexts, along with any pyramids no longer used.
+        _perContextData.setAllElementsTo(0);
+
+        HiZPyramidSetList& pyramidSets = getHiZPyramidSets();
+        for(unsigned int i=0; i<pyramidSets.size(); ++i)
+        {
+            if (pyramidSets[i].valid() && pyramidSets[i]->referenceCount()==1) pyramidSets[i] = 0;
+        }
+        return;
+    }
+
+    unsigned int contextID = state->getContextID();
+    ref_ptr<PerContextData>& pcd = _perContextData[contextID];
+    if (!pcd) return;
+
+    if (pcd->supported)
+    {
+        const GL2Extensions* gl2Extensions = GL2Extensions::Get(contextID, true);
+        const GLBufferObject::Extensions* bufferExtensions = GLBufferObject::getExtensions(contextID, true);
+
+        gl2Extensions->glDeleteProgram(pcd->cullProgram);
+        gl2Extensions->glDeleteProgram(pcd->depthCopyProgram);
+        gl2Extensions->glDeleteProgram(pcd->downsampleProgram);
+
+        GLuint buffers[4] = { pcd->sphereBuffer, pcd->matrixBuffer, pcd->visibleBuffer, pcd->commandBuffer };
+        bufferExtensions->glDeleteBuffers(4, buffers);
+    }
+
+    releaseHiZPyramids(state, *pcd);
+
+    pcd = 0;
+}
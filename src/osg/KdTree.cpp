@@ -18,6 +18,24 @@
 
 #include <osg/io_utils>
 
+#include <OpenThreads/Thread>
+
+#include <algorithm>
+#include <float.h>
+
+#include <osg/Config>
+
+// select the SIMD instructions used to intersect packets of line segments from those the compiler is targeting.
+#if defined(OSG_USE_SIMD)
+    #if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP>=2)
+        #include <emmintrin.h>
+        #define OSG_KDTREE_SSE2 1
+    #elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+        #include <arm_neon.h>
+        #define OSG_KDTREE_NEON 1
+    #endif
+#endif
+
 using namespace osg;
 
 //#define VERBOSE_OUTPUT
@@ -29,17 +47,23 @@ using namespace osg;
 struct BuildKdTree
 {
     BuildKdTree(KdTree& kdTree):
-        _kdTree(kdTree) {}
+        _kdTree(kdTree),
+        _computePrimitiveBounds(false) {}
 
     typedef std::vector< osg::Vec3 >            CenterList;
     typedef std::vector< unsigned int >           Indices;
     typedef std::vector< unsigned int >         AxisStack;
+    typedef std::vector< osg::BoundingBoxf >    BoundingBoxList;
 
     bool build(KdTree::BuildOptions& options, osg::Geometry* geometry);
 
     void computeDivisions(KdTree::BuildOptions& options);
 
-    int divide(KdTree::BuildOptions& options, osg::BoundingBox& bb, int nodeIndex, unsigned int level);
+    int divide(const KdTree::BuildOptions& options, KdTree::KdNodeList& nodes, osg::BoundingBox& bb, int nodeIndex, unsigned int level, unsigned int numThreads);
+
+    void computeLeafBound(KdTree::KdNode& node) const;
+
+    bool partitionBySAH(const KdTree::BuildOptions& options, int istart, int iend, int& firstRight);
 
     KdTree&             _kdTree;
 
@@ -47,12 +71,72 @@ struct BuildKdTree
     AxisStack           _axisStack;
     Indices             _primitiveIndices;
     CenterList          _centers;
+    bool                _computePrimitiveBounds;
+    BoundingBoxList     _primitiveBounds;
 
 protected:
 
     BuildKdTree& operator = (const BuildKdTree&) { return *this; }
 };
 
+////////////////////////////////////////////////////////////////////////////////
+//
+// Thread for building a subtree into its own node list, index 0 of the list is left
+// unused so that the subtree root, like all other nodes, has a non zero index.
+
+class BuildKdTreeThread : public OpenThreads::Thread
+{
+public:
+
+    BuildKdTreeThread(BuildKdTree& buildKdTree, const KdTree::BuildOptions& options,
+                      const KdTree::KdNode& root, const osg::BoundingBox& bb,
+                      unsigned int level, unsigned int numThreads):
+        _buildKdTree(buildKdTree),
+        _options(options),
+        _bb(bb),
+        _level(level),
+        _numThreads(numThreads),
+        _rootIndex(1)
+    {
+        _nodes.push_back(KdTree::KdNode());
+        _nodes.push_back(root);
+    }
+
+    virtual void run()
+    {
+        _rootIndex = _buildKdTree.divide(_options, _nodes, _bb, 1, _level, _numThreads);
+    }
+
+    // append the subtree to nodes, returning the index of the subtree root within nodes.
+    int appendTo(KdTree::KdNodeList& nodes) const
+    {
+        int offset = static_cast<int>(nodes.size())-1;
+        for(unsigned int i=1; i<_nodes.size(); ++i)
+        {
+            KdTree::KdNode node = _nodes[i];
+            if (node.first>=0)
+            {
+                if (node.first>0) node.first += offset;
+                if (node.second>0) node.second += offset;
+            }
+            nodes.push_back(node);
+        }
+        return _rootIndex + offset;
+    }
+
+protected:
+
+    BuildKdTreeThread& operator = (const BuildKdTreeThread&) { return *this; }
+
+    BuildKdTree&                    _buildKdTree;
+    const KdTree::BuildOptions&     _options;
+    osg::BoundingBox                _bb;
+    unsigned int                    _level;
+    unsigned int                    _numThreads;
+    KdTree::KdNodeList              _nodes;
+    int                             _rootIndex;
+};
+
 ////////////////////////////////////////////////////////////////////////////////
 //
 // Functor for collecting triangle indices from Geometry
@@ -87,12 +171,54 @@ struct TriangleIndicesCollector
         _buildKdTree->_centers.push_back(bb.center());
         _buildKdTree->_primitiveIndices.push_back(i);
 
+        if (_buildKdTree->_computePrimitiveBounds) _buildKdTree->_primitiveBounds.push_back(bb);
     }
 
     BuildKdTree* _buildKdTree;
 
 };
 
+////////////////////////////////////////////////////////////////////////////////
+//
+// Helpers for binning triangle centers when searching for the surface area heuristic split
+
+static inline unsigned int computeBin(float center, float binMin, float binScale, unsigned int numBins)
+{
+    unsigned int bin = static_cast<unsigned int>((center-binMin)*binScale);
+    return bin<numBins ? bin : numBins-1;
+}
+
+static inline float computeSurfaceArea(const osg::BoundingBoxf& bb)
+{
+    if (!bb.valid()) return 0.0f;
+    float dx = bb.xMax()-bb.xMin();
+    float dy = bb.yMax()-bb.yMin();
+    float dz = bb.zMax()-bb.zMin();
+    return 2.0f*(dx*dy + dy*dz + dz*dx);
+}
+
+struct LeftOfSplitBin
+{
+    LeftOfSplitBin(const BuildKdTree::CenterList& centers, int axis, float binMin, float binScale, unsigned int numBins, unsigned int splitBin):
+        _centers(centers), _axis(axis), _binMin(binMin), _binScale(binScale), _numBins(numBins), _splitBin(splitBin) {}
+
+    bool operator() (unsigned int primitiveIndex) const
+    {
+        return computeBin(_centers[primitiveIndex][_axis], _binMin, _binScale, _numBins) <= _splitBin;
+    }
+
+    const BuildKdTree::CenterList&  _centers;
+    int                             _axis;
+    float                           _binMin;
+    float                           _binScale;
+    unsigned int                    _numBins;
+    unsigned int                    _splitBin;
+
+protected:
+
+    LeftOfSplitBin& operator = (const LeftOfSplitBin&) { return *this; }
+};
+
 
 ////////////////////////////////////////////////////////////////////////////////
 //
@@ -129,6 +255,9 @@ bool BuildKdTree::build(KdTree::BuildOptions& options, osg::Geometry* geometry)
     _primitiveIndices.reserve(estimatedNumTriangles);
     _centers.reserve(estimatedNumTriangles);
 
+    _computePrimitiveBounds = options._splitMethod==KdTree::BuildOptions::SURFACE_AREA_HEURISTIC;
+    if (_computePrimitiveBounds) _primitiveBounds.reserve(estimatedNumTriangles);
+
     _kdTree.getTriangles().reserve(estimatedNumTriangles);
 
     osg::TriangleIndexFunctor<TriangleIndicesCollector> collectTriangleIndices;
@@ -143,7 +272,7 @@ bool BuildKdTree::build(KdTree::BuildOptions& options, osg::Geometry* geometry)
     int nodeNum = _kdTree.addNode(node);
 
     osg::BoundingBox bb = _bb;
-    nodeNum = divide(options, bb, nodeNum, 0);
+    nodeNum = divide(options, _kdTree.getNodes(), bb, nodeNum, 0, options._numThreads);
 
     // now reorder the triangle list so that it's in order as per the primitiveIndex list.
     KdTree::TriangleList triangleList(_kdTree.getTriangles().size());
@@ -203,63 +332,155 @@ void BuildKdTree::computeDivisions(KdTree::BuildOptions& options)
 #endif
 }
 
-int BuildKdTree::divide(KdTree::BuildOptions& options, osg::BoundingBox& bb, int nodeIndex, unsigned int level)
+void BuildKdTree::computeLeafBound(KdTree::KdNode& node) const
 {
-    KdTree::KdNode& node = _kdTree.getNode(nodeIndex);
+    int istart = -node.first-1;
+    int iend = istart+node.second-1;
 
-    bool needToDivide = level < _axisStack.size() &&
-                        (node.first<0 && static_cast<unsigned int>(node.second)>options._targetNumTrianglesPerLeaf);
+    // leaf is done, now compute bound on it.
+    node.bb.init();
+    for(int i=istart; i<=iend; ++i)
+    {
+        const KdTree::Triangle& tri = _kdTree.getTriangle(_primitiveIndices[i]);
+        const osg::Vec3& v0 = (*_kdTree.getVertices())[tri.p0];
+        const osg::Vec3& v1 = (*_kdTree.getVertices())[tri.p1];
+        const osg::Vec3& v2 = (*_kdTree.getVertices())[tri.p2];
+        node.bb.expandBy(v0);
+        node.bb.expandBy(v1);
+        node.bb.expandBy(v2);
 
-    if (!needToDivide)
+    }
+
+    if (node.bb.valid())
     {
-        if (node.first<0)
+        float epsilon = 1e-6f;
+        node.bb._min.x() -= epsilon;
+        node.bb._min.y() -= epsilon;
+        node.bb._min.z() -= epsilon;
+        node.bb._max.x() += epsilon;
+        node.bb._max.y() += epsilon;
+        node.bb._max.z() += epsilon;
+    }
+
+#ifdef VERBOSE_OUTPUT
+    if (!node.bb.valid())
+    {
+        OSG_NOTICE<<"After reset "<<node.first<<","<<node.second<<std::endl;
+        OSG_NOTICE<<"  bb._min ("<<node.bb._min<<")"<<std::endl;
+        OSG_NOTICE<<"  bb._max ("<<node.bb._max<<")"<<std::endl;
+    }
+#endif
+}
+
+bool BuildKdTree::partitionBySAH(const KdTree::BuildOptions& options, int istart, int iend, int& firstRight)
+{
+    osg::BoundingBoxf centerBound;
+    for(int i=istart; i<=iend; ++i)
+    {
+        centerBound.expandBy(_centers[_primitiveIndices[i]]);
+    }
+
+    const unsigned int maxNumBins = 64;
+    unsigned int numBins = osg::clampBetween(options._numSAHBins, 2u, maxNumBins);
+
+    float binScales[3];
+    for(int axis=0; axis<3; ++axis)
+    {
+        float extent = centerBound._max[axis]-centerBound._min[axis];
+        binScales[axis] = extent>0.0f ? static_cast<float>(numBins)/extent : 0.0f;
+    }
+
+    // bin the triangles along all three axes in a single pass over them.
+    unsigned int binCounts[3][maxNumBins];
+    osg::BoundingBoxf binBounds[3][maxNumBins];
+    for(int axis=0; axis<3; ++axis)
+    {
+        for(unsigned int bin=0; bin<numBins; ++bin)
         {
-            int istart = -node.first-1;
-            int iend = istart+node.second-1;
+            binCounts[axis][bin] = 0;
+        }
+    }
 
-            // leaf is done, now compute bound on it.
-            node.bb.init();
-            for(int i=istart; i<=iend; ++i)
-            {
-                const KdTree::Triangle& tri = _kdTree.getTriangle(_primitiveIndices[i]);
-                const osg::Vec3& v0 = (*_kdTree.getVertices())[tri.p0];
-                const osg::Vec3& v1 = (*_kdTree.getVertices())[tri.p1];
-                const osg::Vec3& v2 = (*_kdTree.getVertices())[tri.p2];
-                node.bb.expandBy(v0);
-                node.bb.expandBy(v1);
-                node.bb.expandBy(v2);
+    for(int i=istart; i<=iend; ++i)
+    {
+        unsigned int primitiveIndex = _primitiveIndices[i];
+        const osg::Vec3& center = _centers[primitiveIndex];
+        const osg::BoundingBoxf& bounds = _primitiveBounds[primitiveIndex];
+        for(int axis=0; axis<3; ++axis)
+        {
+            unsigned int bin = computeBin(center[axis], centerBound._min[axis], binScales[axis], numBins);
+            ++binCounts[axis][bin];
+            binBounds[axis][bin].expandBy(bounds);
+        }
+    }
 
-            }
+    float bestCost = FLT_MAX;
+    int bestAxis = -1;
+    unsigned int bestBin = 0;
 
-            if (node.bb.valid())
-            {
-                float epsilon = 1e-6f;
-                node.bb._min.x() -= epsilon;
-                node.bb._min.y() -= epsilon;
-                node.bb._min.z() -= epsilon;
-                node.bb._max.x() += epsilon;
-                node.bb._max.y() += epsilon;
-                node.bb._max.z() += epsilon;
-            }
+    for(int axis=0; axis<3; ++axis)
+    {
+        if (binScales[axis]==0.0f) continue;
 
-#ifdef VERBOSE_OUTPUT
-            if (!node.bb.valid())
-            {
-                OSG_NOTICE<<"After reset "<<node.first<<","<<node.second<<std::endl;
-                OSG_NOTICE<<"  bb._min ("<<node.bb._min<<")"<<std::endl;
-                OSG_NOTICE<<"  bb._max ("<<node.bb._max<<")"<<std::endl;
-            }
-            else
+        // sweep from the right, recording the cost of the triangles to the right of each bin boundary.
+        float rightCosts[maxNumBins];
+        osg::BoundingBoxf rightBound;
+        unsigned int rightCount = 0;
+        for(unsigned int bin=numBins-1; bin>0; --bin)
+        {
+            rightBound.expandBy(binBounds[axis][bin]);
+            rightCount += binCounts[axis][bin];
+            rightCosts[bin] = rightCount>0 ? computeSurfaceArea(rightBound)*static_cast<float>(rightCount) : -1.0f;
+        }
+
+        // then sweep from the left, costing each split as the area weighted triangle counts of the two sides.
+        osg::BoundingBoxf leftBound;
+        unsigned int leftCount = 0;
+        for(unsigned int bin=0; bin<numBins-1; ++bin)
+        {
+            leftBound.expandBy(binBounds[axis][bin]);
+            leftCount += binCounts[axis][bin];
+            if (leftCount==0 || rightCosts[bin+1]<0.0f) continue;
+
+            float cost = computeSurfaceArea(leftBound)*static_cast<float>(leftCount) + rightCosts[bin+1];
+            if (cost<bestCost)
             {
-                OSG_NOTICE<<"Set bb for nodeIndex = "<<nodeIndex<<std::endl;
+                bestCost = cost;
+                bestAxis = axis;
+                bestBin = bin;
             }
-#endif
+        }
+    }
+
+    if (bestAxis<0) return false;
+
+    Indices::iterator middle = std::partition(_primitiveIndices.begin()+istart, _primitiveIndices.begin()+iend+1,
+                                              LeftOfSplitBin(_centers, bestAxis, centerBound._min[bestAxis], binScales[bestAxis], numBins, bestBin));
+
+    firstRight = static_cast<int>(middle-_primitiveIndices.begin());
+    return firstRight>istart && firstRight<=iend;
+}
+
+int BuildKdTree::divide(const KdTree::BuildOptions& options, KdTree::KdNodeList& nodes, osg::BoundingBox& bb, int nodeIndex, unsigned int level, unsigned int numThreads)
+{
+    KdTree::KdNode& node = nodes[nodeIndex];
+
+    bool needToDivide = level < _axisStack.size() &&
+                        (node.first<0 && static_cast<unsigned int>(node.second)>options._targetNumTrianglesPerLeaf);
+
+    if (!needToDivide)
+    {
+        if (node.first<0)
+        {
+            computeLeafBound(node);
         }
 
         return nodeIndex;
 
     }
 
+    bool splitAtMidpoint = options._splitMethod==KdTree::BuildOptions::SPLIT_AT_MIDPOINT;
+
     int axis = _axisStack[level];
 
 #ifdef VERBOSE_OUTPUT
@@ -284,34 +505,51 @@ int BuildKdTree::divide(KdTree::BuildOptions& options, osg::BoundingBox& bb, int
         int originalRightChildIndex = 0;
         bool insitueDivision = false;
 
+        // large nodes have their left subtree built in a separate thread, into its own node list.
+        bool buildLeftInThread = numThreads>1 && static_cast<unsigned int>(node.second)>=options._minNumTrianglesForThreading;
+        KdTree::KdNode leftLeaf;
+
         {
             //osg::Vec3Array* vertices = kdTree._vertices.get();
             int left = istart;
             int right = iend;
 
-            while(left<right)
+            if (splitAtMidpoint)
             {
-                while(left<right && (_centers[_primitiveIndices[left]][axis]<=mid)) { ++left; }
+                while(left<right)
+                {
+                    while(left<right && (_centers[_primitiveIndices[left]][axis]<=mid)) { ++left; }
+
+                    while(left<right && (_centers[_primitiveIndices[right]][axis]>mid)) { --right; }
 
-                while(left<right && (_centers[_primitiveIndices[right]][axis]>mid)) { --right; }
+                    while(left<right && (_centers[_primitiveIndices[right]][axis]>mid)) { --right; }
 
-                while(left<right && (_centers[_primitiveIndices[right]][axis]>mid)) { --right; }
+                    if (left<right)
+                    {
+                        std::swap(_primitiveIndices[left], _primitiveIndices[right]);
+                        ++left;
+                        --right;
+                    }
+                }
 
-                if (left<right)
+                if (left==right)
                 {
-                    std::swap(_primitiveIndices[left], _primitiveIndices[right]);
-                    ++left;
-                    --right;
+                    if (_centers[_primitiveIndices[left]][axis]<=mid) ++left;
+                    else --right;
                 }
             }
-
-            if (left==right)
+            else
             {
-                if (_centers[_primitiveIndices[left]][axis]<=mid) ++left;
-                else --right;
+                if (!partitionBySAH(options, istart, iend, left))
+                {
+                    // no split separates the triangles, such as when all their centers coincide, so keep the leaf.
+                    computeLeafBound(node);
+                    return nodeIndex;
+                }
+                right = left-1;
             }
 
-            KdTree::KdNode leftLeaf(-istart-1, (right-istart)+1);
+            leftLeaf = KdTree::KdNode(-istart-1, (right-istart)+1);
             KdTree::KdNode rightLeaf(-left-1, (iend-left)+1);
 
 #if 0
@@ -352,34 +590,63 @@ int BuildKdTree::divide(KdTree::BuildOptions& options, osg::BoundingBox& bb, int
             }
             else
             {
-                originalLeftChildIndex = _kdTree.addNode(leftLeaf);
-                originalRightChildIndex = _kdTree.addNode(rightLeaf);
+                if (!buildLeftInThread)
+                {
+                    originalLeftChildIndex = static_cast<int>(nodes.size());
+                    nodes.push_back(leftLeaf);
+                }
+                originalRightChildIndex = static_cast<int>(nodes.size());
+                nodes.push_back(rightLeaf);
             }
         }
 
+        int leftChildIndex = 0;
+        int rightChildIndex = 0;
+
+        if (!insitueDivision && buildLeftInThread)
+        {
+            // build the left subtree in a separate thread while this thread builds the right,
+            // the two partitions of _primitiveIndices they work on are disjoint.
+            osg::BoundingBox leftBB = bb;
+            if (splitAtMidpoint) leftBB._max[axis] = mid;
+
+            BuildKdTreeThread leftThread(*this, options, leftLeaf, leftBB, level+1, numThreads/2);
+            leftThread.start();
 
-        float restore = bb._max[axis];
-        bb._max[axis] = mid;
+            osg::BoundingBox rightBB = bb;
+            if (splitAtMidpoint) rightBB._min[axis] = mid;
+
+            rightChildIndex = divide(options, nodes, rightBB, originalRightChildIndex, level+1, numThreads-numThreads/2);
+
+            leftThread.join();
+
+            leftChildIndex = leftThread.appendTo(nodes);
+        }
+        else
+        {
+            float restore = bb._max[axis];
+            if (splitAtMidpoint) bb._max[axis] = mid;
 
-        //OSG_NOTICE<<"  divide leftLeaf "<<kdTree.getNode(nodeNum).first<<std::endl;
-        int leftChildIndex = originalLeftChildIndex!=0 ? divide(options, bb, originalLeftChildIndex, level+1) : 0;
+            //OSG_NOTICE<<"  divide leftLeaf "<<kdTree.getNode(nodeNum).first<<std::endl;
+            leftChildIndex = originalLeftChildIndex!=0 ? divide(options, nodes, bb, originalLeftChildIndex, level+1, numThreads) : 0;
 
-        bb._max[axis] = restore;
+            bb._max[axis] = restore;
 
-        restore = bb._min[axis];
-        bb._min[axis] = mid;
+            restore = bb._min[axis];
+            if (splitAtMidpoint) bb._min[axis] = mid;
 
-        //OSG_NOTICE<<"  divide rightLeaf "<<kdTree.getNode(nodeNum).second<<std::endl;
-        int rightChildIndex = originalRightChildIndex!=0 ? divide(options, bb, originalRightChildIndex, level+1) : 0;
+            //OSG_NOTICE<<"  divide rightLeaf "<<kdTree.getNode(nodeNum).second<<std::endl;
+            rightChildIndex = originalRightChildIndex!=0 ? divide(options, nodes, bb, originalRightChildIndex, level+1, numThreads) : 0;
 
-        bb._min[axis] = restore;
+            bb._min[axis] = restore;
+        }
 
 
         if (!insitueDivision)
         {
             // take a second reference to node we are working on as the std::vector<> resize could
             // have invalidate the previous node ref.
-            KdTree::KdNode& newNodeRef = _kdTree.getNode(nodeIndex);
+            KdTree::KdNode& newNodeRef = nodes[nodeIndex];
 
             newNodeRef.first = leftChildIndex;
             newNodeRef.second = rightChildIndex;
@@ -387,8 +654,8 @@ int BuildKdTree::divide(KdTree::BuildOptions& options, osg::BoundingBox& bb, int
             insitueDivision = true;
 
             newNodeRef.bb.init();
-            if (leftChildIndex!=0) newNodeRef.bb.expandBy(_kdTree.getNode(leftChildIndex).bb);
-            if (rightChildIndex!=0) newNodeRef.bb.expandBy(_kdTree.getNode(rightChildIndex).bb);
+            if (leftChildIndex!=0) newNodeRef.bb.expandBy(nodes[leftChildIndex].bb);
+            if (rightChildIndex!=0) newNodeRef.bb.expandBy(nodes[rightChildIndex].bb);
 
             if (!newNodeRef.bb.valid())
             {
@@ -401,13 +668,13 @@ int BuildKdTree::divide(KdTree::BuildOptions& options, osg::BoundingBox& bb, int
 
                 if (leftChildIndex!=0)
                 {
-                    OSG_NOTICE<<"  getNode(leftChildIndex).bb min = "<<_kdTree.getNode(leftChildIndex).bb._min<<std::endl;
-                    OSG_NOTICE<<"                                 max = "<<_kdTree.getNode(leftChildIndex).bb._max<<std::endl;
+                    OSG_NOTICE<<"  getNode(leftChildIndex).bb min = "<<nodes[leftChildIndex].bb._min<<std::endl;
+                    OSG_NOTICE<<"                                 max = "<<nodes[leftChildIndex].bb._max<<std::endl;
                 }
                 if (rightChildIndex!=0)
                 {
-                    OSG_NOTICE<<"  getNode(rightChildIndex).bb min = "<<_kdTree.getNode(rightChildIndex).bb._min<<std::endl;
-                    OSG_NOTICE<<"                              max = "<<_kdTree.getNode(rightChildIndex).bb._max<<std::endl;
+                    OSG_NOTICE<<"  getNode(rightChildIndex).bb min = "<<nodes[rightChildIndex].bb._min<<std::endl;
+                    OSG_NOTICE<<"                              max = "<<nodes[rightChildIndex].bb._max<<std::endl;
                 }
             }
         }
@@ -450,7 +717,7 @@ struct IntersectKdTree
     }
 
     void intersect(const KdTree::KdNode& node, const osg::Vec3& s, const osg::Vec3& e) const;
-    bool intersectAndClip(osg::Vec3& s, osg::Vec3& e, const osg::BoundingBox& bb) const;
+    bool intersectAndClip(osg::Vec3& s, osg::Vec3& e, const osg::BoundingBoxf& bb) const;
 
     const osg::Vec3Array&               _vertices;
     const KdTree::KdNodeList&           _kdNodes;
@@ -603,7 +870,7 @@ void IntersectKdTree::intersect(const KdTree::KdNode& node, const osg::Vec3& ls,
     }
 }
 
-bool IntersectKdTree::intersectAndClip(osg::Vec3& s, osg::Vec3& e, const osg::BoundingBox& bb) const
+bool IntersectKdTree::intersectAndClip(osg::Vec3& s, osg::Vec3& e, const osg::BoundingBoxf& bb) const
 {
     //return true;
 
@@ -730,6 +997,336 @@ bool IntersectKdTree::intersectAndClip(osg::Vec3& s, osg::Vec3& e, const osg::Bo
     return true;
 }
 
+////////////////////////////////////////////////////////////////////////////////
+//
+// IntersectKdTreePacket - nearest intersections of packets of four line segments
+
+// Four lane float vector used to carry a packet of line segments through the KdTree, comparisons
+// return lane masks that are combined with &, | and consumed by select() and bits().
+struct Float4Mask;
+
+struct Float4
+{
+#if defined(OSG_KDTREE_SSE2)
+    Float4() {}
+    Float4(__m128 f): v(f) {}
+    explicit Float4(float f): v(_mm_set1_ps(f)) {}
+
+    inline Float4 operator + (const Float4& rhs) const { return _mm_add_ps(v, rhs.v); }
+    inline Float4 operator - (const Float4& rhs) const { return _mm_sub_ps(v, rhs.v); }
+    inline Float4 operator * (const Float4& rhs) const { return _mm_mul_ps(v, rhs.v); }
+    inline Float4 operator / (const Float4& rhs) const { return _mm_div_ps(v, rhs.v); }
+
+    inline void store(float* f) const { _mm_storeu_ps(f, v); }
+
+    __m128 v;
+#elif defined(OSG_KDTREE_NEON)
+    Float4() {}
+    Float4(float32x4_t f): v(f) {}
+    explicit Float4(float f): v(vdupq_n_f32(f)) {}
+
+    inline Float4 operator + (const Float4& rhs) const { return vaddq_f32(v, rhs.v); }
+    inline Float4 operator - (const Float4& rhs) const { return vsubq_f32(v, rhs.v); }
+    inline Float4 operator * (const Float4& rhs) const { return vmulq_f32(v, rhs.v); }
+    inline Float4 operator / (const Float4& rhs) const
+    {
+        float a[4], b[4];
+        vst1q_f32(a, v); vst1q_f32(b, rhs.v);
+        for(int i=0; i<4; ++i) a[i] /= b[i];
+        return vld1q_f32(a);
+    }
+
+    inline void store(float* f) const { vst1q_f32(f, v); }
+
+    float32x4_t v;
+#else
+    Float4() {}
+    Float4(float a, float b, float c, float d) { v[0] = a; v[1] = b; v[2] = c; v[3] = d; }
+    explicit Float4(float f) { v[0] = v[1] = v[2] = v[3] = f; }
+
+    inline Float4 operator + (const Float4& rhs) const { return Float4(v[0]+rhs.v[0], v[1]+rhs.v[1], v[2]+rhs.v[2], v[3]+rhs.v[3]); }
+    inline Float4 operator - (const Float4& rhs) const { return Float4(v[0]-rhs.v[0], v[1]-rhs.v[1], v[2]-rhs.v[2], v[3]-rhs.v[3]); }
+    inline Float4 operator * (const Float4& rhs) const { return Float4(v[0]*rhs.v[0], v[1]*rhs.v[1], v[2]*rhs.v[2], v[3]*rhs.v[3]); }
+    inline Float4 operator / (const Float4& rhs) const { return Float4(v[0]/rhs.v[0], v[1]/rhs.v[1], v[2]/rhs.v[2], v[3]/rhs.v[3]); }
+
+    inline void store(float* f) const { f[0] = v[0]; f[1] = v[1]; f[2] = v[2]; f[3] = v[3]; }
+
+    float v[4];
+#endif
+
+    static inline Float4 load(const float* f)
+    {
+#if defined(OSG_KDTREE_SSE2)
+        return _mm_loadu_ps(f);
+#elif defined(OSG_KDTREE_NEON)
+        return vld1q_f32(f);
+#else
+        return Float4(f[0], f[1], f[2], f[3]);
+#endif
+    }
+
+    inline Float4Mask operator < (const Float4& rhs) const;
+    inline Float4Mask operator <= (const Float4& rhs) const;
+};
+
+struct Float4Mask
+{
+#if defined(OSG_KDTREE_SSE2)
+    Float4Mask(__m128 m): v(m) {}
+
+    inline Float4Mask operator & (const Float4Mask& rhs) const { return _mm_and_ps(v, rhs.v); }
+    inline Float4Mask operator | (const Float4Mask& rhs) const { return _mm_or_ps(v, rhs.v); }
+
+    /** return the lanes set in the mask as the bits 0 to 3 of an int.*/
+    inline int bits() const { return _mm_movemask_ps(v); }
+
+    __m128 v;
+#elif defined(OSG_KDTREE_NEON)
+    Float4Mask(uint32x4_t m): v(m) {}
+
+    inline Float4Mask operator & (const Float4Mask& rhs) const { return vandq_u32(v, rhs.v); }
+    inline Float4Mask operator | (const Float4Mask& rhs) const { return vorrq_u32(v, rhs.v); }
+
+    inline int bits() const
+    {
+        uint32_t m[4];
+        vst1q_u32(m, v);
+        return (m[0]&1) | (m[1]&2) | (m[2]&4) | (m[3]&8);
+    }
+
+    uint32x4_t v;
+#else
+    Float4Mask(int m): v(m) {}
+
+    inline Float4Mask operator & (const Float4Mask& rhs) const { return v & rhs.v; }
+    inline Float4Mask operator | (const Float4Mask& rhs) const { return v | rhs.v; }
+
+    inline int bits() const { return v; }
+
+    int v;
+#endif
+};
+
+#if defined(OSG_KDTREE_SSE2)
+inline Float4Mask Float4::operator < (const Float4& rhs) const { return _mm_cmplt_ps(v, rhs.v); }
+inline Float4Mask Float4::operator <= (const Float4& rhs) const { return _mm_cmple_ps(v, rhs.v); }
+inline Float4 minimum(const Float4& lhs, const Float4& rhs) { return _mm_min_ps(lhs.v, rhs.v); }
+inline Float4 maximum(const Float4& lhs, const Float4& rhs) { return _mm_max_ps(lhs.v, rhs.v); }
+inline Float4 select(const Float4Mask& mask, const Float4& lhs, const Float4& rhs) { return _mm_or_ps(_mm_and_ps(mask.v, lhs.v), _mm_andnot_ps(mask.v, rhs.v)); }
+#elif defined(OSG_KDTREE_NEON)
+inline Float4Mask Float4::operator < (const Float4& rhs) const { return vcltq_f32(v, rhs.v); }
+inline Float4Mask Float4::operator <= (const Float4& rhs) const { return vcleq_f32(v, rhs.v); }
+inline Float4 minimum(const Float4& lhs, const Float4& rhs) { return vminq_f32(lhs.v, rhs.v); }
+inline Float4 maximum(const Float4& lhs, const Float4& rhs) { return vmaxq_f32(lhs.v, rhs.v); }
+inline Float4 select(const Float4Mask& mask, const Float4& lhs, const Float4& rhs) { return vbslq_f32(mask.v, lhs.v, rhs.v); }
+#else
+inline Float4Mask Float4::operator < (const Float4& rhs) const
+{
+    return (v[0]<rhs.v[0] ? 1 : 0) | (v[1]<rhs.v[1] ? 2 : 0) | (v[2]<rhs.v[2] ? 4 : 0) | (v[3]<rhs.v[3] ? 8 : 0);
+}
+inline Float4Mask Float4::operator <= (const Float4& rhs) const
+{
+    return (v[0]<=rhs.v[0] ? 1 : 0) | (v[1]<=rhs.v[1] ? 2 : 0) | (v[2]<=rhs.v[2] ? 4 : 0) | (v[3]<=rhs.v[3] ? 8 : 0);
+}
+inline Float4 minimum(const Float4& lhs, const Float4& rhs)
+{
+    return Float4(osg::minimum(lhs.v[0], rhs.v[0]), osg::minimum(lhs.v[1], rhs.v[1]), osg::minimum(lhs.v[2], rhs.v[2]), osg::minimum(lhs.v[3], rhs.v[3]));
+}
+inline Float4 maximum(const Float4& lhs, const Float4& rhs)
+{
+    return Float4(osg::maximum(lhs.v[0], rhs.v[0]), osg::maximum(lhs.v[1], rhs.v[1]), osg::maximum(lhs.v[2], rhs.v[2]), osg::maximum(lhs.v[3], rhs.v[3]));
+}
+inline Float4 select(const Float4Mask& mask, const Float4& lhs, const Float4& rhs)
+{
+    return Float4((mask.v&1) ? lhs.v[0] : rhs.v[0], (mask.v&2) ? lhs.v[1] : rhs.v[1], (mask.v&4) ? lhs.v[2] : rhs.v[2], (mask.v&8) ? lhs.v[3] : rhs.v[3]);
+}
+#endif
+
+struct IntersectKdTreePacket
+{
+    IntersectKdTreePacket(const osg::Vec3Array& vertices,
+                          const KdTree::KdNodeList& nodes,
+                          const KdTree::TriangleList& triangles):
+                            _vertices(vertices),
+                            _kdNodes(nodes),
+                            _triangles(triangles)
+    {
+        _stack.reserve(64);
+    }
+
+    /** set up the packet from up to four line segments, padding lanes beyond numLineSegments are disabled.*/
+    void set(const osg::Vec3* starts, const osg::Vec3* ends, const float* ratios, unsigned int numLineSegments);
+
+    /** intersect the packet with the KdTree, returning the lanes where a nearer intersection has been found.*/
+    int intersect();
+
+    inline Float4Mask intersect(const osg::BoundingBoxf& bb) const;
+    inline Float4Mask intersect(const KdTree::Triangle& tri, unsigned int triangleIndex);
+
+    const osg::Vec3Array&               _vertices;
+    const KdTree::KdNodeList&           _kdNodes;
+    const KdTree::TriangleList&         _triangles;
+
+    std::vector<int>                    _stack;
+
+    Float4          _s[3];
+    Float4          _d[3];
+    Float4          _d_inv[3];
+    Float4          _s_d_inv[3];
+    Float4          _ratio;
+    unsigned int    _primitiveIndices[4];
+
+    osg::Vec3       _s0;
+    osg::Vec3       _d0;
+
+protected:
+
+    IntersectKdTreePacket& operator = (const IntersectKdTreePacket&) { return *this; }
+};
+
+void IntersectKdTreePacket::set(const osg::Vec3* starts, const osg::Vec3* ends, const float* ratios, unsigned int numLineSegments)
+{
+    float s[3][4], d[3][4], d_inv[3][4], r[4];
+    for(unsigned int lane=0; lane<4; ++lane)
+    {
+        // padding lanes repeat the last line segment with a negative ratio so they never intersect anything.
+        unsigned int i = lane<numLineSegments ? lane : numLineSegments-1;
+        osg::Vec3 dv = ends[i]-starts[i];
+        for(int axis=0; axis<3; ++axis)
+        {
+            s[axis][lane] = starts[i][axis];
+            d[axis][lane] = dv[axis];
+
+            // avoid the 0*inf NaN's of a zero direction by nudging it to a tiny value.
+            float da = dv[axis]!=0.0f ? dv[axis] : 1e-30f;
+            d_inv[axis][lane] = 1.0f/da;
+        }
+        r[lane] = lane<numLineSegments ? ratios[i] : -1.0f;
+        _primitiveIndices[lane] = 0;
+    }
+
+    for(int axis=0; axis<3; ++axis)
+    {
+        _s[axis] = Float4::load(s[axis]);
+        _d[axis] = Float4::load(d[axis]);
+        _d_inv[axis] = Float4::load(d_inv[axis]);
+        _s_d_inv[axis] = _s[axis] * _d_inv[axis];
+    }
+    _ratio = Float4::load(r);
+
+    _s0 = starts[0];
+    _d0 = ends[0]-starts[0];
+}
+
+inline Float4Mask IntersectKdTreePacket::intersect(const osg::BoundingBoxf& bb) const
+{
+    Float4 tNear(0.0f);
+    Float4 tFar(_ratio);
+    for(int axis=0; axis<3; ++axis)
+    {
+        Float4 t0 = Float4(bb._min[axis]) * _d_inv[axis] - _s_d_inv[axis];
+        Float4 t1 = Float4(bb._max[axis]) * _d_inv[axis] - _s_d_inv[axis];
+        tNear = maximum(tNear, minimum(t0, t1));
+        tFar = minimum(tFar, maximum(t0, t1));
+    }
+    return tNear <= tFar;
+}
+
+inline Float4Mask IntersectKdTreePacket::intersect(const KdTree::Triangle& tri, unsigned int triangleIndex)
+{
+    const osg::Vec3& v0 = _vertices[tri.p0];
+    osg::Vec3 E1 = _vertices[tri.p1] - v0;
+    osg::Vec3 E2 = _vertices[tri.p2] - v0;
+
+    Float4 e1x(E1.x()), e1y(E1.y()), e1z(E1.z());
+    Float4 e2x(E2.x()), e2y(E2.y()), e2z(E2.z());
+
+    // Moller-Trumbore test against the unnormalized segment directions so t is directly the ratio along each segment.
+    Float4 Px = _d[1]*e2z - _d[2]*e2y;
+    Float4 Py = _d[2]*e2x - _d[0]*e2z;
+    Float4 Pz = _d[0]*e2y - _d[1]*e2x;
+
+    Float4 det = Px*e1x + Py*e1y + Pz*e1z;
+
+    Float4 Tx = _s[0] - Float4(v0.x());
+    Float4 Ty = _s[1] - Float4(v0.y());
+    Float4 Tz = _s[2] - Float4(v0.z());
+
+    Float4 Qx = Ty*e1z - Tz*e1y;
+    Float4 Qy = Tz*e1x - Tx*e1z;
+    Float4 Qz = Tx*e1y - Ty*e1x;
+
+    Float4 inv_det = Float4(1.0f) / det;
+    Float4 u = (Px*Tx + Py*Ty + Pz*Tz) * inv_det;
+    Float4 v = (Qx*_d[0] + Qy*_d[1] + Qz*_d[2]) * inv_det;
+    Float4 t = (Qx*e2x + Qy*e2y + Qz*e2z) * inv_det;
+
+    const Float4 zero(0.0f);
+    const Float4 epsilon(1e-20f);
+    Float4Mask hit = ((epsilon < det) | (det < zero - epsilon)) &
+                     (zero <= u) & (zero <= v) & ((u+v) <= Float4(1.0f)) &
+                     (zero <= t) & (t < _ratio);
+
+    int bits = hit.bits();
+    if (bits)
+    {
+        _ratio = select(hit, t, _ratio);
+        for(int lane=0; lane<4; ++lane)
+        {
+            if (bits & (1<<lane)) _primitiveIndices[lane] = triangleIndex;
+        }
+    }
+    return hit;
+}
+
+int IntersectKdTreePacket::intersect()
+{
+    int hits = 0;
+
+    _stack.clear();
+    _stack.push_back(0);
+    while(!_stack.empty())
+    {
+        const KdTree::KdNode& node = _kdNodes[_stack.back()];
+        _stack.pop_back();
+
+        // the ratios shrink as intersections are found, so nodes beyond the nearest intersection of every lane are skipped.
+        if (intersect(node.bb).bits()==0) continue;
+
+        if (node.first<0)
+        {
+            int istart = -node.first-1;
+            int iend = istart + node.second;
+            for(int i=istart; i<iend; ++i)
+            {
+                hits |= intersect(_triangles[i], i).bits();
+            }
+        }
+        else
+        {
+            // visit the child nearest the first segment first, so the ratios shrink as early as possible.
+            if (node.first>0 && node.second>0)
+            {
+                float firstDistance = (_kdNodes[node.first].bb.center()-_s0)*_d0;
+                float secondDistance = (_kdNodes[node.second].bb.center()-_s0)*_d0;
+                if (firstDistance<secondDistance)
+                {
+                    _stack.push_back(node.second);
+                    _stack.push_back(node.first);
+                }
+                else
+                {
+                    _stack.push_back(node.first);
+                    _stack.push_back(node.second);
+                }
+            }
+            else if (node.first>0) _stack.push_back(node.first);
+            else if (node.second>0) _stack.push_back(node.second);
+        }
+    }
+    return hits;
+}
+
 
 ////////////////////////////////////////////////////////////////////////////////
 //
@@ -738,7 +1335,11 @@ bool IntersectKdTree::intersectAndClip(osg::Vec3& s, osg::Vec3& e, const osg::Bo
 KdTree::BuildOptions::BuildOptions():
         _numVerticesProcessed(0),
         _targetNumTrianglesPerLeaf(4),
-        _maxNumLevels(32)
+        _maxNumLevels(32),
+        _splitMethod(SPLIT_AT_MIDPOINT),
+        _numSAHBins(16),
+        _numThreads(1),
+        _minNumTrianglesForThreading(65536)
 {
 }
 
@@ -813,3 +1414,41 @@ void KdTreeBuilder::apply(osg::Geometry& geometry)
         geometry.setShape(kdTree.get());
     }
 }
+
+bool KdTree::intersect(unsigned int numLineSegments, const osg::Vec3* starts, const osg::Vec3* ends,
+                       float* ratios, unsigned int* primitiveIndices, IndexList& intersectedLineSegments) const
+{
+    if (_kdNodes.empty())
+    {
+        OSG_NOTICE<<"Warning: _kdTree is empty"<<std::endl;
+        return false;
+    }
+
+    unsigned int numIntersectedBefore = intersectedLineSegments.size();
+
+    IntersectKdTreePacket packet(*_vertices, _kdNodes, _triangles);
+
+    for(unsigned int first=0; first<numLineSegments; first+=4)
+    {
+        unsigned int numInPacket = osg::minimum(numLineSegments-first, 4u);
+
+        packet.set(starts+first, ends+first, ratios+first, numInPacket);
+
+        int hits = packet.intersect();
+        if (hits==0) continue;
+
+        float packetRatios[4];
+        packet._ratio.store(packetRatios);
+        for(unsigned int lane=0; lane<numInPacket; ++lane)
+        {
+            if (hits & (1<<lane))
+            {
+                ratios[first+lane] = packetRatios[lane];
+                primitiveIndices[first+lane] = packet._primitiveIndices[lane];
+                intersectedLineSegments.push_back(first+lane);
+            }
+        }
+    }
+
+    return numIntersectedBefore != intersectedLineSegments.size();
+}
@@ -22,8 +22,147 @@
 #include <stdlib.h>
 #include <float.h>
 
+#include <osg/Config>
+
+// select the SIMD instructions used by the matrix multiplication kernels from those the compiler is targeting.
+#if defined(OSG_USE_SIMD)
+    #if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP>=2)
+        #include <emmintrin.h>
+        #define OSG_MATRIX_SSE2 1
+        #if defined(__AVX__)
+            #include <immintrin.h>
+            #define OSG_MATRIX_AVX 1
+        #endif
+    #elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+        #include <arm_neon.h>
+        #define OSG_MATRIX_NEON 1
+    #endif
+#endif
+
 using namespace osg;
 
+#if defined(OSG_MATRIX_SSE2) || defined(OSG_MATRIX_NEON)
+
+#define OSG_MATRIX_SIMD 1
+
+// Compute result = lhs * rhs for row major 4x4 matrices, forming each row of the result as
+// ((l0*r0 + l1*r1) + l2*r2) + l3*r3 so that, without FMA contraction, the results are bit identical
+// to the scalar INNER_PRODUCT. The whole of rhs and each row of lhs are read before the
+// corresponding row of result is written so result may alias either lhs or rhs.
+static inline void multMatrix(const float* lhs, const float* rhs, float* result)
+{
+#if defined(OSG_MATRIX_SSE2)
+    __m128 r0 = _mm_loadu_ps(rhs);
+    __m128 r1 = _mm_loadu_ps(rhs+4);
+    __m128 r2 = _mm_loadu_ps(rhs+8);
+    __m128 r3 = _mm_loadu_ps(rhs+12);
+    for(int row=0; row<4; ++row)
+    {
+        const float* l = lhs+row*4;
+        __m128 t = _mm_mul_ps(_mm_set1_ps(l[0]), r0);
+        t = _mm_add_ps(t, _mm_mul_ps(_mm_set1_ps(l[1]), r1));
+        t = _mm_add_ps(t, _mm_mul_ps(_mm_set1_ps(l[2]), r2));
+        t = _mm_add_ps(t, _mm_mul_ps(_mm_set1_ps(l[3]), r3));
+        _mm_storeu_ps(result+row*4, t);
+    }
+#else
+    float32x4_t r0 = vld1q_f32(rhs);
+    float32x4_t r1 = vld1q_f32(rhs+4);
+    float32x4_t r2 = vld1q_f32(rhs+8);
+    float32x4_t r3 = vld1q_f32(rhs+12);
+    for(int row=0; row<4; ++row)
+    {
+        const float* l = lhs+row*4;
+        // separate multiply and add rather than vmlaq, which may be fused on AArch64.
+        float32x4_t t = vmulq_f32(vdupq_n_f32(l[0]), r0);
+        t = vaddq_f32(t, vmulq_f32(vdupq_n_f32(l[1]), r1));
+        t = vaddq_f32(t, vmulq_f32(vdupq_n_f32(l[2]), r2));
+        t = vaddq_f32(t, vmulq_f32(vdupq_n_f32(l[3]), r3));
+        vst1q_f32(result+row*4, t);
+    }
+#endif
+}
+
+static inline void multMatrix(const double* lhs, const double* rhs, double* result)
+{
+#if defined(OSG_MATRIX_AVX)
+    __m256d r0 = _mm256_loadu_pd(rhs);
+    __m256d r1 = _mm256_loadu_pd(rhs+4);
+    __m256d r2 = _mm256_loadu_pd(rhs+8);
+    __m256d r3 = _mm256_loadu_pd(rhs+12);
+    for(int row=0; row<4; ++row)
+    {
+        const double* l = lhs+row*4;
+        __m256d t = _mm256_mul_pd(_mm256_set1_pd(l[0]), r0);
+        t = _mm256_add_pd(t, _mm256_mul_pd(_mm256_set1_pd(l[1]), r1));
+        t = _mm256_add_pd(t, _mm256_mul_pd(_mm256_set1_pd(l[2]), r2));
+        t = _mm256_add_pd(t, _mm256_mul_pd(_mm256_set1_pd(l[3]), r3));
+        _mm256_storeu_pd(result+row*4, t);
+    }
+#elif defined(OSG_MATRIX_SSE2)
+    __m128d r0a = _mm_loadu_pd(rhs),    r0b = _mm_loadu_pd(rhs+2);
+    __m128d r1a = _mm_loadu_pd(rhs+4),  r1b = _mm_loadu_pd(rhs+6);
+    __m128d r2a = _mm_loadu_pd(rhs+8),  r2b = _mm_loadu_pd(rhs+10);
+    __m128d r3a = _mm_loadu_pd(rhs+12), r3b = _mm_loadu_pd(rhs+14);
+    for(int row=0; row<4; ++row)
+    {
+        const double* l = lhs+row*4;
+        __m128d l0 = _mm_set1_pd(l[0]);
+        __m128d l1 = _mm_set1_pd(l[1]);
+        __m128d l2 = _mm_set1_pd(l[2]);
+        __m128d l3 = _mm_set1_pd(l[3]);
+        __m128d ta = _mm_mul_pd(l0, r0a);
+        __m128d tb = _mm_mul_pd(l0, r0b);
+        ta = _mm_add_pd(ta, _mm_mul_pd(l1, r1a));
+        tb = _mm_add_pd(tb, _mm_mul_pd(l1, r1b));
+        ta = _mm_add_pd(ta, _mm_mul_pd(l2, r2a));
+        tb = _mm_add_pd(tb, _mm_mul_pd(l2, r2b));
+        ta = _mm_add_pd(ta, _mm_mul_pd(l3, r3a));
+        tb = _mm_add_pd(tb, _mm_mul_pd(l3, r3b));
+        _mm_storeu_pd(result+row*4, ta);
+        _mm_storeu_pd(result+row*4+2, tb);
+    }
+#elif defined(__aarch64__)
+    float64x2_t r0a = vld1q_f64(rhs),    r0b = vld1q_f64(rhs+2);
+    float64x2_t r1a = vld1q_f64(rhs+4),  r1b = vld1q_f64(rhs+6);
+    float64x2_t r2a = vld1q_f64(rhs+8),  r2b = vld1q_f64(rhs+10);
+    float64x2_t r3a = vld1q_f64(rhs+12), r3b = vld1q_f64(rhs+14);
+    for(int row=0; row<4; ++row)
+    {
+        const double* l = lhs+row*4;
+        float64x2_t l0 = vdupq_n_f64(l[0]);
+        float64x2_t l1 = vdupq_n_f64(l[1]);
+        float64x2_t l2 = vdupq_n_f64(l[2]);
+        float64x2_t l3 = vdupq_n_f64(l[3]);
+        float64x2_t ta = vmulq_f64(l0, r0a);
+        float64x2_t tb = vmulq_f64(l0, r0b);
+        ta = vaddq_f64(ta, vmulq_f64(l1, r1a));
+        tb = vaddq_f64(tb, vmulq_f64(l1, r1b));
+        ta = vaddq_f64(ta, vmulq_f64(l2, r2a));
+        tb = vaddq_f64(tb, vmulq_f64(l2, r2b));
+        ta = vaddq_f64(ta, vmulq_f64(l3, r3a));
+        tb = vaddq_f64(tb, vmulq_f64(l3, r3b));
+        vst1q_f64(result+row*4, ta);
+        vst1q_f64(result+row*4+2, tb);
+    }
+#else
+    // 32 bit NEON has no double precision vectors, so fall back to the scalar order of evaluation.
+    double r[16];
+    for(int i=0; i<16; ++i) r[i] = rhs[i];
+    for(int row=0; row<4; ++row)
+    {
+        const double* l = lhs+row*4;
+        double l0 = l[0], l1 = l[1], l2 = l[2], l3 = l[3];
+        for(int col=0; col<4; ++col)
+        {
+            result[row*4+col] = l0*r[col] + l1*r[4+col] + l2*r[8+col] + l3*r[12+col];
+        }
+    }
+#endif
+}
+
+#endif
+
 #define SET_ROW(row, v1, v2, v3, v4 )    \
     _mat[(row)][0] = (v1); \
     _mat[(row)][1] = (v2); \
@@ -463,6 +602,9 @@ void Matrix_implementation::mult( const Matrix_implementation& lhs, const Matrix
         return;
     }
 
+#if defined(OSG_MATRIX_SIMD)
+    multMatrix(lhs._mat[0], rhs._mat[0], _mat[0]);
+#else
 // PRECONDITION: We assume neither &lhs nor &rhs == this
 // if it did, use preMult or postMult instead
     _mat[0][0] = INNER_PRODUCT(lhs, rhs, 0, 0);
@@ -481,10 +623,14 @@ void Matrix_implementation::mult( const Matrix_implementation& lhs, const Matrix
     _mat[3][1] = INNER_PRODUCT(lhs, rhs, 3, 1);
     _mat[3][2] = INNER_PRODUCT(lhs, rhs, 3, 2);
     _mat[3][3] = INNER_PRODUCT(lhs, rhs, 3, 3);
+#endif
 }
 
 void Matrix_implementation::preMult( const Matrix_implementation& other )
 {
+#if defined(OSG_MATRIX_SIMD)
+    multMatrix(other._mat[0], _mat[0], _mat[0]);
+#else
     // brute force method requiring a copy
     //Matrix_implementation tmp(other* *this);
     // *this = tmp;
@@ -501,11 +647,14 @@ void Matrix_implementation::preMult( const Matrix_implementation& other )
         _mat[2][col] = t[2];
         _mat[3][col] = t[3];
     }
-
+#endif
 }
 
 void Matrix_implementation::postMult( const Matrix_implementation& other )
 {
+#if defined(OSG_MATRIX_SIMD)
+    multMatrix(_mat[0], other._mat[0], _mat[0]);
+#else
     // brute force method requiring a copy
     //Matrix_implementation tmp(*this * other);
     // *this = tmp;
@@ -520,6 +669,7 @@ void Matrix_implementation::postMult( const Matrix_implementation& other )
         t[3] = INNER_PRODUCT( *this, other, row, 3 );
         SET_ROW(row, t[0], t[1], t[2], t[3] )
     }
+#endif
 }
 
 #undef INNER_PRODUCT
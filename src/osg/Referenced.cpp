@@ -24,7 +24,7 @@
 #include <OpenThreads/ScopedLock>
 #include <OpenThreads/Mutex>
 
-#include <osg/DeleteHandler>
+#include <osg/DeferredDeleteHandler>
 
 namespace osg
 {
@@ -102,9 +102,10 @@ static InitGlobalMutexes s_initGlobalMutexes;
 static bool s_useThreadSafeReferenceCounting = getenv("OSG_THREAD_SAFE_REF_UNREF")!=0;
 #endif
 // static std::auto_ptr<DeleteHandler> s_deleteHandler(0);
-static DeleteHandlerPointer s_deleteHandler(0);
+static DeleteHandlerPointer s_deleteHandler(getenv("OSG_DEFERRED_DELETE")!=0 ? new DeferredDeleteHandler : 0);
 
 static ApplicationUsageProxy Referenced_e0(ApplicationUsage::ENVIRONMENTAL_VARIABLE,"OSG_THREAD_SAFE_REF_UNREF","");
+static ApplicationUsageProxy Referenced_e1(ApplicationUsage::ENVIRONMENTAL_VARIABLE,"OSG_DEFERRED_DELETE","Batch the deletion of unreferenced objects until the end of the frame using an osg::DeferredDeleteHandler.");
 
 void Referenced::setThreadSafeReferenceCounting(bool enableThreadSafeReferenceCounting)
 {
@@ -241,7 +242,9 @@ Referenced::~Referenced()
     signalObserversAndDelete(true, false);
 
     // delete the ObserverSet
-#if defined(_OSG_REFERENCED_USE_ATOMIC_OPERATIONS)
+#if defined(_OSG_REFERENCED_USE_ATOMIC_BUILTINS)
+    if (_observerSet) static_cast<ObserverSet*>(_observerSet)->unref();
+#elif defined(_OSG_REFERENCED_USE_ATOMIC_OPERATIONS)
     if (_observerSet.get()) static_cast<ObserverSet*>(_observerSet.get())->unref();
 #else
     if (_observerSet) static_cast<ObserverSet*>(_observerSet)->unref();
@@ -254,7 +257,23 @@ Referenced::~Referenced()
 
 ObserverSet* Referenced::getOrCreateObserverSet() const
 {
-#if defined(_OSG_REFERENCED_USE_ATOMIC_OPERATIONS)
+#if defined(_OSG_REFERENCED_USE_ATOMIC_BUILTINS)
+    ObserverSet* observerSet = getObserverSet();
+    while (0 == observerSet)
+    {
+        ObserverSet* newObserverSet = new ObserverSet(this);
+        newObserverSet->ref();
+
+        void* expected = 0;
+        if (!__atomic_compare_exchange_n(&_observerSet, &expected, static_cast<void*>(newObserverSet), false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+        {
+            newObserverSet->unref();
+        }
+
+        observerSet = getObserverSet();
+    }
+    return observerSet;
+#elif defined(_OSG_REFERENCED_USE_ATOMIC_OPERATIONS)
     ObserverSet* observerSet = static_cast<ObserverSet*>(_observerSet.get());
     while (0 == observerSet)
     {
@@ -304,11 +323,7 @@ void Referenced::removeObserver(Observer* observer) const
 
 void Referenced::signalObserversAndDelete(bool signalDelete, bool doDelete) const
 {
-#if defined(_OSG_REFERENCED_USE_ATOMIC_OPERATIONS)
-    ObserverSet* observerSet = static_cast<ObserverSet*>(_observerSet.get());
-#else
-    ObserverSet* observerSet = static_cast<ObserverSet*>(_observerSet);
-#endif
+    ObserverSet* observerSet = getObserverSet();
 
     if (observerSet && signalDelete)
     {
@@ -317,8 +332,8 @@ void Referenced::signalObserversAndDelete(bool signalDelete, bool doDelete) cons
 
     if (doDelete)
     {
-        if (_refCount!=0)
-            OSG_NOTICE<<"Warning Referenced::signalObserversAndDelete(,,) doing delete with _refCount="<<_refCount<<std::endl;
+        if (referenceCount()!=0)
+            OSG_NOTICE<<"Warning Referenced::signalObserversAndDelete(,,) doing delete with _refCount="<<referenceCount()<<std::endl;
 
         if (getDeleteHandler()) deleteUsingDeleteHandler();
         else delete this;
@@ -352,7 +367,9 @@ void Referenced::setThreadSafeRefUnref(bool threadSafe)
 
 int Referenced::unref_nodelete() const
 {
-#if defined(_OSG_REFERENCED_USE_ATOMIC_OPERATIONS)
+#if defined(_OSG_REFERENCED_USE_ATOMIC_BUILTINS)
+    return __atomic_sub_fetch(&_refCount, 1, __ATOMIC_ACQ_REL);
+#elif defined(_OSG_REFERENCED_USE_ATOMIC_OPERATIONS)
     return --_refCount;
 #else
     if (_refMutex)
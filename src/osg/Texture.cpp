@@ -25,6 +25,10 @@
 #include <OpenThreads/ScopedLock>
 #include <OpenThreads/Mutex>
 
+#include <algorithm>
+#include <stdlib.h>
+#include <string.h>
+
 #ifndef GL_TEXTURE_WRAP_R
 #define GL_TEXTURE_WRAP_R                 0x8072
 #endif
@@ -61,6 +65,9 @@ namespace osg {
 
 ApplicationUsageProxy Texture_e0(ApplicationUsage::ENVIRONMENTAL_VARIABLE,"OSG_MAX_TEXTURE_SIZE","Set the maximum size of textures.");
 ApplicationUsageProxy Texture_e1(ApplicationUsage::ENVIRONMENTAL_VARIABLE,"OSG_GL_TEXTURE_STORAGE","ON|OFF or ENABLE|DISABLE, Enables/disables usage of glTexStorage for textures where supported, default is ENABLED.");
+ApplicationUsageProxy Texture_e2(ApplicationUsage::ENVIRONMENTAL_VARIABLE,"OSG_TEXTURE_POOL_HARD_LIMIT","ON|OFF, Delete least recently used orphaned texture objects immediately to keep within OSG_TEXTURE_POOL_SIZE, default is OFF.");
+ApplicationUsageProxy Texture_e3(ApplicationUsage::ENVIRONMENTAL_VARIABLE,"OSG_TEXTURE_POOL_SIZE_CLASSES","ON|OFF, Enables/disables reuse of orphaned texture objects of compatible format and similar size, default is ON.");
+ApplicationUsageProxy Texture_e4(ApplicationUsage::ENVIRONMENTAL_VARIABLE,"OSG_TEXTURE_ORPHAN_REUSE_DELAY <frames>","Number of frames an orphaned texture object must be unused before it is reused when a texture pool size is set, default is 0.");
 
 typedef buffered_value< ref_ptr<Texture::Extensions> > BufferedExtensions;
 static BufferedExtensions s_extensions;
@@ -278,6 +285,8 @@ void Texture::TextureObject::setAllocated(GLint     numMipmapLevels,
             // Update texture pool size
             _set->getParent()->getCurrTexturePoolSize() -= previousSize;
             _set->getParent()->getCurrTexturePoolSize() += _profile._size;
+
+            if (_profile._size>previousSize) _set->getParent()->enforceMaxTexturePoolSize(0);
         }
     }
 }
@@ -689,13 +698,28 @@ bool Texture::TextureObjectSet::makeSpace(unsigned int& size)
     return size==0;
 }
 
-Texture::TextureObject* Texture::TextureObjectSet::takeFromOrphans(Texture* texture)
+ref_ptr<Texture::TextureObject> Texture::TextureObjectSet::removeReusableOrphan(bool requireMutableStorage)
 {
-    // take front of orphaned list.
-    ref_ptr<TextureObject> to = _orphanedTextureObjects.front();
+    for(TextureObjectList::iterator itr = _orphanedTextureObjects.begin();
+        itr != _orphanedTextureObjects.end();
+        ++itr)
+    {
+        TextureObject* to = itr->get();
+        if (requireMutableStorage && to->hasImmutableStorage()) continue;
+        if (!_parent->isOrphanReusable(to)) continue;
 
-    // remove from orphan list.
-    _orphanedTextureObjects.pop_front();
+        ref_ptr<TextureObject> reusable = to;
+        _orphanedTextureObjects.erase(itr);
+        return reusable;
+    }
+    return 0;
+}
+
+Texture::TextureObject* Texture::TextureObjectSet::takeFromOrphans(Texture* texture)
+{
+    // take the first orphan that is no longer in use by the GPU
+    ref_ptr<TextureObject> to = removeReusableOrphan(false);
+    if (!to) return 0;
 
     // assign to new texture
     to->setTexture(texture);
@@ -703,6 +727,7 @@ Texture::TextureObject* Texture::TextureObjectSet::takeFromOrphans(Texture* text
     // update the number of active and orphaned TextureOjects
     _parent->getNumberOrphanedTextureObjects() -= 1;
     _parent->getNumberActiveTextureObjects() += 1;
+    _parent->getNumberPoolHits() += 1;
 
     // place at back of active list
     addToBack(to.get());
@@ -712,6 +737,87 @@ Texture::TextureObject* Texture::TextureObjectSet::takeFromOrphans(Texture* text
     return to.release();
 }
 
+Texture::TextureObject* Texture::TextureObjectSet::takeFromCompatibleOrphans(Texture* texture)
+{
+    if (!_parent->getUseSizeClassPooling() || _profile._size==0) return 0;
+
+    TextureObjectManager::TextureObjectSetList compatibleSets;
+    _parent->getCompatibleTextureObjectSets(_profile, compatibleSets);
+
+    for(TextureObjectManager::TextureObjectSetList::iterator itr = compatibleSets.begin();
+        itr != compatibleSets.end();
+        ++itr)
+    {
+        TextureObjectSet* donor = *itr;
+
+        {
+            OpenThreads::ScopedLock<OpenThreads::Mutex> lock(donor->_mutex);
+            if (!donor->_pendingOrphanedTextureObjects.empty()) donor->handlePendingOrphandedTextureObjects();
+        }
+
+        ref_ptr<TextureObject> to = donor->removeReusableOrphan(true);
+        if (!to) continue;
+
+        // move 'to' across to this set, it will be respecified with this set's profile when next applied.
+        --(donor->_numOfTextureObjects);
+        ++_numOfTextureObjects;
+
+        _parent->getCurrTexturePoolSize() -= donor->_profile._size;
+        _parent->getCurrTexturePoolSize() += _profile._size;
+
+        _parent->getNumberOrphanedTextureObjects() -= 1;
+        _parent->getNumberActiveTextureObjects() += 1;
+        _parent->getNumberPoolHits() += 1;
+
+        to->_set = this;
+        to->_profile = _profile;
+        to->setAllocated(false);
+        to->setTexture(texture);
+
+        addToBack(to.get());
+
+        OSG_INFO<<"Reusing compatible orphaned TextureObject, previous size="<<donor->_profile._size<<", new size="<<_profile._size<<std::endl;
+
+        return to.release();
+    }
+
+    return 0;
+}
+
+void Texture::TextureObjectSet::collectOrphans(std::vector< ref_ptr<TextureObject> >& orphans)
+{
+    {
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+        if (!_pendingOrphanedTextureObjects.empty()) handlePendingOrphandedTextureObjects();
+    }
+
+    orphans.insert(orphans.end(), _orphanedTextureObjects.begin(), _orphanedTextureObjects.end());
+}
+
+bool Texture::TextureObjectSet::deleteOrphan(TextureObject* to)
+{
+    for(TextureObjectList::iterator itr = _orphanedTextureObjects.begin();
+        itr != _orphanedTextureObjects.end();
+        ++itr)
+    {
+        if (itr->get()!=to) continue;
+
+        GLuint id = to->id();
+        glDeleteTextures( 1L, &id);
+
+        _orphanedTextureObjects.erase(itr);
+
+        --_numOfTextureObjects;
+
+        _parent->getCurrTexturePoolSize() -= _profile._size;
+        _parent->getNumberOrphanedTextureObjects() -= 1;
+        _parent->getNumberDeleted() += 1;
+        _parent->getNumberEvicted() += 1;
+
+        return true;
+    }
+    return false;
+}
 
 Texture::TextureObject* Texture::TextureObjectSet::takeOrGenerate(Texture* texture)
 {
@@ -721,15 +827,24 @@ Texture::TextureObject* Texture::TextureObjectSet::takeOrGenerate(Texture* textu
         if (!_pendingOrphanedTextureObjects.empty())
         {
             handlePendingOrphandedTextureObjects();
-            return takeFromOrphans(texture);
         }
     }
 
     if (!_orphanedTextureObjects.empty())
     {
-        return takeFromOrphans(texture);
+        TextureObject* to = takeFromOrphans(texture);
+        if (to) return to;
     }
 
+    // see if an orphan of a compatible format and similar size can be respecified
+    {
+        TextureObject* to = takeFromCompatibleOrphans(texture);
+        if (to) return to;
+    }
+
+    // free up space held by orphans of other profiles before stealing active TextureObjects
+    _parent->enforceMaxTexturePoolSize(_profile._size);
+
     unsigned int minFrameNumber = _parent->getFrameNumber();
 
     // see if we can reuse TextureObject by taking the least recently used active TextureObject
@@ -749,6 +864,7 @@ Texture::TextureObject* Texture::TextureObjectSet::takeOrGenerate(Texture* textu
         if (original_texture.valid())
         {
             original_texture->setTextureObject(_contextID,0);
+            _parent->getNumberEvicted() += 1;
             OSG_INFO<<"TextureObjectSet="<<this<<": Reusing an active TextureObject "<<to.get()<<" _numOfTextureObjects="<<_numOfTextureObjects<<" width="<<_profile._width<<" height="<<_profile._height<<std::endl;
         }
         else
@@ -777,6 +893,7 @@ Texture::TextureObject* Texture::TextureObjectSet::takeOrGenerate(Texture* textu
     // update the current texture pool size
     _parent->getCurrTexturePoolSize() += _profile._size;
     _parent->getNumberActiveTextureObjects() += 1;
+    _parent->getNumberAllocated() += 1;
 
     addToBack(to);
 
@@ -970,8 +1087,30 @@ Texture::TextureObjectManager::TextureObjectManager(unsigned int contextID):
     _numGenerated(0),
     _generateTime(0.0),
     _numApplied(0),
-    _applyTime(0.0)
+    _applyTime(0.0),
+    _numPoolHits(0),
+    _numAllocated(0),
+    _numEvicted(0)
 {
+    const char* ptr = 0;
+
+    _enforceMaxTexturePoolSize = false;
+    if ((ptr = getenv("OSG_TEXTURE_POOL_HARD_LIMIT")) != 0)
+    {
+        _enforceMaxTexturePoolSize = (strcmp(ptr,"ON")==0 || strcmp(ptr,"ENABLE")==0);
+    }
+
+    _useSizeClassPooling = true;
+    if ((ptr = getenv("OSG_TEXTURE_POOL_SIZE_CLASSES")) != 0)
+    {
+        if (strcmp(ptr,"OFF")==0 || strcmp(ptr,"DISABLE")==0) _useSizeClassPooling = false;
+    }
+
+    _orphanReuseDelay = 0;
+    if ((ptr = getenv("OSG_TEXTURE_ORPHAN_REUSE_DELAY")) != 0)
+    {
+        _orphanReuseDelay = atoi(ptr);
+    }
 }
 
 void Texture::TextureObjectManager::setMaxTexturePoolSize(unsigned int size)
@@ -998,6 +1137,62 @@ bool Texture::TextureObjectManager::makeSpace(unsigned int size)
     return size==0;
 }
 
+static bool lessFrameLastUsed(const ref_ptr<Texture::TextureObject>& lhs, const ref_ptr<Texture::TextureObject>& rhs)
+{
+    return lhs->_frameLastUsed < rhs->_frameLastUsed;
+}
+
+void Texture::TextureObjectManager::enforceMaxTexturePoolSize(unsigned int sizeRequired)
+{
+    if (!_enforceMaxTexturePoolSize || _maxTexturePoolSize==0 || hasSpace(sizeRequired)) return;
+
+    std::vector< ref_ptr<TextureObject> > orphans;
+    for(TextureSetMap::iterator itr = _textureSetMap.begin();
+        itr != _textureSetMap.end();
+        ++itr)
+    {
+        (*itr).second->collectOrphans(orphans);
+    }
+
+    // delete the least recently used first
+    std::sort(orphans.begin(), orphans.end(), lessFrameLastUsed);
+
+    ElapsedTime elapsedTime(&(getDeleteTime()));
+
+    for(std::vector< ref_ptr<TextureObject> >::iterator itr = orphans.begin();
+        itr != orphans.end() && !hasSpace(sizeRequired);
+        ++itr)
+    {
+        TextureObject* to = itr->get();
+        if (to->_set) to->_set->deleteOrphan(to);
+    }
+
+    if (!hasSpace(sizeRequired))
+    {
+        OSG_INFO<<"TextureObjectManager::enforceMaxTexturePoolSize("<<sizeRequired<<") unable to keep within MaxTexturePoolSize="<<_maxTexturePoolSize<<" as only active TextureObjects remain, _currTexturePoolSize="<<_currTexturePoolSize<<std::endl;
+    }
+}
+
+void Texture::TextureObjectManager::getCompatibleTextureObjectSets(const TextureProfile& profile, TextureObjectSetList& sets)
+{
+    // the TextureSetMap is ordered by size first, so the sets within a size class are contiguous.
+    unsigned int sizeClass = TextureProfile::computeSizeClass(profile._size);
+
+    TextureProfile lowerBound(0);
+    lowerBound._size = 1u << sizeClass;
+
+    for(TextureSetMap::iterator itr = _textureSetMap.lower_bound(lowerBound);
+        itr != _textureSetMap.end() && TextureProfile::computeSizeClass(itr->first._size)==sizeClass;
+        ++itr)
+    {
+        TextureObjectSet* tos = itr->second.get();
+        if (tos->getProfile()==profile || !tos->getProfile().isCompatible(profile)) continue;
+        if (tos->getNumOrphans()==0 && tos->getNumPendingOrphans()==0) continue;
+
+        sets.push_back(tos);
+    }
+}
+
 
 Texture::TextureObject* Texture::TextureObjectManager::generateTextureObject(const Texture* texture, GLenum target)
 {
@@ -1125,6 +1320,7 @@ void Texture::TextureObjectManager::reportStats(std::ostream& out)
     out<<"   total _numGenerated="<<_numGenerated<<", _generateTime="<<_generateTime<<", averagePerFrame="<<_generateTime/numFrames*1000.0<<"ms"<<std::endl;
     out<<"   total _numDeleted="<<_numDeleted<<", _deleteTime="<<_deleteTime<<", averagePerFrame="<<_deleteTime/numFrames*1000.0<<"ms"<<std::endl;
     out<<"   total _numApplied="<<_numApplied<<", _applyTime="<<_applyTime<<", averagePerFrame="<<_applyTime/numFrames*1000.0<<"ms"<<std::endl;
+    out<<"   total _numPoolHits="<<_numPoolHits<<", _numAllocated="<<_numAllocated<<", hit rate="<<(_numPoolHits+_numAllocated>0 ? double(_numPoolHits)/double(_numPoolHits+_numAllocated)*100.0 : 0.0)<<"%, _numEvicted="<<_numEvicted<<std::endl;
     out<<"   getMaxTexturePoolSize()="<<getMaxTexturePoolSize()<<" current/max size = "<<double(_currTexturePoolSize)/double(getMaxTexturePoolSize())<<std::endl;
     recomputeStats(out);
 }
@@ -1140,6 +1336,10 @@ void Texture::TextureObjectManager::resetStats()
 
     _numApplied = 0;
     _applyTime = 0;
+
+    _numPoolHits = 0;
+    _numAllocated = 0;
+    _numEvicted = 0;
 }
 
 
@@ -2300,6 +2500,9 @@ void Texture::applyTexImage2D_load(State& state, GLenum target, const Image* ima
             {
                 extensions->glTexStorage2D(target, numMipmapLevels, sizedInternalFormat, width, height);
 
+                TextureObject* to = getTextureObject(contextID);
+                if (to) to->setImmutableStorage(true);
+
                 if( !compressed_image )
                 {
                     for( GLsizei k = 0 ; k < numMipmapLevels  && (width || height) ;k++)
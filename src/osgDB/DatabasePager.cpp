@@ -47,6 +47,8 @@ static osg::ApplicationUsageProxy DatabasePager_e0(osg::ApplicationUsage::ENVIRO
 static osg::ApplicationUsageProxy DatabasePager_e3(osg::ApplicationUsage::ENVIRONMENTAL_VARIABLE,"OSG_DATABASE_PAGER_DRAWABLE <mode>","Set the drawable policy for setting of loaded drawable to specified type.  mode can be one of DoNotModify, DisplayList, VBO or VertexArrays>.");
 static osg::ApplicationUsageProxy DatabasePager_e4(osg::ApplicationUsage::ENVIRONMENTAL_VARIABLE,"OSG_DATABASE_PAGER_PRIORITY <mode>", "Set the thread priority to DEFAULT, MIN, LOW, NOMINAL, HIGH or MAX.");
 static osg::ApplicationUsageProxy DatabasePager_e11(osg::ApplicationUsage::ENVIRONMENTAL_VARIABLE,"OSG_MAX_PAGEDLOD <num>","Set the target maximum number of PagedLOD to maintain.");
+static osg::ApplicationUsageProxy DatabasePager_e13(osg::ApplicationUsage::ENVIRONMENTAL_VARIABLE,"OSG_MAX_PAGEDLOD_CPU_MEMORY <megabytes>","Set the target maximum CPU memory of the subgraphs loaded into PagedLOD, expiring them by memory rather than by OSG_MAX_PAGEDLOD.");
+static osg::ApplicationUsageProxy DatabasePager_e14(osg::ApplicationUsage::ENVIRONMENTAL_VARIABLE,"OSG_MAX_PAGEDLOD_GPU_MEMORY <megabytes>","Set the target maximum GPU memory of the subgraphs loaded into PagedLOD, expiring them by memory rather than by OSG_MAX_PAGEDLOD.");
 static osg::ApplicationUsageProxy DatabasePager_e12(osg::ApplicationUsage::ENVIRONMENTAL_VARIABLE,"OSG_ASSIGN_PBO_TO_IMAGES <ON/OFF>","Set whether PixelBufferObjects should be assigned to Images to aid download to the GPU.");
 
 // Convert function objects that take pointer args into functions that a
@@ -384,11 +386,17 @@ protected:
 //
 struct DatabasePager::SortFileRequestFunctor
 {
+    // requests are ordered on the frame number and priority they were queued with, most recent and highest priority first.
+    bool operator() (const DatabasePager::DatabaseRequest* lhs, const DatabasePager::DatabaseRequest* rhs) const
+    {
+        if (lhs->_queueFrameNumber>rhs->_queueFrameNumber) return true;
+        else if (lhs->_queueFrameNumber<rhs->_queueFrameNumber) return false;
+        else return (lhs->_queuePriority>rhs->_queuePriority);
+    }
+
     bool operator() (const osg::ref_ptr<DatabasePager::DatabaseRequest>& lhs,const osg::ref_ptr<DatabasePager::DatabaseRequest>& rhs) const
     {
-        if (lhs->_timestampLastRequest>rhs->_timestampLastRequest) return true;
-        else if (lhs->_timestampLastRequest<rhs->_timestampLastRequest) return false;
-        else return (lhs->_priorityLastRequest>rhs->_priorityLastRequest);
+        return (*this)(lhs.get(), rhs.get());
     }
 };
 
@@ -419,10 +427,11 @@ DatabasePager::RequestQueue::RequestQueue(DatabasePager* pager):
 DatabasePager::RequestQueue::~RequestQueue()
 {
     OSG_INFO<<"DatabasePager::RequestQueue::~RequestQueue() Destructing queue."<<std::endl;
-    for(RequestList::iterator itr = _requestList.begin();
-        itr != _requestList.end();
+    for(RequestHeap::iterator itr = _requestHeap.begin();
+        itr != _requestHeap.end();
         ++itr)
     {
+        (*itr)->_requestQueue = 0;
         invalidate(itr->get());
     }
 }
@@ -441,6 +450,136 @@ void DatabasePager::RequestQueue::invalidate(DatabaseRequest* dr)
     dr->invalidate();
 }
 
+void DatabasePager::RequestQueue::incrementFrameNumberCount(unsigned int frameNumber)
+{
+    ++_frameNumberCounts[frameNumber];
+}
+
+void DatabasePager::RequestQueue::decrementFrameNumberCount(unsigned int frameNumber)
+{
+    FrameNumberCountMap::iterator itr = _frameNumberCounts.find(frameNumber);
+    if (itr==_frameNumberCounts.end()) return;
+
+    if (itr->second<=1) _frameNumberCounts.erase(itr);
+    else --(itr->second);
+}
+
+bool DatabasePager::RequestQueue::higherPriorityNoLock(unsigned int lhs, unsigned int rhs) const
+{
+    return SortFileRequestFunctor()(_requestHeap[lhs], _requestHeap[rhs]);
+}
+
+void DatabasePager::RequestQueue::swapNoLock(unsigned int lhs, unsigned int rhs)
+{
+    _requestHeap[lhs].swap(_requestHeap[rhs]);
+    _requestHeap[lhs]->_queueIndex = lhs;
+    _requestHeap[rhs]->_queueIndex = rhs;
+}
+
+void DatabasePager::RequestQueue::restoreHeapNoLock(unsigned int index)
+{
+    // move towards the root while the request outranks its parent
+    bool movedUp = false;
+    while(index>0)
+    {
+        unsigned int parent = (index-1)/2;
+        if (!higherPriorityNoLock(index, parent)) break;
+
+        swapNoLock(index, parent);
+        index = parent;
+        movedUp = true;
+    }
+
+    if (movedUp) return;
+
+    // otherwise move towards the leaves while a child outranks it
+    unsigned int size = _requestHeap.size();
+    for(;;)
+    {
+        unsigned int left = index*2+1;
+        if (left>=size) break;
+
+        unsigned int right = left+1;
+        unsigned int child = (right<size && higherPriorityNoLock(right, left)) ? right : left;
+        if (!higherPriorityNoLock(child, index)) break;
+
+        swapNoLock(index, child);
+        index = child;
+    }
+}
+
+void DatabasePager::RequestQueue::rebuildHeapNoLock()
+{
+    _frameNumberCounts.clear();
+    for(unsigned int i=0; i<_requestHeap.size(); ++i)
+    {
+        DatabaseRequest* dr = _requestHeap[i].get();
+        dr->_queueIndex = i;
+        dr->_queueFrameNumber = dr->_frameNumberLastRequest;
+        dr->_queuePriority = dr->_priorityLastRequest;
+        incrementFrameNumberCount(dr->_queueFrameNumber);
+    }
+
+    for(unsigned int i=_requestHeap.size()/2; i>0; --i)
+    {
+        restoreHeapNoLock(i-1);
+    }
+}
+
+void DatabasePager::RequestQueue::pushNoLock(DatabaseRequest* databaseRequest)
+{
+    if (databaseRequest->_requestQueue==this)
+    {
+        reprioritiseNoLock(databaseRequest);
+        return;
+    }
+
+    if (databaseRequest->_requestQueue)
+    {
+        // the request has already moved on to another stage, such as when a compile completes before
+        // the database thread has queued the request for compiling, so leave it where it is.
+        OSG_INFO<<"DatabasePager::RequestQueue::add() request already held by another queue."<<std::endl;
+        return;
+    }
+
+    databaseRequest->_requestQueue = this;
+    databaseRequest->_queueIndex = _requestHeap.size();
+    databaseRequest->_queueFrameNumber = databaseRequest->_frameNumberLastRequest;
+    databaseRequest->_queuePriority = databaseRequest->_priorityLastRequest;
+    incrementFrameNumberCount(databaseRequest->_queueFrameNumber);
+
+    _requestHeap.push_back(databaseRequest);
+    restoreHeapNoLock(databaseRequest->_queueIndex);
+}
+
+void DatabasePager::RequestQueue::reprioritiseNoLock(DatabaseRequest* databaseRequest)
+{
+    decrementFrameNumberCount(databaseRequest->_queueFrameNumber);
+
+    databaseRequest->_queueFrameNumber = databaseRequest->_frameNumberLastRequest;
+    databaseRequest->_queuePriority = databaseRequest->_priorityLastRequest;
+    incrementFrameNumberCount(databaseRequest->_queueFrameNumber);
+
+    restoreHeapNoLock(databaseRequest->_queueIndex);
+}
+
+void DatabasePager::RequestQueue::eraseNoLock(unsigned int index)
+{
+    DatabaseRequest* dr = _requestHeap[index].get();
+    decrementFrameNumberCount(dr->_queueFrameNumber);
+    dr->_requestQueue = 0;
+
+    // note, dr may be deleted once it's no longer referenced by the heap so mustn't be used below.
+    unsigned int last = _requestHeap.size()-1;
+    if (index!=last)
+    {
+        _requestHeap[index] = _requestHeap[last];
+        _requestHeap[index]->_queueIndex = index;
+    }
+    _requestHeap.pop_back();
+
+    if (index<_requestHeap.size()) restoreHeapNoLock(index);
+}
 
 bool DatabasePager::RequestQueue::pruneOldRequestsAndCheckIfEmpty()
 {
@@ -449,22 +588,31 @@ bool DatabasePager::RequestQueue::pruneOldRequestsAndCheckIfEmpty()
     unsigned int frameNumber = _pager->_frameNumber;
     if (_frameNumberLastPruned != frameNumber)
     {
-        for(RequestQueue::RequestList::iterator citr = _requestList.begin();
-            citr != _requestList.end();
-            )
+        // only walk the heap when requests older than the previous frame are queued.
+        if (!_frameNumberCounts.empty() && (frameNumber - _frameNumberCounts.begin()->first) > 1)
         {
             OpenThreads::ScopedLock<OpenThreads::Mutex> drLock(_pager->_dr_mutex);
-            if ((*citr)->isRequestCurrent(frameNumber))
+
+            RequestHeap::iterator insert_itr = _requestHeap.begin();
+            for(RequestHeap::iterator citr = _requestHeap.begin();
+                citr != _requestHeap.end();
+                ++citr)
             {
-                ++citr;
+                if ((*citr)->isRequestCurrent(frameNumber))
+                {
+                    if (insert_itr!=citr) *insert_itr = *citr;
+                    ++insert_itr;
+                }
+                else
+                {
+                    OSG_INFO<<"DatabasePager::RequestQueue::pruneOldRequestsAndCheckIfEmpty(): Pruning "<<(*citr)<<std::endl;
+                    (*citr)->_requestQueue = 0;
+                    invalidate(citr->get());
+                }
             }
-            else
-            {
-                invalidate(citr->get());
+            _requestHeap.erase(insert_itr, _requestHeap.end());
 
-                OSG_INFO<<"DatabasePager::RequestQueue::pruneOldRequestsAndCheckIfEmpty(): Pruning "<<(*citr)<<std::endl;
-                citr = _requestList.erase(citr);
-            }
+            rebuildHeapNoLock();
         }
 
         _frameNumberLastPruned = frameNumber;
@@ -472,34 +620,36 @@ bool DatabasePager::RequestQueue::pruneOldRequestsAndCheckIfEmpty()
         updateBlock();
     }
 
-    return _requestList.empty();
+    return _requestHeap.empty();
 }
 
 bool DatabasePager::RequestQueue::empty()
 {
     OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_requestMutex);
-    return _requestList.empty();
+    return _requestHeap.empty();
 }
 
 unsigned int DatabasePager::RequestQueue::size()
 {
     OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_requestMutex);
-    return _requestList.size();
+    return _requestHeap.size();
 }
 
 void DatabasePager::RequestQueue::clear()
 {
     OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_requestMutex);
 
-    for(RequestList::iterator citr = _requestList.begin();
-        citr != _requestList.end();
+    for(RequestHeap::iterator citr = _requestHeap.begin();
+        citr != _requestHeap.end();
         ++citr)
     {
         OpenThreads::ScopedLock<OpenThreads::Mutex> drLock(_pager->_dr_mutex);
+        (*citr)->_requestQueue = 0;
         invalidate(citr->get());
     }
 
-    _requestList.clear();
+    _requestHeap.clear();
+    _frameNumberCounts.clear();
 
     _frameNumberLastPruned = _pager->_frameNumber;
 
@@ -518,81 +668,95 @@ void DatabasePager::RequestQueue::remove(DatabasePager::DatabaseRequest* databas
 {
     // OSG_NOTICE<<"DatabasePager::RequestQueue::remove(DatabaseRequest* databaseRequest)"<<std::endl;
     OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_requestMutex);
-    for(RequestList::iterator citr = _requestList.begin();
-        citr != _requestList.end();
-        ++citr)
+    OpenThreads::ScopedLock<OpenThreads::Mutex> drLock(_pager->_dr_mutex);
+    if (databaseRequest->_requestQueue==this)
     {
-        if (citr->get()==databaseRequest)
-        {
-            // OSG_NOTICE<<"  done remove(DatabaseRequest* databaseRequest)"<<std::endl;
-            _requestList.erase(citr);
-            return;
-        }
+        // OSG_NOTICE<<"  done remove(DatabaseRequest* databaseRequest)"<<std::endl;
+        eraseNoLock(databaseRequest->_queueIndex);
+    }
+}
+
+void DatabasePager::RequestQueue::reprioritise(DatabasePager::DatabaseRequest* databaseRequest)
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_requestMutex);
+    OpenThreads::ScopedLock<OpenThreads::Mutex> drLock(_pager->_dr_mutex);
+    if (databaseRequest->_requestQueue==this)
+    {
+        reprioritiseNoLock(databaseRequest);
     }
 }
 
 
 void DatabasePager::RequestQueue::addNoLock(DatabasePager::DatabaseRequest* databaseRequest)
 {
-    _requestList.push_back(databaseRequest);
+    {
+        OpenThreads::ScopedLock<OpenThreads::Mutex> drLock(_pager->_dr_mutex);
+        pushNoLock(databaseRequest);
+    }
     updateBlock();
 }
 
 void DatabasePager::RequestQueue::swap(RequestList& requestList)
 {
     OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_requestMutex);
-    _requestList.swap(requestList);
+    OpenThreads::ScopedLock<OpenThreads::Mutex> drLock(_pager->_dr_mutex);
+
+    RequestHeap requestHeap;
+    requestHeap.swap(_requestHeap);
+    _frameNumberCounts.clear();
+
+    for(RequestList::iterator citr = requestList.begin();
+        citr != requestList.end();
+        ++citr)
+    {
+        pushNoLock(citr->get());
+    }
+
+    for(RequestHeap::iterator citr = requestHeap.begin();
+        citr != requestHeap.end();
+        ++citr)
+    {
+        (*citr)->_requestQueue = 0;
+    }
+
+    std::sort(requestHeap.begin(), requestHeap.end(), SortFileRequestFunctor());
+    requestList.assign(requestHeap.begin(), requestHeap.end());
 }
 
 void DatabasePager::RequestQueue::takeFirst(osg::ref_ptr<DatabaseRequest>& databaseRequest)
 {
     OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_requestMutex);
 
-    if (!_requestList.empty())
+    if (!_requestHeap.empty())
     {
-        DatabasePager::SortFileRequestFunctor highPriority;
-
-        RequestQueue::RequestList::iterator selected_itr = _requestList.end();
-
         int frameNumber = _pager->_frameNumber;
 
-        for(RequestQueue::RequestList::iterator citr = _requestList.begin();
-            citr != _requestList.end();
-            )
+        OpenThreads::ScopedLock<OpenThreads::Mutex> drLock(_pager->_dr_mutex);
+        while(!_requestHeap.empty())
         {
-            OpenThreads::ScopedLock<OpenThreads::Mutex> drLock(_pager->_dr_mutex);
-            if ((*citr)->isRequestCurrent(frameNumber))
+            DatabaseRequest* dr = _requestHeap.front().get();
+            if (dr->isRequestCurrent(frameNumber))
             {
-                if (selected_itr==_requestList.end() || highPriority(*citr, *selected_itr))
-                {
-                    selected_itr = citr;
-                }
-
-                ++citr;
-            }
-            else
-            {
-                invalidate(citr->get());
-
-                OSG_INFO<<"DatabasePager::RequestQueue::takeFirst(): Pruning "<<(*citr)<<std::endl;
-                citr = _requestList.erase(citr);
+                databaseRequest = dr;
+                eraseNoLock(0);
+                OSG_INFO<<" DatabasePager::RequestQueue::takeFirst() Found DatabaseRequest size()="<<_requestHeap.size()<<std::endl;
+                break;
             }
 
+            // the root holds the most recently requested entry, so once it is stale the heap is drained of stale
+            // entries one O(log n) step at a time rather than scanning the whole queue.
+            OSG_INFO<<"DatabasePager::RequestQueue::takeFirst(): Pruning "<<dr<<std::endl;
+            invalidate(dr);
+            eraseNoLock(0);
         }
 
-        _frameNumberLastPruned = frameNumber;
-
-        if (selected_itr != _requestList.end())
-        {
-            databaseRequest = *selected_itr;
-            _requestList.erase(selected_itr);
-            OSG_INFO<<" DatabasePager::RequestQueue::takeFirst() Found DatabaseRequest size()="<<_requestList.size()<<std::endl;
-        }
-        else
+        if (!databaseRequest)
         {
-            OSG_INFO<<" DatabasePager::RequestQueue::takeFirst() No suitable DatabaseRequest found size()="<<_requestList.size()<<std::endl;
+            OSG_INFO<<" DatabasePager::RequestQueue::takeFirst() No suitable DatabaseRequest found size()="<<_requestHeap.size()<<std::endl;
         }
 
+        _frameNumberLastPruned = frameNumber;
+
         updateBlock();
     }
 }
@@ -610,8 +774,16 @@ DatabasePager::ReadQueue::ReadQueue(DatabasePager* pager, const std::string& nam
 
 void DatabasePager::ReadQueue::updateBlock()
 {
-    _block->set((!_requestList.empty() || !_childrenToDeleteList.empty()) &&
-                !_pager->_databasePagerThreadPaused);
+    bool requiresThread = (!_requestHeap.empty() || !_childrenToDeleteList.empty()) &&
+                          !_pager->_databasePagerThreadPaused;
+
+    _block->set(requiresThread);
+
+    // wake up any thread pool threads, they reset the shared block themselves once they run out of work.
+    if (requiresThread && _pager->_threadPoolBlock.valid())
+    {
+        _pager->_threadPoolBlock->release();
+    }
 }
 
 /////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -660,6 +832,9 @@ int DatabasePager::DatabaseThread::cancel()
             case(HANDLE_ONLY_HTTP):
                 _pager->_httpRequestQueue->release();
                 break;
+            case(HANDLE_ALL_QUEUES):
+                _pager->_threadPoolBlock->release();
+                break;
         }
 
         // then wait for the the thread to stop running.
@@ -683,6 +858,11 @@ void DatabasePager::DatabaseThread::run()
 {
     OSG_INFO<<_name<<": DatabasePager::DatabaseThread::run"<<std::endl;
 
+    if (_mode==HANDLE_ALL_QUEUES)
+    {
+        runAllQueues();
+        return;
+    }
 
     bool firstTime = true;
 
@@ -701,6 +881,8 @@ void DatabasePager::DatabaseThread::run()
         case(HANDLE_ONLY_HTTP):
             read_queue = _pager->_httpRequestQueue;
             break;
+        case(HANDLE_ALL_QUEUES):
+            break;
     }
 
 
@@ -724,18 +906,9 @@ void DatabasePager::DatabaseThread::run()
         //
         // delete any children if required.
         //
-        if (_pager->_deleteRemovedSubgraphsInDatabaseThread/* && !(read_queue->_childrenToDeleteList.empty())*/)
+        if (_pager->_deleteRemovedSubgraphsInDatabaseThread)
         {
-            ObjectList deleteList;
-            {
-                // Don't hold lock during destruction of deleteList
-                OpenThreads::ScopedLock<OpenThreads::Mutex> lock(read_queue->_requestMutex);
-                if (!read_queue->_childrenToDeleteList.empty())
-                {
-                    deleteList.swap(read_queue->_childrenToDeleteList);
-                    read_queue->updateBlock();
-                }
-            }
+            deleteRemovedSubgraphs(read_queue.get());
         }
 
         //
@@ -744,208 +917,354 @@ void DatabasePager::DatabaseThread::run()
         osg::ref_ptr<DatabaseRequest> databaseRequest;
         read_queue->takeFirst(databaseRequest);
 
-        bool readFromFileCache = false;
+        if (databaseRequest.valid())
+        {
+            readRequest(databaseRequest, _mode, out_queue.get());
+        }
 
-        osg::ref_ptr<FileCache> fileCache = osgDB::Registry::instance()->getFileCache();
-        osg::ref_ptr<FileLocationCallback> fileLocationCallback = osgDB::Registry::instance()->getFileLocationCallback();
-        osg::ref_ptr<Options> dr_loadOptions;
-        std::string fileName;
-        int frameNumberLastRequest = 0;
         if (databaseRequest.valid())
         {
+            processRequest(databaseRequest);
+        }
+        else
+        {
+            OpenThreads::Thread::YieldCurrentThread();
+        }
+
+
+        // go to sleep till our the next time our thread gets scheduled.
+
+        if (firstTime)
+        {
+            // do a yield to get round a peculiar thread hang when testCancel() is called
+            // in certain circumstances - of which there is no particular pattern.
+            YieldCurrentThread();
+            firstTime = false;
+        }
+
+    } while (!testCancel() && !_done);
+}
+
+void DatabasePager::DatabaseThread::runAllQueues()
+{
+    bool firstTime = true;
+
+    do
+    {
+        _active = false;
+
+        osg::ref_ptr<DatabaseRequest> databaseRequest;
+        ReadQueue* read_queue = 0;
+
+        bool foundWork = false;
+        while(!_done && !foundWork)
+        {
+            foundWork = takeWork(databaseRequest, read_queue);
+            if (!foundWork)
             {
-                OpenThreads::ScopedLock<OpenThreads::Mutex> drLock(_pager->_dr_mutex);
-                dr_loadOptions = databaseRequest->_loadOptions;
-                fileName = databaseRequest->_fileName;
-                frameNumberLastRequest = databaseRequest->_frameNumberLastRequest;
+                // reset before checking again so that work added in between releases the block rather than being missed.
+                _pager->_threadPoolBlock->reset();
+
+                foundWork = takeWork(databaseRequest, read_queue);
+                if (!foundWork) _pager->_threadPoolBlock->block();
             }
-            if (dr_loadOptions.valid())
-            {
-                if (dr_loadOptions->getFileCache()) fileCache = dr_loadOptions->getFileCache();
-                if (dr_loadOptions->getFileLocationCallback()) fileLocationCallback = dr_loadOptions->getFileLocationCallback();
+        }
+
+        if (_done)
+        {
+            break;
+        }
+
+        _active = true;
 
-                dr_loadOptions = dr_loadOptions->cloneOptions();
+        if (databaseRequest.valid())
+        {
+            if (read_queue==_pager->_dataToProcessList.get())
+            {
+                processRequest(databaseRequest);
             }
             else
             {
-                dr_loadOptions = new osgDB::Options;
+                // file requests that turn out to be high latency are passed on to the http queue, where any idle thread can pick them up.
+                if (read_queue==_pager->_fileRequestQueue.get()) readRequest(databaseRequest, HANDLE_NON_HTTP, _pager->_httpRequestQueue.get());
+                else readRequest(databaseRequest, HANDLE_ONLY_HTTP, 0);
+
+                // queue the post-read processing as a separate task so this thread can get on with the next read.
+                if (databaseRequest.valid())
+                {
+                    _pager->_dataToProcessList->add(databaseRequest.get());
+                }
             }
+        }
+
+        if (firstTime)
+        {
+            // do a yield to get round a peculiar thread hang when testCancel() is called
+            // in certain circumstances - of which there is no particular pattern.
+            YieldCurrentThread();
+            firstTime = false;
+        }
+
+    } while (!testCancel() && !_done);
+}
 
-            dr_loadOptions->setTerrain(databaseRequest->_terrain);
+bool DatabasePager::DatabaseThread::takeWork(osg::ref_ptr<DatabaseRequest>& databaseRequest, ReadQueue*& read_queue)
+{
+    if (_pager->_databasePagerThreadPaused) return false;
 
-            // disable the FileCache if the fileLocationCallback tells us that it isn't required for this request.
-            if (fileLocationCallback.valid() && !fileLocationCallback->useFileCache()) fileCache = 0;
+    if (_pager->_deleteRemovedSubgraphsInDatabaseThread)
+    {
+        if (deleteRemovedSubgraphs(_pager->_fileRequestQueue.get()) ||
+            deleteRemovedSubgraphs(_pager->_httpRequestQueue.get()))
+        {
+            return true;
+        }
+    }
 
+    // finish off tiles already read before starting on new reads, stealing http reads only once the file reads are exhausted.
+    ReadQueue* queues[3] = { _pager->_dataToProcessList.get(), _pager->_fileRequestQueue.get(), _pager->_httpRequestQueue.get() };
+    for(unsigned int i=0; i<3; ++i)
+    {
+        if (queues[i]->empty()) continue;
 
-            // check if databaseRequest is still relevant
-            if ((_pager->_frameNumber-frameNumberLastRequest)<=1)
-            {
+        queues[i]->takeFirst(databaseRequest);
+        if (databaseRequest.valid())
+        {
+            read_queue = queues[i];
+            return true;
+        }
+    }
+
+    return false;
+}
+
+bool DatabasePager::DatabaseThread::deleteRemovedSubgraphs(ReadQueue* read_queue)
+{
+    ObjectList deleteList;
+    {
+        // Don't hold lock during destruction of deleteList
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock(read_queue->_requestMutex);
+        if (!read_queue->_childrenToDeleteList.empty())
+        {
+            deleteList.swap(read_queue->_childrenToDeleteList);
+            read_queue->updateBlock();
+        }
+    }
+    return !deleteList.empty();
+}
+
+void DatabasePager::DatabaseThread::readRequest(osg::ref_ptr<DatabaseRequest>& databaseRequest, Mode mode, ReadQueue* out_queue)
+{
+    bool readFromFileCache = false;
+
+    osg::ref_ptr<FileCache> fileCache = osgDB::Registry::instance()->getFileCache();
+    osg::ref_ptr<FileLocationCallback> fileLocationCallback = osgDB::Registry::instance()->getFileLocationCallback();
+    osg::ref_ptr<Options> dr_loadOptions;
+    std::string fileName;
+    int frameNumberLastRequest = 0;
+    {
+        OpenThreads::ScopedLock<OpenThreads::Mutex> drLock(_pager->_dr_mutex);
+        dr_loadOptions = databaseRequest->_loadOptions;
+        fileName = databaseRequest->_fileName;
+        frameNumberLastRequest = databaseRequest->_frameNumberLastRequest;
+    }
+    if (dr_loadOptions.valid())
+    {
+        if (dr_loadOptions->getFileCache()) fileCache = dr_loadOptions->getFileCache();
+        if (dr_loadOptions->getFileLocationCallback()) fileLocationCallback = dr_loadOptions->getFileLocationCallback();
+
+        dr_loadOptions = dr_loadOptions->cloneOptions();
+    }
+    else
+    {
+        dr_loadOptions = new osgDB::Options;
+    }
+
+    dr_loadOptions->setTerrain(databaseRequest->_terrain);
 
-                // now check to see if this request is appropriate for this thread
-                switch(_mode)
+    // disable the FileCache if the fileLocationCallback tells us that it isn't required for this request.
+    if (fileLocationCallback.valid() && !fileLocationCallback->useFileCache()) fileCache = 0;
+
+
+    // check if databaseRequest is still relevant
+    if ((_pager->_frameNumber-frameNumberLastRequest)<=1)
+    {
+
+        // now check to see if this request is appropriate for this thread
+        switch(mode)
+        {
+            case(HANDLE_ALL_REQUESTS):
+            case(HANDLE_ALL_QUEUES):
+            {
+                // do nothing as this thread can handle the load
+                if (fileCache.valid() && fileCache->isFileAppropriateForFileCache(fileName))
                 {
-                    case(HANDLE_ALL_REQUESTS):
+                    if (fileCache->existsInCache(fileName))
                     {
-                        // do nothing as this thread can handle the load
-                        if (fileCache.valid() && fileCache->isFileAppropriateForFileCache(fileName))
-                        {
-                            if (fileCache->existsInCache(fileName))
-                            {
-                                readFromFileCache = true;
-                            }
-                        }
-                        break;
+                        readFromFileCache = true;
                     }
-                    case(HANDLE_NON_HTTP):
+                }
+                break;
+            }
+            case(HANDLE_NON_HTTP):
+            {
+                // check the cache first
+                bool isHighLatencyFileRequest = false;
+
+                if (fileLocationCallback.valid())
+                {
+                    isHighLatencyFileRequest = fileLocationCallback->fileLocation(fileName, dr_loadOptions.get()) == FileLocationCallback::REMOTE_FILE;
+                }
+                else  if (fileCache.valid() && fileCache->isFileAppropriateForFileCache(fileName))
+                {
+                    isHighLatencyFileRequest = true;
+                }
+
+                if (isHighLatencyFileRequest)
+                {
+                    if (fileCache.valid() && fileCache->existsInCache(fileName))
                     {
-                        // check the cache first
-                        bool isHighLatencyFileRequest = false;
-
-                        if (fileLocationCallback.valid())
-                        {
-                            isHighLatencyFileRequest = fileLocationCallback->fileLocation(fileName, dr_loadOptions.get()) == FileLocationCallback::REMOTE_FILE;
-                        }
-                        else  if (fileCache.valid() && fileCache->isFileAppropriateForFileCache(fileName))
-                        {
-                            isHighLatencyFileRequest = true;
-                        }
-
-                        if (isHighLatencyFileRequest)
-                        {
-                            if (fileCache.valid() && fileCache->existsInCache(fileName))
-                            {
-                                readFromFileCache = true;
-                            }
-                            else
-                            {
-                                OSG_INFO<<_name<<": Passing http requests over "<<fileName<<std::endl;
-                                out_queue->add(databaseRequest.get());
-                                databaseRequest = 0;
-                            }
-                        }
-                        break;
+                        readFromFileCache = true;
                     }
-                    case(HANDLE_ONLY_HTTP):
+                    else
                     {
-                        // accept all requests, as we'll assume only high latency requests will have got here.
-                        break;
+                        OSG_INFO<<_name<<": Passing http requests over "<<fileName<<std::endl;
+                        out_queue->add(databaseRequest.get());
+                        databaseRequest = 0;
+                        return;
                     }
                 }
+                break;
             }
-            else
+            case(HANDLE_ONLY_HTTP):
             {
-                databaseRequest = 0;
+                // accept all requests, as we'll assume only high latency requests will have got here.
+                break;
             }
         }
+    }
+    else
+    {
+        databaseRequest = 0;
+        return;
+    }
 
 
-        if (databaseRequest.valid())
-        {
+    // load the data, note safe to write to the databaseRequest since once
+    // it is created this thread is the only one to write to the _loadedModel pointer.
+    //OSG_NOTICE<<"In DatabasePager thread readNodeFile("<<databaseRequest->_fileName<<")"<<std::endl;
+    osg::Timer_t before = osg::Timer::instance()->tick();
 
-            // load the data, note safe to write to the databaseRequest since once
-            // it is created this thread is the only one to write to the _loadedModel pointer.
-            //OSG_NOTICE<<"In DatabasePager thread readNodeFile("<<databaseRequest->_fileName<<")"<<std::endl;
-            //osg::Timer_t before = osg::Timer::instance()->tick();
 
+    // assume that readNode is thread safe...
+    ReaderWriter::ReadResult rr = readFromFileCache ?
+                fileCache->readNode(fileName, dr_loadOptions.get(), false) :
+                Registry::instance()->readNode(fileName, dr_loadOptions.get(), false);
 
-            // assume that readNode is thread safe...
-            ReaderWriter::ReadResult rr = readFromFileCache ?
-                        fileCache->readNode(fileName, dr_loadOptions.get(), false) :
-                        Registry::instance()->readNode(fileName, dr_loadOptions.get(), false);
+    osg::ref_ptr<osg::Node> loadedModel;
+    if (rr.validNode()) loadedModel = rr.getNode();
+    if (rr.error()) OSG_WARN<<"Error in reading file "<<fileName<<" : "<<rr.message() << std::endl;
+    if (rr.notEnoughMemory()) OSG_INFO<<"Not enought memory to load file "<<fileName << std::endl;
 
-            osg::ref_ptr<osg::Node> loadedModel;
-            if (rr.validNode()) loadedModel = rr.getNode();
-            if (rr.error()) OSG_WARN<<"Error in reading file "<<fileName<<" : "<<rr.message() << std::endl;
-            if (rr.notEnoughMemory()) OSG_INFO<<"Not enought memory to load file "<<fileName << std::endl;
+    if (loadedModel.valid() &&
+        fileCache.valid() &&
+        fileCache->isFileAppropriateForFileCache(fileName) &&
+        !readFromFileCache)
+    {
+        fileCache->writeNode(*(loadedModel), fileName, dr_loadOptions.get());
+    }
 
-            if (loadedModel.valid() &&
-                fileCache.valid() &&
-                fileCache->isFileAppropriateForFileCache(fileName) &&
-                !readFromFileCache)
-            {
-                fileCache->writeNode(*(loadedModel), fileName, dr_loadOptions.get());
-            }
+    _pager->addPagingStageTime(READ_STAGE, osg::Timer::instance()->delta_s(before, osg::Timer::instance()->tick()));
 
-            {
-                OpenThreads::ScopedLock<OpenThreads::Mutex> drLock(_pager->_dr_mutex);
-                if ((_pager->_frameNumber-databaseRequest->_frameNumberLastRequest)>1)
-                {
-                    OSG_INFO<<_name<<": Warning DatabaseRquest no longer required."<<std::endl;
-                    loadedModel = 0;
-                }
-            }
+    {
+        OpenThreads::ScopedLock<OpenThreads::Mutex> drLock(_pager->_dr_mutex);
+        if ((_pager->_frameNumber-databaseRequest->_frameNumberLastRequest)>1)
+        {
+            OSG_INFO<<_name<<": Warning DatabaseRquest no longer required."<<std::endl;
+            loadedModel = 0;
+        }
 
-            //OSG_NOTICE<<"     node read in "<<osg::Timer::instance()->delta_m(before,osg::Timer::instance()->tick())<<" ms"<<std::endl;
+        databaseRequest->_loadedModel = loadedModel;
+    }
 
-            if (loadedModel.valid())
-            {
-                loadedModel->getBound();
+    //OSG_NOTICE<<"     node read in "<<osg::Timer::instance()->delta_m(before,osg::Timer::instance()->tick())<<" ms"<<std::endl;
 
-                // find all the compileable rendering objects
-                DatabasePager::FindCompileableGLObjectsVisitor stateToCompile(_pager);
-                loadedModel->accept(stateToCompile);
+    if (!loadedModel.valid()) databaseRequest = 0;
+}
 
-                bool loadedObjectsNeedToBeCompiled = _pager->_doPreCompile &&
-                                                     _pager->_incrementalCompileOperation.valid() &&
-                                                     _pager->_incrementalCompileOperation->requiresCompile(stateToCompile);
+void DatabasePager::DatabaseThread::processRequest(osg::ref_ptr<DatabaseRequest>& databaseRequest)
+{
+    osg::ref_ptr<osg::Node> loadedModel;
+    {
+        OpenThreads::ScopedLock<OpenThreads::Mutex> drLock(_pager->_dr_mutex);
+        loadedModel = databaseRequest->_loadedModel;
+    }
 
-                // move the databaseRequest from the front of the fileRequest to the end of
-                // dataToCompile or dataToMerge lists.
-                osg::ref_ptr<osgUtil::IncrementalCompileOperation::CompileSet> compileSet = 0;
-                if (loadedObjectsNeedToBeCompiled)
-                {
-                    // OSG_NOTICE<<"Using IncrementalCompileOperation"<<std::endl;
+    // the request may have been invalidated whilst waiting to be processed.
+    if (!loadedModel.valid())
+    {
+        databaseRequest = 0;
+        return;
+    }
 
-                    compileSet = new osgUtil::IncrementalCompileOperation::CompileSet(loadedModel.get());
-                    compileSet->buildCompileMap(_pager->_incrementalCompileOperation->getContextSet(), stateToCompile);
-                    compileSet->_compileCompletedCallback = new DatabasePagerCompileCompletedCallback(_pager, databaseRequest.get());
-                    _pager->_incrementalCompileOperation->add(compileSet.get(), false);
-                }
-                {
-                    OpenThreads::ScopedLock<OpenThreads::Mutex> drLock(_pager->_dr_mutex);
-                    databaseRequest->_loadedModel = loadedModel;
-                    databaseRequest->_compileSet = compileSet;
-                }
-                // Dereference the databaseRequest while the queue is
-                // locked. This prevents the request from being
-                // deleted at an unpredictable time within
-                // addLoadedDataToSceneGraph.
-                if (loadedObjectsNeedToBeCompiled)
-                {
-                    OpenThreads::ScopedLock<OpenThreads::Mutex> listLock(
-                        _pager->_dataToCompileList->_requestMutex);
-                    _pager->_dataToCompileList->addNoLock(databaseRequest.get());
-                    databaseRequest = 0;
-                }
-                else
-                {
-                    OpenThreads::ScopedLock<OpenThreads::Mutex> listLock(
-                        _pager->_dataToMergeList->_requestMutex);
-                    _pager->_dataToMergeList->addNoLock(databaseRequest.get());
-                    databaseRequest = 0;
-                }
+    osg::Timer_t before = osg::Timer::instance()->tick();
 
-            }
+    loadedModel->getBound();
 
-            // _pager->_dataToCompileList->pruneOldRequestsAndCheckIfEmpty();
-        }
-        else
-        {
-            OpenThreads::Thread::YieldCurrentThread();
-        }
+    // find all the compileable rendering objects
+    DatabasePager::FindCompileableGLObjectsVisitor stateToCompile(_pager);
+    loadedModel->accept(stateToCompile);
 
+    bool loadedObjectsNeedToBeCompiled = _pager->_doPreCompile &&
+                                         _pager->_incrementalCompileOperation.valid() &&
+                                         _pager->_incrementalCompileOperation->requiresCompile(stateToCompile);
 
-        // go to sleep till our the next time our thread gets scheduled.
+    // move the databaseRequest from the front of the fileRequest to the end of
+    // dataToCompile or dataToMerge lists.
+    osg::ref_ptr<osgUtil::IncrementalCompileOperation::CompileSet> compileSet = 0;
+    if (loadedObjectsNeedToBeCompiled)
+    {
+        // OSG_NOTICE<<"Using IncrementalCompileOperation"<<std::endl;
 
-        if (firstTime)
-        {
-            // do a yield to get round a peculiar thread hang when testCancel() is called
-            // in certain circumstances - of which there is no particular pattern.
-            YieldCurrentThread();
-            firstTime = false;
-        }
+        compileSet = new osgUtil::IncrementalCompileOperation::CompileSet(loadedModel.get());
+        compileSet->buildCompileMap(_pager->_incrementalCompileOperation->getContextSet(), stateToCompile);
+        compileSet->_compileCompletedCallback = new DatabasePagerCompileCompletedCallback(_pager, databaseRequest.get());
+        _pager->_incrementalCompileOperation->add(compileSet.get(), false);
+    }
 
-    } while (!testCancel() && !_done);
+    // estimate the memory once the drawable and texture policies have been applied, as they decide what is held on the GPU.
+    osg::CostPair memoryCost(0.0,0.0);
+    if (_pager->getUseTargetMaximumMemoryOfPagedLOD() && _pager->_graphicsCostEstimator.valid())
+    {
+        memoryCost = _pager->_graphicsCostEstimator->estimateMemoryCost(loadedModel.get());
+    }
+
+    {
+        OpenThreads::ScopedLock<OpenThreads::Mutex> drLock(_pager->_dr_mutex);
+        databaseRequest->_compileSet = compileSet;
+        databaseRequest->_memoryCost = memoryCost;
+    }
+
+    _pager->addPagingStageTime(PROCESS_STAGE, osg::Timer::instance()->delta_s(before, osg::Timer::instance()->tick()));
+
+    // Dereference the databaseRequest while the queue is
+    // locked. This prevents the request from being
+    // deleted at an unpredictable time within
+    // addLoadedDataToSceneGraph.
+    if (loadedObjectsNeedToBeCompiled)
+    {
+        OpenThreads::ScopedLock<OpenThreads::Mutex> listLock(
+            _pager->_dataToCompileList->_requestMutex);
+        _pager->_dataToCompileList->addNoLock(databaseRequest.get());
+        databaseRequest = 0;
+    }
+    else
+    {
+        OpenThreads::ScopedLock<OpenThreads::Mutex> listLock(
+            _pager->_dataToMergeList->_requestMutex);
+        _pager->_dataToMergeList->addNoLock(databaseRequest.get());
+        databaseRequest = 0;
+    }
 }
 
 
@@ -1024,6 +1343,20 @@ DatabasePager::DatabasePager()
         OSG_NOTICE<<"_targetMaximumNumberOfPageLOD = "<<_targetMaximumNumberOfPageLOD<<std::endl;
     }
 
+    _targetMaximumMemoryOfPagedLOD = osg::CostPair(0.0,0.0);
+    if( (str = getenv("OSG_MAX_PAGEDLOD_CPU_MEMORY")) != 0)
+    {
+        _targetMaximumMemoryOfPagedLOD.first = atof(str)*1024.0*1024.0;
+        OSG_NOTICE<<"_targetMaximumMemoryOfPagedLOD.first = "<<_targetMaximumMemoryOfPagedLOD.first<<std::endl;
+    }
+    if( (str = getenv("OSG_MAX_PAGEDLOD_GPU_MEMORY")) != 0)
+    {
+        _targetMaximumMemoryOfPagedLOD.second = atof(str)*1024.0*1024.0;
+        OSG_NOTICE<<"_targetMaximumMemoryOfPagedLOD.second = "<<_targetMaximumMemoryOfPagedLOD.second<<std::endl;
+    }
+    _memoryOfPagedLOD = osg::CostPair(0.0,0.0);
+    _graphicsCostEstimator = new osg::GraphicsCostEstimator;
+
 
     _doPreCompile = true;
     if( (str = getenv("OSG_DO_PRE_COMPILE")) != 0)
@@ -1032,11 +1365,27 @@ DatabasePager::DatabasePager()
                         strcmp(str,"on")==0 || strcmp(str,"ON")==0;
     }
 
+    _useThreadPool = false;
+    if( (str = getenv("OSG_DATABASE_PAGER_THREAD_POOL")) != 0)
+    {
+        _useThreadPool = strcmp(str,"yes")==0 || strcmp(str,"YES")==0 ||
+                         strcmp(str,"on")==0 || strcmp(str,"ON")==0;
+    }
+
+    _threadPoolBlock = new osg::RefBlock;
+
     // initialize the stats variables
     resetStats();
 
+    for(unsigned int i=0; i<NUMBER_OF_PAGING_STAGES; ++i)
+    {
+        _pagingStageTime[i] = 0.0;
+        _pagingStageCount[i] = 0;
+    }
+
     _fileRequestQueue = new ReadQueue(this,"fileRequestQueue");
     _httpRequestQueue = new ReadQueue(this,"httpRequestQueue");
+    _dataToProcessList = new ReadQueue(this,"dataToProcessList");
 
     _dataToCompileList = new RequestQueue(this);
     _dataToMergeList = new RequestQueue(this);
@@ -1103,10 +1452,24 @@ DatabasePager::DatabasePager(const DatabasePager& rhs)
 
     _targetMaximumNumberOfPageLOD = rhs._targetMaximumNumberOfPageLOD;
 
+    _targetMaximumMemoryOfPagedLOD = rhs._targetMaximumMemoryOfPagedLOD;
+    _memoryOfPagedLOD = osg::CostPair(0.0,0.0);
+    _graphicsCostEstimator = rhs._graphicsCostEstimator;
+
     _doPreCompile = rhs._doPreCompile;
 
+    _useThreadPool = rhs._useThreadPool;
+    _threadPoolBlock = new osg::RefBlock;
+
+    for(unsigned int i=0; i<NUMBER_OF_PAGING_STAGES; ++i)
+    {
+        _pagingStageTime[i] = 0.0;
+        _pagingStageCount[i] = 0;
+    }
+
     _fileRequestQueue = new ReadQueue(this,"fileRequestQueue");
     _httpRequestQueue = new ReadQueue(this,"httpRequestQueue");
+    _dataToProcessList = new ReadQueue(this,"dataToProcessList");
 
     _dataToCompileList = new RequestQueue(this);
     _dataToMergeList = new RequestQueue(this);
@@ -1149,6 +1512,7 @@ DatabasePager::~DatabasePager()
     // destruct all the queues
     _fileRequestQueue = 0;
     _httpRequestQueue = 0;
+    _dataToProcessList = 0;
     _dataToCompileList = 0;
     _dataToMergeList = 0;
 
@@ -1174,8 +1538,17 @@ DatabasePager* DatabasePager::create()
 
 void DatabasePager::setUpThreads(unsigned int totalNumThreads, unsigned int numHttpThreads)
 {
+    if (_useThreadPool)
+    {
+        setUpThreadPool(osg::maximum(totalNumThreads, static_cast<unsigned int>(OpenThreads::GetNumberOfProcessors())));
+        return;
+    }
+
     _databaseThreads.clear();
 
+    // only the thread pool processes loaded tiles as a separate task, so discard any left over from a previous thread pool.
+    _dataToProcessList->clear();
+
     unsigned int numGeneralThreads = numHttpThreads < totalNumThreads ?
         totalNumThreads - numHttpThreads :
         1;
@@ -1201,6 +1574,19 @@ void DatabasePager::setUpThreads(unsigned int totalNumThreads, unsigned int numH
     }
 }
 
+void DatabasePager::setUpThreadPool(unsigned int numThreads)
+{
+    _databaseThreads.clear();
+
+    if (numThreads==0) numThreads = OpenThreads::GetNumberOfProcessors();
+    if (numThreads==0) numThreads = 1;
+
+    for(unsigned int i=0; i<numThreads; ++i)
+    {
+        addDatabaseThread(DatabaseThread::HANDLE_ALL_QUEUES, "HANDLE_ALL_QUEUES");
+    }
+}
+
 unsigned int DatabasePager::addDatabaseThread(DatabaseThread::Mode mode, const std::string& name)
 {
     OSG_INFO<<"DatabasePager::addDatabaseThread() "<<name<<std::endl;
@@ -1257,6 +1643,7 @@ int DatabasePager::cancel()
     // release the queue blocks in case they are holding up thread cancellation.
     _fileRequestQueue->release();
     _httpRequestQueue->release();
+    _threadPoolBlock->release();
 
     for(DatabaseThreadList::iterator dt_itr = _databaseThreads.begin();
         dt_itr != _databaseThreads.end();
@@ -1275,6 +1662,7 @@ void DatabasePager::clear()
 {
     _fileRequestQueue->clear();
     _httpRequestQueue->clear();
+    _dataToProcessList->clear();
 
     _dataToCompileList->clear();
     _dataToMergeList->clear();
@@ -1282,6 +1670,9 @@ void DatabasePager::clear()
     // note, no need to use a mutex as the list is only accessed from the update thread.
     _activePagedLODList->clear();
 
+    _pagedLODMemoryMap.clear();
+    _memoryOfPagedLOD = osg::CostPair(0.0,0.0);
+
     // ??
     // _activeGraphicsContexts
 }
@@ -1295,10 +1686,64 @@ void DatabasePager::resetStats()
     _numTilesMerges = 0;
 }
 
+void DatabasePager::addPagingStageTime(PagingStage stage, double timeTaken)
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_pagingStageMutex);
+    _pagingStageTime[stage] += timeTaken;
+    ++_pagingStageCount[stage];
+}
+
+const char* DatabasePager::getPagingStageName(PagingStage stage)
+{
+    switch(stage)
+    {
+        case(READ_STAGE): return "read";
+        case(PROCESS_STAGE): return "process";
+        case(MERGE_STAGE): return "merge";
+        default: return "unknown";
+    }
+}
+
+void DatabasePager::reportStats(unsigned int frameNumber, osg::Stats& stats)
+{
+    double stageTime[NUMBER_OF_PAGING_STAGES];
+    unsigned int stageCount[NUMBER_OF_PAGING_STAGES];
+    {
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_pagingStageMutex);
+        for(unsigned int i=0; i<NUMBER_OF_PAGING_STAGES; ++i)
+        {
+            stageTime[i] = _pagingStageTime[i];
+            stageCount[i] = _pagingStageCount[i];
+            _pagingStageTime[i] = 0.0;
+            _pagingStageCount[i] = 0;
+        }
+    }
+
+    for(unsigned int i=0; i<NUMBER_OF_PAGING_STAGES; ++i)
+    {
+        std::string name = std::string("DatabasePager ")+getPagingStageName(static_cast<PagingStage>(i));
+
+        // only frames in which tiles passed through a stage contribute to its average time.
+        if (stageCount[i]>0)
+        {
+            stats.setAttribute(frameNumber, name+" time taken", stageTime[i]/static_cast<double>(stageCount[i]));
+        }
+        stats.setAttribute(frameNumber, name+" tiles", static_cast<double>(stageCount[i]));
+    }
+
+    if (getUseTargetMaximumMemoryOfPagedLOD())
+    {
+        stats.setAttribute(frameNumber, "DatabasePager CPU memory", _memoryOfPagedLOD.first);
+        stats.setAttribute(frameNumber, "DatabasePager GPU memory", _memoryOfPagedLOD.second);
+    }
+}
+
 bool DatabasePager::getRequestsInProgress() const
 {
     if (getFileRequestListSize()>0) return true;
 
+    if (_dataToProcessList->size()>0) return true;
+
     if (getDataToCompileListSize()>0)
     {
         return true;
@@ -1383,6 +1828,7 @@ void DatabasePager::requestNodeFile(const std::string& fileName, osg::NodePath&
     {
         DatabaseRequest* databaseRequest = dynamic_cast<DatabaseRequest*>(databaseRequestRef.get());
         bool requeue = false;
+        RequestQueue* requestQueue = 0;
         if (databaseRequest)
         {
             OpenThreads::ScopedLock<OpenThreads::Mutex> drLock(_dr_mutex);
@@ -1402,6 +1848,8 @@ void DatabasePager::requestNodeFile(const std::string& fileName, osg::NodePath&
                 databaseRequest->_priorityLastRequest = priority;
                 ++(databaseRequest->_numOfRequests);
 
+                requestQueue = databaseRequest->_requestQueue;
+
                 foundEntry = true;
 
                 if (databaseRequestRef->referenceCount()==1)
@@ -1421,6 +1869,8 @@ void DatabasePager::requestNodeFile(const std::string& fileName, osg::NodePath&
         }
         if (requeue)
             _fileRequestQueue->add(databaseRequest);
+        else if (requestQueue)
+            requestQueue->reprioritise(databaseRequest);
     }
 
     if (!foundEntry)
@@ -1518,6 +1968,10 @@ void DatabasePager::setDatabasePagerThreadPause(bool pause)
         OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_httpRequestQueue->_requestMutex);
         _httpRequestQueue->updateBlock();
     }
+    {
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_dataToProcessList->_requestMutex);
+        _dataToProcessList->updateBlock();
+    }
 }
 
 
@@ -1586,6 +2040,8 @@ void DatabasePager::addLoadedDataToSceneGraph(const osg::FrameStamp &frameStamp)
     {
         DatabaseRequest* databaseRequest = itr->get();
 
+        osg::Timer_t mergeStartTick = osg::Timer::instance()->tick();
+
         // No need to take _dr_mutex. The pager threads are done with
         // the request; the cull traversal -- which might redispatch
         // the request -- can't run at the sametime as this update traversal.
@@ -1613,6 +2069,11 @@ void DatabasePager::addLoadedDataToSceneGraph(const osg::FrameStamp &frameStamp)
 
             group->addChild(databaseRequest->_loadedModel.get());
 
+            if (plod && getUseTargetMaximumMemoryOfPagedLOD())
+            {
+                addMemoryOfPagedLOD(plod, databaseRequest->_loadedModel.get(), databaseRequest->_memoryCost);
+            }
+
             // Check if parent plod was already registered if not start visitor from parent
             if( plod &&
                 !_activePagedLODList->containsPagedLOD( plod ) )
@@ -1633,6 +2094,8 @@ void DatabasePager::addLoadedDataToSceneGraph(const osg::FrameStamp &frameStamp)
 
             _totalTimeToMergeTiles += timeToMerge;
             ++_numTilesMerges;
+
+            addPagingStageTime(MERGE_STAGE, osg::Timer::instance()->delta_s(mergeStartTick, osg::Timer::instance()->tick()));
         }
         else
         {
@@ -1695,30 +2158,43 @@ void DatabasePager::removeExpiredSubgraphs(const osg::FrameStamp& frameStamp)
     if (s_total_max_stage_a<time_a) s_total_max_stage_a = time_a;
 
 
-    if (numPagedLODs <= _targetMaximumNumberOfPageLOD)
-    {
-        // nothing to do
-        return;
-    }
-
-    int numToPrune = numPagedLODs - _targetMaximumNumberOfPageLOD;
-
     ObjectList childrenRemoved;
 
     double expiryTime = frameStamp.getReferenceTime() - 0.1;
     unsigned int expiryFrame = frameStamp.getFrameNumber() - 1;
 
-    // First traverse inactive PagedLODs, as their children will
-    // certainly have expired. Then traverse active nodes if we still
-    // need to prune.
-    //OSG_NOTICE<<"numToPrune "<<numToPrune;
-    if (numToPrune>0)
-        _activePagedLODList->removeExpiredChildren(
-            numToPrune, expiryTime, expiryFrame, childrenRemoved, false);
-    numToPrune = _activePagedLODList->size() - _targetMaximumNumberOfPageLOD;
-    if (numToPrune>0)
-        _activePagedLODList->removeExpiredChildren(
-            numToPrune, expiryTime, expiryFrame, childrenRemoved, true);
+    if (getUseTargetMaximumMemoryOfPagedLOD())
+    {
+        if (!exceedsTargetMaximumMemoryOfPagedLOD())
+        {
+            // nothing to do
+            return;
+        }
+
+        removeLeastRecentlyUsedSubgraphs(expiryTime, expiryFrame, childrenRemoved);
+    }
+    else
+    {
+        if (numPagedLODs <= _targetMaximumNumberOfPageLOD)
+        {
+            // nothing to do
+            return;
+        }
+
+        int numToPrune = numPagedLODs - _targetMaximumNumberOfPageLOD;
+
+        // First traverse inactive PagedLODs, as their children will
+        // certainly have expired. Then traverse active nodes if we still
+        // need to prune.
+        //OSG_NOTICE<<"numToPrune "<<numToPrune;
+        if (numToPrune>0)
+            _activePagedLODList->removeExpiredChildren(
+                numToPrune, expiryTime, expiryFrame, childrenRemoved, false);
+        numToPrune = _activePagedLODList->size() - _targetMaximumNumberOfPageLOD;
+        if (numToPrune>0)
+            _activePagedLODList->removeExpiredChildren(
+                numToPrune, expiryTime, expiryFrame, childrenRemoved, true);
+    }
 
     osg::Timer_t end_b_Tick = osg::Timer::instance()->tick();
     double time_b = osg::Timer::instance()->delta_m(end_a_Tick,end_b_Tick);
@@ -1758,6 +2234,123 @@ void DatabasePager::removeExpiredSubgraphs(const osg::FrameStamp& frameStamp)
                               " C="<<time_c<<" avg="<<s_total_time_stage_c/s_total_iter_stage_c<<" max = "<<s_total_max_stage_c<<std::endl;
 }
 
+namespace
+{
+    struct LeastRecentlyUsedSubgraph
+    {
+        LeastRecentlyUsedSubgraph(osg::PagedLOD* plod, osg::Node* subgraph, unsigned int frameNumber, double timeStamp):
+            _pagedLOD(plod), _subgraph(subgraph), _frameNumber(frameNumber), _timeStamp(timeStamp) {}
+
+        bool operator < (const LeastRecentlyUsedSubgraph& rhs) const
+        {
+            if (_frameNumber<rhs._frameNumber) return true;
+            if (_frameNumber>rhs._frameNumber) return false;
+            return _timeStamp<rhs._timeStamp;
+        }
+
+        osg::ref_ptr<osg::PagedLOD>     _pagedLOD;
+        osg::Node*                      _subgraph;
+        unsigned int                    _frameNumber;
+        double                          _timeStamp;
+    };
+}
+
+void DatabasePager::removeLeastRecentlyUsedSubgraphs(double expiryTime, unsigned int expiryFrame, ObjectList& childrenRemoved)
+{
+    // Gather the subgraphs that PagedLOD::removeExpiredChildren could remove, i.e. the last child of each PagedLOD,
+    // dropping the records of subgraphs that are no longer attached to their PagedLOD.
+    typedef std::vector<LeastRecentlyUsedSubgraph> Candidates;
+    Candidates candidates;
+
+    for(PagedLODMemoryMap::iterator itr = _pagedLODMemoryMap.begin();
+        itr != _pagedLODMemoryMap.end();
+        )
+    {
+        osg::ref_ptr<osg::Node> subgraph;
+        osg::ref_ptr<osg::PagedLOD> plod;
+        if (!itr->first.lock(subgraph) || !itr->second._pagedLOD.lock(plod) || !plod->containsNode(subgraph.get()))
+        {
+            _memoryOfPagedLOD.first -= itr->second._memoryCost.first;
+            _memoryOfPagedLOD.second -= itr->second._memoryCost.second;
+            _pagedLODMemoryMap.erase(itr++);
+            continue;
+        }
+
+        unsigned int cindex = plod->getNumChildren()-1;
+        if (plod->getChild(cindex)==subgraph.get() && cindex>=plod->getNumChildrenThatCannotBeExpired())
+        {
+            candidates.push_back(LeastRecentlyUsedSubgraph(plod.get(), subgraph.get(), plod->getFrameNumber(cindex), plod->getTimeStamp(cindex)));
+        }
+
+        ++itr;
+    }
+
+    std::sort(candidates.begin(), candidates.end());
+
+    for(Candidates::iterator itr = candidates.begin();
+        itr != candidates.end() && exceedsTargetMaximumMemoryOfPagedLOD();
+        ++itr)
+    {
+        // skip subgraphs that were nested within a subgraph already removed.
+        if (_pagedLODMemoryMap.count(itr->_subgraph)==0) continue;
+
+        ExpirePagedLODsVisitor expirePagedLODsVisitor;
+        osg::NodeList expiredChildren;
+        if (!expirePagedLODsVisitor.removeExpiredChildrenAndFindPagedLODs(
+                itr->_pagedLOD.get(), expiryTime, expiryFrame, expiredChildren))
+        {
+            continue;
+        }
+
+        for(osg::NodeList::iterator citr = expiredChildren.begin();
+            citr != expiredChildren.end();
+            ++citr)
+        {
+            removeMemoryOfPagedLOD(citr->get());
+        }
+
+        // the PagedLODs nested in the removed subgraphs go with them, along with their own loaded children.
+        osg::NodeList childPagedLODs;
+        for(ExpirePagedLODsVisitor::PagedLODset::iterator pitr = expirePagedLODsVisitor._childPagedLODs.begin();
+            pitr != expirePagedLODsVisitor._childPagedLODs.end();
+            ++pitr)
+        {
+            osg::PagedLOD* childPagedLOD = pitr->get();
+            for(unsigned int i=0; i<childPagedLOD->getNumChildren(); ++i)
+            {
+                removeMemoryOfPagedLOD(childPagedLOD->getChild(i));
+            }
+            childPagedLODs.push_back(childPagedLOD);
+        }
+        _activePagedLODList->removeNodes(childPagedLODs);
+
+        std::copy(expiredChildren.begin(), expiredChildren.end(), std::back_inserter(childrenRemoved));
+    }
+}
+
+void DatabasePager::addMemoryOfPagedLOD(osg::PagedLOD* plod, osg::Node* subgraph, const osg::CostPair& memoryCost)
+{
+    // a record left behind by a deleted subgraph at the same address is replaced.
+    removeMemoryOfPagedLOD(subgraph);
+
+    PagedLODMemory& pagedLODMemory = _pagedLODMemoryMap[subgraph];
+    pagedLODMemory._pagedLOD = plod;
+    pagedLODMemory._memoryCost = memoryCost;
+
+    _memoryOfPagedLOD.first += memoryCost.first;
+    _memoryOfPagedLOD.second += memoryCost.second;
+}
+
+void DatabasePager::removeMemoryOfPagedLOD(osg::Node* subgraph)
+{
+    PagedLODMemoryMap::iterator itr = _pagedLODMemoryMap.find(subgraph);
+    if (itr == _pagedLODMemoryMap.end()) return;
+
+    _memoryOfPagedLOD.first -= itr->second._memoryCost.first;
+    _memoryOfPagedLOD.second -= itr->second._memoryCost.second;
+    _pagedLODMemoryMap.erase(itr);
+}
+
 class DatabasePager::FindPagedLODsVisitor : public osg::NodeVisitor
 {
 public:
@@ -14,6 +14,7 @@
 
 #include <osg/Notify>
 #include <osg/ImageSequence>
+#include <osg/Types>
 #include <osgDB/ReadFile>
 #include <osgDB/XmlParser>
 #include <osgDB/FileNameUtils>
@@ -24,7 +25,7 @@ using namespace osgDB;
 static std::string s_lastSchema;
 
 InputStream::InputStream( const osgDB::Options* options )
-    :   _fileVersion(0), _useSchemaData(false), _forceReadingImage(false), _dataDecompress(0)
+    :   _useClassTable(false), _classTableAtEnd(false), _objectDepth(0), _skippedObjects(false), _fileVersion(0), _useSchemaData(false), _forceReadingImage(false), _dataDecompress(0)
 {
     BEGIN_BRACKET.set( "{", +INDENT_VALUE );
     END_BRACKET.set( "}", -INDENT_VALUE );
@@ -32,6 +33,8 @@ InputStream::InputStream( const osgDB::Options* options )
     if ( !options ) return;
     _options = options;
 
+    _readStreamCallback = (ReadStreamCallback*)options->getPluginData("ReadStreamCallback");
+
     if ( options->getPluginStringData("ForceReadingImage")=="true" )
         _forceReadingImage = true;
 
@@ -665,7 +668,11 @@ osg::Image* InputStream::readImage(bool readFromExternal)
 {
     std::string className = "osg::Image";
     if ( _fileVersion>94 )  // ClassName property is only supported in 3.1.4 and higher
-        *this >> PROPERTY("ClassName") >> className;
+    {
+        *this >> PROPERTY("ClassName");
+        const ResolvedClass* resolvedClass = readClass();
+        if ( resolvedClass ) className = resolvedClass->name;
+    }
 
     unsigned int id = 0;
     *this >> PROPERTY("UniqueID") >> id;
@@ -789,9 +796,9 @@ osg::Image* InputStream::readImage(bool readFromExternal)
 
 osg::Object* InputStream::readObject( osg::Object* existingObj )
 {
-    std::string className;
+    const ResolvedClass* resolvedClass = readClass();
     unsigned int id = 0;
-    *this >> className >> BEGIN_BRACKET >> PROPERTY("UniqueID") >> id;
+    *this >> BEGIN_BRACKET >> PROPERTY("UniqueID") >> id;
     if ( getException() ) return NULL;
 
     IdentifierMap::iterator itr = _identifierMap.find( id );
@@ -801,45 +808,94 @@ osg::Object* InputStream::readObject( osg::Object* existingObj )
         return itr->second.get();
     }
 
-    osg::ref_ptr<osg::Object> obj = readObjectFields( className, id, existingObj );
+    // A shared object first written inside a skipped object is only referred to by ID here
+    if ( _skippedObjects && _in->isAtCurrentEndBracket() )
+    {
+        advanceToCurrentEndBracket();
+        return NULL;
+    }
+
+    if ( _readStreamCallback.valid() && _readStreamCallback->skipClass(resolvedClass->name) )
+    {
+        _identifierMap[id] = 0;
+        if ( _in->canAdvanceToCurrentEndBracket() )
+        {
+            _skippedObjects = true;
+            advanceToCurrentEndBracket();
+            return NULL;
+        }
+
+        // Without block sizes or brackets to skip to, the object has to be read to get past it
+        osg::ref_ptr<ReadStreamCallback> callback = _readStreamCallback;
+        _readStreamCallback = 0;
+        readObjectFields( *resolvedClass, id, existingObj );
+        _readStreamCallback = callback;
+        _identifierMap[id] = 0;
+        advanceToCurrentEndBracket();
+        return NULL;
+    }
+
+    ++_objectDepth;
+    osg::ref_ptr<osg::Object> obj = readObjectFields( *resolvedClass, id, existingObj, true );
+    --_objectDepth;
 
     advanceToCurrentEndBracket();
 
     return obj.release();
 }
 
+bool InputStream::childRead( osg::Group& parent, osg::Node& child )
+{
+    if ( !_readStreamCallback || _objectDepth!=1 ) return true;
+    return _readStreamCallback->topLevelChildRead( parent, child );
+}
+
 osg::Object* InputStream::readObjectFields( const std::string& className, unsigned int id, osg::Object* existingObj )
 {
-    ObjectWrapper* wrapper = Registry::instance()->getObjectWrapperManager()->findWrapper( className );
-    if ( !wrapper )
+    return readObjectFields( *resolveClass(className), id, existingObj );
+}
+
+osg::Object* InputStream::readObjectFields( const ResolvedClass& resolvedClass, unsigned int id, osg::Object* existingObj, bool skippable )
+{
+    if ( !resolvedClass.wrapper )
     {
         OSG_WARN << "InputStream::readObject(): Unsupported wrapper class "
-                               << className << std::endl;
+                               << resolvedClass.name << std::endl;
         return NULL;
     }
 
-    osg::ref_ptr<osg::Object> obj = existingObj ? existingObj : wrapper->createInstance();
+    osg::ref_ptr<osg::Object> obj = existingObj ? existingObj : resolvedClass.wrapper->createInstance();
     _identifierMap[id] = obj;
+    bool skipped = false;
     if ( obj.valid() )
     {
-        const StringList& associates = wrapper->getAssociates();
-        for ( StringList::const_iterator itr=associates.begin(); itr!=associates.end(); ++itr )
+        for ( ResolvedClass::AssociateList::const_iterator itr=resolvedClass.associates.begin();
+              itr!=resolvedClass.associates.end(); ++itr )
         {
-            ObjectWrapper* assocWrapper = Registry::instance()->getObjectWrapperManager()->findWrapper(*itr);
-            if ( !assocWrapper )
-            {
-                OSG_WARN << "InputStream::readObject(): Unsupported associated class "
-                                       << *itr << std::endl;
-                continue;
-            }
-            _fields.push_back( assocWrapper->getName() );
-            assocWrapper->read( *this, *obj );
+            _fields.push_back( itr->wrapper->getName() );
+            itr->wrapper->read( *this, *obj, itr->serializers );
             if ( getException() ) return NULL;
 
             _fields.pop_back();
+
+            if ( skippable && _readStreamCallback.valid() && itr->wrapper->getName()=="osg::Object" &&
+                 _readStreamCallback->skipObject(*obj) )
+            {
+                _identifierMap[id] = 0;
+                if ( _in->canAdvanceToCurrentEndBracket() )
+                {
+                    // the caller advances past the rest of the object
+                    _skippedObjects = true;
+                    return NULL;
+                }
+
+                // Without block sizes or brackets to skip to, the rest of the object has to be read to get past it
+                skipped = true;
+                skippable = false;
+            }
         }
     }
-    return obj.release();
+    return skipped ? NULL : obj.release();
 }
 
 void InputStream::readSchema( std::istream& fin )
@@ -884,6 +940,14 @@ InputStream::ReadType InputStream::start( InputIterator* inIterator )
         if ( attributes&0x4 ) inIterator->setSupportBinaryBrackets( true );
         if ( attributes&0x2 ) _useSchemaData = true;
 
+        // From SOVERSION 116, class tables and 64-bit bracket sizes
+        if ( version>=116 )
+        {
+            if ( attributes&0x8 ) _useClassTable = true;
+            if ( attributes&0x10 ) inIterator->setSupportLargeBinaryBrackets( true );
+            if ( attributes&0x20 ) _classTableAtEnd = true;
+        }
+
         // Record custom domains
         if ( attributes&0x1 )
         {
@@ -956,10 +1020,110 @@ void InputStream::decompress()
         readSchema( iss );
         _fields.pop_back();
     }
+
+    if ( _classTableAtEnd )
+    {
+        _fields.push_back( "ClassTable" );
+        readClassTable();
+        _fields.pop_back();
+    }
 }
 
 // PROTECTED METHODS
 
+const ResolvedClass* InputStream::readClass()
+{
+    std::string className;
+    if ( !_useClassTable )
+    {
+        *this >> className;
+        return resolveClass( className );
+    }
+
+    unsigned int classID = 0;
+    *this >> classID;
+    if ( classID<_classTable.size() )
+    {
+        // Classes from a table stored at the end are resolved when first used
+        if ( !_classTable[classID] ) _classTable[classID] = resolveClass( _classNames[classID] );
+        return _classTable[classID];
+    }
+
+    if ( classID>_classTable.size() || _classTableAtEnd )
+    {
+        throwException( "InputStream: Invalid class ID." );
+        return NULL;
+    }
+
+    *this >> className;
+    const ResolvedClass* resolvedClass = resolveClass( className );
+    _classTable.push_back( resolvedClass );
+    return resolvedClass;
+}
+
+void InputStream::readClassTable()
+{
+    std::istream* in = _in->getStream();
+    std::streampos offsetPosition = in->tellg();
+    if ( offsetPosition==std::streampos(-1) )
+    {
+        throwException( "InputStream: The class table is stored at the end of the file, which requires a seekable stream." );
+        return;
+    }
+
+    int64_t offset = 0;
+    _in->readComponentArray( (char*)&offset, 1, 1, INT64_SIZE );
+    std::streampos dataPosition = in->tellg();
+
+    in->seekg( offsetPosition + std::streamoff(offset) );
+    if ( in->fail() )
+    {
+        throwException( "InputStream: Failed to seek to the class table." );
+        return;
+    }
+
+    unsigned int numClasses = 0; *this >> numClasses;
+    if ( getException() ) return;
+
+    _classNames.resize( numClasses );
+    for ( unsigned int i=0; i<numClasses; ++i )
+        *this >> _classNames[i];
+    _classTable.assign( numClasses, (const ResolvedClass*)NULL );
+
+    in->seekg( dataPosition );
+    if ( in->fail() ) throwException( "InputStream: Failed to seek back from the class table." );
+}
+
+const ResolvedClass* InputStream::resolveClass( const std::string& className )
+{
+    ResolvedClassMap::iterator itr = _resolvedClassMap.find( className );
+    if ( itr!=_resolvedClassMap.end() ) return &(itr->second);
+
+    ResolvedClass& resolvedClass = _resolvedClassMap[className];
+    resolvedClass.name = className;
+
+    ObjectWrapperManager* wrapperManager = Registry::instance()->getObjectWrapperManager();
+    resolvedClass.wrapper = wrapperManager->findWrapper( className );
+    if ( !resolvedClass.wrapper ) return &resolvedClass;
+
+    const StringList& associates = resolvedClass.wrapper->getAssociates();
+    for ( StringList::const_iterator aitr=associates.begin(); aitr!=associates.end(); ++aitr )
+    {
+        ObjectWrapper* assocWrapper = wrapperManager->findWrapper( *aitr );
+        if ( !assocWrapper )
+        {
+            OSG_WARN << "InputStream::readObject(): Unsupported associated class "
+                                   << *aitr << std::endl;
+            continue;
+        }
+
+        resolvedClass.associates.push_back( ResolvedClass::Associate() );
+        resolvedClass.associates.back().wrapper = assocWrapper;
+        assocWrapper->collectSerializers( getFileVersion(assocWrapper->getDomain()), resolvedClass.associates.back().serializers );
+    }
+    return &resolvedClass;
+}
+
 void InputStream::setWrapperSchema( const std::string& name, const std::string& properties )
 {
     ObjectWrapper* wrapper = Registry::instance()->getObjectWrapperManager()->findWrapper(name);
@@ -1009,14 +1173,13 @@ void InputStream::readArrayImplementation( T* a, unsigned int numComponentsPerEl
     *this >> size >> BEGIN_BRACKET;
     if ( size )
     {
-        a->resize( size );
         if ( isBinary() )
         {
-            readComponentArray( (char*)&((*a)[0]), size, numComponentsPerElements, componentSizeInBytes );
-            checkStream();
+            readBinaryBlock( *a, size, numComponentsPerElements, componentSizeInBytes );
         }
         else
         {
+            a->resize( size );
             for ( int i=0; i<size; ++i )
                 *this >> (*a)[i];
         }
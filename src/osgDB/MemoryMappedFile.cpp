@@ -0,0 +1,138 @@
+/* -*-c++-*- OpenSceneGraph - Copyright (C) 1998-2008 Robert Osfield
+ *
+ * This library is open source and may be redistributed and/or modified under
+ * the terms of the OpenSceneGraph Public License (OSGPL) version 0.0 or
+ * (at your option) any later version.  The full license is in LICENSE file
+ * included with this distribution, and on the openscenegraph.org website.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * OpenSceneGraph Public License for more details.
+*/
+
+#include <osgDB/MemoryMappedFile>
+#include <osgDB/ConvertUTF>
+
+#include <osg/Config>
+#include <osg/Notify>
+
+#if defined(WIN32) && !defined(__CYGWIN__)
+    #define WIN32_LEAN_AND_MEAN
+    #ifndef NOMINMAX
+        #define NOMINMAX
+    #endif
+    #include <windows.h>
+#else
+    #include <sys/types.h>
+    #include <sys/stat.h>
+    #include <sys/mman.h>
+    #include <fcntl.h>
+    #include <unistd.h>
+#endif
+
+using namespace osgDB;
+
+MemoryMappedFile::MemoryMappedFile():
+    _data(0),
+    _size(0)
+{
+}
+
+MemoryMappedFile::MemoryMappedFile(const std::string& filename):
+    _data(0),
+    _size(0)
+{
+    open(filename);
+}
+
+MemoryMappedFile::~MemoryMappedFile()
+{
+    close();
+}
+
+#if defined(WIN32) && !defined(__CYGWIN__)
+
+bool MemoryMappedFile::open(const std::string& filename)
+{
+    close();
+
+#ifdef OSG_USE_UTF8_FILENAME
+    HANDLE file = CreateFileW(convertUTF8toUTF16(filename).c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+#else
+    HANDLE file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+#endif
+    if (file==INVALID_HANDLE_VALUE) return false;
+
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart==0 ||
+        static_cast<unsigned long long>(fileSize.QuadPart) > static_cast<size_t>(~0))
+    {
+        CloseHandle(file);
+        return false;
+    }
+
+    // the view keeps the mapping, and the mapping the file, open once their handles are closed.
+    HANDLE mapping = CreateFileMapping(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    CloseHandle(file);
+    if (!mapping) return false;
+
+    const void* view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    CloseHandle(mapping);
+    if (!view) return false;
+
+    _data = static_cast<const char*>(view);
+    _size = static_cast<size_t>(fileSize.QuadPart);
+    return true;
+}
+
+void MemoryMappedFile::close()
+{
+    if (_data) UnmapViewOfFile(_data);
+    _data = 0;
+    _size = 0;
+}
+
+#else
+
+bool MemoryMappedFile::open(const std::string& filename)
+{
+    close();
+
+    int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd<0) return false;
+
+    struct stat fileStat;
+    if (fstat(fd, &fileStat)!=0 || fileStat.st_size==0 ||
+        static_cast<unsigned long long>(fileStat.st_size) > static_cast<size_t>(~0))
+    {
+        ::close(fd);
+        return false;
+    }
+
+    size_t size = static_cast<size_t>(fileStat.st_size);
+    void* ptr = mmap(0, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (ptr==MAP_FAILED)
+    {
+        OSG_INFO<<"MemoryMappedFile::open("<<filename<<") unable to map file."<<std::endl;
+        return false;
+    }
+
+#ifdef MADV_SEQUENTIAL
+    madvise(ptr, size, MADV_SEQUENTIAL);
+#endif
+
+    _data = static_cast<const char*>(ptr);
+    _size = size;
+    return true;
+}
+
+void MemoryMappedFile::close()
+{
+    if (_data) munmap(const_cast<char*>(_data), _size);
+    _data = 0;
+    _size = 0;
+}
+
+#endif
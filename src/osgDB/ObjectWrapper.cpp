@@ -190,30 +190,45 @@ BaseSerializer* ObjectWrapper::getSerializer( const std::string& name, BaseSeria
     return NULL;
 }
 
-bool ObjectWrapper::read( InputStream& is, osg::Object& obj )
+void ObjectWrapper::collectSerializers( int version, ActiveSerializerList& serializers )
 {
-    bool readOK = true;
-    int inputVersion = is.getFileVersion(_domain);
     for ( SerializerList::iterator itr=_serializers.begin();
           itr!=_serializers.end(); ++itr )
     {
         BaseSerializer* serializer = itr->get();
-        if ( serializer->_firstVersion <= inputVersion &&
-             inputVersion <= serializer->_lastVersion &&
+        if ( serializer->_firstVersion <= version &&
+             version <= serializer->_lastVersion &&
              serializer->supportsReadWrite())
         {
-            if ( !serializer->read(is, obj) )
-            {
-                OSG_WARN << "ObjectWrapper::read(): Error reading property "
-                                    << _name << "::" << (*itr)->getName() << std::endl;
-                readOK = false;
-            }
+            serializers.push_back( serializer );
         }
         else
         {
             // OSG_NOTICE<<"Ignoring serializer due to version mismatch"<<std::endl;
         }
     }
+}
+
+bool ObjectWrapper::read( InputStream& is, osg::Object& obj )
+{
+    ActiveSerializerList serializers;
+    collectSerializers( is.getFileVersion(_domain), serializers );
+    return read( is, obj, serializers );
+}
+
+bool ObjectWrapper::read( InputStream& is, osg::Object& obj, const ActiveSerializerList& serializers )
+{
+    bool readOK = true;
+    for ( ActiveSerializerList::const_iterator itr=serializers.begin();
+          itr!=serializers.end(); ++itr )
+    {
+        if ( !(*itr)->read(is, obj) )
+        {
+            OSG_WARN << "ObjectWrapper::read(): Error reading property "
+                                << _name << "::" << (*itr)->getName() << std::endl;
+            readOK = false;
+        }
+    }
 
     for ( FinishedObjectReadCallbackList::iterator itr=_finishedObjectReadCallbacks.begin();
           itr!=_finishedObjectReadCallbacks.end();
@@ -226,27 +241,23 @@ bool ObjectWrapper::read( InputStream& is, osg::Object& obj )
 }
 
 bool ObjectWrapper::write( OutputStream& os, const osg::Object& obj )
+{
+    ActiveSerializerList serializers;
+    collectSerializers( os.getFileVersion(_domain), serializers );
+    return write( os, obj, serializers );
+}
+
+bool ObjectWrapper::write( OutputStream& os, const osg::Object& obj, const ActiveSerializerList& serializers )
 {
     bool writeOK = true;
-    int outputVersion = os.getFileVersion(_domain);
-    for ( SerializerList::iterator itr=_serializers.begin();
-          itr!=_serializers.end(); ++itr )
+    for ( ActiveSerializerList::const_iterator itr=serializers.begin();
+          itr!=serializers.end(); ++itr )
     {
-        BaseSerializer* serializer = itr->get();
-        if ( serializer->_firstVersion <= outputVersion &&
-             outputVersion <= serializer->_lastVersion  &&
-             serializer->supportsReadWrite())
+        if ( !(*itr)->write(os, obj) )
         {
-            if ( !serializer->write(os, obj) )
-            {
-                OSG_WARN << "ObjectWrapper::write(): Error writing property "
-                                    << _name << "::" << (*itr)->getName() << std::endl;
-                writeOK = false;
-            }
-        }
-        else
-        {
-            // OSG_NOTICE<<"Ignoring serializer due to version mismatch"<<std::endl;
+            OSG_WARN << "ObjectWrapper::write(): Error writing property "
+                                << _name << "::" << (*itr)->getName() << std::endl;
+            writeOK = false;
         }
     }
     return writeOK;
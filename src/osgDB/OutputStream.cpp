@@ -19,11 +19,12 @@
 #include <fstream>
 #include <sstream>
 #include <stdlib.h>
+#include <osg/Types>
 
 using namespace osgDB;
 
 OutputStream::OutputStream( const osgDB::Options* options )
-:   _writeImageHint(WRITE_USE_IMAGE_HINT), _useSchemaData(false), _useRobustBinaryFormat(true)
+:   _useClassTable(false), _classTableAtEnd(false), _targetFileVersion(OPENSCENEGRAPH_SOVERSION), _writeImageHint(WRITE_USE_IMAGE_HINT), _useSchemaData(false), _useRobustBinaryFormat(true)
 {
     BEGIN_BRACKET.set( "{", +INDENT_VALUE );
     END_BRACKET.set( "}", -INDENT_VALUE );
@@ -39,6 +40,12 @@ OutputStream::OutputStream( const osgDB::Options* options )
         _schemaName = options->getPluginStringData("SchemaFile");
     if ( !options->getPluginStringData("Compressor").empty() )
         _compressorName = options->getPluginStringData("Compressor");
+    if ( !options->getPluginStringData("TargetFileVersion").empty() )
+    {
+        int targetFileVersion = atoi(options->getPluginStringData("TargetFileVersion").c_str());
+        if ( targetFileVersion>0 && targetFileVersion<=OPENSCENEGRAPH_SOVERSION )
+            _targetFileVersion = targetFileVersion;
+    }
     if ( !options->getPluginStringData("WriteImageHint").empty() )
     {
         std::string hintString = options->getPluginStringData("WriteImageHint");
@@ -67,7 +74,7 @@ OutputStream::~OutputStream()
 
 int OutputStream::getFileVersion( const std::string& d ) const
 {
-    if ( d.empty() ) return OPENSCENEGRAPH_SOVERSION;
+    if ( d.empty() ) return _targetFileVersion;
     VersionMap::const_iterator itr = _domainVersionMap.find(d);
     return itr==_domainVersionMap.end() ? 0 : itr->second;
 }
@@ -438,7 +445,7 @@ void OutputStream::writeImage( const osg::Image* img )
     bool newID = false;
     unsigned int id = findOrCreateObjectID( img, newID );
 
-    *this << PROPERTY("ClassName") << name << std::endl;   // Write object name
+    *this << PROPERTY("ClassName"); writeClass( name ); *this << std::endl;   // Write object name
     *this << PROPERTY("UniqueID") << id << std::endl;      // Write image ID
     if ( getException() ) return;
 
@@ -585,7 +592,7 @@ void OutputStream::writeObject( const osg::Object* obj )
     bool newID = false;
     unsigned int id = findOrCreateObjectID( obj, newID );
 
-    *this << name << BEGIN_BRACKET << std::endl;       // Write object name
+    writeClass( name ); *this << BEGIN_BRACKET << std::endl;   // Write object name
     *this << PROPERTY("UniqueID") << id << std::endl;  // Write object ID
     if ( getException() ) return;
 
@@ -608,48 +615,20 @@ void OutputStream::writeObjectFields( const osg::Object* obj, const std::string&
 {
     // OSG_NOTICE<<"OutputStream::writeObjectFields("<<obj->className()<<", name="<<name<<")"<<std::endl;
 
-    ObjectWrapper* wrapper = Registry::instance()->getObjectWrapperManager()->findWrapper( name );
-    if ( !wrapper )
+    const ResolvedClass* resolvedClass = resolveClass( name );
+    if ( !resolvedClass->wrapper )
     {
         OSG_WARN << "OutputStream::writeObject(): Unsupported wrapper class "
                                 << name << std::endl;
         return;
     }
 
-    const StringList& associates = wrapper->getAssociates();
-    for ( StringList::const_iterator itr=associates.begin(); itr!=associates.end(); ++itr )
+    for ( ResolvedClass::AssociateList::const_iterator itr=resolvedClass->associates.begin();
+          itr!=resolvedClass->associates.end(); ++itr )
     {
-        const std::string& assocName = *itr;
-        ObjectWrapper* assocWrapper = Registry::instance()->getObjectWrapperManager()->findWrapper(assocName);
-        if ( !assocWrapper )
-        {
-            OSG_WARN << "OutputStream::writeObject(): Unsupported associated class "
-                                    << assocName << std::endl;
-            continue;
-        }
-        else if ( _useSchemaData )
-        {
-            if ( _inbuiltSchemaMap.find(assocName)==_inbuiltSchemaMap.end() )
-            {
-                StringList properties;
-                ObjectWrapper::TypeList types;
-                assocWrapper->writeSchema( properties, types );
+        _fields.push_back( itr->wrapper->getName() );
 
-                unsigned int size = osg::minimum( properties.size(), types.size() );
-                if ( size>0 )
-                {
-                    std::stringstream propertiesStream;
-                    for ( unsigned int i=0; i<size; ++i )
-                    {
-                        propertiesStream << properties[i] << ":" << types[i] << " ";
-                    }
-                    _inbuiltSchemaMap[assocName] = propertiesStream.str();
-                }
-            }
-        }
-        _fields.push_back( assocWrapper->getName() );
-
-        assocWrapper->write( *this, *obj );
+        itr->wrapper->write( *this, *obj, itr->serializers );
         if ( getException() ) return;
 
         _fields.pop_back();
@@ -668,7 +647,7 @@ void OutputStream::start( OutputIterator* outIterator, OutputStream::WriteType t
 
     if ( isBinary() )
     {
-        *this << (unsigned int)type << (unsigned int)OPENSCENEGRAPH_SOVERSION;
+        *this << (unsigned int)type << (unsigned int)_targetFileVersion;
 
         bool useCompressSource = false;
         unsigned int attributes = 0;
@@ -688,7 +667,25 @@ void OutputStream::start( OutputIterator* outIterator, OutputStream::WriteType t
         {
             outIterator->setSupportBinaryBrackets( true );
             attributes |= 0x4;
+
+            // From SOVERSION 116, bracket sizes may be 64-bit so blocks over 2GB can be skipped, only used when
+            // asked for as writers first try 32-bit sizes and write again with 64-bit ones if a block overflows
+            if ( _targetFileVersion>=116 && _options.valid() && _options->getPluginStringData("LargeBinaryBrackets")=="true" )
+            {
+                outIterator->setSupportLargeBinaryBrackets( true );
+                attributes |= 0x10;
+            }
         }
+
+        // From SOVERSION 116, write class names once per file and refer to them by ID afterwards
+        _useClassTable = _targetFileVersion>=116 && !(_options.valid() && _options->getPluginStringData("NoClassTable")=="true");
+        if ( _useClassTable ) attributes |= 0x8;
+
+        // From SOVERSION 116, with binary brackets the class table is written after the scene, so that
+        // readers may skip any block without missing class names first written inside it. Streams that
+        // can't seek back to fill in its offset, such as pipes and sockets, write each name where it is first used
+        _classTableAtEnd = _useClassTable && _useRobustBinaryFormat && _out->getStream()->tellp()!=std::streampos(-1);
+        if ( _classTableAtEnd ) attributes |= 0x20;
         *this << attributes;
 
         // Record all custom versions
@@ -726,6 +723,14 @@ void OutputStream::start( OutputIterator* outIterator, OutputStream::WriteType t
             _out->flush();
             _out->setStream( &_compressSource );
         }
+
+        // Reserve space for the offset of the class table from here, filled in by compress()
+        if ( _classTableAtEnd )
+        {
+            int64_t offset = 0;
+            _classTableOffsetPosition = _out->getStream()->tellp();
+            _out->writeCharArray( (char*)&offset, INT64_SIZE );
+        }
     }
     else
     {
@@ -739,7 +744,7 @@ void OutputStream::start( OutputIterator* outIterator, OutputStream::WriteType t
         }
 
         *this << typeString << std::endl;
-        *this << PROPERTY("#Version") << (unsigned int)OPENSCENEGRAPH_SOVERSION << std::endl;
+        *this << PROPERTY("#Version") << (unsigned int)_targetFileVersion << std::endl;
         *this << PROPERTY("#Generator") << std::string("OpenSceneGraph")
               << std::string(osgGetVersion()) << std::endl;
         if ( _domainVersionMap.size()>0 )
@@ -760,6 +765,20 @@ void OutputStream::compress( std::ostream* ostream )
     _fields.clear();
     if ( !isBinary() ) return;
 
+    if ( _out->getBinaryBracketOverflow() )
+    {
+        throwException( "OutputStream: A block exceeds 2GB, which requires the LargeBinaryBrackets option and file version 116 or later." );
+        return;
+    }
+
+    if ( _classTableAtEnd )
+    {
+        _fields.push_back( "ClassTable" );
+        writeClassTable();
+        _fields.pop_back();
+        if ( getException() ) return;
+    }
+
     std::stringstream schemaSource;
     if ( _useSchemaData )
     {
@@ -830,6 +849,99 @@ void OutputStream::writeSchema( std::ostream& fout )
 
 // PROTECTED METHODS
 
+void OutputStream::writeClass( const std::string& name )
+{
+    if ( !_useClassTable )
+    {
+        *this << name;
+        return;
+    }
+
+    ClassIDMap::iterator itr = _classIDMap.find( name );
+    if ( itr!=_classIDMap.end() )
+    {
+        *this << itr->second;
+        return;
+    }
+
+    unsigned int classID = _classIDMap.size();
+    _classIDMap[name] = classID;
+    *this << classID;
+    if ( !_classTableAtEnd ) *this << name;
+}
+
+void OutputStream::writeClassTable()
+{
+    std::ostream* out = _out->getStream();
+    std::streampos tablePosition = out->tellp();
+
+    StringList classNames( _classIDMap.size() );
+    for ( ClassIDMap::iterator itr=_classIDMap.begin(); itr!=_classIDMap.end(); ++itr )
+        classNames[itr->second] = itr->first;
+
+    *this << (unsigned int)classNames.size();
+    for ( StringList::iterator itr=classNames.begin(); itr!=classNames.end(); ++itr )
+        *this << *itr;
+
+    std::streampos endPosition = out->tellp();
+    int64_t offset = (int64_t)(tablePosition - _classTableOffsetPosition);
+    out->seekp( _classTableOffsetPosition );
+    _out->writeCharArray( (char*)&offset, INT64_SIZE );
+    out->seekp( endPosition );
+    if ( out->fail() ) throwException( "OutputStream: Failed to write class table." );
+}
+
+const ResolvedClass* OutputStream::resolveClass( const std::string& name )
+{
+    ResolvedClassMap::iterator itr = _resolvedClassMap.find( name );
+    if ( itr!=_resolvedClassMap.end() ) return &(itr->second);
+
+    ResolvedClass& resolvedClass = _resolvedClassMap[name];
+    resolvedClass.name = name;
+
+    ObjectWrapperManager* wrapperManager = Registry::instance()->getObjectWrapperManager();
+    resolvedClass.wrapper = wrapperManager->findWrapper( name );
+    if ( !resolvedClass.wrapper ) return &resolvedClass;
+
+    const StringList& associates = resolvedClass.wrapper->getAssociates();
+    for ( StringList::const_iterator aitr=associates.begin(); aitr!=associates.end(); ++aitr )
+    {
+        const std::string& assocName = *aitr;
+        ObjectWrapper* assocWrapper = wrapperManager->findWrapper(assocName);
+        if ( !assocWrapper )
+        {
+            OSG_WARN << "OutputStream::writeObject(): Unsupported associated class "
+                                    << assocName << std::endl;
+            continue;
+        }
+        else if ( _useSchemaData )
+        {
+            if ( _inbuiltSchemaMap.find(assocName)==_inbuiltSchemaMap.end() )
+            {
+                StringList properties;
+                ObjectWrapper::TypeList types;
+                assocWrapper->writeSchema( properties, types );
+
+                unsigned int size = osg::minimum( properties.size(), types.size() );
+                if ( size>0 )
+                {
+                    std::stringstream propertiesStream;
+                    for ( unsigned int i=0; i<size; ++i )
+                    {
+                        propertiesStream << properties[i] << ":" << types[i] << " ";
+                    }
+                    _inbuiltSchemaMap[assocName] = propertiesStream.str();
+                }
+            }
+        }
+
+        resolvedClass.associates.push_back( ResolvedClass::Associate() );
+        resolvedClass.associates.back().wrapper = assocWrapper;
+        assocWrapper->collectSerializers( getFileVersion(assocWrapper->getDomain()), resolvedClass.associates.back().serializers );
+    }
+    return &resolvedClass;
+}
+
 template<typename T>
 void OutputStream::writeArrayImplementation( const T* a, int write_size, unsigned int numInRow )
 {
@@ -13,6 +13,7 @@
 
 #include <osgDB/StreamOperator>
 #include <osgDB/InputStream>
+#include <osgDB/MemoryMappedFile>
 
 using namespace osgDB;
 
@@ -38,6 +39,12 @@ void InputIterator::readComponentArray( char* s, unsigned int numElements, unsig
     }
 }
 
+const char* InputIterator::readCharArrayInPlace( unsigned int size )
+{
+    MemoryStreamBuffer* buffer = _in ? dynamic_cast<MemoryStreamBuffer*>(_in->rdbuf()) : 0;
+    return buffer ? buffer->readInPlace( size ) : 0;
+}
+
 void InputIterator::throwException( const std::string& msg )
 {
     if (_inputStream) _inputStream->throwException(msg);
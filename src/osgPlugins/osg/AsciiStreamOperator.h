@@ -318,6 +318,15 @@ public:
         }
     }
 
+    virtual bool canAdvanceToCurrentEndBracket() const { return true; }
+
+    virtual bool isAtCurrentEndBracket()
+    {
+        if ( _preReadString.empty() )
+            *_in >> _preReadString;
+        return _preReadString=="}";
+    }
+
 protected:
     void getCharacter( char& ch )
     {
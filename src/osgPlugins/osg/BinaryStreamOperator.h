@@ -4,6 +4,7 @@
 #include <osgDB/StreamOperator>
 #include <osg/Types>
 #include <vector>
+#include <limits.h>
 
 
 class BinaryOutputIterator : public osgDB::OutputIterator
@@ -78,9 +79,9 @@ public:
         {
             if ( mark._name=="{" )
             {
-                int size = 0;
+                int64_t size = 0;
                 _beginPositions.push_back( _out->tellp() );
-                _out->write( (char*)&size, osgDB::INT_SIZE );
+                _out->write( (char*)&size, _supportLargeBinaryBrackets ? osgDB::INT64_SIZE : osgDB::INT_SIZE );
             }
             else if ( mark._name=="}" && _beginPositions.size()>0 )
             {
@@ -89,8 +90,18 @@ public:
                 _out->seekp( beginPos );
 
                 std::streampos size64 = pos - beginPos;
-                int size = (int) size64;
-                _out->write( (char*)&size, osgDB::INT_SIZE );
+                if ( _supportLargeBinaryBrackets )
+                {
+                    int64_t size = (int64_t) size64;
+                    _out->write( (char*)&size, osgDB::INT64_SIZE );
+                }
+                else
+                {
+                    if ( (int64_t)size64>INT_MAX ) _binaryBracketOverflow = true;
+
+                    int size = (int) size64;
+                    _out->write( (char*)&size, osgDB::INT_SIZE );
+                }
                 _out->seekp( pos );
             }
         }
@@ -232,12 +243,22 @@ public:
         {
             if ( mark._name=="{" )
             {
-                int size = 0;
                 _beginPositions.push_back( _in->tellg() );
 
-                _in->read( (char*)&size, osgDB::INT_SIZE );
-                if ( _byteSwap ) osg::swapBytes( (char*)&size, osgDB::INT_SIZE );
-                _blockSizes.push_back( size );
+                if ( _supportLargeBinaryBrackets )
+                {
+                    int64_t size = 0;
+                    _in->read( (char*)&size, osgDB::INT64_SIZE );
+                    if ( _byteSwap ) osg::swapBytes( (char*)&size, osgDB::INT64_SIZE );
+                    _blockSizes.push_back( size );
+                }
+                else
+                {
+                    int size = 0;
+                    _in->read( (char*)&size, osgDB::INT_SIZE );
+                    if ( _byteSwap ) osg::swapBytes( (char*)&size, osgDB::INT_SIZE );
+                    _blockSizes.push_back( size );
+                }
             }
             else if ( mark._name=="}" && _beginPositions.size()>0 )
             {
@@ -258,16 +279,27 @@ public:
         if ( _supportBinaryBrackets && _beginPositions.size()>0 )
         {
             std::streampos position(_beginPositions.back());
-            position += _blockSizes.back();
+            position += std::streamoff(_blockSizes.back());
             _in->seekg( position );
             _beginPositions.pop_back();
             _blockSizes.pop_back();
         }
     }
 
+    virtual bool canAdvanceToCurrentEndBracket() const { return _supportBinaryBrackets; }
+
+    virtual bool isAtCurrentEndBracket()
+    {
+        if ( !_supportBinaryBrackets || _beginPositions.empty() ) return false;
+
+        std::streampos position(_beginPositions.back());
+        position += std::streamoff(_blockSizes.back());
+        return _in->tellg()>=position;
+    }
+
 protected:
     std::vector<std::streampos> _beginPositions;
-    std::vector<int> _blockSizes;
+    std::vector<int64_t> _blockSizes;
 };
 
 #endif
@@ -16,6 +16,8 @@
 #include <osgDB/FileUtils>
 #include <osgDB/Registry>
 #include <osgDB/ObjectWrapper>
+#include <osgDB/MemoryMappedFile>
+#include <osgDB/fstream>
 #include <stdlib.h>
 #include "AsciiStreamOperator.h"
 #include "BinaryStreamOperator.h"
@@ -115,6 +117,36 @@ OutputIterator* writeOutputIterator( std::ostream& fout, const Options* options
     }
 }
 
+// Input file stream that memory maps binary files, so that arrays are copied straight from the mapping, falling back
+// to osgDB::ifstream for other files, when the NoMemoryMapping option is set or when the file can't be mapped.
+class InputFileStream
+{
+public:
+    InputFileStream( const std::string& fileName, std::ios::openmode mode, const Options* options )
+    :   _mappedStream(&_mappedBuffer)
+    {
+        if ( (mode&std::ios::binary) && !(options && options->getPluginStringData("NoMemoryMapping")=="true") )
+        {
+            _mappedFile = new MemoryMappedFile;
+            if ( _mappedFile->open(fileName) )
+            {
+                _mappedBuffer.setBuffer( _mappedFile->data(), _mappedFile->size() );
+                return;
+            }
+            _mappedFile = 0;
+        }
+        _fileStream.open( fileName.c_str(), mode );
+    }
+
+    std::istream& getStream() { return _mappedFile.valid() ? _mappedStream : _fileStream; }
+
+protected:
+    osg::ref_ptr<MemoryMappedFile> _mappedFile;
+    MemoryStreamBuffer _mappedBuffer;
+    std::istream _mappedStream;
+    osgDB::ifstream _fileStream;
+};
+
 class ReaderWriterOSG2 : public osgDB::ReaderWriter
 {
 public:
@@ -128,9 +160,13 @@ public:
         supportsOption( "Ascii", "Import/Export option: Force reading/writing ascii file" );
         supportsOption( "XML", "Import/Export option: Force reading/writing XML file" );
         supportsOption( "ForceReadingImage", "Import option: Load an empty image instead if required file missed" );
+        supportsOption( "NoMemoryMapping", "Import option: Read binary files through a file stream rather than memory mapping them" );
         supportsOption( "SchemaData", "Export option: Record inbuilt schema data into a binary file" );
+        supportsOption( "NoClassTable", "Export option: Write the class name of every object to binary files in full rather than using a class table" );
+        supportsOption( "LargeBinaryBrackets", "Export option: Record the size of every block of binary files in 64 bits, otherwise only done when a block exceeds 2GB" );
+        supportsOption( "TargetFileVersion=<version>", "Export option: Write a file that releases with the given SOVERSION can read, leaving out the class table and serializers added since" );
         supportsOption( "SchemaFile=<file>", "Import/Export option: Use/Record an ascii schema file" );
-        supportsOption( "Compressor=<name>", "Export option: Use an inbuilt or user-defined compressor" );
+        supportsOption( "Compressor=<name>", "Export option: Use an inbuilt or user-defined compressor, the inbuilt compressors are zlib, zstd and lz4 when built with their libraries" );
         supportsOption( "WriteImageHint=<hint>", "Export option: Hint of writing image to stream: "
                         "<IncludeData> writes Image::data() directly; "
                         "<IncludeFile> writes the image file itself to stream; "
@@ -182,8 +218,8 @@ public:
         Options* local_opt = prepareReading( result, fileName, mode, options );
         if ( !result.success() ) return result;
 
-        osgDB::ifstream istream( fileName.c_str(), mode );
-        return readObject( istream, local_opt );
+        InputFileStream istream( fileName, mode, local_opt );
+        return readObject( istream.getStream(), local_opt );
     }
 
     virtual ReadResult readObject( std::istream& fin, const Options* options ) const
@@ -213,8 +249,8 @@ public:
         Options* local_opt = prepareReading( result, fileName, mode, options );
         if ( !result.success() ) return result;
 
-        osgDB::ifstream istream( fileName.c_str(), mode );
-        return readImage( istream, local_opt );
+        InputFileStream istream( fileName, mode, local_opt );
+        return readImage( istream.getStream(), local_opt );
     }
 
     virtual ReadResult readImage( std::istream& fin, const Options* options ) const
@@ -244,8 +280,8 @@ public:
         Options* local_opt = prepareReading( result, fileName, mode, options );
         if ( !result.success() ) return result;
 
-        osgDB::ifstream istream( fileName.c_str(), mode );
-        return readNode( istream, local_opt );
+        InputFileStream istream( fileName, mode, local_opt );
+        return readNode( istream.getStream(), local_opt );
     }
 
     virtual ReadResult readNode( std::istream& fin, const Options* options ) const
@@ -290,6 +326,21 @@ public:
         return local_opt.release();
     }
 
+    // Rewind fout to start and return options for writing it again with 64-bit bracket sizes, after a block was too
+    // large for 32-bit ones. Returns 0 if they were already used or fout can't be rewound.
+    Options* prepareLargeBinaryBrackets( std::ostream& fout, std::streampos start, const Options* options ) const
+    {
+        if ( options && options->getPluginStringData("LargeBinaryBrackets")=="true" ) return 0;
+        if ( start==std::streampos(-1) || fout.fail() ) return 0;
+
+        fout.seekp( start );
+        if ( fout.fail() ) return 0;
+
+        osg::ref_ptr<Options> local_opt = options ? static_cast<Options*>(options->clone(osg::CopyOp::SHALLOW_COPY)) : new Options;
+        local_opt->setPluginStringData( "LargeBinaryBrackets", "true" );
+        return local_opt.release();
+    }
+
     virtual WriteResult writeObject( const osg::Object& object, const std::string& fileName, const Options* options ) const
     {
         WriteResult result = WriteResult::FILE_SAVED;
@@ -307,11 +358,17 @@ public:
 
     virtual WriteResult writeObject( const osg::Object& object, std::ostream& fout, const Options* options ) const
     {
+        std::streampos start = fout.tellp();
         osg::ref_ptr<OutputIterator> oi = writeOutputIterator(fout, options);
 
         OutputStream os( options );
         os.start( oi.get(), OutputStream::WRITE_OBJECT ); CATCH_EXCEPTION(os);
         os.writeObject( &object ); CATCH_EXCEPTION(os);
+        if ( oi->getBinaryBracketOverflow() )
+        {
+            osg::ref_ptr<Options> local_opt = prepareLargeBinaryBrackets( fout, start, options );
+            if ( local_opt.valid() ) return writeObject( object, fout, local_opt.get() );
+        }
         os.compress( &fout ); CATCH_EXCEPTION(os);
 
         oi->flush();
@@ -343,11 +400,17 @@ public:
 
     virtual WriteResult writeImage( const osg::Image& image, std::ostream& fout, const Options* options ) const
     {
+        std::streampos start = fout.tellp();
         osg::ref_ptr<OutputIterator> oi = writeOutputIterator(fout, options);
 
         OutputStream os( options );
         os.start( oi.get(), OutputStream::WRITE_IMAGE ); CATCH_EXCEPTION(os);
         os.writeImage( &image ); CATCH_EXCEPTION(os);
+        if ( oi->getBinaryBracketOverflow() )
+        {
+            osg::ref_ptr<Options> local_opt = prepareLargeBinaryBrackets( fout, start, options );
+            if ( local_opt.valid() ) return writeImage( image, fout, local_opt.get() );
+        }
         os.compress( &fout ); CATCH_EXCEPTION(os);
 
         oi->flush();
@@ -379,11 +442,17 @@ public:
 
     virtual WriteResult writeNode( const osg::Node& node, std::ostream& fout, const Options* options ) const
     {
+        std::streampos start = fout.tellp();
         osg::ref_ptr<OutputIterator> oi = writeOutputIterator(fout, options);
 
         OutputStream os( options );
         os.start( oi.get(), OutputStream::WRITE_SCENE ); CATCH_EXCEPTION(os);
         os.writeObject( &node ); CATCH_EXCEPTION(os);
+        if ( oi->getBinaryBracketOverflow() )
+        {
+            osg::ref_ptr<Options> local_opt = prepareLargeBinaryBrackets( fout, start, options );
+            if ( local_opt.valid() ) return writeNode( node, fout, local_opt.get() );
+        }
         os.compress( &fout ); CATCH_EXCEPTION(os);
 
         oi->flush();
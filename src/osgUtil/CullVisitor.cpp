@@ -26,12 +26,16 @@
 #include <osg/LineSegment>
 #include <osg/TemplatePrimitiveFunctor>
 #include <osg/Geometry>
+#include <osg/OperationThread>
 #include <osg/io_utils>
 
 #include <osgUtil/CullVisitor>
 
+#include "ThreadPool.h"
+
 #include <float.h>
 #include <algorithm>
+#include <typeinfo>
 
 #include <osg/Timer>
 
@@ -52,9 +56,14 @@ CullVisitor::CullVisitor():
     _computed_znear(FLT_MAX),
     _computed_zfar(-FLT_MAX),
     _currentReuseRenderLeafIndex(0),
-    _numberOfEncloseOverrideRenderBinDetails(0)
+    _numberOfEncloseOverrideRenderBinDetails(0),
+    _parallelCullGroup(0),
+    _parallelCullNextSubgraph(0),
+    _numParallelCullSubgraphs(0),
+    _parallelCullMergeTime(0.0)
 {
     _identifier = new Identifier;
+    _frameArena = new FrameArena;
 }
 
 CullVisitor::CullVisitor(const CullVisitor& rhs):
@@ -67,8 +76,13 @@ CullVisitor::CullVisitor(const CullVisitor& rhs):
     _computed_zfar(-FLT_MAX),
     _currentReuseRenderLeafIndex(0),
     _numberOfEncloseOverrideRenderBinDetails(0),
-    _identifier(rhs._identifier)
+    _identifier(rhs._identifier),
+    _parallelCullGroup(0),
+    _parallelCullNextSubgraph(0),
+    _numParallelCullSubgraphs(0),
+    _parallelCullMergeTime(0.0)
 {
+    _frameArena = new FrameArena;
 }
 
 CullVisitor::~CullVisitor()
@@ -98,6 +112,9 @@ void CullVisitor::reset()
 
     CullStack::reset();
 
+    _frameArena->reset();
+    _frameArena->trim();
+
     _renderBinStack.clear();
 
     _numberOfEncloseOverrideRenderBinDetails = 0;
@@ -132,6 +149,41 @@ void CullVisitor::reset()
 
     _nearPlaneCandidateMap.clear();
     _farPlaneCandidateMap.clear();
+
+    // reset the parallel cull workers, which own the RenderLeaf objects of the subgraphs they culled last frame.
+    for(CullVisitorList::iterator itr = _parallelCullWorkers.begin();
+        itr != _parallelCullWorkers.end();
+        ++itr)
+    {
+        (*itr)->reset();
+    }
+
+    _numParallelCullSubgraphs = 0;
+    _parallelCullMergeTime = 0.0;
+}
+
+unsigned int CullVisitor::getNumberOfFrameAllocations() const
+{
+    unsigned int numAllocations = _frameArena->getNumberOfAllocations() + getNumberOfMatrixAllocations();
+    for(CullVisitorList::const_iterator itr = _parallelCullWorkers.begin();
+        itr != _parallelCullWorkers.end();
+        ++itr)
+    {
+        numAllocations += (*itr)->getNumberOfFrameAllocations();
+    }
+    return numAllocations;
+}
+
+unsigned int CullVisitor::getNumberOfFrameReuses() const
+{
+    unsigned int numReuses = _frameArena->getNumberOfReuses() + getNumberOfMatrixReuses();
+    for(CullVisitorList::const_iterator itr = _parallelCullWorkers.begin();
+        itr != _parallelCullWorkers.end();
+        ++itr)
+    {
+        numReuses += (*itr)->getNumberOfFrameReuses();
+    }
+    return numReuses;
 }
 
 float CullVisitor::getDistanceToEyePoint(const Vec3& pos, bool withLODScale) const
@@ -1218,7 +1270,8 @@ void CullVisitor::apply(Group& node)
     StateSet* node_state = node.getStateSet();
     if (node_state) pushStateSet(node_state);
 
-    handle_cull_callbacks_and_traverse(node);
+    if (isParallelCullGroup(node)) parallelCull(node);
+    else handle_cull_callbacks_and_traverse(node);
 
     // pop the node's state off the render graph stack.
     if (node_state) popStateSet();
@@ -1227,6 +1280,304 @@ void CullVisitor::apply(Group& node)
     popCurrentMask();
 }
 
+struct CullVisitor::ParallelCullOperation : public ThreadPool::Work
+{
+    ParallelCullOperation(CullVisitor* cullVisitor):
+        _cullVisitor(cullVisitor) {}
+
+    virtual void operator () (unsigned int threadIndex)
+    {
+        _cullVisitor->parallelCullSubgraphs(threadIndex);
+    }
+
+    CullVisitor*                        _cullVisitor;
+};
+
+bool CullVisitor::isParallelCullGroup(const osg::Group& group) const
+{
+    return (group.getNodeMask() & _parallelCullMask)!=0 &&
+           _numParallelCullThreads!=1 &&
+           group.getNumChildren()>1 &&
+           !group.getCullCallback() &&
+           typeid(group)==typeid(osg::Group);
+}
+
+void CullVisitor::parallelCull(osg::Group& group)
+{
+    unsigned int numChildren = group.getNumChildren();
+    unsigned int numThreads = _numParallelCullThreads>0 ? _numParallelCullThreads : OpenThreads::GetNumberOfProcessors();
+
+    // split the children into several subgraphs per thread so threads that finish early can balance the load.
+    unsigned int numSubgraphs = osg::minimum(numChildren, numThreads*4);
+    numThreads = osg::maximum(1u, osg::minimum(numThreads, numSubgraphs));
+
+    // compute any dirty bounds up front, so the parallel cull threads only ever read them.
+    for(unsigned int i=0; i<numChildren; ++i)
+    {
+        group.getChild(i)->getBound();
+    }
+
+    while(_parallelCullWorkers.size()<numThreads)
+    {
+        _parallelCullWorkers.push_back(clone());
+    }
+
+    _parallelCullGroup = &group;
+    _parallelCullSubgraphs.resize(numSubgraphs);
+    for(unsigned int i=0; i<numSubgraphs; ++i)
+    {
+        _parallelCullSubgraphs[i]._begin = (numChildren*i)/numSubgraphs;
+        _parallelCullSubgraphs[i]._end = (numChildren*(i+1))/numSubgraphs;
+    }
+    _parallelCullNextSubgraph.exchange(0);
+
+    // cull subgraphs in this thread too, each thread using the worker CullVisitor of its index.
+    ParallelCullOperation operation(this);
+    ThreadPool::instance()->run(operation, numThreads);
+
+    // merge in child order so the results match those of a serial traversal.
+    osg::Timer_t startTick = osg::Timer::instance()->tick();
+
+    for(ParallelCullSubgraphs::iterator itr = _parallelCullSubgraphs.begin();
+        itr != _parallelCullSubgraphs.end();
+        ++itr)
+    {
+        mergeParallelCullSubgraph(*itr);
+    }
+
+    _parallelCullMergeTime += osg::Timer::instance()->delta_s(startTick, osg::Timer::instance()->tick());
+    _numParallelCullSubgraphs += numSubgraphs;
+    _parallelCullGroup = 0;
+}
+
+void CullVisitor::parallelCullSubgraphs(unsigned int workerIndex)
+{
+    CullVisitor* worker = _parallelCullWorkers[workerIndex].get();
+    bool copiedState = false;
+
+    for(;;)
+    {
+        unsigned int subgraphIndex = (++_parallelCullNextSubgraph)-1;
+        if (subgraphIndex>=_parallelCullSubgraphs.size()) break;
+
+        if (!copiedState)
+        {
+            worker->copyParallelCullState(*this);
+            copiedState = true;
+        }
+
+        worker->cullParallelSubgraph(*this, *_parallelCullGroup, _parallelCullSubgraphs[subgraphIndex]);
+    }
+}
+
+void CullVisitor::copyParallelCullState(CullVisitor& cv)
+{
+    // workers never fork nested parallel cull Groups themselves.
+    setCullSettings(cv);
+    _parallelCullMask = 0x0;
+
+    setTraversalMode(cv.getTraversalMode());
+    setTraversalMask(cv.getTraversalMask());
+    setNodeMaskOverride(cv.getNodeMaskOverride());
+    setTraversalNumber(cv.getTraversalNumber());
+    _frameStamp = cv._frameStamp;
+    _databaseRequestHandler = cv._databaseRequestHandler;
+    _imageRequestHandler = cv._imageRequestHandler;
+    _nodePath = cv._nodePath;
+
+    _renderInfo = cv._renderInfo;
+    _identifier = cv._identifier;
+    _numberOfEncloseOverrideRenderBinDetails = cv._numberOfEncloseOverrideRenderBinDetails;
+
+    _projectionStack = cv._projectionStack;
+    _modelviewStack = cv._modelviewStack;
+    _MVPW_Stack = cv._MVPW_Stack;
+    _viewportStack = cv._viewportStack;
+    _referenceViewPoints = cv._referenceViewPoints;
+    _eyePointStack = cv._eyePointStack;
+    _viewPointStack = cv._viewPointStack;
+    _clipspaceCullingStack = cv._clipspaceCullingStack;
+    _projectionCullingStack = cv._projectionCullingStack;
+
+    // only the entries below the index are in use, the rest are kept for reuse.
+    _index_modelviewCullingStack = cv._index_modelviewCullingStack;
+    if (_modelviewCullingStack.size()<_index_modelviewCullingStack) _modelviewCullingStack.resize(_index_modelviewCullingStack);
+    std::copy(cv._modelviewCullingStack.begin(), cv._modelviewCullingStack.begin()+_index_modelviewCullingStack, _modelviewCullingStack.begin());
+    _back_modelviewCullingStack = _index_modelviewCullingStack>0 ? &_modelviewCullingStack[_index_modelviewCullingStack-1] : 0;
+
+    _frustumVolume = cv._frustumVolume;
+    _bbCornerNear = cv._bbCornerNear;
+    _bbCornerFar = cv._bbCornerFar;
+}
+
+void CullVisitor::cullParallelSubgraph(CullVisitor& cv, osg::Group& group, ParallelCullSubgraph& subgraph)
+{
+    // replicate the current RenderStage of cv and the path of RenderBins down to its current RenderBin.
+    RenderStage* renderStage = cv._currentRenderBin->getStage();
+    std::vector<RenderBin*> renderBinPath;
+    for(RenderBin* rb = cv._currentRenderBin; rb!=renderStage; rb = rb->getParent())
+    {
+        renderBinPath.push_back(rb);
+    }
+
+    subgraph._renderStage = new RenderStage;
+    subgraph._renderStage->setCamera(renderStage->getCamera());
+
+    _rootRenderStage = subgraph._renderStage;
+    _currentRenderBin = subgraph._renderStage.get();
+    for(std::vector<RenderBin*>::reverse_iterator itr = renderBinPath.rbegin();
+        itr != renderBinPath.rend();
+        ++itr)
+    {
+        _currentRenderBin = _currentRenderBin->find_or_insert(*itr);
+    }
+    _renderBinStack.clear();
+
+    // replicate the path of StateGraphs of cv down to its current StateGraph.
+    std::vector<const osg::StateSet*> stateSetPath;
+    StateGraph* rootStateGraph = cv._currentStateGraph;
+    for(; rootStateGraph->_parent; rootStateGraph = rootStateGraph->_parent)
+    {
+        stateSetPath.push_back(rootStateGraph->getStateSet());
+    }
+
+    subgraph._rootStateGraph = rootStateGraph->getStateSet() ? new StateGraph(0, rootStateGraph->getStateSet()) : new StateGraph;
+
+    _rootStateGraph = subgraph._rootStateGraph;
+    _currentStateGraph = subgraph._rootStateGraph.get();
+    for(std::vector<const osg::StateSet*>::reverse_iterator itr = stateSetPath.rbegin();
+        itr != stateSetPath.rend();
+        ++itr)
+    {
+        _currentStateGraph = _currentStateGraph->find_or_insert(*itr);
+    }
+
+    _traversalNumber = 0;
+    _computed_znear = FLT_MAX;
+    _computed_zfar = -FLT_MAX;
+    _nearPlaneCandidateMap.clear();
+    _farPlaneCandidateMap.clear();
+
+    for(unsigned int i=subgraph._begin; i<subgraph._end; ++i)
+    {
+        group.getChild(i)->accept(*this);
+    }
+
+    subgraph._numRenderLeaves = _traversalNumber;
+    subgraph._computed_znear = _computed_znear;
+    subgraph._computed_zfar = _computed_zfar;
+    subgraph._nearPlaneCandidateMap.swap(_nearPlaneCandidateMap);
+    subgraph._farPlaneCandidateMap.swap(_farPlaneCandidateMap);
+
+    // leave the fragments to be owned by the subgraph alone.
+    _rootRenderStage = 0;
+    _currentRenderBin = 0;
+    _rootStateGraph = 0;
+    _currentStateGraph = 0;
+}
+
+void CullVisitor::mergeParallelCullSubgraph(ParallelCullSubgraph& subgraph)
+{
+    RenderStage* renderStage = _currentRenderBin->getStage();
+
+    StateGraphMap stateGraphMap;
+    mergeParallelCullRenderBin(subgraph._renderStage.get(), renderStage, _traversalNumber, stateGraphMap);
+    _traversalNumber += subgraph._numRenderLeaves;
+
+    PositionalStateContainer* source = subgraph._renderStage->getPositionalStateContainer();
+    PositionalStateContainer* destination = renderStage->getPositionalStateContainer();
+    destination->getAttrMatrixList().insert(destination->getAttrMatrixList().end(),
+                                            source->getAttrMatrixList().begin(), source->getAttrMatrixList().end());
+    for(PositionalStateContainer::TexUnitAttrMatrixListMap::iterator itr = source->getTexUnitAttrMatrixListMap().begin();
+        itr != source->getTexUnitAttrMatrixListMap().end();
+        ++itr)
+    {
+        PositionalStateContainer::AttrMatrixList& attrMatrixList = destination->getTexUnitAttrMatrixListMap()[itr->first];
+        attrMatrixList.insert(attrMatrixList.end(), itr->second.begin(), itr->second.end());
+    }
+
+    if (subgraph._computed_znear<_computed_znear) _computed_znear = subgraph._computed_znear;
+    if (subgraph._computed_zfar>_computed_zfar) _computed_zfar = subgraph._computed_zfar;
+    _nearPlaneCandidateMap.insert(subgraph._nearPlaneCandidateMap.begin(), subgraph._nearPlaneCandidateMap.end());
+    _farPlaneCandidateMap.insert(subgraph._farPlaneCandidateMap.begin(), subgraph._farPlaneCandidateMap.end());
+
+    subgraph._renderStage = 0;
+    subgraph._rootStateGraph = 0;
+    subgraph._nearPlaneCandidateMap.clear();
+    subgraph._farPlaneCandidateMap.clear();
+}
+
+void CullVisitor::mergeParallelCullRenderBin(RenderBin* source, RenderBin* destination, unsigned int traversalNumberOffset, StateGraphMap& stateGraphMap)
+{
+    // move the RenderLeaves onto the equivalent StateGraphs of this CullVisitor, adding them to the destination
+    // as addDrawable() would. When source and destination are the same bin, as for render to texture RenderStages,
+    // this just moves the bin's StateGraphs.
+    RenderBin::StateGraphList stateGraphList;
+    stateGraphList.swap(source->getStateGraphList());
+    for(RenderBin::StateGraphList::iterator itr = stateGraphList.begin();
+        itr != stateGraphList.end();
+        ++itr)
+    {
+        StateGraph* sg = *itr;
+        StateGraph* destinationStateGraph = findParallelCullStateGraph(sg, stateGraphMap);
+        if (destinationStateGraph->leaves_empty()) destination->addStateGraph(destinationStateGraph);
+
+        for(StateGraph::LeafList::iterator litr = sg->_leaves.begin();
+            litr != sg->_leaves.end();
+            ++litr)
+        {
+            (*litr)->_traversalNumber += traversalNumberOffset;
+            destinationStateGraph->addLeaf(litr->get());
+        }
+
+        // release the worker's references so it can reuse its RenderLeaves next frame.
+        sg->_leaves.clear();
+    }
+
+    for(RenderBin::RenderBinList::iterator itr = source->getRenderBinList().begin();
+        itr != source->getRenderBinList().end();
+        ++itr)
+    {
+        RenderBin* bin = itr->second.get();
+        mergeParallelCullRenderBin(bin, source==destination ? bin : destination->find_or_insert(bin), traversalNumberOffset, stateGraphMap);
+    }
+
+    // render to texture RenderStages are merged in place, then moved across if their parent RenderStage is a fragment.
+    RenderStage* sourceStage = dynamic_cast<RenderStage*>(source);
+    if (sourceStage)
+    {
+        RenderStage* destinationStage = destination->getStage();
+        for(RenderStage::RenderStageList::iterator itr = sourceStage->getPreRenderList().begin();
+            itr != sourceStage->getPreRenderList().end();
+            ++itr)
+        {
+            mergeParallelCullRenderBin(itr->second.get(), itr->second.get(), traversalNumberOffset, stateGraphMap);
+            if (destinationStage!=sourceStage) destinationStage->addPreRenderStage(itr->second.get(), itr->first);
+        }
+
+        for(RenderStage::RenderStageList::iterator itr = sourceStage->getPostRenderList().begin();
+            itr != sourceStage->getPostRenderList().end();
+            ++itr)
+        {
+            mergeParallelCullRenderBin(itr->second.get(), itr->second.get(), traversalNumberOffset, stateGraphMap);
+            if (destinationStage!=sourceStage) destinationStage->addPostRenderStage(itr->second.get(), itr->first);
+        }
+    }
+}
+
+StateGraph* CullVisitor::findParallelCullStateGraph(StateGraph* sg, StateGraphMap& stateGraphMap)
+{
+    // the fragment's root replicates the root StateGraph.
+    if (!sg->_parent) return _rootStateGraph.get();
+
+    StateGraphMap::iterator itr = stateGraphMap.find(sg);
+    if (itr!=stateGraphMap.end()) return itr->second;
+
+    StateGraph* destinationStateGraph = findParallelCullStateGraph(sg->_parent, stateGraphMap)->find_or_insert(sg->getStateSet());
+    stateGraphMap[sg] = destinationStateGraph;
+    return destinationStateGraph;
+}
+
 void CullVisitor::apply(Transform& node)
 {
     if (isCulled(node)) return;
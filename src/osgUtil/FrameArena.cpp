@@ -0,0 +1,67 @@
+/* -*-c++-*- OpenSceneGraph - Copyright (C) 1998-2006 Robert Osfield
+ *
+ * This library is open source and may be redistributed and/or modified under
+ * the terms of the OpenSceneGraph Public License (OSGPL) version 0.0 or
+ * (at your option) any later version.  The full license is in LICENSE file
+ * included with this distribution, and on the openscenegraph.org website.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * OpenSceneGraph Public License for more details.
+*/
+#include <osgUtil/FrameArena>
+#include <osgUtil/StateGraph>
+
+using namespace osgUtil;
+
+FrameArena::FrameArena():
+    _maximumNumberOfPooledObjects(4096),
+    _numAllocations(0),
+    _numReuses(0)
+{
+}
+
+FrameArena::~FrameArena()
+{
+}
+
+void FrameArena::reset()
+{
+    _numAllocations = 0;
+    _numReuses = 0;
+}
+
+StateGraph* FrameArena::createStateGraph(StateGraph* parent, const osg::StateSet* stateset)
+{
+    if (!_stateGraphPool.empty())
+    {
+        // the pool holds the last reference, which is handed over to the caller's ref_ptr via the release below.
+        osg::ref_ptr<StateGraph> sg = _stateGraphPool.back();
+        _stateGraphPool.pop_back();
+
+        sg->set(parent, stateset);
+        ++_numReuses;
+        return sg.release();
+    }
+
+    ++_numAllocations;
+    return new StateGraph(parent, stateset);
+}
+
+void FrameArena::releaseStateGraph(StateGraph* stateGraph)
+{
+    // drop references to the scene graph now rather than when the StateGraph is next recycled.
+    stateGraph->set(0, 0);
+    _stateGraphPool.push_back(stateGraph);
+}
+
+void FrameArena::clear()
+{
+    _stateGraphPool.clear();
+}
+
+void FrameArena::trim()
+{
+    if (_stateGraphPool.size()>_maximumNumberOfPooledObjects) _stateGraphPool.resize(_maximumNumberOfPooledObjects);
+}
@@ -19,6 +19,7 @@
 #include <osg/Depth>
 #include <osg/ColorMask>
 #include <osg/ApplicationUsage>
+#include <osg/OcclusionQueryNode>
 
 #include <OpenThreads/ScopedLock>
 
@@ -48,6 +49,7 @@ namespace osgUtil
 static osg::ApplicationUsageProxy ICO_e1(osg::ApplicationUsage::ENVIRONMENTAL_VARIABLE,"OSG_MINIMUM_COMPILE_TIME_PER_FRAME <float>","minimum compile time alloted to compiling OpenGL objects per frame in database pager.");
 static osg::ApplicationUsageProxy UCO_e2(osg::ApplicationUsage::ENVIRONMENTAL_VARIABLE,"OSG_MAXIMUM_OBJECTS_TO_COMPILE_PER_FRAME <int>","maximum number of OpenGL objects to compile per frame in database pager.");
 static osg::ApplicationUsageProxy UCO_e3(osg::ApplicationUsage::ENVIRONMENTAL_VARIABLE,"OSG_FORCE_TEXTURE_DOWNLOAD <ON/OFF>","should the texture compiles be forced to download using a dummy Geometry.");
+static osg::ApplicationUsageProxy UCO_e4(osg::ApplicationUsage::ENVIRONMENTAL_VARIABLE,"OSG_MEASURE_COMPILE_COSTS <ON/OFF>","should the times taken to compile OpenGL objects be measured to refine the estimates used to schedule compiles.");
 
 /////////////////////////////////////////////////////////////////
 //
@@ -212,14 +214,25 @@ IncrementalCompileOperation::CompileDrawableOp::CompileDrawableOp(osg::Drawable*
 }
 
 double IncrementalCompileOperation::CompileDrawableOp::estimatedTimeForCompile(CompileInfo& compileInfo) const
+{
+    osg::CostPair cost = estimatedCostForCompile(compileInfo);
+    return osg::maximum(cost.first, cost.second);
+}
+
+osg::CostPair IncrementalCompileOperation::CompileDrawableOp::estimatedCostForCompile(CompileInfo& compileInfo) const
 {
     osg::GraphicsCostEstimator* gce = compileInfo.getState()->getGraphicsCostEstimator();
     osg::Geometry* geometry = _drawable->asGeometry();
     if (gce && geometry)
     {
-        return gce->estimateCompileCost(geometry).first;
+        return gce->estimateCompileCost(geometry);
     }
-    else return 0.0;
+    else return osg::CostPair(0.0,0.0);
+}
+
+void IncrementalCompileOperation::CompileDrawableOp::updateCompileCost(osg::GraphicsCostEstimator* gce, const osg::CostPair& estimatedCost, const osg::CostPair& measuredCost) const
+{
+    if (gce && _drawable->asGeometry()) gce->getGeometryCostEstimator()->updateCompileCost(estimatedCost, measuredCost);
 }
 
 bool IncrementalCompileOperation::CompileDrawableOp::compile(CompileInfo& compileInfo)
@@ -235,10 +248,21 @@ IncrementalCompileOperation::CompileTextureOp::CompileTextureOp(osg::Texture* te
 }
 
 double IncrementalCompileOperation::CompileTextureOp::estimatedTimeForCompile(CompileInfo& compileInfo) const
+{
+    osg::CostPair cost = estimatedCostForCompile(compileInfo);
+    return osg::maximum(cost.first, cost.second);
+}
+
+osg::CostPair IncrementalCompileOperation::CompileTextureOp::estimatedCostForCompile(CompileInfo& compileInfo) const
 {
     osg::GraphicsCostEstimator* gce = compileInfo.getState()->getGraphicsCostEstimator();
-    if (gce) return gce->estimateCompileCost(_texture.get()).first;
-    else return 0.0;
+    if (gce) return gce->estimateCompileCost(_texture.get());
+    else return osg::CostPair(0.0,0.0);
+}
+
+void IncrementalCompileOperation::CompileTextureOp::updateCompileCost(osg::GraphicsCostEstimator* gce, const osg::CostPair& estimatedCost, const osg::CostPair& measuredCost) const
+{
+    if (gce) gce->getTextureCostEstimator()->updateCompileCost(estimatedCost, measuredCost);
 }
 
 bool IncrementalCompileOperation::CompileTextureOp::compile(CompileInfo& compileInfo)
@@ -285,15 +309,142 @@ bool IncrementalCompileOperation::CompileProgramOp::compile(CompileInfo& compile
     return true;
 }
 
+/////////////////////////////////////////////////////////////////
+//
+// CompileCostQueries
+//
+// Measures the GPU time of compiles with GL_TIME_ELAPSED queries, whose results are collected on later frames
+// once they become available so the draw thread never waits on the GPU.
+//
+class IncrementalCompileOperation::CompileCostQueries : public osg::Referenced
+{
+public:
+    CompileCostQueries(osg::State* state):
+        _contextID(state->getContextID()),
+        _extensions(osg::Drawable::getExtensions(state->getContextID(), true)) {}
+
+    /** pass all the queries to the deleted query object cache, which deletes them on the context's next flush of deleted GL objects.*/
+    void releaseQueries()
+    {
+        for(ActiveQueries::iterator itr = _activeQueries.begin();
+            itr != _activeQueries.end();
+            ++itr)
+        {
+            osg::QueryGeometry::deleteQueryObject(_contextID, itr->query);
+        }
+        _activeQueries.clear();
+
+        for(std::vector<GLuint>::iterator itr = _availableQueries.begin();
+            itr != _availableQueries.end();
+            ++itr)
+        {
+            osg::QueryGeometry::deleteQueryObject(_contextID, *itr);
+        }
+        _availableQueries.clear();
+    }
+
+    GLuint beginQuery()
+    {
+        if (!_extensions || !_extensions->isTimerQuerySupported()) return 0;
+
+        GLuint query = 0;
+        if (_availableQueries.empty())
+        {
+            _extensions->glGenQueries(1, &query);
+        }
+        else
+        {
+            query = _availableQueries.back();
+            _availableQueries.pop_back();
+        }
+
+        _extensions->glBeginQuery(GL_TIME_ELAPSED, query);
+        return query;
+    }
+
+    void endQuery(GLuint query, CompileOp* compileOp, const osg::CostPair& estimatedCost)
+    {
+        if (!query) return;
+
+        _extensions->glEndQuery(GL_TIME_ELAPSED);
+        _activeQueries.push_back(ActiveQuery(query, compileOp, estimatedCost));
+    }
+
+    void checkQueries(CompileInfo& compileInfo)
+    {
+        osg::GraphicsCostEstimator* gce = compileInfo.getState()->getGraphicsCostEstimator();
+        for(ActiveQueries::iterator itr = _activeQueries.begin();
+            itr != _activeQueries.end();
+            )
+        {
+            GLint available = 0;
+            _extensions->glGetQueryObjectiv(itr->query, GL_QUERY_RESULT_AVAILABLE, &available);
+            if (!available)
+            {
+                ++itr;
+                continue;
+            }
+
+            GLuint64 timeElapsed = 0;
+            _extensions->glGetQueryObjectui64v(itr->query, GL_QUERY_RESULT, &timeElapsed);
+
+            osg::CostPair measuredCost(-1.0, double(timeElapsed)*1e-9);
+            itr->compileOp->updateCompileCost(gce, itr->estimatedCost, measuredCost);
+            compileInfo.incrementalCompileOperation->addCompileCost(itr->estimatedCost, measuredCost);
+
+            _availableQueries.push_back(itr->query);
+            itr = _activeQueries.erase(itr);
+        }
+    }
+
+protected:
+
+    struct ActiveQuery
+    {
+        ActiveQuery(GLuint q, CompileOp* op, const osg::CostPair& cost):
+            query(q), compileOp(op), estimatedCost(cost) {}
+
+        GLuint                      query;
+        osg::ref_ptr<CompileOp>     compileOp;
+        osg::CostPair               estimatedCost;
+    };
+    typedef std::list<ActiveQuery> ActiveQueries;
+
+    unsigned int                        _contextID;
+    const osg::Drawable::Extensions*    _extensions;
+    ActiveQueries                       _activeQueries;
+    std::vector<GLuint>                 _availableQueries;
+};
+
 IncrementalCompileOperation::CompileInfo::CompileInfo(osg::GraphicsContext* context, IncrementalCompileOperation* ico):
+    compileCostQueries(0),
     compileAll(false),
     maxNumObjectsToCompile(0),
+    numObjectsCompiled(0),
     allocatedTime(0)
 {
     setState(context->getState());
     incrementalCompileOperation = ico;
 }
 
+bool IncrementalCompileOperation::CompileInfo::compile(CompileOp* compileOp, const osg::CostPair& estimatedCost)
+{
+    if (!compileCostQueries) return compileOp->compile(*this);
+
+    GLuint query = compileCostQueries->beginQuery();
+    osg::ElapsedTime compileTimer;
+
+    bool result = compileOp->compile(*this);
+
+    osg::CostPair measuredCost(compileTimer.elapsedTime(), -1.0);
+    compileCostQueries->endQuery(query, compileOp, estimatedCost);
+
+    compileOp->updateCompileCost(getState()->getGraphicsCostEstimator(), estimatedCost, measuredCost);
+    incrementalCompileOperation->addCompileCost(estimatedCost, measuredCost);
+
+    return result;
+}
+
 
 /////////////////////////////////////////////////////////////////
 //
@@ -316,7 +467,7 @@ double IncrementalCompileOperation::CompileList::estimatedTimeForCompile(Compile
 {
     double estimateTime = 0.0;
     for(CompileOps::const_iterator itr = _compileOps.begin();
-        itr != _compileOps.begin();
+        itr != _compileOps.end();
         ++itr)
     {
         estimateTime += (*itr)->estimatedTimeForCompile(compileInfo);
@@ -326,35 +477,29 @@ double IncrementalCompileOperation::CompileList::estimatedTimeForCompile(Compile
 
 bool IncrementalCompileOperation::CompileList::compile(CompileInfo& compileInfo)
 {
-//#define USE_TIME_ESTIMATES
-
     for(CompileOps::iterator itr = _compileOps.begin();
         itr != _compileOps.end() && compileInfo.okToCompile();
     )
     {
-        #ifdef USE_TIME_ESTIMATES
-        double estimatedCompileCost = (*itr)->estimatedTimeForCompile(compileInfo);
-        #endif
+        osg::CostPair estimatedCost = (*itr)->estimatedCostForCompile(compileInfo);
 
-        --compileInfo.maxNumObjectsToCompile;
+        // leave objects that won't fit in the time left for a later frame, unless nothing has been compiled yet this frame
+        // so that objects too large for any frame still get compiled.
+        if (compileInfo.numObjectsCompiled>0 && !compileInfo.okToCompile(osg::maximum(estimatedCost.first, estimatedCost.second)))
+        {
+            ++itr;
+            continue;
+        }
 
-        #ifdef USE_TIME_ESTIMATES
-        osg::ElapsedTime timer;
-        #endif
+        --compileInfo.maxNumObjectsToCompile;
+        ++compileInfo.numObjectsCompiled;
 
         CompileOps::iterator saved_itr(itr);
         ++itr;
-        if ((*saved_itr)->compile(compileInfo))
+        if (compileInfo.compile(saved_itr->get(), estimatedCost))
         {
             _compileOps.erase(saved_itr);
         }
-
-        #ifdef USE_TIME_ESTIMATES
-        double actualCompileCost = timer.elapsedTime();
-        OSG_NOTICE<<"IncrementalCompileOperation::CompileList::compile() estimatedTimForCompile = "<<estimatedCompileCost*1000.0<<"ms, actual = "<<actualCompileCost*1000.0<<"ms";
-        if (estimatedCompileCost>0.0) OSG_NOTICE<<", ratio="<<(actualCompileCost/estimatedCompileCost);
-        OSG_NOTICE<<std::endl;
-        #endif
     }
     return empty();
 }
@@ -433,7 +578,14 @@ IncrementalCompileOperation::IncrementalCompileOperation():
     _flushTimeRatio(0.5),
     _conservativeTimeRatio(0.5),
     _currentFrameNumber(0),
-    _compileAllTillFrameNumber(0)
+    _compileAllTillFrameNumber(0),
+    _measureCompileCosts(true),
+    _estimatedCPUCompileTime(0.0),
+    _measuredCPUCompileTime(0.0),
+    _numCPUCompileTimes(0),
+    _estimatedGPUCompileTime(0.0),
+    _measuredGPUCompileTime(0.0),
+    _numGPUCompileTimes(0)
 {
     _targetFrameRate = 100.0;
     _minimumTimeAvailableForGLCompileAndDeletePerFrame = 0.001; // 1ms.
@@ -463,10 +615,22 @@ IncrementalCompileOperation::IncrementalCompileOperation():
         assignForceTextureDownloadGeometry();
     }
 
+    if( (ptr = getenv("OSG_MEASURE_COMPILE_COSTS")) != 0)
+    {
+        _measureCompileCosts = strcmp(ptr,"OFF")!=0 && strcmp(ptr,"off")!=0 &&
+                               strcmp(ptr,"NO")!=0 && strcmp(ptr,"no")!=0;
+    }
+
 }
 
 IncrementalCompileOperation::~IncrementalCompileOperation()
 {
+    for(CompileCostQueriesMap::iterator itr = _compileCostQueriesMap.begin();
+        itr != _compileCostQueriesMap.end();
+        ++itr)
+    {
+        itr->second->releaseQueries();
+    }
 }
 
 void IncrementalCompileOperation::assignForceTextureDownloadGeometry()
@@ -535,6 +699,14 @@ void IncrementalCompileOperation::removeGraphicsContext(osg::GraphicsContext* gc
         gc->remove(this);
         _contexts.erase(gc);
     }
+
+    OpenThreads::ScopedLock<OpenThreads::Mutex>  lock(_compileCostQueriesMutex);
+    CompileCostQueriesMap::iterator itr = _compileCostQueriesMap.find(gc);
+    if (itr != _compileCostQueriesMap.end())
+    {
+        itr->second->releaseQueries();
+        _compileCostQueriesMap.erase(itr);
+    }
 }
 
 bool IncrementalCompileOperation::requiresCompile(StateToCompile& stateToCompile)
@@ -657,9 +829,6 @@ void IncrementalCompileOperation::operator () (osg::GraphicsContext* context)
     OSG_NOTIFY(level)<<"    currentTime = "<<currentTime<<std::endl;
     OSG_NOTIFY(level)<<"    currentElapsedFrameTime = "<<currentElapsedFrameTime<<std::endl;
 
-    double _flushTimeRatio(0.5);
-    double _conservativeTimeRatio(0.5);
-
     double availableTime = std::max((targetFrameTime - currentElapsedFrameTime)*_conservativeTimeRatio,
                                     minimumTimeAvailableForGLCompileAndDeletePerFrame);
 
@@ -679,6 +848,12 @@ void IncrementalCompileOperation::operator () (osg::GraphicsContext* context)
     compileInfo.allocatedTime = compileTime;
     compileInfo.compileAll = (_compileAllTillFrameNumber > _currentFrameNumber);
 
+    if (_measureCompileCosts)
+    {
+        compileInfo.compileCostQueries = getCompileCostQueries(context);
+        compileInfo.compileCostQueries->checkQueries(compileInfo);
+    }
+
     CompileSets toCompileCopy;
     {
         OpenThreads::ScopedLock<OpenThreads::Mutex>  toCompile_lock(_toCompileMutex);
@@ -687,6 +862,15 @@ void IncrementalCompileOperation::operator () (osg::GraphicsContext* context)
 
     if (!toCompileCopy.empty())
     {
+        // calibrate the cost estimates before the first compile on the context, rather than on creating every context.
+        osg::GraphicsCostEstimator* gce = context->getState()->getGraphicsCostEstimator();
+        if (gce && !gce->getCalibrated())
+        {
+            osg::ElapsedTime calibrateTimer;
+            gce->calibrate(compileInfo);
+            compileInfo.allocatedTime = osg::maximum(compileInfo.allocatedTime - calibrateTimer.elapsedTime(), 0.0);
+        }
+
         compileSets(toCompileCopy, compileInfo);
     }
 
@@ -754,6 +938,66 @@ void IncrementalCompileOperation::compileSets(CompileSets& toCompile, CompileInf
 }
 
 
+IncrementalCompileOperation::CompileCostQueries* IncrementalCompileOperation::getCompileCostQueries(osg::GraphicsContext* context)
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex>  lock(_compileCostQueriesMutex);
+    osg::ref_ptr<CompileCostQueries>& queries = _compileCostQueriesMap[context];
+    if (!queries) queries = new CompileCostQueries(context->getState());
+    return queries.get();
+}
+
+void IncrementalCompileOperation::addCompileCost(const osg::CostPair& estimatedCost, const osg::CostPair& measuredCost)
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex>  lock(_compileCostMutex);
+    if (measuredCost.first>=0.0)
+    {
+        _estimatedCPUCompileTime += estimatedCost.first;
+        _measuredCPUCompileTime += measuredCost.first;
+        ++_numCPUCompileTimes;
+    }
+    if (measuredCost.second>=0.0)
+    {
+        _estimatedGPUCompileTime += estimatedCost.second;
+        _measuredGPUCompileTime += measuredCost.second;
+        ++_numGPUCompileTimes;
+    }
+}
+
+void IncrementalCompileOperation::reportStats(unsigned int frameNumber, osg::Stats& stats)
+{
+    double estimatedCPUTime, measuredCPUTime, estimatedGPUTime, measuredGPUTime;
+    unsigned int numCPUTimes, numGPUTimes;
+    {
+        OpenThreads::ScopedLock<OpenThreads::Mutex>  lock(_compileCostMutex);
+        estimatedCPUTime = _estimatedCPUCompileTime;
+        measuredCPUTime = _measuredCPUCompileTime;
+        numCPUTimes = _numCPUCompileTimes;
+        estimatedGPUTime = _estimatedGPUCompileTime;
+        measuredGPUTime = _measuredGPUCompileTime;
+        numGPUTimes = _numGPUCompileTimes;
+
+        _estimatedCPUCompileTime = _measuredCPUCompileTime = 0.0;
+        _estimatedGPUCompileTime = _measuredGPUCompileTime = 0.0;
+        _numCPUCompileTimes = _numGPUCompileTimes = 0;
+    }
+
+    stats.setAttribute(frameNumber, "Compile objects", static_cast<double>(numCPUTimes));
+
+    // only frames in which objects were compiled contribute to the averaged times.
+    if (numCPUTimes>0)
+    {
+        stats.setAttribute(frameNumber, "Compile estimated CPU time", estimatedCPUTime);
+        stats.setAttribute(frameNumber, "Compile CPU time taken", measuredCPUTime);
+    }
+
+    // GPU times arrive a few frames after the compile that they measure.
+    if (numGPUTimes>0)
+    {
+        stats.setAttribute(frameNumber, "Compile estimated GPU time", estimatedGPUTime);
+        stats.setAttribute(frameNumber, "Compile GPU time taken", measuredGPUTime);
+    }
+}
+
 void IncrementalCompileOperation::compileAllForNextFrame(unsigned int numFramesToDoCompileAll)
 {
     _compileAllTillFrameNumber = _currentFrameNumber+numFramesToDoCompileAll;
@@ -0,0 +1,314 @@
+/* -*-c++-*- OpenSceneGraph - Copyright (C) 1998-2006 Robert Osfield
+ *
+ * This library is open source and may be redistributed and/or modified under
+ * the terms of the OpenSceneGraph Public License (OSGPL) version 0.0 or
+ * (at your option) any later version.  The full license is in LICENSE file
+ * included with this distribution, and on the openscenegraph.org website.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * OpenSceneGraph Public License for more details.
+*/
+
+
+#include <osgUtil/LineSegmentBatchIntersector>
+#include <osgUtil/LineSegmentIntersector>
+#include <osg/Geometry>
+#include <osg/KdTree>
+#include <osg/Notify>
+#include <osg/TriangleIndexFunctor>
+
+#include <algorithm>
+
+using namespace osgUtil;
+
+namespace LineSegmentBatchIntersectorUtils
+{
+
+/** Intersect each triangle of a Geometry without a KdTree with a list of line segments, numbering the
+  * triangles in the order they are visited and skipping degenerate ones as KdTree does.*/
+struct TriangleIntersector
+{
+    TriangleIntersector():
+        _vertices(0),
+        _starts(0),
+        _ends(0),
+        _ratios(0),
+        _primitiveIndices(0),
+        _normals(0),
+        _lineSegments(0),
+        _intersectedLineSegments(0),
+        _triangleIndex(0) {}
+
+    inline void operator () (unsigned int p0, unsigned int p1, unsigned int p2)
+    {
+        const osg::Vec3& v0 = (*_vertices)[p0];
+        const osg::Vec3& v1 = (*_vertices)[p1];
+        const osg::Vec3& v2 = (*_vertices)[p2];
+
+        // discard degenerate triangles without numbering them.
+        if (v0==v1 || v1==v2 || v2==v0) return;
+
+        unsigned int triangleIndex = _triangleIndex++;
+
+        osg::Vec3 e1 = v1-v0;
+        osg::Vec3 e2 = v2-v0;
+
+        for(osg::KdTree::IndexList::const_iterator itr = _lineSegments->begin();
+            itr != _lineSegments->end();
+            ++itr)
+        {
+            unsigned int i = *itr;
+            osg::Vec3 d = _ends[i]-_starts[i];
+            osg::Vec3 p = d ^ e2;
+            float det = e1 * p;
+            if (det==0.0f) continue;
+
+            float inverseDet = 1.0f/det;
+            osg::Vec3 t = _starts[i]-v0;
+            float u = (t * p)*inverseDet;
+            if (u<0.0f || u>1.0f) continue;
+
+            osg::Vec3 q = t ^ e1;
+            float v = (d * q)*inverseDet;
+            if (v<0.0f || u+v>1.0f) continue;
+
+            float ratio = (e2 * q)*inverseDet;
+            if (ratio<0.0f || ratio>=_ratios[i]) continue;
+
+            _ratios[i] = ratio;
+            _primitiveIndices[i] = triangleIndex;
+            _normals[i] = e1 ^ e2;
+            _intersectedLineSegments->push_back(i);
+        }
+    }
+
+    const osg::Vec3Array*           _vertices;
+    const osg::Vec3*                _starts;
+    const osg::Vec3*                _ends;
+    float*                          _ratios;
+    unsigned int*                   _primitiveIndices;
+    osg::Vec3*                      _normals;
+    const osg::KdTree::IndexList*   _lineSegments;
+    osg::KdTree::IndexList*         _intersectedLineSegments;
+    unsigned int                    _triangleIndex;
+};
+
+}
+
+///////////////////////////////////////////////////////////////////////////////////
+//
+//  LineSegmentBatchIntersector::Intersections
+//
+void LineSegmentBatchIntersector::Intersections::reset(unsigned int numLineSegments)
+{
+    ratios.assign(numLineSegments, 1.0f);
+    drawableIndices.assign(numLineSegments, -1);
+    primitiveIndices.assign(numLineSegments, 0);
+    normals.assign(numLineSegments, osg::Vec3(0.0f,0.0f,0.0f));
+    drawables.clear();
+    numIntersections = 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////////
+//
+//  LineSegmentBatchIntersector
+//
+LineSegmentBatchIntersector::LineSegmentBatchIntersector(CoordinateFrame cf):
+    Intersector(cf, LIMIT_NEAREST),
+    _parent(0)
+{
+}
+
+LineSegmentBatchIntersector::LineSegmentBatchIntersector(CoordinateFrame cf, const Vec3dList& starts, const Vec3dList& ends):
+    Intersector(cf, LIMIT_NEAREST),
+    _parent(0),
+    _starts(starts),
+    _ends(ends)
+{
+    computeLocalLineSegments(_starts, _ends, 0);
+    _intersections.reset(_localStarts.size());
+}
+
+void LineSegmentBatchIntersector::addLineSegment(const osg::Vec3d& start, const osg::Vec3d& end)
+{
+    _starts.push_back(start);
+    _ends.push_back(end);
+
+    _localStarts.push_back(start);
+    _localEnds.push_back(end);
+    _localBound.expandBy(_localStarts.back());
+    _localBound.expandBy(_localEnds.back());
+
+    _intersections.ratios.push_back(1.0f);
+    _intersections.drawableIndices.push_back(-1);
+    _intersections.primitiveIndices.push_back(0);
+    _intersections.normals.push_back(osg::Vec3(0.0f,0.0f,0.0f));
+}
+
+void LineSegmentBatchIntersector::setLineSegments(const Vec3dList& starts, const Vec3dList& ends)
+{
+    _starts = starts;
+    _ends = ends;
+    reset();
+}
+
+Intersector* LineSegmentBatchIntersector::clone(osgUtil::IntersectionVisitor& iv)
+{
+    osg::ref_ptr<LineSegmentBatchIntersector> lsbi = new LineSegmentBatchIntersector(_coordinateFrame);
+    lsbi->_parent = this;
+    lsbi->_intersectionLimit = this->_intersectionLimit;
+    lsbi->setPrecisionHint(getPrecisionHint());
+
+    if (_coordinateFrame==MODEL && iv.getModelMatrix()==0)
+    {
+        lsbi->computeLocalLineSegments(_starts, _ends, 0);
+        return lsbi.release();
+    }
+
+    // compute the matrix that takes this Intersector from its CoordinateFrame into the local MODEL coordinate frame
+    // that geometry in the scene graph will always be in.
+    osg::Matrix matrix(LineSegmentIntersector::getTransformation(iv, _coordinateFrame));
+
+    lsbi->computeLocalLineSegments(_starts, _ends, &matrix);
+    return lsbi.release();
+}
+
+void LineSegmentBatchIntersector::computeLocalLineSegments(const Vec3dList& starts, const Vec3dList& ends, const osg::Matrix* matrix)
+{
+    unsigned int numLineSegments = osg::minimum(starts.size(), ends.size());
+
+    _localStarts.resize(numLineSegments);
+    _localEnds.resize(numLineSegments);
+    _localBound.init();
+
+    for(unsigned int i=0; i<numLineSegments; ++i)
+    {
+        _localStarts[i] = matrix ? starts[i] * (*matrix) : starts[i];
+        _localEnds[i] = matrix ? ends[i] * (*matrix) : ends[i];
+        _localBound.expandBy(_localStarts[i]);
+        _localBound.expandBy(_localEnds[i]);
+    }
+}
+
+bool LineSegmentBatchIntersector::enter(const osg::Node& node)
+{
+    if (reachedLimit()) return false;
+
+    if (_localStarts.empty()) return false;
+
+    if (!node.isCullingActive()) return true;
+
+    // conservatively test the bounding sphere against the bounding box of all the line segments.
+    const osg::BoundingSphere& bs = node.getBound();
+    if (!bs.valid()) return false;
+
+    osg::Vec3 radius(bs.radius(), bs.radius(), bs.radius());
+    osg::BoundingBox bb(_localBound._min-radius, _localBound._max+radius);
+    return bb.contains(bs.center());
+}
+
+void LineSegmentBatchIntersector::leave()
+{
+    // do nothing
+}
+
+void LineSegmentBatchIntersector::intersect(osgUtil::IntersectionVisitor& iv, osg::Drawable* drawable)
+{
+    if (reachedLimit()) return;
+
+    if (_localStarts.empty()) return;
+
+    if (!drawable->getBoundingBox().intersects(_localBound)) return;
+
+    if (iv.getDoDummyTraversal()) return;
+
+    Intersections& intersections = getIntersections();
+    _intersectedLineSegments.clear();
+
+    const osg::Vec3Array* vertices = 0;
+    const osg::KdTree* kdTree = iv.getUseKdTreeWhenAvailable() ? dynamic_cast<const osg::KdTree*>(drawable->getShape()) : 0;
+    if (kdTree)
+    {
+        vertices = kdTree->getVertices();
+        if (!kdTree->intersect(_localStarts.size(), &_localStarts.front(), &_localEnds.front(),
+                               &intersections.ratios.front(), &intersections.primitiveIndices.front(),
+                               _intersectedLineSegments))
+        {
+            return;
+        }
+    }
+    else
+    {
+        // without a KdTree test each triangle against the segments that may reach the drawable's bounding box.
+        osg::Geometry* geometry = drawable->asGeometry();
+        vertices = geometry ? dynamic_cast<const osg::Vec3Array*>(geometry->getVertexArray()) : 0;
+        if (!vertices) return;
+
+        const osg::BoundingBox& bb = drawable->getBoundingBox();
+        _candidateLineSegments.clear();
+        for(unsigned int i=0; i<_localStarts.size(); ++i)
+        {
+            osg::BoundingBox segmentBound;
+            segmentBound.expandBy(_localStarts[i]);
+            segmentBound.expandBy(_localEnds[i]);
+            if (segmentBound.intersects(bb)) _candidateLineSegments.push_back(i);
+        }
+        if (_candidateLineSegments.empty()) return;
+
+        osg::TriangleIndexFunctor<LineSegmentBatchIntersectorUtils::TriangleIntersector> intersector;
+        intersector._vertices = vertices;
+        intersector._starts = &_localStarts.front();
+        intersector._ends = &_localEnds.front();
+        intersector._ratios = &intersections.ratios.front();
+        intersector._primitiveIndices = &intersections.primitiveIndices.front();
+        intersector._normals = &intersections.normals.front();
+        intersector._lineSegments = &_candidateLineSegments;
+        intersector._intersectedLineSegments = &_intersectedLineSegments;
+        drawable->accept(intersector);
+
+        if (_intersectedLineSegments.empty()) return;
+
+        // a segment is listed again each time a nearer triangle is found, keep one entry so its normal is only transformed once.
+        std::sort(_intersectedLineSegments.begin(), _intersectedLineSegments.end());
+        _intersectedLineSegments.erase(std::unique(_intersectedLineSegments.begin(), _intersectedLineSegments.end()), _intersectedLineSegments.end());
+    }
+
+    int drawableIndex = static_cast<int>(intersections.drawables.size());
+    intersections.drawables.push_back(drawable);
+
+    osg::Matrix inverse;
+    if (iv.getModelMatrix()) inverse.invert(*iv.getModelMatrix());
+
+    for(osg::KdTree::IndexList::iterator itr = _intersectedLineSegments.begin();
+        itr != _intersectedLineSegments.end();
+        ++itr)
+    {
+        unsigned int i = *itr;
+        if (intersections.drawableIndices[i]<0) ++intersections.numIntersections;
+        intersections.drawableIndices[i] = drawableIndex;
+
+        // the triangle intersector has already stored the local normal of the triangle it hit.
+        osg::Vec3 normal = intersections.normals[i];
+        if (kdTree)
+        {
+            const osg::KdTree::Triangle& tri = kdTree->getTriangle(intersections.primitiveIndices[i]);
+            normal = ((*vertices)[tri.p1]-(*vertices)[tri.p0]) ^ ((*vertices)[tri.p2]-(*vertices)[tri.p0]);
+        }
+        if (iv.getModelMatrix()) normal = osg::Matrix::transform3x3(inverse, normal);
+        normal.normalize();
+        intersections.normals[i] = normal;
+    }
+}
+
+void LineSegmentBatchIntersector::reset()
+{
+    Intersector::reset();
+
+    if (!_parent)
+    {
+        computeLocalLineSegments(_starts, _ends, 0);
+        _intersections.reset(_localStarts.size());
+    }
+}
@@ -48,6 +48,32 @@ void GeometryCollector::apply(Geode& geode)
     }
 }
 
+void GeometryCollector::processGeometryList(ParallelSubgraphProcessor::Functor& functor)
+{
+    ParallelSubgraphProcessor processor(_numThreads);
+    for(GeometryList::iterator itr=_geometryList.begin();
+        itr!=_geometryList.end();
+        ++itr)
+    {
+        processor.add(*itr);
+    }
+    processor.run(functor);
+}
+
+namespace
+{
+// Calls one of the visitor's per Geometry methods for each Geometry processed.
+template<class V, void (V::*Method)(osg::Geometry&)>
+struct GeometryMethodFunctor : public ParallelSubgraphProcessor::Functor
+{
+    GeometryMethodFunctor(V& visitor) : _visitor(visitor) {}
+
+    virtual void operator() (osg::Node& node) { (_visitor.*Method)(*node.asGeometry()); }
+
+    V& _visitor;
+};
+}
+
 namespace
 {
 typedef std::vector<unsigned int> IndexList;
@@ -395,12 +421,8 @@ void IndexMeshVisitor::makeMesh(Geometry& geom)
 
 void IndexMeshVisitor::makeMesh()
 {
-    for(GeometryList::iterator itr=_geometryList.begin();
-        itr!=_geometryList.end();
-        ++itr)
-    {
-        makeMesh(*(*itr));
-    }
+    GeometryMethodFunctor<IndexMeshVisitor, &IndexMeshVisitor::makeMesh> functor(*this);
+    processGeometryList(functor);
 }
 
 namespace
@@ -872,17 +894,13 @@ void VertexCacheVisitor::doVertexOptimization(Geometry& geom,
 
 void VertexCacheVisitor::optimizeVertices()
 {
-    for(GeometryList::iterator itr=_geometryList.begin();
-        itr!=_geometryList.end();
-        ++itr)
-    {
-        optimizeVertices(*(*itr));
-    }
+    GeometryMethodFunctor<VertexCacheVisitor, &VertexCacheVisitor::optimizeVertices> functor(*this);
+    processGeometryList(functor);
 }
 
 VertexCacheMissVisitor::VertexCacheMissVisitor(unsigned cacheSize)
     : osg::NodeVisitor(NodeVisitor::TRAVERSE_ALL_CHILDREN), misses(0),
-      triangles(0), _cacheSize(cacheSize)
+      triangles(0), vertices(0), _cacheSize(cacheSize)
 {
 }
 
@@ -890,6 +908,7 @@ void VertexCacheMissVisitor::reset()
 {
     misses = 0;
     triangles = 0;
+    vertices = 0;
 }
 
 void VertexCacheMissVisitor::apply(Geode& geode)
@@ -937,10 +956,12 @@ struct FIFOCache
 // Insert vertices in a cache and record cache misses
 struct CacheRecordOperator
 {
-    CacheRecordOperator() : cache(0), misses(0), triangles(0) {}
+    CacheRecordOperator() : cache(0), misses(0), triangles(0), vertices(0) {}
     FIFOCache* cache;
     unsigned misses;
     unsigned triangles;
+    unsigned vertices;
+    vector<bool> referenced;
     void operator()(unsigned p1, unsigned p2, unsigned p3)
     {
         unsigned verts[3];
@@ -953,6 +974,13 @@ struct CacheRecordOperator
             if (find(cache->entries.begin(), cache->entries.end(), verts[i])
                 == cache->entries.end())
                 misses++;
+            if (verts[i] >= referenced.size())
+                referenced.resize(verts[i] + 1, false);
+            if (!referenced[verts[i]])
+            {
+                referenced[verts[i]] = true;
+                vertices++;
+            }
         }
         cache->addEntries(&verts[0], &verts[3]);
     }
@@ -988,6 +1016,270 @@ void VertexCacheMissVisitor::doGeometry(Geometry& geom)
     }
     misses += recorder.misses;
     triangles += recorder.triangles;
+    vertices += recorder.vertices;
+}
+
+namespace
+{
+// A FIFO post-transform cache that records when each vertex entered the
+// cache, so that a vertex is a hit if fewer than cacheSize misses have
+// happened since, and the cache can be flushed in constant time.
+struct TimestampCache
+{
+    TimestampCache(size_t numVertices, unsigned cacheSize_)
+        : timestamps(numVertices, 0), timestamp(cacheSize_ + 1), cacheSize(cacheSize_)
+    {
+    }
+    vector<unsigned> timestamps;
+    unsigned timestamp;
+    unsigned cacheSize;
+
+    unsigned addVertex(unsigned v)
+    {
+        if (timestamp - timestamps[v] > cacheSize)
+        {
+            timestamps[v] = timestamp++;
+            return 1;
+        }
+        return 0;
+    }
+
+    // Returns the number of misses.
+    unsigned addTriangle(const unsigned* tri)
+    {
+        return addVertex(tri[0]) + addVertex(tri[1]) + addVertex(tri[2]);
+    }
+
+    void flush()
+    {
+        timestamp += cacheSize + 1;
+    }
+};
+
+struct ClusterSortKey
+{
+    float key;
+    unsigned cluster;
+    bool operator<(const ClusterSortKey& rhs) const
+    {
+        // Clusters facing away from the centre of the mesh first.
+        return key > rhs.key;
+    }
+};
+
+// Split the triangles, in cache optimized order, into clusters.
+void generateClusters(const vector<unsigned>& indices, size_t numVertices,
+                      unsigned cacheSize, float threshold,
+                      unsigned maxMeshletVertices, unsigned maxMeshletTriangles,
+                      vector<unsigned>& clusters)
+{
+    unsigned numTris = indices.size() / 3;
+    TimestampCache cache(numVertices, cacheSize);
+
+    // Hard boundaries, where all three vertices of a triangle miss the
+    // cache so a new patch of the mesh is starting, or where the meshlet
+    // limits would be exceeded.
+    vector<unsigned> hardBoundaries;
+    vector<unsigned> vertexCluster(numVertices, 0);
+    unsigned clusterId = 0;
+    unsigned clusterVertices = 0;
+    unsigned clusterTriangles = 0;
+    for (unsigned t = 0; t < numTris; ++t)
+    {
+        const unsigned* tri = &indices[t * 3];
+        unsigned newVertices = 0;
+        for (int i = 0; i < 3; ++i)
+        {
+            if (vertexCluster[tri[i]] != clusterId
+                && (i < 1 || tri[i] != tri[0])
+                && (i < 2 || tri[i] != tri[1]))
+                ++newVertices;
+        }
+        bool meshletFull
+            = (maxMeshletTriangles > 0 && clusterTriangles + 1 > maxMeshletTriangles)
+            || (maxMeshletVertices > 0 && clusterVertices + newVertices > maxMeshletVertices);
+        unsigned misses = cache.addTriangle(tri);
+        if (t == 0 || misses == 3 || meshletFull)
+        {
+            hardBoundaries.push_back(t);
+            ++clusterId;
+            clusterVertices = 0;
+            clusterTriangles = 0;
+        }
+        for (int i = 0; i < 3; ++i)
+        {
+            if (vertexCluster[tri[i]] != clusterId)
+            {
+                vertexCluster[tri[i]] = clusterId;
+                ++clusterVertices;
+            }
+        }
+        ++clusterTriangles;
+    }
+
+    // Soft boundaries, splitting each hard cluster into the smallest
+    // clusters that reach the cluster's ACMR scaled by the threshold
+    // when drawn from an empty cache.
+    for (size_t h = 0; h < hardBoundaries.size(); ++h)
+    {
+        unsigned start = hardBoundaries[h];
+        unsigned end = h + 1 < hardBoundaries.size() ? hardBoundaries[h + 1] : numTris;
+
+        cache.flush();
+        unsigned clusterMisses = 0;
+        for (unsigned t = start; t < end; ++t)
+            clusterMisses += cache.addTriangle(&indices[t * 3]);
+        float clusterThreshold = threshold * (float)clusterMisses / (float)(end - start);
+
+        clusters.push_back(start);
+        cache.flush();
+        unsigned runningMisses = 0;
+        unsigned runningTriangles = 0;
+        for (unsigned t = start; t < end; ++t)
+        {
+            runningMisses += cache.addTriangle(&indices[t * 3]);
+            ++runningTriangles;
+            if ((float)runningMisses <= clusterThreshold * (float)runningTriangles)
+            {
+                clusters.push_back(t + 1);
+                cache.flush();
+                runningMisses = 0;
+                runningTriangles = 0;
+            }
+        }
+        // The last boundary either starts an empty cluster, or one that
+        // didn't reach the threshold, so merge it into the previous one.
+        if (clusters.back() != start)
+            clusters.pop_back();
+    }
+}
+
+// Sort the clusters by how much they face away from the centre of the mesh.
+void sortClusters(vector<unsigned>& indices, const Vec3Array& positions,
+                  const vector<unsigned>& clusters)
+{
+    Vec3 meshCentroid;
+    for (vector<unsigned>::const_iterator itr = indices.begin(), end = indices.end();
+         itr != end;
+         ++itr)
+        meshCentroid += positions[*itr];
+    meshCentroid /= (float)indices.size();
+
+    unsigned numTris = indices.size() / 3;
+    vector<ClusterSortKey> keys(clusters.size());
+    for (size_t c = 0; c < clusters.size(); ++c)
+    {
+        unsigned start = clusters[c];
+        unsigned end = c + 1 < clusters.size() ? clusters[c + 1] : numTris;
+        Vec3 centroid;
+        Vec3 normal;
+        float area = 0.0f;
+        for (unsigned t = start; t < end; ++t)
+        {
+            const Vec3& p0 = positions[indices[t * 3]];
+            const Vec3& p1 = positions[indices[t * 3 + 1]];
+            const Vec3& p2 = positions[indices[t * 3 + 2]];
+            Vec3 triNormal = (p1 - p0) ^ (p2 - p0);
+            float triArea = triNormal.length();
+            centroid += (p0 + p1 + p2) * (triArea / 3.0f);
+            normal += triNormal;
+            area += triArea;
+        }
+        if (area > 0.0f)
+            centroid /= area;
+        normal.normalize();
+        keys[c].key = (centroid - meshCentroid) * normal;
+        keys[c].cluster = c;
+    }
+    stable_sort(keys.begin(), keys.end());
+
+    vector<unsigned> sorted;
+    sorted.reserve(indices.size());
+    for (vector<ClusterSortKey>::iterator itr = keys.begin(), end = keys.end();
+         itr != end;
+         ++itr)
+    {
+        unsigned c = itr->cluster;
+        unsigned start = clusters[c];
+        unsigned clusterEnd = c + 1 < clusters.size() ? clusters[c + 1] : numTris;
+        sorted.insert(sorted.end(), indices.begin() + start * 3,
+                      indices.begin() + clusterEnd * 3);
+    }
+    indices.swap(sorted);
+}
+
+template<typename DE>
+bool reorderForOverdraw(DE& drawElements, const Vec3Array& positions,
+                        unsigned cacheSize, float threshold,
+                        unsigned maxMeshletVertices, unsigned maxMeshletTriangles)
+{
+    if (drawElements.size() < 6)
+        return false;
+    vector<unsigned> indices(drawElements.begin(),
+                             drawElements.begin() + drawElements.size() / 3 * 3);
+    for (vector<unsigned>::iterator itr = indices.begin(), end = indices.end();
+         itr != end;
+         ++itr)
+    {
+        if (*itr >= positions.size())
+            return false;
+    }
+    vector<unsigned> clusters;
+    generateClusters(indices, positions.size(), cacheSize, threshold,
+                     maxMeshletVertices, maxMeshletTriangles, clusters);
+    if (clusters.size() < 2)
+        return false;
+    sortClusters(indices, positions, clusters);
+    copy(indices.begin(), indices.end(), drawElements.begin());
+    drawElements.dirty();
+    return true;
+}
+}
+
+void OverdrawOrderVisitor::optimizeOverdraw(Geometry& geom)
+{
+    const Vec3Array* positions = dynamic_cast<const Vec3Array*>(geom.getVertexArray());
+    if (!positions || positions->empty())
+        return;
+    bool modified = false;
+    Geometry::PrimitiveSetList& primSets = geom.getPrimitiveSetList();
+    for (Geometry::PrimitiveSetList::iterator itr = primSets.begin(),
+             end = primSets.end();
+         itr != end;
+         ++itr)
+    {
+        PrimitiveSet* ps = itr->get();
+        if (ps->getMode() != PrimitiveSet::TRIANGLES)
+            continue;
+        switch (ps->getType())
+        {
+        case PrimitiveSet::DrawElementsUBytePrimitiveType:
+            modified |= reorderForOverdraw(*static_cast<DrawElementsUByte*>(ps), *positions,
+                                           _cacheSize, _threshold,
+                                           _maxMeshletVertices, _maxMeshletTriangles);
+            break;
+        case PrimitiveSet::DrawElementsUShortPrimitiveType:
+            modified |= reorderForOverdraw(*static_cast<DrawElementsUShort*>(ps), *positions,
+                                           _cacheSize, _threshold,
+                                           _maxMeshletVertices, _maxMeshletTriangles);
+            break;
+        case PrimitiveSet::DrawElementsUIntPrimitiveType:
+            modified |= reorderForOverdraw(*static_cast<DrawElementsUInt*>(ps), *positions,
+                                           _cacheSize, _threshold,
+                                           _maxMeshletVertices, _maxMeshletTriangles);
+            break;
+        default:
+            break;
+        }
+    }
+    if (modified)
+        geom.dirtyDisplayList();
+}
+
+void OverdrawOrderVisitor::optimizeOverdraw()
+{
+    GeometryMethodFunctor<OverdrawOrderVisitor, &OverdrawOrderVisitor::optimizeOverdraw> functor(*this);
+    processGeometryList(functor);
 }
 
 namespace
@@ -1094,12 +1386,8 @@ struct VertexReorder : public TriangleIndexFunctor<VertexReorderOperator>
 
 void VertexAccessOrderVisitor::optimizeOrder()
 {
-    for (GeometryList::iterator itr = _geometryList.begin(), end = _geometryList.end();
-         itr != end;
-         ++itr)
-    {
-        optimizeOrder(*(*itr));
-    }
+    GeometryMethodFunctor<VertexAccessOrderVisitor, &VertexAccessOrderVisitor::optimizeOrder> functor(*this);
+    processGeometryList(functor);
 }
 
 template<typename DE>
@@ -0,0 +1,664 @@
+/* -*-c++-*- OpenSceneGraph - Copyright (C) 1998-2006 Robert Osfield
+ *
+ * This library is open source and may be redistributed and/or modified under
+ * the terms of the OpenSceneGraph Public License (OSGPL) version 0.0 or
+ * (at your option) any later version.  The full license is in LICENSE file
+ * included with this distribution, and on the openscenegraph.org website.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * OpenSceneGraph Public License for more details.
+*/
+#include <osgUtil/MultiDrawIndirectBatcher>
+
+#include <osg/GLExtensions>
+#include <osg/GL2Extensions>
+#include <osg/buffered_value>
+#include <osg/Notify>
+#include <osg/Program>
+
+#include <algorithm>
+
+using namespace osgUtil;
+
+#ifndef GL_DRAW_INDIRECT_BUFFER
+    #define GL_DRAW_INDIRECT_BUFFER 0x8F3F
+#endif
+
+#ifndef GL_COPY_READ_BUFFER
+    #define GL_COPY_READ_BUFFER  0x8F36
+    #define GL_COPY_WRITE_BUFFER 0x8F37
+#endif
+
+// number of GLuint's in a DrawElementsIndirectCommand {count, instanceCount, firstIndex, baseVertex, baseInstance}
+static const unsigned int s_commandSize = 5;
+
+bool MultiDrawIndirectBatcher::AttributeFormat::operator < (const AttributeFormat& rhs) const
+{
+    if (slot<rhs.slot) return true;
+    if (rhs.slot<slot) return false;
+    if (size<rhs.size) return true;
+    if (rhs.size<size) return false;
+    if (type<rhs.type) return true;
+    if (rhs.type<type) return false;
+    return (normalize<rhs.normalize);
+}
+
+bool MultiDrawIndirectBatcher::Layout::operator < (const Layout& rhs) const
+{
+    if (mode<rhs.mode) return true;
+    if (rhs.mode<mode) return false;
+    return std::lexicographical_compare(attributes.begin(), attributes.end(), rhs.attributes.begin(), rhs.attributes.end());
+}
+
+MultiDrawIndirectBatcher::MultiDrawIndirectBatcher(osg::State& state):
+    _contextID(state.getContextID()),
+    _state(&state),
+    _isSupported(false),
+    _glMultiDrawElementsIndirect(0),
+    _glCopyBufferSubData(0),
+    _matrixAttributeLocation(12),
+    _minimumBatchSize(8),
+    _commandBuffer(0),
+    _matrixBuffer(0),
+    _identity(new osg::RefMatrix),
+    _numBatchedDraws(0),
+    _numMultiDrawCalls(0)
+{
+    osg::setGLExtensionFuncPtr(_glMultiDrawElementsIndirect, "glMultiDrawElementsIndirect", "glMultiDrawElementsIndirectARB");
+    osg::setGLExtensionFuncPtr(_glCopyBufferSubData, "glCopyBufferSubData");
+
+    const osg::GLBufferObject::Extensions* bufferExtensions = osg::GLBufferObject::getExtensions(_contextID, true);
+    const osg::GL2Extensions* gl2Extensions = osg::GL2Extensions::Get(_contextID, true);
+
+    _isSupported = osg::isGLExtensionOrVersionSupported(_contextID, "GL_ARB_multi_draw_indirect", 4.3f) &&
+                   osg::isGLExtensionOrVersionSupported(_contextID, "GL_ARB_base_instance", 4.2f) &&
+                   osg::isGLExtensionOrVersionSupported(_contextID, "GL_ARB_copy_buffer", 3.1f) &&
+                   _glMultiDrawElementsIndirect!=0 &&
+                   _glCopyBufferSubData!=0 &&
+                   bufferExtensions && bufferExtensions->isBufferObjectSupported() &&
+                   gl2Extensions && gl2Extensions->isGlslSupported();
+
+    OSG_INFO<<"MultiDrawIndirectBatcher created for contextID "<<_contextID<<", supported="<<_isSupported<<std::endl;
+}
+
+MultiDrawIndirectBatcher::~MultiDrawIndirectBatcher()
+{
+    // GL buffers are not deleted here as the graphics context may no longer be current,
+    // they are released along with the context, or explicitly via releaseGLObjects().
+}
+
+typedef osg::buffered_object< osg::ref_ptr<MultiDrawIndirectBatcher> > BufferedBatchers;
+static BufferedBatchers s_batchers;
+
+MultiDrawIndirectBatcher* MultiDrawIndirectBatcher::getOrCreate(osg::State& state)
+{
+    unsigned int contextID = state.getContextID();
+    osg::ref_ptr<MultiDrawIndirectBatcher>& batcher = s_batchers[contextID];
+
+    // a batcher created for another State belongs to a graphics context that has since been closed and
+    // its contextID reused, its buffer names died with that context so it is dropped without any GL calls.
+    if (batcher.valid() && batcher->_state.get()!=&state)
+    {
+        OSG_INFO<<"MultiDrawIndirectBatcher discarding stale batcher for contextID "<<contextID<<std::endl;
+        batcher = 0;
+    }
+
+    if (!batcher)
+    {
+        batcher = new MultiDrawIndirectBatcher(state);
+        batcher->resetMatrixAttribute(state);
+    }
+    return batcher.get();
+}
+
+void MultiDrawIndirectBatcher::releaseBatcher(osg::State* state)
+{
+    if (state)
+    {
+        unsigned int contextID = state->getContextID();
+        if (contextID>=s_batchers.size()) return;
+
+        osg::ref_ptr<MultiDrawIndirectBatcher>& batcher = s_batchers[contextID];
+        if (batcher.valid() && batcher->_state.get()==state) batcher->releaseGLObjects(state);
+        batcher = 0;
+    }
+    else
+    {
+        for(unsigned int i=0; i<s_batchers.size(); ++i)
+        {
+            if (s_batchers[i].valid() && s_batchers[i]->_state.valid()) s_batchers[i]->releaseGLObjects(0);
+            s_batchers[i] = 0;
+        }
+    }
+}
+
+void MultiDrawIndirectBatcher::resetMatrixAttribute(osg::State& state)
+{
+    if (!_isSupported) return;
+
+    const osg::GL2Extensions* gl2Extensions = osg::GL2Extensions::Get(state.getContextID(), true);
+    for(unsigned int c=0; c<4; ++c)
+    {
+        GLfloat column[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+        column[c] = 1.0f;
+        gl2Extensions->glVertexAttrib4fv(_matrixAttributeLocation+c, column);
+    }
+}
+
+void MultiDrawIndirectBatcher::computeSources(osg::Geometry* geometry, SourceList& sources)
+{
+    sources.clear();
+    sources.push_back(Source(geometry->getVertexArray()));
+    sources.push_back(Source(geometry->getNormalArray()));
+    sources.push_back(Source(geometry->getColorArray()));
+
+    osg::Geometry::ArrayList& texCoords = geometry->getTexCoordArrayList();
+    for(osg::Geometry::ArrayList::iterator itr = texCoords.begin(); itr != texCoords.end(); ++itr)
+    {
+        sources.push_back(Source(itr->get()));
+    }
+
+    osg::Geometry::ArrayList& vertexAttribs = geometry->getVertexAttribArrayList();
+    for(osg::Geometry::ArrayList::iterator itr = vertexAttribs.begin(); itr != vertexAttribs.end(); ++itr)
+    {
+        sources.push_back(Source(itr->get()));
+    }
+
+    osg::Geometry::PrimitiveSetList& primitives = geometry->getPrimitiveSetList();
+    for(osg::Geometry::PrimitiveSetList::iterator itr = primitives.begin(); itr != primitives.end(); ++itr)
+    {
+        sources.push_back(Source(itr->get()));
+    }
+}
+
+bool MultiDrawIndirectBatcher::declaresMatrixAttribute(const StateGraph* stateGraph) const
+{
+    typedef std::vector<const osg::StateSet*> StateSetStack;
+    StateSetStack statesets;
+    for(const StateGraph* sg = stateGraph; sg; sg = sg->_parent)
+    {
+        if (sg->getStateSet()) statesets.push_back(sg->getStateSet());
+    }
+
+    // resolve the Program the leaves are drawn with the same way osg::State applies the StateSet stack, honouring OVERRIDE and PROTECTED.
+    const osg::Program* program = 0;
+    osg::StateAttribute::OverrideValue programValue = osg::StateAttribute::OFF;
+    for(StateSetStack::reverse_iterator itr = statesets.rbegin(); itr != statesets.rend(); ++itr)
+    {
+        const osg::StateSet::RefAttributePair* pair = (*itr)->getAttributePair(osg::StateAttribute::PROGRAM);
+        if (!pair) continue;
+
+        if (!program || !(programValue & osg::StateAttribute::OVERRIDE) || (pair->second & osg::StateAttribute::PROTECTED))
+        {
+            program = static_cast<const osg::Program*>(pair->first.get());
+            programValue = pair->second;
+        }
+    }
+
+    // fixed function leaves and shaders that don't read the per draw matrix must keep their own modelview matrix.
+    if (!program) return false;
+
+    const osg::Program::AttribBindingList& bindings = program->getAttribBindingList();
+    osg::Program::AttribBindingList::const_iterator itr = bindings.find("osg_MultiDrawMatrix");
+    return itr!=bindings.end() && itr->second==_matrixAttributeLocation;
+}
+
+bool MultiDrawIndirectBatcher::overlapsMatrixAttribute(unsigned int location) const
+{
+    return location>=_matrixAttributeLocation && location<_matrixAttributeLocation+4;
+}
+
+bool MultiDrawIndirectBatcher::computeLayout(osg::State& state, const RenderLeaf* leaf, Layout& layout) const
+{
+    if (leaf->_dynamic) return false;
+
+    const osg::Geometry* geometry = leaf->getDrawable() ? leaf->getDrawable()->asGeometry() : 0;
+    if (!geometry || geometry->getDrawCallback()) return false;
+
+    const osg::Array* vertices = geometry->getVertexArray();
+    if (!vertices || vertices->getBinding()!=osg::Array::BIND_PER_VERTEX || vertices->getNumElements()==0) return false;
+    unsigned int numVertices = vertices->getNumElements();
+
+    // secondary colours and fog coords are rarely used by the scenes worth batching, leave them to the normal path.
+    if (osg::getBinding(geometry->getSecondaryColorArray())!=osg::Array::BIND_OFF ||
+        osg::getBinding(geometry->getFogCoordArray())!=osg::Array::BIND_OFF) return false;
+
+    const osg::Geometry::PrimitiveSetList& primitives = geometry->getPrimitiveSetList();
+    if (primitives.empty()) return false;
+
+    // all primitive sets must be of the same list mode so that they can be concatenated into a single draw.
+    layout.mode = primitives.front()->getMode();
+    if (layout.mode!=GL_POINTS && layout.mode!=GL_LINES && layout.mode!=GL_TRIANGLES) return false;
+    for(osg::Geometry::PrimitiveSetList::const_iterator itr = primitives.begin(); itr != primitives.end(); ++itr)
+    {
+        if ((*itr)->getMode()!=layout.mode || (*itr)->getNumInstances()!=0) return false;
+    }
+
+    layout.attributes.clear();
+
+    AttributeFormat format;
+    format.slot = VERTEX_SLOT;
+    format.size = vertices->getDataSize();
+    format.type = vertices->getDataType();
+    format.normalize = vertices->getNormalize();
+    format.elementSize = vertices->getElementSize();
+    layout.attributes.push_back(format);
+
+    const osg::Array* normals = geometry->getNormalArray();
+    if (normals)
+    {
+        if (normals->getBinding()==osg::Array::BIND_PER_VERTEX && normals->getNumElements()>=numVertices)
+        {
+            format.slot = NORMAL_SLOT;
+            format.size = normals->getDataSize();
+            format.type = normals->getDataType();
+            format.normalize = normals->getNormalize();
+            format.elementSize = normals->getElementSize();
+            layout.attributes.push_back(format);
+        }
+        else if (normals->getBinding()!=osg::Array::BIND_OFF) return false;
+    }
+
+    const osg::Array* colors = geometry->getColorArray();
+    if (colors)
+    {
+        if (colors->getBinding()==osg::Array::BIND_PER_VERTEX && colors->getNumElements()>=numVertices)
+        {
+            format.slot = COLOR_SLOT;
+            format.size = colors->getDataSize();
+            format.type = colors->getDataType();
+            format.normalize = colors->getNormalize();
+            format.elementSize = colors->getElementSize();
+            layout.attributes.push_back(format);
+        }
+        else if (colors->getBinding()!=osg::Array::BIND_OFF) return false;
+    }
+
+    // with vertex attribute aliasing the texture coordinates are passed in generic attributes which may share the matrix locations.
+    const osg::State::VertexAttribAliasList& texCoordAliases = state.getTexCoordAliasList();
+    bool useVertexAttributeAliasing = state.getUseVertexAttributeAliasing();
+
+    const osg::Geometry::ArrayList& texCoords = geometry->getTexCoordArrayList();
+    for(unsigned int unit=0; unit<texCoords.size(); ++unit)
+    {
+        const osg::Array* array = texCoords[unit].get();
+        if (!array) continue;
+        if (array->getNumElements()<numVertices || unit>=(VERTEX_ATTRIB_SLOT-TEXCOORD_SLOT)) return false;
+        if (useVertexAttributeAliasing &&
+            (unit>=texCoordAliases.size() || overlapsMatrixAttribute(texCoordAliases[unit]._location))) return false;
+
+        format.slot = TEXCOORD_SLOT+unit;
+        format.size = array->getDataSize();
+        format.type = array->getDataType();
+        format.normalize = array->getNormalize();
+        format.elementSize = array->getElementSize();
+        layout.attributes.push_back(format);
+    }
+
+    const osg::Geometry::ArrayList& vertexAttribs = geometry->getVertexAttribArrayList();
+    for(unsigned int index=0; index<vertexAttribs.size(); ++index)
+    {
+        const osg::Array* array = vertexAttribs[index].get();
+        if (!array || array->getBinding()==osg::Array::BIND_OFF) continue;
+        if (array->getBinding()!=osg::Array::BIND_PER_VERTEX ||
+            array->getNumElements()<numVertices ||
+            array->getPreserveDataType() ||
+            overlapsMatrixAttribute(index)) return false;
+
+        format.slot = VERTEX_ATTRIB_SLOT+index;
+        format.size = array->getDataSize();
+        format.type = array->getDataType();
+        format.normalize = array->getNormalize();
+        format.elementSize = array->getElementSize();
+        layout.attributes.push_back(format);
+    }
+
+    return true;
+}
+
+void MultiDrawIndirectBatcher::resizeBuffer(GLuint& buffer, unsigned int usedSize, unsigned int newSize)
+{
+    const osg::GLBufferObject::Extensions* extensions = osg::GLBufferObject::getExtensions(_contextID, true);
+
+    GLuint newBuffer = 0;
+    extensions->glGenBuffers(1, &newBuffer);
+    extensions->glBindBuffer(GL_COPY_WRITE_BUFFER, newBuffer);
+    extensions->glBufferData(GL_COPY_WRITE_BUFFER, newSize, 0, GL_STATIC_DRAW_ARB);
+
+    if (buffer)
+    {
+        if (usedSize>0)
+        {
+            extensions->glBindBuffer(GL_COPY_READ_BUFFER, buffer);
+            _glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, usedSize);
+            extensions->glBindBuffer(GL_COPY_READ_BUFFER, 0);
+        }
+        extensions->glDeleteBuffers(1, &buffer);
+    }
+
+    extensions->glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    buffer = newBuffer;
+}
+
+void MultiDrawIndirectBatcher::resetPool(Pool& pool)
+{
+    OSG_INFO<<"MultiDrawIndirectBatcher::resetPool() discarding "<<pool.numWastedVertices<<" of "<<pool.numVertices<<" vertices"<<std::endl;
+
+    pool.entries.clear();
+    pool.numVertices = 0;
+    pool.numIndices = 0;
+    pool.numWastedVertices = 0;
+}
+
+const MultiDrawIndirectBatcher::Entry* MultiDrawIndirectBatcher::upload(Pool& pool, const Layout& layout, osg::Geometry* geometry, bool& poolReset)
+{
+    computeSources(geometry, _sources);
+
+    EntryMap::iterator itr = pool.entries.find(geometry);
+    if (itr!=pool.entries.end())
+    {
+        Entry& entry = itr->second;
+        if (entry.geometry.get()==geometry && entry.sources==_sources) return &entry;
+
+        // an array or primitive set has been modified or replaced, or the address has been reused by a new
+        // geometry, so the old copy is now wasted.
+        pool.numWastedVertices += entry.numVertices;
+        pool.entries.erase(itr);
+    }
+
+    unsigned int numVertices = geometry->getVertexArray()->getNumElements();
+
+    _indices.clear();
+    const osg::Geometry::PrimitiveSetList& primitives = geometry->getPrimitiveSetList();
+    for(osg::Geometry::PrimitiveSetList::const_iterator pitr = primitives.begin(); pitr != primitives.end(); ++pitr)
+    {
+        const osg::PrimitiveSet* primitive = pitr->get();
+        unsigned int numIndices = primitive->getNumIndices();
+        for(unsigned int i=0; i<numIndices; ++i)
+        {
+            _indices.push_back(primitive->index(i));
+        }
+    }
+
+    unsigned int requiredVertices = pool.numVertices + numVertices;
+    unsigned int requiredIndices = pool.numIndices + static_cast<unsigned int>(_indices.size());
+
+    if (requiredVertices>pool.vertexCapacity || requiredIndices>pool.indexCapacity)
+    {
+        // account for geometries that have been deleted since they were uploaded.
+        for(EntryMap::iterator eitr = pool.entries.begin(); eitr != pool.entries.end();)
+        {
+            if (!eitr->second.geometry.valid())
+            {
+                pool.numWastedVertices += eitr->second.numVertices;
+                pool.entries.erase(eitr++);
+            }
+            else ++eitr;
+        }
+
+        // compact rather than grow when at least half the pool is wasted.
+        if (pool.numWastedVertices>0 && pool.numWastedVertices*2>=pool.numVertices)
+        {
+            resetPool(pool);
+            poolReset = true;
+            return 0;
+        }
+
+        if (requiredVertices>pool.vertexCapacity)
+        {
+            unsigned int newCapacity = std::max(requiredVertices, std::max(pool.vertexCapacity*2, 4096u));
+            pool.vertexBuffers.resize(layout.attributes.size(), 0);
+            for(unsigned int a=0; a<layout.attributes.size(); ++a)
+            {
+                unsigned int elementSize = layout.attributes[a].elementSize;
+                resizeBuffer(pool.vertexBuffers[a], pool.numVertices*elementSize, newCapacity*elementSize);
+            }
+            pool.vertexCapacity = newCapacity;
+        }
+
+        if (requiredIndices>pool.indexCapacity)
+        {
+            unsigned int newCapacity = std::max(requiredIndices, std::max(pool.indexCapacity*2, 16384u));
+            resizeBuffer(pool.indexBuffer, pool.numIndices*sizeof(GLuint), newCapacity*sizeof(GLuint));
+            pool.indexCapacity = newCapacity;
+        }
+    }
+
+    const osg::GLBufferObject::Extensions* extensions = osg::GLBufferObject::getExtensions(_contextID, true);
+
+    for(unsigned int a=0; a<layout.attributes.size(); ++a)
+    {
+        const AttributeFormat& format = layout.attributes[a];
+        const osg::Array* array = 0;
+        if (format.slot==VERTEX_SLOT) array = geometry->getVertexArray();
+        else if (format.slot==NORMAL_SLOT) array = geometry->getNormalArray();
+        else if (format.slot==COLOR_SLOT) array = geometry->getColorArray();
+        else if (format.slot>=VERTEX_ATTRIB_SLOT) array = geometry->getVertexAttribArray(format.slot-VERTEX_ATTRIB_SLOT);
+        else array = geometry->getTexCoordArray(format.slot-TEXCOORD_SLOT);
+
+        extensions->glBindBuffer(GL_COPY_WRITE_BUFFER, pool.vertexBuffers[a]);
+        extensions->glBufferSubData(GL_COPY_WRITE_BUFFER, pool.numVertices*format.elementSize, numVertices*format.elementSize, array->getDataPointer());
+    }
+
+    if (!_indices.empty())
+    {
+        extensions->glBindBuffer(GL_COPY_WRITE_BUFFER, pool.indexBuffer);
+        extensions->glBufferSubData(GL_COPY_WRITE_BUFFER, pool.numIndices*sizeof(GLuint), _indices.size()*sizeof(GLuint), &_indices.front());
+    }
+    extensions->glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+    Entry& entry = pool.entries[geometry];
+    entry.geometry = geometry;
+    entry.sources = _sources;
+    entry.baseVertex = pool.numVertices;
+    entry.numVertices = numVertices;
+    entry.firstIndex = pool.numIndices;
+    entry.numIndices = static_cast<unsigned int>(_indices.size());
+
+    pool.numVertices = requiredVertices;
+    pool.numIndices = requiredIndices;
+
+    return &entry;
+}
+
+void MultiDrawIndirectBatcher::applyState(osg::RenderInfo& renderInfo, RenderLeaf* leaf, RenderLeaf* previous)
+{
+    osg::State& state = *renderInfo.getState();
+
+    // the per draw matrices carry the modelview, so the State's modelview is left as identity.
+    state.applyProjectionMatrix(leaf->_projection.get());
+    state.applyModelViewMatrix(_identity.get());
+
+    StateGraph* rg = leaf->_parent;
+    if (previous)
+    {
+        StateGraph* prev_rg = previous->_parent;
+        StateGraph* prev_rg_parent = prev_rg->_parent;
+        if (prev_rg_parent!=rg->_parent)
+        {
+            StateGraph::moveStateGraph(state,prev_rg_parent,rg->_parent);
+            state.apply(rg->getStateSet());
+        }
+        else if (rg!=prev_rg)
+        {
+            state.apply(rg->getStateSet());
+        }
+    }
+    else
+    {
+        StateGraph::moveStateGraph(state,NULL,rg->_parent);
+        state.apply(rg->getStateSet());
+    }
+
+    if (state.getUseModelViewAndProjectionUniforms()) state.applyModelViewAndProjectionUniformsIfRequired();
+}
+
+void MultiDrawIndirectBatcher::drawBatch(osg::RenderInfo& renderInfo, const Layout& layout, Pool& pool, LeafList& leaves, RenderLeaf*& previous)
+{
+    osg::State& state = *renderInfo.getState();
+
+    // resolve the shared buffer location of every leaf, restarting once if the pool had to be compacted.
+    for(unsigned int attempt=0; attempt<2; ++attempt)
+    {
+        bool poolReset = false;
+        _commands.clear();
+        _matrices.clear();
+
+        for(LeafList::iterator itr = leaves.begin(); itr != leaves.end(); ++itr)
+        {
+            RenderLeaf* leaf = *itr;
+            const Entry* entry = upload(pool, layout, leaf->_drawable->asGeometry(), poolReset);
+            if (poolReset) break;
+
+            _commands.push_back(entry->numIndices);
+            _commands.push_back(1);
+            _commands.push_back(entry->firstIndex);
+            _commands.push_back(entry->baseVertex);
+            _commands.push_back(static_cast<GLuint>(_matrices.size()/16));
+
+            osg::Matrixf modelview(leaf->_modelview.valid() ? osg::Matrixf(*(leaf->_modelview)) : osg::Matrixf());
+            _matrices.insert(_matrices.end(), modelview.ptr(), modelview.ptr()+16);
+        }
+
+        if (!poolReset) break;
+    }
+
+    if (_commands.empty()) return;
+
+    applyState(renderInfo, leaves.front(), previous);
+
+    const osg::GLBufferObject::Extensions* extensions = osg::GLBufferObject::getExtensions(_contextID, true);
+    const osg::GL2Extensions* gl2Extensions = osg::GL2Extensions::Get(_contextID, true);
+
+    // keep osg::State's record of the bound buffer objects in step with the direct binds below.
+    state.unbindVertexBufferObject();
+    state.unbindElementBufferObject();
+
+    if (!_commandBuffer) extensions->glGenBuffers(1, &_commandBuffer);
+    if (!_matrixBuffer) extensions->glGenBuffers(1, &_matrixBuffer);
+
+    extensions->glBindBuffer(GL_DRAW_INDIRECT_BUFFER, _commandBuffer);
+    extensions->glBufferData(GL_DRAW_INDIRECT_BUFFER, _commands.size()*sizeof(GLuint), &_commands.front(), GL_STREAM_DRAW_ARB);
+
+    state.lazyDisablingOfVertexAttributes();
+
+    for(unsigned int a=0; a<layout.attributes.size(); ++a)
+    {
+        const AttributeFormat& format = layout.attributes[a];
+        GLboolean normalize = format.normalize ? GL_TRUE : GL_FALSE;
+
+        extensions->glBindBuffer(GL_ARRAY_BUFFER_ARB, pool.vertexBuffers[a]);
+
+        if (format.slot==VERTEX_SLOT) state.setVertexPointer(format.size, format.type, 0, 0, normalize);
+        else if (format.slot==NORMAL_SLOT) state.setNormalPointer(format.type, 0, 0, normalize);
+        else if (format.slot==COLOR_SLOT) state.setColorPointer(format.size, format.type, 0, 0, normalize);
+        else if (format.slot>=VERTEX_ATTRIB_SLOT) state.setVertexAttribPointer(format.slot-VERTEX_ATTRIB_SLOT, format.size, format.type, normalize, 0, 0);
+        else state.setTexCoordPointer(format.slot-TEXCOORD_SLOT, format.size, format.type, 0, 0, normalize);
+    }
+
+    extensions->glBindBuffer(GL_ARRAY_BUFFER_ARB, _matrixBuffer);
+    extensions->glBufferData(GL_ARRAY_BUFFER_ARB, _matrices.size()*sizeof(float), &_matrices.front(), GL_STREAM_DRAW_ARB);
+    for(unsigned int c=0; c<4; ++c)
+    {
+        state.setVertexAttribPointer(_matrixAttributeLocation+c, 4, GL_FLOAT, GL_FALSE, 16*sizeof(float), reinterpret_cast<const GLvoid*>(c*4*sizeof(float)));
+        gl2Extensions->glVertexAttribDivisor(_matrixAttributeLocation+c, 1);
+    }
+
+    state.applyDisablingOfVertexAttributes();
+
+    extensions->glBindBuffer(GL_ELEMENT_ARRAY_BUFFER_ARB, pool.indexBuffer);
+
+    GLsizei drawCount = static_cast<GLsizei>(_commands.size()/s_commandSize);
+    _glMultiDrawElementsIndirect(layout.mode, GL_UNSIGNED_INT, 0, drawCount, 0);
+
+    ++_numMultiDrawCalls;
+    _numBatchedDraws += drawCount;
+
+    // restore the divisors and leave the matrix attribute as identity for any leaves drawn individually.
+    for(unsigned int c=0; c<4; ++c)
+    {
+        state.disableVertexAttribPointer(_matrixAttributeLocation+c);
+        gl2Extensions->glVertexAttribDivisor(_matrixAttributeLocation+c, 0);
+    }
+    resetMatrixAttribute(state);
+
+    extensions->glBindBuffer(GL_ELEMENT_ARRAY_BUFFER_ARB, 0);
+    extensions->glBindBuffer(GL_ARRAY_BUFFER_ARB, 0);
+    extensions->glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+
+    previous = leaves.back();
+}
+
+void MultiDrawIndirectBatcher::draw(osg::RenderInfo& renderInfo, StateGraph* stateGraph, RenderLeaf*& previous)
+{
+    osg::State& state = *renderInfo.getState();
+
+    _leafGroups.clear();
+
+    // all the leaves of a StateGraph share its Program, so check it once for the whole graph.
+    bool batchable = _isSupported && declaresMatrixAttribute(stateGraph);
+
+    Layout layout;
+    for(StateGraph::LeafList::iterator itr = stateGraph->_leaves.begin();
+        itr != stateGraph->_leaves.end();
+        ++itr)
+    {
+        RenderLeaf* leaf = itr->get();
+        if (batchable && computeLayout(state, leaf, layout))
+        {
+            _leafGroups[LeafGroupKey(leaf->_projection.get(), layout)].push_back(leaf);
+        }
+        else
+        {
+            leaf->render(renderInfo,previous);
+            previous = leaf;
+        }
+    }
+
+    for(LeafGroupMap::iterator itr = _leafGroups.begin();
+        itr != _leafGroups.end();
+        ++itr)
+    {
+        LeafList& leaves = itr->second;
+        if (state.getAbortRendering()) break;
+
+        if (leaves.size()<_minimumBatchSize)
+        {
+            for(LeafList::iterator litr = leaves.begin(); litr != leaves.end(); ++litr)
+            {
+                (*litr)->render(renderInfo,previous);
+                previous = *litr;
+            }
+        }
+        else
+        {
+            drawBatch(renderInfo, itr->first.second, _pools[itr->first.second], leaves, previous);
+        }
+    }
+
+    _leafGroups.clear();
+}
+
+void MultiDrawIndirectBatcher::releaseGLObjects(osg::State* state) const
+{
+    if (state && state->getContextID()!=_contextID) return;
+
+    // hand the buffers over to the deleted buffer object cache, as the graphics context need not be current here.
+    for(PoolMap::iterator itr = _pools.begin(); itr != _pools.end(); ++itr)
+    {
+        Pool& pool = itr->second;
+        for(std::vector<GLuint>::iterator bitr = pool.vertexBuffers.begin(); bitr != pool.vertexBuffers.end(); ++bitr)
+        {
+            if (*bitr) osg::BufferObject::deleteBufferObject(_contextID, *bitr);
+        }
+        if (pool.indexBuffer) osg::BufferObject::deleteBufferObject(_contextID, pool.indexBuffer);
+    }
+    _pools.clear();
+
+    if (_commandBuffer) osg::BufferObject::deleteBufferObject(_contextID, _commandBuffer);
+    if (_matrixBuffer) osg::BufferObject::deleteBufferObject(_contextID, _matrixBuffer);
+    _commandBuffer = 0;
+    _matrixBuffer = 0;
+}
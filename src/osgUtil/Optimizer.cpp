@@ -12,6 +12,7 @@
 */
 #include <stdlib.h>
 #include <string.h>
+#include <limits.h>
 
 #include <osgUtil/Optimizer>
 
@@ -33,18 +34,26 @@
 #include <osg/ImageStream>
 #include <osg/Timer>
 #include <osg/TexMat>
+#include <osg/OperationThread>
 #include <osg/io_utils>
 
+#include <OpenThreads/Atomic>
+#include <OpenThreads/Thread>
+#include <OpenThreads/ScopedLock>
+
 #include <osgUtil/TransformAttributeFunctor>
 #include <osgUtil/TriStripVisitor>
 #include <osgUtil/Tessellator>
 #include <osgUtil/Statistics>
 #include <osgUtil/MeshOptimizers>
 
+#include "ThreadPool.h"
+
 #include <typeinfo>
 #include <algorithm>
 #include <numeric>
 #include <sstream>
+#include <map>
 
 #include <iterator>
 
@@ -52,11 +61,33 @@ using namespace osgUtil;
 
 // #define GEOMETRYDEPRECATED
 
+static osg::ApplicationUsageProxy Optimizer_e1(osg::ApplicationUsage::ENVIRONMENTAL_VARIABLE,"OSG_OPTIMIZER_NUM_THREADS <value>","Set the number of threads used by the Optimizer passes that work on independent Geodes and Geometries, 0 uses one thread per processor and larger values are clamped to the number of processors, default is 1.");
+
+Optimizer::Optimizer():
+    _numThreads(1)
+{
+    const char* env = getenv("OSG_OPTIMIZER_NUM_THREADS");
+    if (env)
+    {
+        char* end = 0;
+        long numThreads = strtol(env, &end, 10);
+        if (end==env || *end!=0 || numThreads<0)
+        {
+            OSG_NOTICE<<"Warning: OSG_OPTIMIZER_NUM_THREADS=\""<<env<<"\" is not a valid number of threads, ignoring it."<<std::endl;
+        }
+        else
+        {
+            long numProcessors = osg::maximum(OpenThreads::GetNumberOfProcessors(), 1);
+            _numThreads = static_cast<unsigned int>(osg::minimum(numThreads, numProcessors));
+        }
+    }
+}
+
 void Optimizer::reset()
 {
 }
 
-static osg::ApplicationUsageProxy Optimizer_e0(osg::ApplicationUsage::ENVIRONMENTAL_VARIABLE,"OSG_OPTIMIZER \"<type> [<type>]\"","OFF | DEFAULT | FLATTEN_STATIC_TRANSFORMS | FLATTEN_STATIC_TRANSFORMS_DUPLICATING_SHARED_SUBGRAPHS | REMOVE_REDUNDANT_NODES | COMBINE_ADJACENT_LODS | SHARE_DUPLICATE_STATE | MERGE_GEOMETRY | MERGE_GEODES | SPATIALIZE_GROUPS  | COPY_SHARED_NODES  | TRISTRIP_GEOMETRY | OPTIMIZE_TEXTURE_SETTINGS | REMOVE_LOADED_PROXY_NODES | TESSELLATE_GEOMETRY | CHECK_GEOMETRY |  FLATTEN_BILLBOARDS | TEXTURE_ATLAS_BUILDER | STATIC_OBJECT_DETECTION | INDEX_MESH | VERTEX_POSTTRANSFORM | VERTEX_PRETRANSFORM");
+static osg::ApplicationUsageProxy Optimizer_e0(osg::ApplicationUsage::ENVIRONMENTAL_VARIABLE,"OSG_OPTIMIZER \"<type> [<type>]\"","OFF | DEFAULT | FLATTEN_STATIC_TRANSFORMS | FLATTEN_STATIC_TRANSFORMS_DUPLICATING_SHARED_SUBGRAPHS | REMOVE_REDUNDANT_NODES | COMBINE_ADJACENT_LODS | SHARE_DUPLICATE_STATE | MERGE_GEOMETRY | MERGE_GEODES | SPATIALIZE_GROUPS  | COPY_SHARED_NODES  | TRISTRIP_GEOMETRY | OPTIMIZE_TEXTURE_SETTINGS | REMOVE_LOADED_PROXY_NODES | TESSELLATE_GEOMETRY | CHECK_GEOMETRY |  FLATTEN_BILLBOARDS | TEXTURE_ATLAS_BUILDER | STATIC_OBJECT_DETECTION | INDEX_MESH | VERTEX_POSTTRANSFORM | REDUCE_OVERDRAW | VERTEX_PRETRANSFORM");
 
 void Optimizer::optimize(osg::Node* node)
 {
@@ -136,6 +167,9 @@ void Optimizer::optimize(osg::Node* node)
         if(str.find("~VERTEX_PRETRANSFORM")!=std::string::npos) options ^= VERTEX_PRETRANSFORM;
         else if(str.find("VERTEX_PRETRANSFORM")!=std::string::npos) options |= VERTEX_PRETRANSFORM;
 
+        if(str.find("~REDUCE_OVERDRAW")!=std::string::npos) options ^= REDUCE_OVERDRAW;
+        else if(str.find("REDUCE_OVERDRAW")!=std::string::npos) options |= REDUCE_OVERDRAW;
+
     }
     else
     {
@@ -146,6 +180,16 @@ void Optimizer::optimize(osg::Node* node)
 
 }
 
+/** Report the post-transform cache efficiency of the geometry in the subgraph when info messages are enabled.*/
+static void reportVertexCacheStatistics(osg::Node* node, const char* stage)
+{
+    if (!osg::isNotifyEnabled(osg::INFO)) return;
+
+    VertexCacheMissVisitor vcmv;
+    node->accept(vcmv);
+    OSG_INFO<<"Optimizer::optimize() "<<stage<<": triangles "<<vcmv.triangles<<", ACMR "<<vcmv.getACMR()<<", ATVR "<<vcmv.getATVR()<<std::endl;
+}
+
 void Optimizer::optimize(osg::Node* node, unsigned int options)
 {
     StatsVisitor stats;
@@ -221,6 +265,7 @@ void Optimizer::optimize(osg::Node* node, unsigned int options)
 
         // traverse the scene collecting textures into texture atlas.
         TextureAtlasVisitor tav(this);
+        tav.setNumThreads(_numThreads);
         node->accept(tav);
         tav.optimize();
 
@@ -312,7 +357,9 @@ void Optimizer::optimize(osg::Node* node, unsigned int options)
 
         MergeGeometryVisitor mgv(this);
         mgv.setTargetMaximumNumberOfVertices(10000);
+        mgv.setNumThreads(_numThreads);
         node->accept(mgv);
+        mgv.mergeCollectedGeodes();
 
         osg::Timer_t endTick = osg::Timer::instance()->tick();
 
@@ -324,6 +371,7 @@ void Optimizer::optimize(osg::Node* node, unsigned int options)
         OSG_INFO<<"Optimizer::optimize() doing TRISTRIP_GEOMETRY"<<std::endl;
 
         TriStripVisitor tsv(this);
+        tsv.setNumThreads(_numThreads);
         node->accept(tsv);
         tsv.stripify();
     }
@@ -358,28 +406,49 @@ void Optimizer::optimize(osg::Node* node, unsigned int options)
         sv.divide();
     }
 
+    if (options & (INDEX_MESH|VERTEX_POSTTRANSFORM|REDUCE_OVERDRAW|VERTEX_PRETRANSFORM))
+    {
+        reportVertexCacheStatistics(node, "before mesh optimization");
+    }
+
     if (options & INDEX_MESH)
     {
         OSG_INFO<<"Optimizer::optimize() doing INDEX_MESH"<<std::endl;
         IndexMeshVisitor imv(this);
+        imv.setNumThreads(_numThreads);
         node->accept(imv);
         imv.makeMesh();
+        reportVertexCacheStatistics(node, "after INDEX_MESH");
     }
 
     if (options & VERTEX_POSTTRANSFORM)
     {
         OSG_INFO<<"Optimizer::optimize() doing VERTEX_POSTTRANSFORM"<<std::endl;
         VertexCacheVisitor vcv;
+        vcv.setNumThreads(_numThreads);
         node->accept(vcv);
         vcv.optimizeVertices();
+        reportVertexCacheStatistics(node, "after VERTEX_POSTTRANSFORM");
+    }
+
+    if (options & REDUCE_OVERDRAW)
+    {
+        OSG_INFO<<"Optimizer::optimize() doing REDUCE_OVERDRAW"<<std::endl;
+        OverdrawOrderVisitor oov(this);
+        oov.setNumThreads(_numThreads);
+        node->accept(oov);
+        oov.optimizeOverdraw();
+        reportVertexCacheStatistics(node, "after REDUCE_OVERDRAW");
     }
 
     if (options & VERTEX_PRETRANSFORM)
     {
         OSG_INFO<<"Optimizer::optimize() doing VERTEX_PRETRANSFORM"<<std::endl;
         VertexAccessOrderVisitor vaov;
+        vaov.setNumThreads(_numThreads);
         node->accept(vaov);
         vaov.optimizeOrder();
+        reportVertexCacheStatistics(node, "after VERTEX_PRETRANSFORM");
     }
 
     if (osg::getNotifyLevel()>=osg::INFO)
@@ -1884,6 +1953,36 @@ bool isAbleToMerge(const osg::Geometry& g1, const osg::Geometry& g2)
     return true;
 }
 
+namespace
+{
+
+struct MergeGeodeFunctor : public ParallelSubgraphProcessor::Functor
+{
+    MergeGeodeFunctor(Optimizer::MergeGeometryVisitor& visitor):
+        _visitor(visitor) {}
+
+    virtual void operator() (osg::Node& node) { _visitor.mergeGeode(*node.asGeode()); }
+
+    Optimizer::MergeGeometryVisitor& _visitor;
+};
+
+}
+
+void Optimizer::MergeGeometryVisitor::apply(osg::Geode& geode)
+{
+    if (_numThreads==1) mergeGeode(geode);
+    else _collectedGeodes.add(&geode);
+}
+
+void Optimizer::MergeGeometryVisitor::mergeCollectedGeodes()
+{
+    if (_collectedGeodes.getNumNodes()==0) return;
+
+    MergeGeodeFunctor functor(*this);
+    _collectedGeodes.setNumThreads(_numThreads);
+    _collectedGeodes.run(functor);
+}
+
 bool Optimizer::MergeGeometryVisitor::mergeGeode(osg::Geode& geode)
 {
     if (!isOperationPermissibleForObject(&geode)) return false;
@@ -3283,10 +3382,69 @@ void Optimizer::FlattenBillboardVisitor::process()
 // TextureAtlasBuilder
 ////////////////////////////////////////////////////////////////////////////
 
+namespace
+{
+
+/** Work divided into numbered items, processed in parallel by the osgUtil ThreadPool and the calling thread.*/
+struct ParallelFor : public ThreadPool::Work
+{
+    ParallelFor(): _size(0) {}
+
+    virtual void process(unsigned int index) = 0;
+
+    virtual void operator () (unsigned int)
+    {
+        for(;;)
+        {
+            unsigned int index = (++_next)-1;
+            if (index>=_size) break;
+            process(index);
+        }
+    }
+
+    /** Process items 0 to size-1, blocking until complete.*/
+    void run(unsigned int size, unsigned int numThreads);
+
+    unsigned int        _size;
+    OpenThreads::Atomic _next;
+};
+
+void ParallelFor::run(unsigned int size, unsigned int numThreads)
+{
+    _size = size;
+    _next.exchange(0);
+
+    numThreads = osg::minimum(numThreads, size);
+    if (numThreads<1) numThreads = 1;
+
+    // process items in this thread too, then wait for the other threads to complete theirs.
+    ThreadPool::instance()->run(*this, numThreads);
+}
+
+bool isMipmapFilter(osg::Texture::FilterMode filter)
+{
+    return filter!=osg::Texture::LINEAR && filter!=osg::Texture::NEAREST;
+}
+
+bool isCompressedInternalFormatMode(const osg::Texture* texture)
+{
+    switch(texture->getInternalFormatMode())
+    {
+        case(osg::Texture::USE_IMAGE_DATA_FORMAT): return false;
+        case(osg::Texture::USE_USER_DEFINED_FORMAT): return osg::Texture::isCompressedInternalFormat(texture->getInternalFormat());
+        default: return true;
+    }
+}
+
+}
+
 Optimizer::TextureAtlasBuilder::TextureAtlasBuilder():
     _maximumAtlasWidth(2048),
     _maximumAtlasHeight(2048),
-    _margin(8)
+    _margin(8),
+    _blockAlignment(1),
+    _generateMipmaps(true),
+    _numThreads(1)
 {
 }
 
@@ -3317,99 +3475,6 @@ void Optimizer::TextureAtlasBuilder::addSource(const osg::Texture2D* texture)
     if (!getSource(texture)) _sourceList.push_back(new Source(texture));
 }
 
-
-void Optimizer::TextureAtlasBuilder::completeRow(unsigned int indexAtlas)
-{
-    AtlasList::iterator aitr = _atlasList.begin() + indexAtlas;
-    //SourceList::iterator sitr = _sourceList.begin() + indexSource;
-    Atlas * atlas = aitr->get();
-    if(atlas->_indexFirstOfRow < atlas->_sourceList.size())
-    {
-        //Try to fill the row with smaller images.
-        int x_max = atlas->_width  - _margin;
-        int y_max = atlas->_height - _margin;
-        //int x_max = atlas->_maximumAtlasWidth  - _margin;
-        //int y_max = atlas->_maximumAtlasHeight - _margin;
-
-        // Fill last Row
-        for(SourceList::iterator sitr3 = _sourceList.begin(); sitr3 != _sourceList.end(); ++sitr3)
-        {
-            int x_min = atlas->_x + _margin;
-            int y_min = atlas->_y + _margin;
-            if (y_min >= y_max || x_min >= x_max) continue;
-
-            Source * source = sitr3->get();
-            if (source->_atlas || atlas->_image->getPixelFormat() != source->_image->getPixelFormat() ||
-                atlas->_image->getDataType() != source->_image->getDataType())
-            {
-                continue;
-            }
-
-            int image_s = source->_image->s();
-            int image_t = source->_image->t();
-            if (x_min + image_s <= x_max && y_min + image_t <= y_max)        // Test if the image can fit in the empty space.
-            {
-                source->_x = x_min;
-                source->_y = y_min;
-                //assert(source->_x + source->_image->s()+_margin <= atlas->_maximumAtlasWidth );        // "+_margin" and not "+2*_margin" because _x already takes the margin into account
-                //assert(source->_y + source->_image->t()+_margin <= atlas->_maximumAtlasHeight);
-                //assert(source->_x >= _margin);
-                //assert(source->_y >= _margin);
-                atlas->_x += image_s + 2*_margin;
-                //assert(atlas->_x <= atlas->_maximumAtlasWidth);
-                source->_atlas = atlas;
-                atlas->_sourceList.push_back(source);
-            }
-        }
-
-        // Fill the last column
-        SourceList srcListTmp;
-        for(SourceList::iterator sitr4 = atlas->_sourceList.begin() + atlas->_indexFirstOfRow;
-            sitr4 != atlas->_sourceList.end(); ++sitr4)
-        {
-            Source * srcAdded = sitr4->get();
-            int y_min = srcAdded->_y + srcAdded->_image->t() + 2 * _margin;
-            int x_min = srcAdded->_x;
-            int x_max = x_min + srcAdded->_image->s();        // Hides upper block's x_max
-            if (y_min >= y_max || x_min >= x_max) continue;
-
-            Source * maxWidthSource = NULL;
-            for(SourceList::iterator sitr2 = _sourceList.begin(); sitr2 != _sourceList.end(); ++sitr2)
-            {
-                Source * source = sitr2->get();
-                if (source->_atlas || atlas->_image->getPixelFormat() != source->_image->getPixelFormat() ||
-                    atlas->_image->getDataType() != source->_image->getDataType())
-                {
-                    continue;
-                }
-                int image_s = source->_image->s();
-                int image_t = source->_image->t();
-                if(x_min + image_s <= x_max && y_min + image_t <= y_max)        // Test if the image can fit in the empty space.
-                {
-                    if (maxWidthSource == NULL || maxWidthSource->_image->s() < source->_image->s())
-                    {
-                        maxWidthSource = source; //Keep the maximum width for source.
-                    }
-                }
-            }
-            if (maxWidthSource)
-            {
-                // Add the source with the max width to the atlas
-                maxWidthSource->_x = x_min;
-                maxWidthSource->_y = y_min;
-                maxWidthSource->_atlas = atlas;
-                srcListTmp.push_back(maxWidthSource); //Store the mawWidth source in the temporary vector.
-            }
-        }
-        for(SourceList::iterator itTmp = srcListTmp.begin(); itTmp != srcListTmp.end(); ++itTmp)
-        {
-            //Add the sources to the general list (wasn't possible in the loop using the iterator on the same list)
-            atlas->_sourceList.push_back(*itTmp);
-        }
-        atlas->_indexFirstOfRow = atlas->_sourceList.size();
-    }
-}
-
 void Optimizer::TextureAtlasBuilder::buildAtlas()
 {
     std::sort(_sourceList.begin(), _sourceList.end(), CompareSrc());        // Sort using the height of images
@@ -3426,35 +3491,15 @@ void Optimizer::TextureAtlasBuilder::buildAtlas()
                 aitr != _atlasList.end() && !addedSourceToAtlas;
                 ++aitr)
             {
-                if(!(*aitr)->_image ||
-                    ((*aitr)->_image->getPixelFormat() == (*sitr)->_image->getPixelFormat() &&
-                    (*aitr)->_image->getPacking() == (*sitr)->_image->getPacking()))
-                {
-                    OSG_INFO<<"checking source "<<source->_image->getFileName()<<" to see it it'll fit in atlas "<<aitr->get()<<std::endl;
-                    Optimizer::TextureAtlasBuilder::Atlas::FitsIn fitsIn = (*aitr)->doesSourceFit(source);
-                    if (fitsIn == Optimizer::TextureAtlasBuilder::Atlas::FITS_IN_CURRENT_ROW)
-                    {
-                        addedSourceToAtlas = true;
-                        (*aitr)->addSource(source); // Add in the currentRow.
-                    }
-                    else if(fitsIn == Optimizer::TextureAtlasBuilder::Atlas::IN_NEXT_ROW)
-                    {
-                        completeRow(aitr - _atlasList.begin()); //Fill Empty spaces.
-                        addedSourceToAtlas = true;
-                        (*aitr)->addSource(source); // Add the source in the new row.
-                    }
-                    else
-                    {
-                        completeRow(aitr - _atlasList.begin()); //Fill Empty spaces before creating a new atlas.
-                    }
-                }
+                OSG_INFO<<"checking source "<<source->_image->getFileName()<<" to see it it'll fit in atlas "<<aitr->get()<<std::endl;
+                addedSourceToAtlas = (*aitr)->addSource(source);
             }
 
             if (!addedSourceToAtlas)
             {
                 OSG_INFO<<"creating new Atlas for "<<source->_image->getFileName()<<std::endl;
 
-                osg::ref_ptr<Atlas> atlas = new Atlas(_maximumAtlasWidth,_maximumAtlasHeight,_margin);
+                osg::ref_ptr<Atlas> atlas = new Atlas(_maximumAtlasWidth,_maximumAtlasHeight,_margin,osg::maximum(_blockAlignment,1));
                 _atlasList.push_back(atlas);
                 if (!source->_atlas) atlas->addSource(source);
             }
@@ -3485,12 +3530,110 @@ void Optimizer::TextureAtlasBuilder::buildAtlas()
             atlas->_image->setFileName(ostr.str());
             activeAtlasList.push_back(atlas);
             atlas->clampToNearestPowerOfTwoSize();
-            atlas->copySources();
+            atlas->shrinkToFit();
+
+            bool generateMipmaps = _generateMipmaps &&
+                                   atlas->_texture.valid() &&
+                                   isMipmapFilter(atlas->_texture->getFilter(osg::Texture2D::MIN_FILTER)) &&
+                                   atlas->_image->getDataType()==GL_UNSIGNED_BYTE;
+            atlas->allocateImage(generateMipmaps);
         }
     }
     // keep only the active atlas'
     _atlasList.swap(activeAtlasList);
 
+    copySourcesAndGenerateMipmaps();
+
+    for(AtlasList::iterator aitr = _atlasList.begin();
+        aitr != _atlasList.end();
+        ++aitr)
+    {
+        Atlas* atlas = aitr->get();
+        OSG_INFO<<"TextureAtlasBuilder::buildAtlas() "<<atlas->_image->getFileName()<<" "<<atlas->_width<<"x"<<atlas->_height<<", "
+                <<atlas->_sourceList.size()<<" sources, fill ratio "<<atlas->_fillRatio<<std::endl;
+    }
+}
+
+void Optimizer::TextureAtlasBuilder::copySourcesAndGenerateMipmaps()
+{
+    unsigned int numThreads = _numThreads>0 ? _numThreads : OpenThreads::GetNumberOfProcessors();
+
+    // each source writes only to its own footprint of its atlas, so all the sources can be copied concurrently,
+    // largest first to balance the threads.
+    struct CopySources : public ParallelFor
+    {
+        struct LessArea
+        {
+            bool operator() (const Source* lhs, const Source* rhs) const
+            {
+                return lhs->_image->s()*lhs->_image->t() > rhs->_image->s()*rhs->_image->t();
+            }
+        };
+
+        virtual void process(unsigned int index) { _sources[index]->_atlas->copySource(_sources[index]); }
+
+        std::vector<Source*> _sources;
+    };
+
+    CopySources copySources;
+    for(AtlasList::iterator aitr = _atlasList.begin();
+        aitr != _atlasList.end();
+        ++aitr)
+    {
+        for(SourceList::iterator sitr = (*aitr)->_sourceList.begin();
+            sitr != (*aitr)->_sourceList.end();
+            ++sitr)
+        {
+            copySources._sources.push_back(sitr->get());
+        }
+    }
+    std::sort(copySources._sources.begin(), copySources._sources.end(), CopySources::LessArea());
+    copySources.run(copySources._sources.size(), numThreads);
+
+    // each mipmap level is filtered from the one below, so the levels are generated in turn, each divided into bands of rows.
+    struct GenerateMipmaps : public ParallelFor
+    {
+        struct Band
+        {
+            Band(Atlas* atlas, int rowBegin, int rowEnd):
+                _atlas(atlas), _rowBegin(rowBegin), _rowEnd(rowEnd) {}
+
+            Atlas*  _atlas;
+            int     _rowBegin;
+            int     _rowEnd;
+        };
+
+        GenerateMipmaps(): _level(0) {}
+
+        virtual void process(unsigned int index) { _bands[index]._atlas->generateMipmapRows(_level, _bands[index]._rowBegin, _bands[index]._rowEnd); }
+
+        unsigned int        _level;
+        std::vector<Band>   _bands;
+    };
+
+    const int rowsPerBand = 64;
+    GenerateMipmaps generateMipmaps;
+    for(generateMipmaps._level = 1; ; ++generateMipmaps._level)
+    {
+        generateMipmaps._bands.clear();
+        for(AtlasList::iterator aitr = _atlasList.begin();
+            aitr != _atlasList.end();
+            ++aitr)
+        {
+            Atlas* atlas = aitr->get();
+            if (generateMipmaps._level>=atlas->_image->getNumMipmapLevels()) continue;
+
+            int height = osg::maximum(atlas->_image->t()>>generateMipmaps._level, 1);
+            for(int row = 0; row<height; row += rowsPerBand)
+            {
+                generateMipmaps._bands.push_back(GenerateMipmaps::Band(atlas, row, osg::minimum(row+rowsPerBand, height)));
+            }
+        }
+
+        if (generateMipmaps._bands.empty()) break;
+
+        generateMipmaps.run(generateMipmaps._bands.size(), numThreads);
+    }
 }
 
 osg::Image* Optimizer::TextureAtlasBuilder::getImageAtlas(unsigned int i)
@@ -3644,17 +3787,18 @@ osg::Matrix Optimizer::TextureAtlasBuilder::Source::computeTextureMatrix() const
            osg::Matrix::translate(Float(_x)/Float(_atlas->_image->s()), Float(_y)/Float(_atlas->_image->t()), 0.0);
 }
 
-Optimizer::TextureAtlasBuilder::Atlas::FitsIn Optimizer::TextureAtlasBuilder::Atlas::doesSourceFit(Source* source)
+bool Optimizer::TextureAtlasBuilder::Atlas::isCompatible(Source* source) const
 {
     // does the source have a valid image?
     const osg::Image* sourceImage = source->_image.get();
-    if (!sourceImage) return DOES_NOT_FIT_IN_ANY_ROW;
+    if (!sourceImage) return false;
 
     // does pixel format match?
     if (_image.valid())
     {
-        if (_image->getPixelFormat() != sourceImage->getPixelFormat()) return DOES_NOT_FIT_IN_ANY_ROW;
-        if (_image->getDataType() != sourceImage->getDataType()) return DOES_NOT_FIT_IN_ANY_ROW;
+        if (_image->getPixelFormat() != sourceImage->getPixelFormat()) return false;
+        if (_image->getDataType() != sourceImage->getDataType()) return false;
+        if (_image->getPacking() != sourceImage->getPacking()) return false;
     }
 
     const osg::Texture2D* sourceTexture = source->_texture.get();
@@ -3664,20 +3808,20 @@ Optimizer::TextureAtlasBuilder::Atlas::FitsIn Optimizer::TextureAtlasBuilder::At
             sourceTexture->getWrap(osg::Texture2D::WRAP_S)==osg::Texture2D::MIRROR)
         {
             // can't support repeating textures in texture atlas
-            return DOES_NOT_FIT_IN_ANY_ROW;
+            return false;
         }
 
         if (sourceTexture->getWrap(osg::Texture2D::WRAP_T)==osg::Texture2D::REPEAT ||
             sourceTexture->getWrap(osg::Texture2D::WRAP_T)==osg::Texture2D::MIRROR)
         {
             // can't support repeating textures in texture atlas
-            return DOES_NOT_FIT_IN_ANY_ROW;
+            return false;
         }
 
         if (sourceTexture->getReadPBuffer()!=0)
         {
             // pbuffer textures not suitable
-            return DOES_NOT_FIT_IN_ANY_ROW;
+            return false;
         }
 
         if (_texture.valid())
@@ -3686,114 +3830,169 @@ Optimizer::TextureAtlasBuilder::Atlas::FitsIn Optimizer::TextureAtlasBuilder::At
             bool sourceUsesBorder = sourceTexture->getWrap(osg::Texture2D::WRAP_S)==osg::Texture2D::CLAMP_TO_BORDER ||
                                     sourceTexture->getWrap(osg::Texture2D::WRAP_T)==osg::Texture2D::CLAMP_TO_BORDER;
 
-            bool atlasUsesBorder = sourceTexture->getWrap(osg::Texture2D::WRAP_S)==osg::Texture2D::CLAMP_TO_BORDER ||
-                                   sourceTexture->getWrap(osg::Texture2D::WRAP_T)==osg::Texture2D::CLAMP_TO_BORDER;
+            bool atlasUsesBorder = _texture->getWrap(osg::Texture2D::WRAP_S)==osg::Texture2D::CLAMP_TO_BORDER ||
+                                   _texture->getWrap(osg::Texture2D::WRAP_T)==osg::Texture2D::CLAMP_TO_BORDER;
 
             if (sourceUsesBorder!=atlasUsesBorder)
             {
                 // border wrapping does not match
-                return DOES_NOT_FIT_IN_ANY_ROW;
+                return false;
             }
 
             if (sourceUsesBorder)
             {
                 // border colours don't match
-                if (_texture->getBorderColor() != sourceTexture->getBorderColor()) return DOES_NOT_FIT_IN_ANY_ROW;
+                if (_texture->getBorderColor() != sourceTexture->getBorderColor()) return false;
             }
 
             if (_texture->getFilter(osg::Texture2D::MIN_FILTER) != sourceTexture->getFilter(osg::Texture2D::MIN_FILTER))
             {
                 // inconsitent min filters
-                return DOES_NOT_FIT_IN_ANY_ROW;
+                return false;
             }
 
             if (_texture->getFilter(osg::Texture2D::MAG_FILTER) != sourceTexture->getFilter(osg::Texture2D::MAG_FILTER))
             {
                 // inconsitent mag filters
-                return DOES_NOT_FIT_IN_ANY_ROW;
+                return false;
             }
 
             if (_texture->getMaxAnisotropy() != sourceTexture->getMaxAnisotropy())
             {
                 // anisotropy different.
-                return DOES_NOT_FIT_IN_ANY_ROW;
+                return false;
             }
 
-            if (_texture->getInternalFormat() != sourceTexture->getInternalFormat())
+            if (_texture->getInternalFormatMode() != sourceTexture->getInternalFormatMode() ||
+                (_texture->getInternalFormatMode()==osg::Texture::USE_USER_DEFINED_FORMAT &&
+                 _texture->getInternalFormat() != sourceTexture->getInternalFormat()))
             {
                 // internal formats inconistent
-                return DOES_NOT_FIT_IN_ANY_ROW;
+                return false;
             }
 
             if (_texture->getShadowCompareFunc() != sourceTexture->getShadowCompareFunc())
             {
                 // shadow functions inconsitent
-                return DOES_NOT_FIT_IN_ANY_ROW;
+                return false;
             }
 
             if (_texture->getShadowTextureMode() != sourceTexture->getShadowTextureMode())
             {
                 // shadow texture mode inconsitent
-                return DOES_NOT_FIT_IN_ANY_ROW;
+                return false;
             }
 
             if (_texture->getShadowAmbient() != sourceTexture->getShadowAmbient())
             {
                 // shadow ambient inconsitent
-                return DOES_NOT_FIT_IN_ANY_ROW;
+                return false;
             }
         }
     }
 
-    if (sourceImage->s() + 2*_margin > _maximumAtlasWidth)
-    {
-        // image too big for Atlas
-        return DOES_NOT_FIT_IN_ANY_ROW;
-    }
+    return true;
+}
 
-    if (sourceImage->t() + 2*_margin > _maximumAtlasHeight)
-    {
-        // image too big for Atlas
-        return DOES_NOT_FIT_IN_ANY_ROW;
-    }
+int Optimizer::TextureAtlasBuilder::Atlas::computeFootprint(int size) const
+{
+    int footprint = size + 2*_margin;
+    return ((footprint + _alignment - 1)/_alignment)*_alignment;
+}
 
-    if ((_y + sourceImage->t() + 2*_margin) > _maximumAtlasHeight)
+bool Optimizer::TextureAtlasBuilder::Atlas::findPosition(int width, int height, int& x, int& y) const
+{
+    // best short side fit: choose the free rectangle leaving the least space along its shorter side, then its longer side.
+    int bestShortSide = INT_MAX;
+    int bestLongSide = INT_MAX;
+    for(FreeRectangleList::const_iterator itr = _freeRectangles.begin();
+        itr != _freeRectangles.end();
+        ++itr)
     {
-        // image doesn't have up space in height axis.
-        return DOES_NOT_FIT_IN_ANY_ROW;
+        if (itr->_width < width || itr->_height < height) continue;
+
+        int shortSide = osg::minimum(itr->_width - width, itr->_height - height);
+        int longSide = osg::maximum(itr->_width - width, itr->_height - height);
+        if (shortSide < bestShortSide || (shortSide == bestShortSide && longSide < bestLongSide))
+        {
+            bestShortSide = shortSide;
+            bestLongSide = longSide;
+            x = itr->_x;
+            y = itr->_y;
+        }
     }
 
-    // does the source fit in the current row?
-    if ((_x + sourceImage->s() + 2*_margin) <= _maximumAtlasWidth)
+    return bestShortSide != INT_MAX;
+}
+
+void Optimizer::TextureAtlasBuilder::Atlas::removeFreeSpace(int x, int y, int width, int height)
+{
+    // split each free rectangle the footprint overlaps into the up to four maximal rectangles around it.
+    FreeRectangleList freeRectangles;
+    for(FreeRectangleList::const_iterator itr = _freeRectangles.begin();
+        itr != _freeRectangles.end();
+        ++itr)
     {
-        // yes it fits :-)
-        OSG_INFO<<"Fits in current row"<<std::endl;
-        return FITS_IN_CURRENT_ROW;
+        const FreeRectangle& rect = *itr;
+        if (x >= rect._x + rect._width || x + width <= rect._x ||
+            y >= rect._y + rect._height || y + height <= rect._y)
+        {
+            freeRectangles.push_back(rect);
+            continue;
+        }
+
+        if (x > rect._x) freeRectangles.push_back(FreeRectangle(rect._x, rect._y, x - rect._x, rect._height));
+        if (x + width < rect._x + rect._width) freeRectangles.push_back(FreeRectangle(x + width, rect._y, rect._x + rect._width - x - width, rect._height));
+        if (y > rect._y) freeRectangles.push_back(FreeRectangle(rect._x, rect._y, rect._width, y - rect._y));
+        if (y + height < rect._y + rect._height) freeRectangles.push_back(FreeRectangle(rect._x, y + height, rect._width, rect._y + rect._height - y - height));
     }
 
-    // does the source fit in the new row up?
-    if ((_height + sourceImage->t() + 2*_margin) <= _maximumAtlasHeight)
+    // discard the rectangles contained in another, keeping the first of any duplicates.
+    _freeRectangles.clear();
+    for(unsigned int i=0; i<freeRectangles.size(); ++i)
     {
-        // yes it fits :-)
-        OSG_INFO<<"Fits in next row"<<std::endl;
-        return IN_NEXT_ROW;
+        bool contained = false;
+        for(unsigned int j=0; j<freeRectangles.size() && !contained; ++j)
+        {
+            if (i!=j && freeRectangles[j].contains(freeRectangles[i]))
+            {
+                contained = j<i || !freeRectangles[i].contains(freeRectangles[j]);
+            }
+        }
+        if (!contained) _freeRectangles.push_back(freeRectangles[i]);
     }
-
-    // no space for the texture
-    return DOES_NOT_FIT_IN_ANY_ROW;
 }
 
 bool Optimizer::TextureAtlasBuilder::Atlas::addSource(Source* source)
 {
     // double check source is compatible
-    if (!doesSourceFit(source))
+    if (!isCompatible(source))
     {
-        OSG_INFO<<"source "<<source->_image->getFileName()<<" does not fit in atlas "<<this<<std::endl;
+        OSG_INFO<<"source "<<source->_image->getFileName()<<" is not compatible with atlas "<<this<<std::endl;
         return false;
     }
     const osg::Image* sourceImage = source->_image.get();
     const osg::Texture2D* sourceTexture = source->_texture.get();
 
+    // the first source decides whether the atlas is compressed, so take account of its blocks before placing it.
+    int alignment = _alignment;
+    if (_sourceList.empty() && sourceTexture && isCompressedInternalFormatMode(sourceTexture))
+    {
+        alignment = osg::maximum(alignment, 4);
+    }
+
+    int footprintWidth = ((sourceImage->s() + 2*_margin + alignment - 1)/alignment)*alignment;
+    int footprintHeight = ((sourceImage->t() + 2*_margin + alignment - 1)/alignment)*alignment;
+
+    int x = 0, y = 0;
+    if (!findPosition(footprintWidth, footprintHeight, x, y))
+    {
+        OSG_INFO<<"source "<<source->_image->getFileName()<<" does not fit in atlas "<<this<<std::endl;
+        return false;
+    }
+
+    _alignment = alignment;
+
     if (!_image)
     {
         // need to create an image of the same pixel format to store the atlas in
@@ -3818,7 +4017,12 @@ bool Optimizer::TextureAtlasBuilder::Atlas::addSource(Source* source)
 
         _texture->setMaxAnisotropy(sourceTexture->getMaxAnisotropy());
 
-        _texture->setInternalFormat(sourceTexture->getInternalFormat());
+        // only a user defined internal format needs copying, the others are computed from the mode and image when applied.
+        if (sourceTexture->getInternalFormatMode()==osg::Texture::USE_USER_DEFINED_FORMAT)
+        {
+            _texture->setInternalFormat(sourceTexture->getInternalFormat());
+        }
+        _texture->setInternalFormatMode(sourceTexture->getInternalFormatMode());
 
         _texture->setShadowCompareFunc(sourceTexture->getShadowCompareFunc());
         _texture->setShadowTextureMode(sourceTexture->getShadowTextureMode());
@@ -3826,63 +4030,50 @@ bool Optimizer::TextureAtlasBuilder::Atlas::addSource(Source* source)
 
     }
 
-    // now work out where to fit it, first try current row.
-    if ((_x + sourceImage->s() + 2*_margin) <= _maximumAtlasWidth)
-    {
-        // yes it fits, so add the source to the atlas's list of sources it contains
-        _sourceList.push_back(source);
-
-        OSG_INFO<<"current row insertion, source "<<source->_image->getFileName()<<" "<<_x<<","<<_y<<" fits in row of atlas "<<this<<std::endl;
+    _sourceList.push_back(source);
 
-        // set up the source so it knows where it is in the atlas
-        source->_x = _x + _margin;
-        source->_y = _y + _margin;
-        source->_atlas = this;
+    OSG_INFO<<"insertion, source "<<source->_image->getFileName()<<" "<<x<<","<<y<<" in atlas "<<this<<std::endl;
 
-        // move the atlas' cursor along to the right
-        _x += sourceImage->s() + 2*_margin;
+    // set up the source so it knows where it is in the atlas
+    source->_x = x + _margin;
+    source->_y = y + _margin;
+    source->_atlas = this;
 
-        if (_x > _width) _width = _x;
+    if (x + footprintWidth > _width) _width = x + footprintWidth;
+    if (y + footprintHeight > _height) _height = y + footprintHeight;
 
-        int localTop = _y + sourceImage->t() + 2*_margin;
-        if ( localTop > _height) _height = localTop;
-
-        return true;
-    }
-
-    // does the source fit in the new row up?
-    if ((_height + sourceImage->t() + 2*_margin) <= _maximumAtlasHeight)
-    {
-        // now row so first need to reset the atlas cursor
-        _x = 0;
-        _y = _height;
+    removeFreeSpace(x, y, footprintWidth, footprintHeight);
 
-        // yes it fits, so add the source to the atlas' list of sources it contains
-        _sourceList.push_back(source);
-
-        OSG_INFO<<"next row insertion, source "<<source->_image->getFileName()<<" "<<_x<<","<<_y<<" fits in row of atlas "<<this<<std::endl;
-
-        // set up the source so it knows where it is in the atlas
-        source->_x = _x + _margin;
-        source->_y = _y + _margin;
-        source->_atlas = this;
-
-        // move the atlas' cursor along to the right
-        _x += sourceImage->s() + 2*_margin;
-
-        if (_x > _width) _width = _x;
+    return true;
+}
 
-        _height = _y + sourceImage->t() + 2*_margin;
+bool Optimizer::TextureAtlasBuilder::Atlas::repack(int width, int height)
+{
+    SourceList sourceList;
+    sourceList.swap(_sourceList);
 
-        OSG_INFO<<"source "<<source->_image->getFileName()<<" "<<_x<<","<<_y<<" fits in row of atlas "<<this<<std::endl;
+    _maximumAtlasWidth = width;
+    _maximumAtlasHeight = height;
+    _width = 0;
+    _height = 0;
+    _freeRectangles.clear();
+    _freeRectangles.push_back(FreeRectangle(0, 0, width, height));
 
-        return true;
+    for(SourceList::iterator itr = sourceList.begin();
+        itr != sourceList.end();
+        ++itr)
+    {
+        (*itr)->_atlas = 0;
     }
 
-    OSG_INFO<<"source "<<source->_image->getFileName()<<" does not fit in atlas "<<this<<std::endl;
+    for(SourceList::iterator itr = sourceList.begin();
+        itr != sourceList.end();
+        ++itr)
+    {
+        if (!addSource(itr->get())) return false;
+    }
 
-    // shouldn't get here, unless doesSourceFit isn't working...
-    return false;
+    return true;
 }
 
 void Optimizer::TextureAtlasBuilder::Atlas::clampToNearestPowerOfTwoSize()
@@ -3899,175 +4090,178 @@ void Optimizer::TextureAtlasBuilder::Atlas::clampToNearestPowerOfTwoSize()
     _height = h;
 }
 
+void Optimizer::TextureAtlasBuilder::Atlas::shrinkToFit()
+{
+    int width = _width;
+    int height = _height;
+    int maximumAtlasWidth = _maximumAtlasWidth;
+    int maximumAtlasHeight = _maximumAtlasHeight;
 
-void Optimizer::TextureAtlasBuilder::Atlas::copySources()
+    double footprintArea = 0.0;
+    for(SourceList::iterator itr = _sourceList.begin();
+        itr != _sourceList.end();
+        ++itr)
+    {
+        footprintArea += double(computeFootprint((*itr)->_image->s()))*double(computeFootprint((*itr)->_image->t()));
+    }
+
+    // try the power of two sizes smaller than the clamped size that could hold the footprints, smallest and squarest first.
+    typedef std::multimap<double, std::pair<int, int> > SizeMap;
+    SizeMap sizes;
+    for(int w = width; w>=1; w /= 2)
+    {
+        for(int h = height; h>=1; h /= 2)
+        {
+            double area = double(w)*double(h);
+            if (area < double(width)*double(height) && area >= footprintArea)
+            {
+                sizes.insert(SizeMap::value_type(area + std::abs(w-h)*1e-3, std::make_pair(w, h)));
+            }
+        }
+    }
+
+    for(SizeMap::iterator itr = sizes.begin();
+        itr != sizes.end();
+        ++itr)
+    {
+        if (repack(itr->second.first, itr->second.second))
+        {
+            OSG_INFO<<"Shrunk "<<width<<", "<<height<<" to "<<itr->second.first<<","<<itr->second.second<<std::endl;
+            clampToNearestPowerOfTwoSize();
+            return;
+        }
+    }
+
+    // no smaller size holds the sources, so restore the original packing, which adding the sources in the same order reproduces.
+    if (!sizes.empty()) repack(maximumAtlasWidth, maximumAtlasHeight);
+    clampToNearestPowerOfTwoSize();
+}
+
+void Optimizer::TextureAtlasBuilder::Atlas::allocateImage(bool generateMipmaps)
 {
     GLenum pixelFormat = _image->getPixelFormat();
     GLenum dataType = _image->getDataType();
-    GLenum packing = _image->getPacking();
-    OSG_INFO<<"Allocated to "<<_width<<","<<_height<<std::endl;
-    _image->allocateImage(_width,_height,1,
-                          pixelFormat, dataType,
-                          packing);
+    int packing = _image->getPacking();
+    GLint internalTextureFormat = _image->getInternalTextureFormat() ? _image->getInternalTextureFormat() : pixelFormat;
 
+    // lay out the mipmap levels after the base level, as osg::Image expects.
+    osg::Image::MipmapDataType mipmapOffsets;
+    unsigned int totalSize = osg::Image::computeImageSizeInBytes(_width, _height, 1, pixelFormat, dataType, packing);
+    if (generateMipmaps)
     {
-        // clear memory
-        unsigned int size = _image->getTotalSizeInBytes();
-        unsigned char* str = _image->data();
-        for(unsigned int i=0; i<size; ++i) *(str++) = 0;
+        int numLevels = osg::Image::computeNumberOfMipmapLevels(_width, _height);
+        for(int level=1; level<numLevels; ++level)
+        {
+            mipmapOffsets.push_back(totalSize);
+            totalSize += osg::Image::computeImageSizeInBytes(osg::maximum(_width>>level, 1), osg::maximum(_height>>level, 1), 1, pixelFormat, dataType, packing);
+        }
     }
 
-    OSG_INFO<<"Atlas::copySources() "<<std::endl;
+    OSG_INFO<<"Allocated to "<<_width<<","<<_height<<" with "<<mipmapOffsets.size()<<" mipmap levels"<<std::endl;
+
+    unsigned char* data = new unsigned char[totalSize];
+    memset(data, 0, totalSize);
+
+    _image->setImage(_width, _height, 1,
+                     internalTextureFormat, pixelFormat, dataType,
+                     data, osg::Image::USE_NEW_DELETE,
+                     packing);
+    _image->setMipmapLevels(mipmapOffsets);
 
+    double sourceArea = 0.0;
     for(SourceList::iterator itr = _sourceList.begin();
         itr !=_sourceList.end();
         ++itr)
     {
-        Source* source = itr->get();
-        Atlas* atlas = source->_atlas;
-
-        if (atlas == this)
-        {
-            OSG_INFO<<"Copying image "<<source->_image->getFileName()<<" to "<<source->_x<<" ,"<<source->_y<<std::endl;
-            OSG_INFO<<"        image size "<<source->_image->s()<<","<<source->_image->t()<<std::endl;
-
-            const osg::Image* sourceImage = source->_image.get();
-            osg::Image* atlasImage = atlas->_image.get();
-            //assert(sourceImage->getPacking() == atlasImage->getPacking()); //Test if packings are equals.
-            unsigned int rowSize = sourceImage->getRowSizeInBytes();
-            unsigned int pixelSizeInBits = sourceImage->getPixelSizeInBits();
-            unsigned int pixelSizeInBytes = pixelSizeInBits/8;
-            unsigned int marginSizeInBytes = pixelSizeInBytes*_margin;
-
-            //assert(atlas->_width  == static_cast<int>(atlasImage->s()));
-            //assert(atlas->_height == static_cast<int>(atlasImage->t()));
-            //assert(source->_x + static_cast<int>(source->_image->s())+_margin <= static_cast<int>(atlas->_image->s()));        // "+_margin" and not "+2*_margin" because _x already takes the margin into account
-            //assert(source->_y + static_cast<int>(source->_image->t())+_margin <= static_cast<int>(atlas->_image->t()));
-            //assert(source->_x >= _margin);
-            //assert(source->_y >= _margin);
-            int x = source->_x;
-            int y = source->_y;
-
-            int t;
-            for(t=0; t<sourceImage->t(); ++t, ++y)
-            {
-                unsigned char* destPtr = atlasImage->data(x, y);
-                const unsigned char* sourcePtr = sourceImage->data(0, t);
-                for(unsigned int i=0; i<rowSize; i++)
-                {
-                    *(destPtr++) = *(sourcePtr++);
-                }
-            }
+        sourceArea += double((*itr)->_image->s())*double((*itr)->_image->t());
+    }
+    _fillRatio = float(sourceArea/(double(_width)*double(_height)));
+}
 
-            // copy top row margin
-            y = source->_y + sourceImage->t();
-            int m;
-            for(m=0; m<_margin; ++m, ++y)
-            {
-                unsigned char* destPtr = atlasImage->data(x, y);
-                const unsigned char* sourcePtr = sourceImage->data(0, sourceImage->t()-1);
-                for(unsigned int i=0; i<rowSize; i++)
-                {
-                    *(destPtr++) = *(sourcePtr++);
-                }
+void Optimizer::TextureAtlasBuilder::Atlas::copySource(Source* source)
+{
+    OSG_INFO<<"Copying image "<<source->_image->getFileName()<<" to "<<source->_x<<" ,"<<source->_y<<std::endl;
+    OSG_INFO<<"        image size "<<source->_image->s()<<","<<source->_image->t()<<std::endl;
 
-            }
+    const osg::Image* sourceImage = source->_image.get();
+    osg::Image* atlasImage = _image.get();
 
+    int s = sourceImage->s();
+    int t = sourceImage->t();
+    unsigned int pixelSizeInBytes = sourceImage->getPixelSizeInBits()/8;
 
+    // the margins fill the footprint, replicating the edge texels into any space left by the block alignment.
+    int leftMargin = _margin;
+    int rightMargin = computeFootprint(s) - s - _margin;
+    int bottomMargin = _margin;
+    int topMargin = computeFootprint(t) - t - _margin;
+    unsigned int footprintRowSizeInBytes = (leftMargin + s + rightMargin)*pixelSizeInBytes;
 
-            // copy bottom row margin
-            y = source->_y-1;
-            for(m=0; m<_margin; ++m, --y)
-            {
-                unsigned char* destPtr = atlasImage->data(x, y);
-                const unsigned char* sourcePtr = sourceImage->data(0, 0);
-                for(unsigned int i=0; i<rowSize; i++)
-                {
-                    *(destPtr++) = *(sourcePtr++);
-                }
+    int x = source->_x;
+    int y = source->_y;
 
-            }
+    // copy the image with its left and right column margins
+    for(int r=0; r<t; ++r)
+    {
+        const unsigned char* sourcePtr = sourceImage->data(0, r);
+        memcpy(atlasImage->data(x, y+r), sourcePtr, s*pixelSizeInBytes);
 
-            // copy left column margin
-            y = source->_y;
-            for(t=0; t<sourceImage->t(); ++t, ++y)
-            {
-                x = source->_x-1;
-                for(m=0; m<_margin; ++m, --x)
-                {
-                    unsigned char* destPtr = atlasImage->data(x, y);
-                    const unsigned char* sourcePtr = sourceImage->data(0, t);
-                    for(unsigned int i=0; i<pixelSizeInBytes; i++)
-                    {
-                        *(destPtr++) = *(sourcePtr++);
-                    }
-                }
-            }
+        for(int m=1; m<=leftMargin; ++m)
+        {
+            memcpy(atlasImage->data(x-m, y+r), sourcePtr, pixelSizeInBytes);
+        }
 
-            // copy right column margin
-            y = source->_y;
-            for(t=0; t<sourceImage->t(); ++t, ++y)
-            {
-                x = source->_x + sourceImage->s();
-                for(m=0; m<_margin; ++m, ++x)
-                {
-                    unsigned char* destPtr = atlasImage->data(x, y);
-                    const unsigned char* sourcePtr = sourceImage->data(sourceImage->s()-1, t);
-                    for(unsigned int i=0; i<pixelSizeInBytes; i++)
-                    {
-                        *(destPtr++) = *(sourcePtr++);
-                    }
-                }
-            }
+        const unsigned char* lastPtr = sourceImage->data(s-1, r);
+        for(int m=0; m<rightMargin; ++m)
+        {
+            memcpy(atlasImage->data(x+s+m, y+r), lastPtr, pixelSizeInBytes);
+        }
+    }
 
-            // copy top left corner margin
-            y = source->_y + sourceImage->t();
-            for(m=0; m<_margin; ++m, ++y)
-            {
-                unsigned char* destPtr = atlasImage->data(source->_x - _margin, y);
-                unsigned char* sourcePtr = atlasImage->data(source->_x - _margin, y-1); // copy from row below
-                for(unsigned int i=0; i<marginSizeInBytes; i++)
-                {
-                    *(destPtr++) = *(sourcePtr++);
-                }
-            }
+    // copy bottom row margin, including the corners
+    for(int m=1; m<=bottomMargin; ++m)
+    {
+        memcpy(atlasImage->data(x-leftMargin, y-m), atlasImage->data(x-leftMargin, y), footprintRowSizeInBytes);
+    }
 
-            // copy top right corner margin
-            y = source->_y + sourceImage->t();
-            for(m=0; m<_margin; ++m, ++y)
-            {
-                unsigned char* destPtr = atlasImage->data(source->_x + sourceImage->s(), y);
-                unsigned char* sourcePtr = atlasImage->data(source->_x + sourceImage->s(), y-1); // copy from row below
-                for(unsigned int i=0; i<marginSizeInBytes; i++)
-                {
-                    *(destPtr++) = *(sourcePtr++);
-                }
-            }
+    // copy top row margin, including the corners
+    for(int m=0; m<topMargin; ++m)
+    {
+        memcpy(atlasImage->data(x-leftMargin, y+t+m), atlasImage->data(x-leftMargin, y+t-1), footprintRowSizeInBytes);
+    }
+}
 
-            // copy bottom left corner margin
-            y = source->_y - 1;
-            for(m=0; m<_margin; ++m, --y)
-            {
-                unsigned char* destPtr = atlasImage->data(source->_x - _margin, y);
-                unsigned char* sourcePtr = atlasImage->data(source->_x - _margin, y+1); // copy from row below
-                for(unsigned int i=0; i<marginSizeInBytes; i++)
-                {
-                    *(destPtr++) = *(sourcePtr++);
-                }
-            }
+void Optimizer::TextureAtlasBuilder::Atlas::generateMipmapRows(unsigned int level, int rowBegin, int rowEnd)
+{
+    GLenum pixelFormat = _image->getPixelFormat();
+    GLenum dataType = _image->getDataType();
+    int packing = _image->getPacking();
+    unsigned int numComponents = osg::Image::computeNumComponents(pixelFormat);
+
+    int sourceWidth = osg::maximum(_image->s()>>(level-1), 1);
+    int sourceHeight = osg::maximum(_image->t()>>(level-1), 1);
+    int width = osg::maximum(_image->s()>>level, 1);
 
-            // copy bottom right corner margin
-            y = source->_y - 1;
-            for(m=0; m<_margin; ++m, --y)
+    unsigned int sourceRowSize = osg::Image::computeRowWidthInBytes(sourceWidth, pixelFormat, dataType, packing);
+    unsigned int rowSize = osg::Image::computeRowWidthInBytes(width, pixelFormat, dataType, packing);
+    const unsigned char* sourceData = _image->getMipmapData(level-1);
+    unsigned char* data = _image->getMipmapData(level);
+
+    // box filter the 2x2 texels below each texel, a dimension already down to one texel is not halved.
+    unsigned int dx = sourceWidth>1 ? numComponents : 0;
+    unsigned int dy = sourceHeight>1 ? sourceRowSize : 0;
+    for(int row=rowBegin; row<rowEnd; ++row)
+    {
+        const unsigned char* sourcePtr = sourceData + (sourceHeight>1 ? 2*row : row)*sourceRowSize;
+        unsigned char* ptr = data + row*rowSize;
+        for(int column=0; column<width; ++column)
+        {
+            for(unsigned int c=0; c<numComponents; ++c)
             {
-                unsigned char* destPtr = atlasImage->data(source->_x + sourceImage->s(), y);
-                unsigned char* sourcePtr = atlasImage->data(source->_x + sourceImage->s(), y+1); // copy from row below
-                for(unsigned int i=0; i<marginSizeInBytes; i++)
-                {
-                    *(destPtr++) = *(sourcePtr++);
-                }
+                unsigned int sum = sourcePtr[c] + sourcePtr[c+dx] + sourcePtr[c+dy] + sourcePtr[c+dx+dy];
+                *(ptr++) = static_cast<unsigned char>((sum+2)/4);
             }
-
+            sourcePtr += 2*dx;
         }
     }
 }
@@ -4322,6 +4516,7 @@ void Optimizer::TextureAtlasVisitor::optimize()
         }
     }
 
+    _builder.setNumThreads(_numThreads);
     _builder.buildAtlas();
 
 
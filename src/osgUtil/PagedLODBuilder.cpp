@@ -0,0 +1,858 @@
+/* -*-c++-*- OpenSceneGraph - Copyright (C) 1998-2006 Robert Osfield
+ *
+ * This library is open source and may be redistributed and/or modified under
+ * the terms of the OpenSceneGraph Public License (OSGPL) version 0.0 or
+ * (at your option) any later version.  The full license is in LICENSE file
+ * included with this distribution, and on the openscenegraph.org website.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * OpenSceneGraph Public License for more details.
+*/
+
+#include <osgUtil/PagedLODBuilder>
+#include <osgUtil/Optimizer>
+#include <osgUtil/Simplifier>
+#include "ThreadPool.h"
+
+#include <osg/Geode>
+#include <osg/Geometry>
+#include <osg/MatrixTransform>
+#include <osg/Notify>
+#include <osg/OperationThread>
+#include <osg/Timer>
+#include <osg/Transform>
+#include <osg/TriangleIndexFunctor>
+
+#include <OpenThreads/Atomic>
+#include <OpenThreads/ScopedLock>
+#include <OpenThreads/Thread>
+
+#include <algorithm>
+#include <map>
+#include <sstream>
+
+using namespace osgUtil;
+
+namespace
+{
+
+/** The StateSet and the arrays a Geometry is extracted with, Geometry of the same Signature are merged.*/
+struct Signature
+{
+    Signature():
+        stateSetIndex(0),
+        normals(false),
+        colors(false) {}
+
+    bool operator < (const Signature& rhs) const
+    {
+        if (stateSetIndex<rhs.stateSetIndex) return true;
+        if (rhs.stateSetIndex<stateSetIndex) return false;
+        if (normals<rhs.normals) return true;
+        if (rhs.normals<normals) return false;
+        if (colors<rhs.colors) return true;
+        if (rhs.colors<colors) return false;
+        return texCoordComponents<rhs.texCoordComponents;
+    }
+
+    unsigned int                stateSetIndex;
+    bool                        normals;
+    bool                        colors;
+    std::vector<unsigned int>   texCoordComponents;
+};
+
+/** A Geometry of the source scene with the matrix that places it in world coordinates.*/
+struct Source
+{
+    osg::ref_ptr<osg::Geometry> geometry;
+    osg::Matrix                 matrix;
+    osg::Matrix                 inverse;
+    const osg::Vec3Array*       vertices;
+    const osg::Vec3Array*       normals;
+    const osg::Array*           colors;
+    std::vector<const osg::Array*> texCoords;
+    Signature                   signature;
+};
+
+struct Triangle
+{
+    unsigned int    source;
+    unsigned int    indices[3];
+};
+
+/** A cell of the octree, the tile of a leaf holds its triangles and the tile of an internal cell the PagedLOD of its children.*/
+struct Cell : public osg::Referenced
+{
+    Cell(unsigned int l, unsigned int cx, unsigned int cy, unsigned int cz):
+        level(l), x(cx), y(cy), z(cz) {}
+
+    bool isLeaf() const { return children.empty(); }
+
+    unsigned int                        level;
+    unsigned int                        x, y, z;
+    osg::BoundingBoxd                   bound;
+
+    /** The centre of the bound, the vertices of the cell's tile and coarse geometry are stored relative to it.*/
+    osg::Vec3d                          origin;
+    std::vector<unsigned int>           triangles;
+    std::vector< osg::ref_ptr<Cell> >   children;
+    std::string                         fileName;
+
+    /** The simplified geometry shown by the cell's PagedLOD when its tile is not loaded.*/
+    osg::ref_ptr<osg::Geode>            coarse;
+    std::vector<Signature>              coarseSignatures;
+};
+
+bool isPerVertex(const osg::Array* array, unsigned int numVertices)
+{
+    if (!array || array->getNumElements()==0) return false;
+    if (array->getBinding()==osg::Array::BIND_OVERALL) return true;
+    return array->getBinding()==osg::Array::BIND_PER_VERTEX && array->getNumElements()>=numVertices;
+}
+
+unsigned int getElementIndex(const osg::Array* array, unsigned int index)
+{
+    return array->getBinding()==osg::Array::BIND_OVERALL ? 0 : index;
+}
+
+class CollectTrianglesOperator
+{
+public:
+
+    CollectTrianglesOperator():
+        _triangles(0),
+        _source(0),
+        _numVertices(0) {}
+
+    void set(std::vector<Triangle>* triangles, const Source* source, unsigned int sourceIndex)
+    {
+        _triangles = triangles;
+        _source = source;
+        _sourceIndex = sourceIndex;
+        _numVertices = source->vertices->size();
+    }
+
+    inline void operator()(unsigned int p1, unsigned int p2, unsigned int p3)
+    {
+        if (p1==p2 || p2==p3 || p1==p3) return;
+        if (p1>=_numVertices || p2>=_numVertices || p3>=_numVertices) return;
+
+        Triangle triangle;
+        triangle.source = _sourceIndex;
+        triangle.indices[0] = p1;
+        triangle.indices[1] = p2;
+        triangle.indices[2] = p3;
+        _triangles->push_back(triangle);
+    }
+
+    std::vector<Triangle>*  _triangles;
+    const Source*           _source;
+    unsigned int            _sourceIndex;
+    unsigned int            _numVertices;
+};
+
+/** Collect the Geometry of a scene along with their world matrices and the StateSets accumulated down their paths.
+  * Only the highest level of detail of LOD nodes is collected.*/
+class CollectSourcesVisitor : public osg::NodeVisitor
+{
+public:
+
+    CollectSourcesVisitor(std::vector<Source>& sources, std::vector<Triangle>& triangles, std::vector< osg::ref_ptr<osg::StateSet> >& stateSets):
+        osg::NodeVisitor(osg::NodeVisitor::TRAVERSE_ALL_CHILDREN),
+        _sources(sources),
+        _triangles(triangles),
+        _stateSets(stateSets) {}
+
+    virtual void apply(osg::LOD& lod)
+    {
+        if (lod.getNumChildren()==0) return;
+
+        unsigned int highest = 0;
+        for(unsigned int i=1; i<lod.getNumChildren() && i<lod.getNumRanges(); ++i)
+        {
+            bool higher = lod.getRangeMode()==osg::LOD::DISTANCE_FROM_EYE_POINT ?
+                lod.getMinRange(i)<lod.getMinRange(highest) :
+                lod.getMaxRange(i)>lod.getMaxRange(highest);
+            if (higher) highest = i;
+        }
+
+        lod.getChild(highest)->accept(*this);
+    }
+
+    virtual void apply(osg::Geometry& geometry)
+    {
+        const osg::Vec3Array* vertices = dynamic_cast<const osg::Vec3Array*>(geometry.getVertexArray());
+        if (!vertices || vertices->empty()) return;
+
+        unsigned int numVertices = vertices->size();
+
+        Source source;
+        source.geometry = &geometry;
+        source.matrix = osg::computeLocalToWorld(getNodePath());
+        source.inverse.invert(source.matrix);
+        source.vertices = vertices;
+
+        source.normals = dynamic_cast<const osg::Vec3Array*>(geometry.getNormalArray());
+        if (!isPerVertex(source.normals, numVertices)) source.normals = 0;
+
+        source.colors = geometry.getColorArray();
+        if (!isPerVertex(source.colors, numVertices) ||
+            (source.colors->getType()!=osg::Array::Vec4ArrayType && source.colors->getType()!=osg::Array::Vec4ubArrayType))
+        {
+            source.colors = 0;
+        }
+
+        source.signature.stateSetIndex = getStateSetIndex();
+        source.signature.normals = source.normals!=0;
+        source.signature.colors = source.colors!=0;
+
+        for(unsigned int unit=0; unit<geometry.getNumTexCoordArrays(); ++unit)
+        {
+            const osg::Array* texCoords = geometry.getTexCoordArray(unit);
+            unsigned int numComponents = 0;
+            if (texCoords && isPerVertex(texCoords, numVertices))
+            {
+                switch(texCoords->getType())
+                {
+                    case(osg::Array::Vec2ArrayType): numComponents = 2; break;
+                    case(osg::Array::Vec3ArrayType): numComponents = 3; break;
+                    case(osg::Array::Vec4ArrayType): numComponents = 4; break;
+                    default: break;
+                }
+            }
+            source.texCoords.push_back(numComponents>0 ? texCoords : 0);
+            source.signature.texCoordComponents.push_back(numComponents);
+        }
+        while(!source.texCoords.empty() && source.texCoords.back()==0)
+        {
+            source.texCoords.pop_back();
+            source.signature.texCoordComponents.pop_back();
+        }
+
+        _sources.push_back(source);
+
+        unsigned int numTriangles = _triangles.size();
+
+        osg::TriangleIndexFunctor<CollectTrianglesOperator> collectTriangles;
+        collectTriangles.set(&_triangles, &_sources.back(), _sources.size()-1);
+        geometry.accept(collectTriangles);
+
+        if (_triangles.size()==numTriangles) _sources.pop_back();
+    }
+
+protected:
+
+    /** Get the index of the StateSet accumulated along the current path, merging and caching it on first use.*/
+    unsigned int getStateSetIndex()
+    {
+        StateSetPath path;
+        for(osg::NodePath::const_iterator itr=getNodePath().begin(); itr!=getNodePath().end(); ++itr)
+        {
+            if ((*itr)->getStateSet()) path.push_back((*itr)->getStateSet());
+        }
+
+        StateSetPathMap::iterator itr = _stateSetPathMap.find(path);
+        if (itr!=_stateSetPathMap.end()) return itr->second;
+
+        osg::ref_ptr<osg::StateSet> stateSet;
+        if (path.size()==1)
+        {
+            stateSet = const_cast<osg::StateSet*>(path.front());
+        }
+        else if (!path.empty())
+        {
+            stateSet = new osg::StateSet(*path.front());
+            for(unsigned int i=1; i<path.size(); ++i)
+            {
+                stateSet->merge(*path[i]);
+            }
+        }
+
+        unsigned int index = _stateSets.size();
+        _stateSets.push_back(stateSet);
+        _stateSetPathMap[path] = index;
+        return index;
+    }
+
+    typedef std::vector<const osg::StateSet*> StateSetPath;
+    typedef std::map<StateSetPath, unsigned int> StateSetPathMap;
+
+    std::vector<Source>&                            _sources;
+    std::vector<Triangle>&                          _triangles;
+    std::vector< osg::ref_ptr<osg::StateSet> >&     _stateSets;
+    StateSetPathMap                                 _stateSetPathMap;
+};
+
+template<class A>
+void appendElements(A& dst, const A& src, const std::vector<unsigned int>& indices)
+{
+    for(std::vector<unsigned int>::const_iterator itr=indices.begin(); itr!=indices.end(); ++itr)
+    {
+        dst.push_back(src[getElementIndex(&src, *itr)]);
+    }
+}
+
+template<class A>
+void appendTexCoords(osg::Geometry& geometry, unsigned int unit, const osg::Array* texCoords, const std::vector<unsigned int>& indices)
+{
+    appendElements(*static_cast<A*>(geometry.getTexCoordArray(unit)), *static_cast<const A*>(texCoords), indices);
+}
+
+unsigned int getNumTriangles(const osg::Geometry& geometry)
+{
+    unsigned int numTriangles = 0;
+    for(unsigned int i=0; i<geometry.getNumPrimitiveSets(); ++i)
+    {
+        const osg::PrimitiveSet* primitiveSet = geometry.getPrimitiveSet(i);
+        if (primitiveSet->getMode()==GL_TRIANGLES) numTriangles += primitiveSet->getNumIndices()/3;
+    }
+    return numTriangles;
+}
+
+class DatabaseBuilder;
+
+struct BuildTilesOperation : public ThreadPool::Work
+{
+    BuildTilesOperation(DatabaseBuilder* builder):
+        _builder(builder) {}
+
+    virtual void operator () (unsigned int threadIndex);
+
+    DatabaseBuilder*                    _builder;
+};
+
+/** Build the octree over the triangles of the scene and write the tiles level by level, deepest first.*/
+class DatabaseBuilder
+{
+public:
+
+    DatabaseBuilder(PagedLODBuilder& builder, const std::string& fileName):
+        _builder(builder),
+        _currentCells(0)
+    {
+        std::string::size_type slash = fileName.find_last_of("/\\");
+        std::string::size_type dot = fileName.find_last_of('.');
+        if (dot!=std::string::npos && (slash==std::string::npos || dot>slash))
+        {
+            _basePath = fileName.substr(0, dot);
+        }
+        else
+        {
+            _basePath = fileName;
+        }
+        _baseName = slash==std::string::npos ? _basePath : _basePath.substr(slash+1);
+    }
+
+    bool collect(osg::Node& node)
+    {
+        CollectSourcesVisitor csv(_sources, _triangles, _stateSets);
+        node.accept(csv);
+        return !_triangles.empty();
+    }
+
+    void buildOctree()
+    {
+        // the world space centroids are only needed to place the triangles in the octree, so are freed once it is built.
+        _centroids.resize(_triangles.size());
+
+        osg::BoundingBoxd box;
+        for(unsigned int i=0; i<_triangles.size(); ++i)
+        {
+            const Triangle& triangle = _triangles[i];
+            const Source& source = _sources[triangle.source];
+            const osg::Vec3Array& vertices = *(source.vertices);
+            _centroids[i] = ((osg::Vec3d(vertices[triangle.indices[0]])+osg::Vec3d(vertices[triangle.indices[1]])+osg::Vec3d(vertices[triangle.indices[2]]))/3.0)*source.matrix;
+            box.expandBy(_centroids[i]);
+        }
+
+        // make the box cubic so that the cells of each level are as close to cubes as the scene allows.
+        double halfSize = osg::maximum(box.xMax()-box.xMin(), osg::maximum(box.yMax()-box.yMin(), box.zMax()-box.zMin()))*0.5;
+        osg::Vec3d halfDiagonal(halfSize, halfSize, halfSize);
+        osg::BoundingBoxd cube(box.center()-halfDiagonal, box.center()+halfDiagonal);
+
+        _root = new Cell(0, 0, 0, 0);
+        _root->triangles.resize(_triangles.size());
+        for(unsigned int i=0; i<_triangles.size(); ++i)
+        {
+            _root->triangles[i] = i;
+        }
+
+        subdivide(_root.get(), cube);
+
+        std::vector<osg::Vec3d>().swap(_centroids);
+    }
+
+    bool buildTiles(unsigned int numThreads)
+    {
+        for(unsigned int level=_levels.size(); level>0 && _failed==0; --level)
+        {
+            processLevel(_levels[level-1], numThreads);
+        }
+
+        return _failed==0;
+    }
+
+    bool writeRoot(const std::string& fileName)
+    {
+        osg::ref_ptr<osg::PagedLOD> root = PagedLODBuilder::createPagedLOD(createLocalTransform(*_root, _root->coarse.get()), _root->fileName, getBoundingSphere(*_root), _builder.getRangeFactor());
+        return writeTile(*root, fileName, _root->coarse.get(), _root->coarseSignatures);
+    }
+
+    unsigned int getNumTilesWritten() const { return _numTilesWritten; }
+
+    unsigned int getNumLevels() const { return _levels.size(); }
+
+    /** Called by each thread, processing cells of the current level until there are none left.*/
+    void processCells()
+    {
+        for(;;)
+        {
+            unsigned int index = (++_nextCell)-1;
+            if (index>=_currentCells->size() || _failed!=0) break;
+
+            Cell* cell = (*_currentCells)[index].get();
+            if (cell->isLeaf()) processLeaf(*cell);
+            else processInternal(*cell);
+        }
+    }
+
+protected:
+
+    typedef std::vector< osg::ref_ptr<Cell> > Cells;
+    typedef std::map<Signature, osg::ref_ptr<osg::Geometry> > GeometryMap;
+
+    void subdivide(Cell* cell, const osg::BoundingBoxd& box)
+    {
+        if (_levels.size()<=cell->level) _levels.resize(cell->level+1);
+        _levels[cell->level].push_back(cell);
+
+        std::ostringstream str;
+        str<<"_L"<<cell->level<<"_X"<<cell->x<<"_Y"<<cell->y<<"_Z"<<cell->z<<_builder.getTileExtension();
+        cell->fileName = _baseName+str.str();
+
+        if (cell->triangles.size()<=_builder.getMaximumNumTrianglesPerTile() || cell->level>=_builder.getMaximumDepth())
+        {
+            for(std::vector<unsigned int>::const_iterator itr=cell->triangles.begin(); itr!=cell->triangles.end(); ++itr)
+            {
+                const Triangle& triangle = _triangles[*itr];
+                const Source& source = _sources[triangle.source];
+                for(unsigned int c=0; c<3; ++c)
+                {
+                    cell->bound.expandBy(osg::Vec3d((*source.vertices)[triangle.indices[c]])*source.matrix);
+                }
+            }
+            cell->origin = cell->bound.center();
+            return;
+        }
+
+        osg::Vec3d center = box.center();
+        std::vector<unsigned int> octants[8];
+        for(std::vector<unsigned int>::const_iterator itr=cell->triangles.begin(); itr!=cell->triangles.end(); ++itr)
+        {
+            const osg::Vec3d& centroid = _centroids[*itr];
+            unsigned int octant = (centroid.x()<center.x() ? 0 : 1) | (centroid.y()<center.y() ? 0 : 2) | (centroid.z()<center.z() ? 0 : 4);
+            octants[octant].push_back(*itr);
+        }
+
+        cell->triangles.clear();
+        std::vector<unsigned int>().swap(cell->triangles);
+
+        for(unsigned int octant=0; octant<8; ++octant)
+        {
+            if (octants[octant].empty()) continue;
+
+            unsigned int dx = octant&1, dy = (octant>>1)&1, dz = (octant>>2)&1;
+            osg::ref_ptr<Cell> child = new Cell(cell->level+1, cell->x*2+dx, cell->y*2+dy, cell->z*2+dz);
+            child->triangles.swap(octants[octant]);
+
+            osg::BoundingBoxd childBox(dx ? center.x() : box.xMin(), dy ? center.y() : box.yMin(), dz ? center.z() : box.zMin(),
+                                      dx ? box.xMax() : center.x(), dy ? box.yMax() : center.y(), dz ? box.zMax() : center.z());
+            subdivide(child.get(), childBox);
+
+            cell->bound.expandBy(child->bound);
+            cell->children.push_back(child);
+        }
+
+        cell->origin = cell->bound.center();
+    }
+
+    void processLevel(Cells& cells, unsigned int numThreads)
+    {
+        _currentCells = &cells;
+        _nextCell.exchange(0);
+
+        numThreads = osg::minimum(numThreads, static_cast<unsigned int>(cells.size()));
+
+        // build tiles in this thread too, then wait for the other threads to complete theirs.
+        BuildTilesOperation operation(this);
+        ThreadPool::instance()->run(operation, numThreads);
+
+        _currentCells = 0;
+    }
+
+    static osg::BoundingSphere getBoundingSphere(const Cell& cell)
+    {
+        return osg::BoundingSphere(osg::Vec3(cell.bound.center()), static_cast<float>(cell.bound.radius()));
+    }
+
+    /** Place node, whose vertices are relative to the origin of cell, in world coordinates.*/
+    static osg::MatrixTransform* createLocalTransform(const Cell& cell, osg::Node* node)
+    {
+        osg::MatrixTransform* transform = new osg::MatrixTransform(osg::Matrixd::translate(cell.origin));
+        transform->addChild(node);
+        return transform;
+    }
+
+    static void translateVertices(osg::Geometry& geometry, const osg::Vec3& offset)
+    {
+        osg::Vec3Array& vertices = *static_cast<osg::Vec3Array*>(geometry.getVertexArray());
+        for(osg::Vec3Array::iterator itr=vertices.begin(); itr!=vertices.end(); ++itr)
+        {
+            *itr += offset;
+        }
+        vertices.dirty();
+        geometry.dirtyBound();
+    }
+
+    osg::Geometry* createGeometry(const Signature& signature)
+    {
+        osg::Geometry* geometry = new osg::Geometry;
+        geometry->setVertexArray(new osg::Vec3Array);
+        if (signature.normals) geometry->setNormalArray(new osg::Vec3Array, osg::Array::BIND_PER_VERTEX);
+        if (signature.colors) geometry->setColorArray(new osg::Vec4Array, osg::Array::BIND_PER_VERTEX);
+        for(unsigned int unit=0; unit<signature.texCoordComponents.size(); ++unit)
+        {
+            switch(signature.texCoordComponents[unit])
+            {
+                case(2): geometry->setTexCoordArray(unit, new osg::Vec2Array, osg::Array::BIND_PER_VERTEX); break;
+                case(3): geometry->setTexCoordArray(unit, new osg::Vec3Array, osg::Array::BIND_PER_VERTEX); break;
+                case(4): geometry->setTexCoordArray(unit, new osg::Vec4Array, osg::Array::BIND_PER_VERTEX); break;
+                default: break;
+            }
+        }
+        geometry->addPrimitiveSet(new osg::DrawElementsUInt(GL_TRIANGLES));
+        return geometry;
+    }
+
+    /** Append the vertices of source referenced by indices, sorted and unique, to geometry relative to origin.
+      * The vertices are transformed into world coordinates in double precision before the origin is subtracted,
+      * so that no precision is lost for scenes far from the world origin.*/
+    void appendVertices(osg::Geometry& geometry, const Source& source, const std::vector<unsigned int>& indices, const osg::Vec3d& origin)
+    {
+        osg::Vec3Array& vertices = *static_cast<osg::Vec3Array*>(geometry.getVertexArray());
+        for(std::vector<unsigned int>::const_iterator itr=indices.begin(); itr!=indices.end(); ++itr)
+        {
+            vertices.push_back(osg::Vec3(osg::Vec3d((*source.vertices)[*itr])*source.matrix-origin));
+        }
+
+        if (source.normals)
+        {
+            osg::Vec3Array& normals = *static_cast<osg::Vec3Array*>(geometry.getNormalArray());
+            for(std::vector<unsigned int>::const_iterator itr=indices.begin(); itr!=indices.end(); ++itr)
+            {
+                osg::Vec3 normal = osg::Matrix::transform3x3(source.inverse, (*source.normals)[getElementIndex(source.normals, *itr)]);
+                normal.normalize();
+                normals.push_back(normal);
+            }
+        }
+
+        if (source.colors)
+        {
+            osg::Vec4Array& colors = *static_cast<osg::Vec4Array*>(geometry.getColorArray());
+            if (source.colors->getType()==osg::Array::Vec4ArrayType)
+            {
+                appendElements(colors, *static_cast<const osg::Vec4Array*>(source.colors), indices);
+            }
+            else
+            {
+                const osg::Vec4ubArray& ubColors = *static_cast<const osg::Vec4ubArray*>(source.colors);
+                for(std::vector<unsigned int>::const_iterator itr=indices.begin(); itr!=indices.end(); ++itr)
+                {
+                    const osg::Vec4ub& color = ubColors[getElementIndex(&ubColors, *itr)];
+                    colors.push_back(osg::Vec4(color.r(), color.g(), color.b(), color.a())/255.0f);
+                }
+            }
+        }
+
+        for(unsigned int unit=0; unit<source.texCoords.size(); ++unit)
+        {
+            switch(source.signature.texCoordComponents[unit])
+            {
+                case(2): appendTexCoords<osg::Vec2Array>(geometry, unit, source.texCoords[unit], indices); break;
+                case(3): appendTexCoords<osg::Vec3Array>(geometry, unit, source.texCoords[unit], indices); break;
+                case(4): appendTexCoords<osg::Vec4Array>(geometry, unit, source.texCoords[unit], indices); break;
+                default: break;
+            }
+        }
+    }
+
+    /** Extract the triangles of a leaf cell relative to its origin, merged into one Geometry per Signature.*/
+    void extractGeometry(const Cell& cell, GeometryMap& geometryMap)
+    {
+        // the triangles of a cell are in collection order so those of each source are consecutive.
+        std::vector<unsigned int>::const_iterator begin = cell.triangles.begin();
+        while(begin!=cell.triangles.end())
+        {
+            unsigned int sourceIndex = _triangles[*begin].source;
+            std::vector<unsigned int>::const_iterator end = begin;
+            while(end!=cell.triangles.end() && _triangles[*end].source==sourceIndex) ++end;
+
+            const Source& source = _sources[sourceIndex];
+
+            std::vector<unsigned int> indices;
+            for(std::vector<unsigned int>::const_iterator itr=begin; itr!=end; ++itr)
+            {
+                const Triangle& triangle = _triangles[*itr];
+                indices.insert(indices.end(), triangle.indices, triangle.indices+3);
+            }
+            std::sort(indices.begin(), indices.end());
+            indices.erase(std::unique(indices.begin(), indices.end()), indices.end());
+
+            osg::ref_ptr<osg::Geometry>& geometry = geometryMap[source.signature];
+            if (!geometry) geometry = createGeometry(source.signature);
+
+            unsigned int base = geometry->getVertexArray()->getNumElements();
+            appendVertices(*geometry, source, indices, cell.origin);
+
+            osg::DrawElementsUInt& elements = *static_cast<osg::DrawElementsUInt*>(geometry->getPrimitiveSet(0));
+            for(std::vector<unsigned int>::const_iterator itr=begin; itr!=end; ++itr)
+            {
+                const Triangle& triangle = _triangles[*itr];
+                for(unsigned int c=0; c<3; ++c)
+                {
+                    unsigned int index = std::lower_bound(indices.begin(), indices.end(), triangle.indices[c])-indices.begin();
+                    elements.push_back(base+index);
+                }
+            }
+
+            begin = end;
+        }
+    }
+
+    /** Simplify a copy of the geometry of a cell into the Geode shown by its PagedLOD.*/
+    void createCoarse(Cell& cell, const GeometryMap& geometryMap, bool copy)
+    {
+        unsigned int numTriangles = 0;
+        for(GeometryMap::const_iterator itr=geometryMap.begin(); itr!=geometryMap.end(); ++itr)
+        {
+            numTriangles += getNumTriangles(*(itr->second));
+        }
+
+        float sampleRatio = _builder.getSampleRatio();
+        if (numTriangles>0)
+        {
+            sampleRatio = osg::minimum(sampleRatio, static_cast<float>(_builder.getMaximumNumTrianglesPerTile())/static_cast<float>(numTriangles));
+        }
+
+        Simplifier simplifier(sampleRatio);
+        simplifier.setSmoothing(false);
+        simplifier.setDoTriStrip(false);
+
+        cell.coarse = new osg::Geode;
+        cell.coarseSignatures.clear();
+        for(GeometryMap::const_iterator itr=geometryMap.begin(); itr!=geometryMap.end(); ++itr)
+        {
+            osg::ref_ptr<osg::Geometry> geometry = copy ?
+                osg::clone(itr->second.get(), osg::CopyOp::DEEP_COPY_ARRAYS|osg::CopyOp::DEEP_COPY_PRIMITIVES) :
+                itr->second.get();
+
+            if (sampleRatio<1.0f) simplifier.simplify(*geometry);
+
+            if (getNumTriangles(*geometry)==0) continue;
+
+            cell.coarse->addDrawable(geometry.get());
+            cell.coarseSignatures.push_back(itr->first);
+        }
+    }
+
+    void processLeaf(Cell& cell)
+    {
+        GeometryMap geometryMap;
+        extractGeometry(cell, geometryMap);
+
+        std::vector<unsigned int>().swap(cell.triangles);
+
+        createCoarse(cell, geometryMap, true);
+
+        osg::ref_ptr<osg::Geode> tile = new osg::Geode;
+        std::vector<Signature> signatures;
+        for(GeometryMap::const_iterator itr=geometryMap.begin(); itr!=geometryMap.end(); ++itr)
+        {
+            tile->addDrawable(itr->second.get());
+            signatures.push_back(itr->first);
+        }
+
+        osg::ref_ptr<osg::MatrixTransform> transform = createLocalTransform(cell, tile.get());
+        writeTile(*transform, getTilePath(cell), tile.get(), signatures);
+    }
+
+    void processInternal(Cell& cell)
+    {
+        osg::ref_ptr<osg::Group> tile = new osg::Group;
+        osg::ref_ptr<osg::Geode> coarse = new osg::Geode;
+        std::vector<Signature> signatures;
+        GeometryMap geometryMap;
+
+        for(Cells::const_iterator itr=cell.children.begin(); itr!=cell.children.end(); ++itr)
+        {
+            Cell& child = *(*itr);
+            tile->addChild(PagedLODBuilder::createPagedLOD(createLocalTransform(child, child.coarse.get()), child.fileName, getBoundingSphere(child), _builder.getRangeFactor()));
+
+            // the coarse geometry of the child is relative to its own origin, so is moved to this cell's origin before merging.
+            osg::Vec3 offset(child.origin-cell.origin);
+
+            for(unsigned int i=0; i<child.coarse->getNumDrawables(); ++i)
+            {
+                osg::Geometry* geometry = child.coarse->getDrawable(i)->asGeometry();
+                coarse->addDrawable(geometry);
+                signatures.push_back(child.coarseSignatures[i]);
+
+                osg::ref_ptr<osg::Geometry> copy = osg::clone(geometry, osg::CopyOp::DEEP_COPY_ARRAYS|osg::CopyOp::DEEP_COPY_PRIMITIVES);
+                translateVertices(*copy, offset);
+
+                osg::ref_ptr<osg::Geometry>& merged = geometryMap[child.coarseSignatures[i]];
+                if (!merged) merged = copy;
+                else Optimizer::MergeGeometryVisitor::mergeGeometry(*merged, *copy);
+            }
+        }
+
+        writeTile(*tile, getTilePath(cell), coarse.get(), signatures);
+
+        for(Cells::const_iterator itr=cell.children.begin(); itr!=cell.children.end(); ++itr)
+        {
+            (*itr)->coarse = 0;
+            (*itr)->coarseSignatures.clear();
+        }
+
+        createCoarse(cell, geometryMap, false);
+    }
+
+    std::string getTilePath(const Cell& cell) const
+    {
+        return _basePath.substr(0, _basePath.size()-_baseName.size())+cell.fileName;
+    }
+
+    /** Write a tile, attaching the StateSets of signatures to the Geometry of geode while it is written.*/
+    bool writeTile(osg::Node& node, const std::string& fileName, osg::Geode* geode, const std::vector<Signature>& signatures)
+    {
+        setStateSets(geode, signatures, true);
+
+        bool result = _builder.getWriteTileCallback()->writeTile(node, fileName);
+
+        setStateSets(geode, signatures, false);
+
+        if (!result)
+        {
+            OSG_NOTICE<<"Warning: PagedLODBuilder could not write tile "<<fileName<<std::endl;
+            _failed.exchange(1);
+            return false;
+        }
+
+        ++_numTilesWritten;
+        return true;
+    }
+
+    void setStateSets(osg::Geode* geode, const std::vector<Signature>& signatures, bool attach)
+    {
+        // the parent lists of shared StateSets are not thread safe, so serialize attaching and detaching them.
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_stateSetMutex);
+        for(unsigned int i=0; i<geode->getNumDrawables(); ++i)
+        {
+            osg::Drawable* drawable = geode->getDrawable(i);
+            if (!attach)
+            {
+                drawable->setStateSet(0);
+                continue;
+            }
+
+            drawable->setStateSet(_stateSets[signatures[i].stateSetIndex].get());
+        }
+    }
+
+    PagedLODBuilder&                            _builder;
+    std::string                                 _basePath;
+    std::string                                 _baseName;
+
+    std::vector<Source>                         _sources;
+    std::vector<Triangle>                       _triangles;
+    std::vector<osg::Vec3d>                     _centroids;
+    std::vector< osg::ref_ptr<osg::StateSet> >  _stateSets;
+
+    osg::ref_ptr<Cell>                          _root;
+    std::vector<Cells>                          _levels;
+
+    Cells*                                      _currentCells;
+    OpenThreads::Atomic                         _nextCell;
+    OpenThreads::Atomic                         _numTilesWritten;
+    OpenThreads::Atomic                         _failed;
+    OpenThreads::Mutex                          _stateSetMutex;
+};
+
+void BuildTilesOperation::operator () (unsigned int)
+{
+    _builder->processCells();
+}
+
+}
+
+PagedLODBuilder::PagedLODBuilder():
+    _maximumNumTrianglesPerTile(16384),
+    _maximumDepth(10),
+    _sampleRatio(0.25f),
+    _rangeFactor(4.0f),
+    _numThreads(1),
+    _tileExtension(".osgb"),
+    _numTilesWritten(0),
+    _numLevels(0)
+{
+}
+
+PagedLODBuilder::~PagedLODBuilder()
+{
+}
+
+osg::PagedLOD* PagedLODBuilder::createPagedLOD(osg::Node* node, const std::string& fileName, const osg::BoundingSphere& bound, float rangeFactor)
+{
+    float cutOff = bound.radius()*rangeFactor;
+
+    osg::PagedLOD* plod = new osg::PagedLOD;
+    plod->setCenterMode(osg::LOD::USER_DEFINED_CENTER);
+    plod->setCenter(bound.center());
+    plod->setRadius(bound.radius());
+    plod->addChild(node, cutOff, FLT_MAX);
+    plod->setFileName(1, fileName);
+    plod->setRange(1, 0.0f, cutOff);
+    return plod;
+}
+
+bool PagedLODBuilder::build(osg::Node* node, const std::string& fileName)
+{
+    _numTilesWritten = 0;
+    _numLevels = 0;
+
+    if (!node || !_writeTileCallback) return false;
+
+    osg::Timer_t startTick = osg::Timer::instance()->tick();
+
+    DatabaseBuilder builder(*this, fileName);
+    if (!builder.collect(*node))
+    {
+        OSG_NOTICE<<"Warning: PagedLODBuilder::build() scene contains no triangles."<<std::endl;
+        return false;
+    }
+
+    builder.buildOctree();
+
+    unsigned int numThreads = _numThreads>0 ? _numThreads : OpenThreads::GetNumberOfProcessors();
+    bool result = builder.buildTiles(numThreads) && builder.writeRoot(fileName);
+
+    _numTilesWritten = builder.getNumTilesWritten();
+    _numLevels = builder.getNumLevels();
+
+    OSG_INFO<<"PagedLODBuilder::build() wrote "<<_numTilesWritten<<" tiles in "<<_numLevels<<" levels in "
+            <<osg::Timer::instance()->delta_s(startTick, osg::Timer::instance()->tick())<<"s"<<std::endl;
+
+    return result;
+}
@@ -0,0 +1,267 @@
+/* -*-c++-*- OpenSceneGraph - Copyright (C) 1998-2006 Robert Osfield
+ *
+ * This library is open source and may be redistributed and/or modified under
+ * the terms of the OpenSceneGraph Public License (OSGPL) version 0.0 or
+ * (at your option) any later version.  The full license is in LICENSE file
+ * included with this distribution, and on the openscenegraph.org website.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * OpenSceneGraph Public License for more details.
+*/
+
+#include <osgUtil/ParallelSubgraphProcessor>
+
+#include <osg/Geode>
+#include <osg/Geometry>
+
+#include <OpenThreads/Atomic>
+#include <OpenThreads/Thread>
+
+#include <map>
+
+#include "ThreadPool.h"
+
+using namespace osgUtil;
+
+namespace
+{
+
+typedef std::vector<const osg::Referenced*> SharedObjectList;
+
+void addSharedArray(const osg::Array* array, SharedObjectList& objects)
+{
+    if (!array) return;
+
+    objects.push_back(array);
+    if (array->getBufferObject()) objects.push_back(array->getBufferObject());
+}
+
+/** Collect the objects a Drawable may share with other Drawables and which processing it may modify.*/
+void addSharedObjects(const osg::Drawable* drawable, SharedObjectList& objects)
+{
+    objects.push_back(drawable);
+
+    const osg::Geometry* geometry = drawable->asGeometry();
+    if (!geometry) return;
+
+    addSharedArray(geometry->getVertexArray(), objects);
+    addSharedArray(geometry->getNormalArray(), objects);
+    addSharedArray(geometry->getColorArray(), objects);
+    addSharedArray(geometry->getSecondaryColorArray(), objects);
+    addSharedArray(geometry->getFogCoordArray(), objects);
+
+    for(unsigned int i=0; i<geometry->getNumTexCoordArrays(); ++i)
+    {
+        addSharedArray(geometry->getTexCoordArray(i), objects);
+    }
+
+    for(unsigned int i=0; i<geometry->getNumVertexAttribArrays(); ++i)
+    {
+        addSharedArray(geometry->getVertexAttribArray(i), objects);
+    }
+
+    for(unsigned int i=0; i<geometry->getNumPrimitiveSets(); ++i)
+    {
+        const osg::PrimitiveSet* primitiveSet = geometry->getPrimitiveSet(i);
+        objects.push_back(primitiveSet);
+
+        const osg::DrawElements* drawElements = primitiveSet->getDrawElements();
+        if (drawElements && drawElements->getBufferObject()) objects.push_back(drawElements->getBufferObject());
+    }
+}
+
+/** Modifying the children of a Geode that has any of these counters set updates the counters of its parents.*/
+bool requiresSerialProcessing(const osg::Node& node)
+{
+    return node.getNumChildrenRequiringUpdateTraversal()>0 ||
+           node.getNumChildrenRequiringEventTraversal()>0 ||
+           node.getNumChildrenWithCullingDisabled()>0 ||
+           node.getNumChildrenWithOccluderNodes()>0;
+}
+
+struct ParallelSubgraphPartitions
+{
+    typedef std::vector<osg::Node*> Partition;
+    typedef std::vector<Partition> PartitionList;
+
+    ParallelSubgraphPartitions(ParallelSubgraphProcessor::Functor& functor):
+        _functor(functor) {}
+
+    void process()
+    {
+        for(;;)
+        {
+            unsigned int partitionIndex = (++_nextPartition)-1;
+            if (partitionIndex>=_partitions.size()) break;
+
+            Partition& partition = _partitions[partitionIndex];
+            for(Partition::iterator itr = partition.begin();
+                itr != partition.end();
+                ++itr)
+            {
+                _functor(**itr);
+            }
+        }
+    }
+
+    ParallelSubgraphProcessor::Functor& _functor;
+    PartitionList                       _partitions;
+    OpenThreads::Atomic                 _nextPartition;
+};
+
+struct ParallelSubgraphOperation : public ThreadPool::Work
+{
+    ParallelSubgraphOperation(ParallelSubgraphPartitions* partitions):
+        _partitions(partitions) {}
+
+    virtual void operator () (unsigned int)
+    {
+        _partitions->process();
+    }
+
+    ParallelSubgraphPartitions*         _partitions;
+};
+
+unsigned int findRoot(std::vector<unsigned int>& roots, unsigned int i)
+{
+    while(roots[i]!=i)
+    {
+        roots[i] = roots[roots[i]];
+        i = roots[i];
+    }
+    return i;
+}
+
+}
+
+void ParallelSubgraphProcessor::run(Functor& functor)
+{
+    // hold references to the nodes until all the processing is complete.
+    NodeList nodes;
+    nodes.swap(_nodes);
+
+    unsigned int numThreads = _numThreads>0 ? _numThreads : OpenThreads::GetNumberOfProcessors();
+    if (numThreads<=1 || nodes.size()<2)
+    {
+        for(NodeList::iterator itr = nodes.begin();
+            itr != nodes.end();
+            ++itr)
+        {
+            functor(**itr);
+        }
+        _numPartitions = nodes.empty() ? 0 : 1;
+        return;
+    }
+
+    // hold references to the drawables of Geodes so any the functor removes are deleted on this thread,
+    // as deleting a Drawable modifies the parent lists of its StateSet which may be shared.
+    NodeList keepDrawables;
+
+    // join nodes that share any object into the same partition, each partition keeping the index of its first node as root.
+    typedef std::map<const osg::Referenced*, unsigned int> ObjectOwnerMap;
+    ObjectOwnerMap objectOwners;
+    std::vector<unsigned int> roots(nodes.size());
+    std::vector<bool> serial(nodes.size(), false);
+    SharedObjectList objects;
+
+    for(unsigned int i=0; i<nodes.size(); ++i)
+    {
+        osg::Node* node = nodes[i].get();
+        roots[i] = i;
+
+        objects.clear();
+        objects.push_back(node);
+
+        osg::Geode* geode = node->asGeode();
+        if (geode)
+        {
+            for(unsigned int d=0; d<geode->getNumDrawables(); ++d)
+            {
+                osg::Drawable* drawable = geode->getDrawable(d);
+                if (!drawable) continue;
+
+                keepDrawables.push_back(drawable);
+                addSharedObjects(drawable, objects);
+            }
+            serial[i] = requiresSerialProcessing(*geode);
+        }
+        else if (node->asDrawable())
+        {
+            addSharedObjects(node->asDrawable(), objects);
+        }
+
+        for(SharedObjectList::iterator itr = objects.begin();
+            itr != objects.end();
+            ++itr)
+        {
+            ObjectOwnerMap::iterator oitr = objectOwners.find(*itr);
+            if (oitr==objectOwners.end())
+            {
+                objectOwners[*itr] = i;
+            }
+            else
+            {
+                unsigned int lhs = findRoot(roots, oitr->second);
+                unsigned int rhs = findRoot(roots, i);
+                if (lhs<rhs) roots[rhs] = lhs;
+                else if (rhs<lhs) roots[lhs] = rhs;
+            }
+        }
+
+        // dirty the bounds up front so that any dirtyBound() during processing stops at the node
+        // rather than racing with other threads to dirty the shared parents.
+        node->dirtyBound();
+    }
+
+    // gather the partitions, ordered by their first node, keeping the nodes in the order they were added.
+    ParallelSubgraphPartitions parallelPartitions(functor);
+    ParallelSubgraphPartitions::PartitionList serialPartitions;
+    std::vector<unsigned int> partitionIndices(nodes.size(), 0);
+    std::vector<bool> partitionSerial;
+    ParallelSubgraphPartitions::PartitionList partitions;
+
+    for(unsigned int i=0; i<nodes.size(); ++i)
+    {
+        unsigned int root = findRoot(roots, i);
+        if (root==i)
+        {
+            partitionIndices[i] = partitions.size();
+            partitions.push_back(ParallelSubgraphPartitions::Partition());
+            partitionSerial.push_back(false);
+        }
+
+        unsigned int partitionIndex = partitionIndices[root];
+        partitions[partitionIndex].push_back(nodes[i].get());
+        if (serial[i]) partitionSerial[partitionIndex] = true;
+    }
+
+    for(unsigned int p=0; p<partitions.size(); ++p)
+    {
+        if (partitionSerial[p]) serialPartitions.push_back(partitions[p]);
+        else parallelPartitions._partitions.push_back(partitions[p]);
+    }
+
+    _numPartitions = partitions.size();
+
+    numThreads = osg::minimum(numThreads, static_cast<unsigned int>(parallelPartitions._partitions.size()));
+    if (numThreads<1) numThreads = 1;
+
+    // process partitions in this thread too, then wait for the other threads to complete theirs.
+    ParallelSubgraphOperation operation(&parallelPartitions);
+    ThreadPool::instance()->run(operation, numThreads);
+
+    // the partitions that modify shared parents share nothing with the others, so can be processed afterwards.
+    for(ParallelSubgraphPartitions::PartitionList::iterator pitr = serialPartitions.begin();
+        pitr != serialPartitions.end();
+        ++pitr)
+    {
+        for(ParallelSubgraphPartitions::Partition::iterator itr = pitr->begin();
+            itr != pitr->end();
+            ++itr)
+        {
+            functor(**itr);
+        }
+    }
+}
@@ -16,10 +16,12 @@
 #include <osgUtil/RenderBin>
 #include <osgUtil/RenderStage>
 #include <osgUtil/Statistics>
+#include <osgUtil/MultiDrawIndirectBatcher>
 
 #include <osg/Notify>
 #include <osg/ApplicationUsage>
 #include <osg/AlphaFunc>
+#include <osg/Types>
 
 #include <algorithm>
 
@@ -38,6 +40,10 @@ class RenderBinPrototypeList : osg::depends_on<OpenThreads::Mutex*, osg::Referen
             add("SORT_BACK_TO_FRONT",new RenderBin(RenderBin::SORT_BACK_TO_FRONT));
             add("SORT_FRONT_TO_BACK",new RenderBin(RenderBin::SORT_FRONT_TO_BACK));
             add("TraversalOrderBin",new RenderBin(RenderBin::TRAVERSAL_ORDER));
+
+            osg::ref_ptr<RenderBin> multiDrawBin = new RenderBin(RenderBin::SORT_BY_STATE);
+            multiDrawBin->setUseMultiDrawIndirect(true);
+            add("MultiDrawIndirectBin",multiDrawBin.get());
         }
 
         void add(const std::string& name, RenderBin* bin)
@@ -149,6 +155,9 @@ RenderBin::RenderBin()
     _stage = NULL;
     _sorted = false;
     _sortMode = getDefaultRenderBinSortMode();
+    _useMultiDrawIndirect = false;
+    _multiDrawMatrixAttributeLocation = 12;
+    _minimumMultiDrawBatchSize = 8;
 }
 
 RenderBin::RenderBin(SortMode mode)
@@ -158,6 +167,9 @@ RenderBin::RenderBin(SortMode mode)
     _stage = NULL;
     _sorted = false;
     _sortMode = mode;
+    _useMultiDrawIndirect = false;
+    _multiDrawMatrixAttributeLocation = 12;
+    _minimumMultiDrawBatchSize = 8;
 
 #if 1
     if (_sortMode==SORT_BACK_TO_FRONT)
@@ -189,7 +201,10 @@ RenderBin::RenderBin(const RenderBin& rhs,const CopyOp& copyop):
         _sortMode(rhs._sortMode),
         _sortCallback(rhs._sortCallback),
         _drawCallback(rhs._drawCallback),
-        _stateset(rhs._stateset)
+        _stateset(rhs._stateset),
+        _useMultiDrawIndirect(rhs._useMultiDrawIndirect),
+        _multiDrawMatrixAttributeLocation(rhs._multiDrawMatrixAttributeLocation),
+        _minimumMultiDrawBatchSize(rhs._minimumMultiDrawBatchSize)
 {
 
 }
@@ -204,6 +219,13 @@ void RenderBin::reset()
     _renderLeafList.clear();
     _bins.clear();
     _sorted = false;
+
+    for(RenderBinReuseMap::iterator itr = _reuseBins.begin();
+        itr != _reuseBins.end();
+        ++itr)
+    {
+        itr->second.second->reset();
+    }
 }
 
 void RenderBin::sort()
@@ -272,6 +294,78 @@ void RenderBin::sortByState()
 }
 
 
+// lists shorter than this are sorted with std::sort, longer ones with the radix sort below.
+static const unsigned int s_minimumRadixSortSize = 256;
+
+/** Map a float onto an unsigned int whose unsigned ordering matches the float ordering.*/
+static inline uint32_t floatToSortKey(float value)
+{
+    union { float f; uint32_t u; } bits;
+    bits.f = value;
+    return (bits.u & 0x80000000u) ? ~bits.u : (bits.u | 0x80000000u);
+}
+
+/** Sort a list by a 32 bit key using a least significant digit radix sort over contiguous 64 bit keys.
+  * The key functor's value is packed in the upper 32 bits and the original position in the lower 32 bits,
+  * only the upper digits are sorted on, so elements with equal keys keep their original order - for leaves
+  * copied from the StateGraphList this keeps them grouped by StateGraph.*/
+template<class T, class KeyFunctor>
+static void radixSortByKey(std::vector<T>& list, KeyFunctor keyFunctor)
+{
+    const unsigned int numElements = static_cast<unsigned int>(list.size());
+
+    std::vector<uint64_t> keys(numElements);
+    std::vector<uint64_t> scratch(numElements);
+
+    unsigned int counts[4][256];
+    memset(counts, 0, sizeof(counts));
+
+    for(unsigned int i=0; i<numElements; ++i)
+    {
+        uint32_t key = keyFunctor(list[i]);
+        keys[i] = (static_cast<uint64_t>(key)<<32) | i;
+
+        for(unsigned int pass=0; pass<4; ++pass)
+        {
+            ++counts[pass][(key>>(pass*8)) & 0xff];
+        }
+    }
+
+    uint64_t* src = &keys.front();
+    uint64_t* dst = &scratch.front();
+    for(unsigned int pass=0; pass<4; ++pass)
+    {
+        unsigned int shift = 32+pass*8;
+        unsigned int* count = counts[pass];
+
+        // skip digits that are the same across all keys.
+        if (count[(src[0]>>shift) & 0xff]==numElements) continue;
+
+        unsigned int offset = 0;
+        for(unsigned int d=0; d<256; ++d)
+        {
+            unsigned int c = count[d];
+            count[d] = offset;
+            offset += c;
+        }
+
+        for(unsigned int i=0; i<numElements; ++i)
+        {
+            dst[count[(src[i]>>shift) & 0xff]++] = src[i];
+        }
+
+        std::swap(src, dst);
+    }
+
+    std::vector<T> sorted;
+    sorted.reserve(numElements);
+    for(unsigned int i=0; i<numElements; ++i)
+    {
+        sorted.push_back(list[static_cast<unsigned int>(src[i] & 0xffffffff)]);
+    }
+    list.swap(sorted);
+}
+
 struct StateGraphFrontToBackSortFunctor
 {
     bool operator() (const StateGraph* lhs,const StateGraph* rhs) const
@@ -280,6 +374,14 @@ struct StateGraphFrontToBackSortFunctor
     }
 };
 
+struct StateGraphFrontToBackKeyFunctor
+{
+    uint32_t operator() (const StateGraph* rg) const
+    {
+        return floatToSortKey(rg->_minimumDistance);
+    }
+};
+
 void RenderBin::sortByStateThenFrontToBack()
 {
     for(StateGraphList::iterator itr=_stateGraphList.begin();
@@ -289,7 +391,9 @@ void RenderBin::sortByStateThenFrontToBack()
         (*itr)->sortFrontToBack();
         (*itr)->getMinimumDistance();
     }
-    std::sort(_stateGraphList.begin(),_stateGraphList.end(),StateGraphFrontToBackSortFunctor());
+
+    if (_stateGraphList.size()<s_minimumRadixSortSize) std::sort(_stateGraphList.begin(),_stateGraphList.end(),StateGraphFrontToBackSortFunctor());
+    else radixSortByKey(_stateGraphList, StateGraphFrontToBackKeyFunctor());
 }
 
 struct FrontToBackSortFunctor
@@ -300,13 +404,21 @@ struct FrontToBackSortFunctor
     }
 };
 
+struct FrontToBackKeyFunctor
+{
+    uint32_t operator() (const RenderLeaf* rl) const
+    {
+        return floatToSortKey(rl->_depth);
+    }
+};
 
 void RenderBin::sortFrontToBack()
 {
     copyLeavesFromStateGraphListToRenderLeafList();
 
     // now sort the list into acending depth order.
-    std::sort(_renderLeafList.begin(),_renderLeafList.end(),FrontToBackSortFunctor());
+    if (_renderLeafList.size()<s_minimumRadixSortSize) std::sort(_renderLeafList.begin(),_renderLeafList.end(),FrontToBackSortFunctor());
+    else radixSortByKey(_renderLeafList, FrontToBackKeyFunctor());
 
 //    cout << "sort front to back"<<endl;
 }
@@ -319,12 +431,21 @@ struct BackToFrontSortFunctor
     }
 };
 
+struct BackToFrontKeyFunctor
+{
+    uint32_t operator() (const RenderLeaf* rl) const
+    {
+        return ~floatToSortKey(rl->_depth);
+    }
+};
+
 void RenderBin::sortBackToFront()
 {
     copyLeavesFromStateGraphListToRenderLeafList();
 
-    // now sort the list into acending depth order.
-    std::sort(_renderLeafList.begin(),_renderLeafList.end(),BackToFrontSortFunctor());
+    // now sort the list into decending depth order.
+    if (_renderLeafList.size()<s_minimumRadixSortSize) std::sort(_renderLeafList.begin(),_renderLeafList.end(),BackToFrontSortFunctor());
+    else radixSortByKey(_renderLeafList, BackToFrontKeyFunctor());
 
 //    cout << "sort back to front"<<endl;
 }
@@ -338,12 +459,21 @@ struct TraversalOrderFunctor
     }
 };
 
+struct TraversalOrderKeyFunctor
+{
+    uint32_t operator() (const RenderLeaf* rl) const
+    {
+        return rl->_traversalNumber;
+    }
+};
+
 void RenderBin::sortTraversalOrder()
 {
     copyLeavesFromStateGraphListToRenderLeafList();
 
-    // now sort the list into acending depth order.
-    std::sort(_renderLeafList.begin(),_renderLeafList.end(),TraversalOrderFunctor());
+    // now sort the list into acending traversal order.
+    if (_renderLeafList.size()<s_minimumRadixSortSize) std::sort(_renderLeafList.begin(),_renderLeafList.end(),TraversalOrderFunctor());
+    else radixSortByKey(_renderLeafList, TraversalOrderKeyFunctor());
 }
 
 void RenderBin::copyLeavesFromStateGraphListToRenderLeafList()
@@ -395,6 +525,17 @@ RenderBin* RenderBin::find_or_insert(int binNum,const std::string& binName)
     RenderBinList::iterator itr = _bins.find(binNum);
     if (itr!=_bins.end()) return itr->second.get();
 
+    // reuse the bin created for binNum in an earlier frame if it came from the same prototype.
+    RenderBinReuseMap::iterator ritr = _reuseBins.find(binNum);
+    if (ritr!=_reuseBins.end() && ritr->second.first==binName)
+    {
+        RenderBin* rb = ritr->second.second.get();
+        rb->_parent = this;
+        rb->_stage = _stage;
+        _bins[binNum] = rb;
+        return rb;
+    }
+
     // create a rendering bin and insert into bin list.
     RenderBin* rb = RenderBin::createRenderBin(binName);
     if (rb)
@@ -414,11 +555,31 @@ RenderBin* RenderBin::find_or_insert(int binNum,const std::string& binName)
             rb->_parent = this;
             rb->_stage = _stage;
             _bins[binNum] = rb;
+            _reuseBins[binNum] = std::make_pair(binName, osg::ref_ptr<RenderBin>(rb));
         }
     }
     return rb;
 }
 
+RenderBin* RenderBin::find_or_insert(const RenderBin* bin)
+{
+    // search for appropriate bin.
+    RenderBinList::iterator itr = _bins.find(bin->_binNum);
+    if (itr!=_bins.end()) return itr->second.get();
+
+    // create an empty bin of the same type and settings and insert into bin list.
+    RenderBin* rb = dynamic_cast<RenderBin*>(bin->clone(osg::CopyOp::SHALLOW_COPY));
+    if (rb)
+    {
+        rb->reset();
+        rb->_binNum = bin->_binNum;
+        rb->_parent = this;
+        rb->_stage = _stage;
+        _bins[rb->_binNum] = rb;
+    }
+    return rb;
+}
+
 void RenderBin::draw(osg::RenderInfo& renderInfo,RenderLeaf*& previous)
 {
     renderInfo.pushRenderBin(this);
@@ -471,8 +632,27 @@ void RenderBin::drawImplementation(osg::RenderInfo& renderInfo,RenderLeaf*& prev
 
     bool draw_forward = true; //(_sortMode!=SORT_BY_STATE) || (state.getFrameStamp()->getFrameNumber() % 2)==0;
 
+    MultiDrawIndirectBatcher* batcher = _useMultiDrawIndirect ? MultiDrawIndirectBatcher::getOrCreate(state) : 0;
+    if (batcher && !batcher->isSupported()) batcher = 0;
+
     // draw coarse grained ordering.
-    if (draw_forward)
+    if (batcher)
+    {
+        if (batcher->getMatrixAttributeLocation()!=_multiDrawMatrixAttributeLocation)
+        {
+            batcher->setMatrixAttributeLocation(_multiDrawMatrixAttributeLocation);
+            batcher->resetMatrixAttribute(state);
+        }
+        batcher->setMinimumBatchSize(_minimumMultiDrawBatchSize);
+
+        for(StateGraphList::iterator oitr=_stateGraphList.begin();
+            oitr!=_stateGraphList.end();
+            ++oitr)
+        {
+            batcher->draw(renderInfo,*oitr,previous);
+        }
+    }
+    else if (draw_forward)
     {
         for(StateGraphList::iterator oitr=_stateGraphList.begin();
             oitr!=_stateGraphList.end();
@@ -660,6 +840,8 @@ void RenderBin::releaseGLObjects(osg::State* state) const
 {
     if (_stateset) _stateset->releaseGLObjects(state);
 
+    if (_useMultiDrawIndirect) MultiDrawIndirectBatcher::releaseBatcher(state);
+
     for(RenderBinList::const_iterator itr = _bins.begin();
         itr != _bins.end();
         ++itr)
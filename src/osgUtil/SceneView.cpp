@@ -924,8 +924,9 @@ bool SceneView::cullStage(const osg::Matrixd& projection,const osg::Matrixd& mod
     // note, this would be not required if the rendergraph had been
     // reset at the start of each frame (see top of this method) but
     // a clean has been used instead to try to minimize the amount of
-    // allocation and deleteing of the StateGraph nodes.
-    rendergraph->prune();
+    // allocation and deleteing of the StateGraph nodes. The pruned nodes
+    // are passed to the CullVisitor's FrameArena for recycling.
+    rendergraph->prune(cullVisitor->getFrameArena());
 
     // set the number of dynamic objects in the scene.
     _dynamicObjectCount += renderStage->computeNumberOfDynamicRenderLeaves();
@@ -12,15 +12,24 @@
 */
 
 #include <osg/TriangleIndexFunctor>
+#include <osg/BoundingBox>
+#include <osg/OperationThread>
+
+#include <OpenThreads/Atomic>
+#include <OpenThreads/ScopedLock>
+#include <OpenThreads/Thread>
 
 #include <osgUtil/Simplifier>
 
 #include <osgUtil/SmoothingVisitor>
 #include <osgUtil/TriStripVisitor>
 
+#include "ThreadPool.h"
+
 #include <set>
 #include <list>
 #include <algorithm>
+#include <functional>
 
 #include <iterator>
 
@@ -71,17 +80,13 @@ public:
 
 
     EdgeCollapse():
-        _geometry(0),
-        _computeErrorMetricUsingLength(false)  {}
+        _geometry(0) {}
 
     ~EdgeCollapse();
 
-    void setGeometry(osg::Geometry* geometry, const Simplifier::IndexList& protectedPoints);
+    void setGeometry(osg::Geometry* geometry);
     osg::Geometry* getGeometry() { return _geometry; }
 
-    void setComputeErrorMetricUsingLength(bool flag) { _computeErrorMetricUsingLength = flag; }
-    bool getComputeErrorMetricUsingLength() const { return _computeErrorMetricUsingLength; }
-
     unsigned int getNumOfTriangles() { return _triangleSet.size(); }
 
     Point* computeInterpolatedPoint(Edge* edge,float r) const
@@ -112,43 +117,13 @@ public:
         return computeInterpolatedPoint(edge,0.5f);
     }
 
-    error_type computeErrorMetric(Edge* edge,Point* point) const
+    // edges are divided longest first, so the error metric is the length of the edge.
+    error_type computeErrorMetric(Edge* edge) const
     {
-        if (_computeErrorMetricUsingLength)
-        {
-            error_type dx = error_type(edge->_p1->_vertex.x()) - error_type(edge->_p2->_vertex.x());
-            error_type dy = error_type(edge->_p1->_vertex.y()) - error_type(edge->_p2->_vertex.y());
-            error_type dz = error_type(edge->_p1->_vertex.z()) - error_type(edge->_p2->_vertex.z());
-            return sqrt(dx*dx + dy*dy + dz*dz);
-        }
-        else if (point)
-        {
-            typedef std::set< osg::ref_ptr<Triangle> > LocalTriangleSet ;
-            LocalTriangleSet triangles;
-            std::copy( edge->_p1->_triangles.begin(), edge->_p1->_triangles.end(), std::inserter(triangles,triangles.begin()));
-            std::copy( edge->_p2->_triangles.begin(), edge->_p2->_triangles.end(), std::inserter(triangles,triangles.begin()));
-
-            const osg::Vec3& vertex = point->_vertex;
-            error_type error = 0.0;
-
-            if (triangles.empty()) return 0.0;
-
-            for(LocalTriangleSet::iterator itr=triangles.begin();
-                itr!=triangles.end();
-                ++itr)
-            {
-                error += fabs( (*itr)->distance(vertex) );
-            }
-
-            // use average of error
-            error /= error_type(triangles.size());
-
-            return error;
-        }
-        else
-        {
-            return 0;
-        }
+        error_type dx = error_type(edge->_p1->_vertex.x()) - error_type(edge->_p2->_vertex.x());
+        error_type dy = error_type(edge->_p1->_vertex.y()) - error_type(edge->_p2->_vertex.y());
+        error_type dz = error_type(edge->_p1->_vertex.z()) - error_type(edge->_p2->_vertex.z());
+        return sqrt(dx*dx + dy*dy + dz*dz);
     }
 
     void updateErrorMetricForEdge(Edge* edge)
@@ -168,20 +143,7 @@ public:
         }
 
         edge->_proposedPoint = computeOptimalPoint(edge);
-
-        if (_computeErrorMetricUsingLength)
-        {
-            edge->setErrorMetric( computeErrorMetric( edge, edge->_proposedPoint.get()));
-        }
-        else
-        {
-            edge->updateMaxNormalDeviationOnEdgeCollapse();
-
-            if (edge->getMaxNormalDeviationOnEdgeCollapse()<=1.0 && !edge->isAdjacentToBoundary())
-                edge->setErrorMetric( computeErrorMetric( edge, edge->_proposedPoint.get()));
-            else
-                edge->setErrorMetric( FLT_MAX );
-         }
+        edge->setErrorMetric( computeErrorMetric( edge ));
 
         _edgeSet.insert(keep_local_reference_to_edge);
     }
@@ -199,46 +161,11 @@ public:
             ++itr)
         {
             Edge* edge = itr->get();
-
-            if (_computeErrorMetricUsingLength)
-            {
-                edge->setErrorMetric( computeErrorMetric( edge, edge->_proposedPoint.get()));
-            }
-            else
-            {
-                edge->_proposedPoint = computeOptimalPoint(edge);
-                edge->updateMaxNormalDeviationOnEdgeCollapse();
-
-                if (edge->getMaxNormalDeviationOnEdgeCollapse()<=1.0 && !edge->isAdjacentToBoundary())
-                    edge->setErrorMetric( computeErrorMetric( edge, edge->_proposedPoint.get()));
-                else
-                    edge->setErrorMetric( FLT_MAX );
-
-            }
+            edge->setErrorMetric( computeErrorMetric( edge ));
             _edgeSet.insert(edge);
         }
     }
 
-    bool collapseMinimumErrorEdge()
-    {
-        if (!_edgeSet.empty())
-        {
-            Edge* edge = const_cast<Edge*>(_edgeSet.begin()->get());
-
-            if (edge->getErrorMetric()==FLT_MAX)
-            {
-                OSG_INFO<<"collapseMinimumErrorEdge() return false due to edge->getErrorMetric()==FLT_MAX"<<std::endl;
-                return false;
-            }
-
-            osg::ref_ptr<Point> pNew = edge->_proposedPoint.valid()? edge->_proposedPoint.get() : computeInterpolatedPoint(edge,0.5f);
-            return (collapseEdge(edge,pNew.get()));
-        }
-        OSG_INFO<<"collapseMinimumErrorEdge() return false due to _edgeSet.empty()"<<std::endl;
-        return false;
-    }
-
-
     bool divideLongestEdge()
     {
         if (!_edgeSet.empty())
@@ -270,9 +197,7 @@ public:
 
     struct Point : public osg::Referenced
     {
-        Point(): _protected(false), _index(0) {}
-
-        bool _protected;
+        Point(): _index(0) {}
 
         unsigned int _index;
 
@@ -293,30 +218,11 @@ public:
 
             return _attributes < rhs._attributes;
         }
-
-        bool isBoundaryPoint() const
-        {
-            if (_protected) return true;
-
-            for(TriangleSet::const_iterator itr=_triangles.begin();
-                itr!=_triangles.end();
-                ++itr)
-            {
-                const Triangle* triangle = itr->get();
-                if ((triangle->_e1->_p1==this || triangle->_e1->_p2==this) && triangle->_e1->isBoundaryEdge()) return true;
-                if ((triangle->_e2->_p1==this || triangle->_e2->_p2==this) && triangle->_e2->isBoundaryEdge()) return true;
-                if ((triangle->_e3->_p1==this || triangle->_e3->_p2==this) && triangle->_e3->isBoundaryEdge()) return true;
-
-                //if ((*itr)->isBoundaryTriangle()) return true;
-            }
-            return false;
-        }
-
     };
 
     struct Edge : public osg::Referenced
     {
-        Edge(): _errorMetric(0.0), _maximumDeviation(1.0) {}
+        Edge(): _errorMetric(0.0) {}
 
         void clear()
         {
@@ -331,7 +237,6 @@ public:
         TriangleSet _triangles;
 
         error_type _errorMetric;
-        error_type _maximumDeviation;
 
         osg::ref_ptr<Point> _proposedPoint;
 
@@ -376,39 +281,6 @@ public:
         {
             return _triangles.size()<=1;
         }
-
-        bool isAdjacentToBoundary() const
-        {
-            return isBoundaryEdge() || _p1->isBoundaryPoint() || _p2->isBoundaryPoint();
-        }
-
-
-        void updateMaxNormalDeviationOnEdgeCollapse()
-        {
-            //OSG_NOTICE<<"updateMaxNormalDeviationOnEdgeCollapse()"<<std::endl;
-            _maximumDeviation = 0.0f;
-            for(TriangleSet::iterator itr1=_p1->_triangles.begin();
-                itr1!=_p1->_triangles.end();
-                ++itr1)
-            {
-                if (_triangles.count(*itr1)==0)
-                {
-                    _maximumDeviation = osg::maximum(_maximumDeviation, (*itr1)->computeNormalDeviationOnEdgeCollapse(this,_proposedPoint.get()));
-                }
-            }
-            for(TriangleSet::iterator itr2=_p2->_triangles.begin();
-                itr2!=_p2->_triangles.end();
-                ++itr2)
-            {
-                if (_triangles.count(*itr2)==0)
-                {
-                    _maximumDeviation = osg::maximum(_maximumDeviation, (*itr2)->computeNormalDeviationOnEdgeCollapse(this,_proposedPoint.get()));
-                }
-            }
-        }
-
-        error_type getMaxNormalDeviationOnEdgeCollapse() const { return _maximumDeviation; }
-
     };
 
     struct Triangle : public osg::Referenced
@@ -462,49 +334,6 @@ public:
             _p3 = points[(lowest+2)%3];
         }
 
-        void update()
-        {
-            _plane.set(_p1->_vertex,_p2->_vertex,_p3->_vertex);
-
-        }
-
-        osg::Plane computeNewPlaneOnEdgeCollapse(Edge* edge,Point* pNew) const
-        {
-            const Point* p1 = (_p1==edge->_p1 || _p1==edge->_p2) ? pNew : _p1.get();
-            const Point* p2 = (_p2==edge->_p1 || _p2==edge->_p2) ? pNew : _p2.get();
-            const Point* p3 = (_p3==edge->_p1 || _p3==edge->_p2) ? pNew : _p3.get();
-
-            return osg::Plane(p1->_vertex,p2->_vertex,p3->_vertex);
-        }
-
-        // note return 1 - dotproduct, so that deviation is in the range of 0.0 to 2.0, where 0 is coincident, 1.0 is 90 degrees, and 2.0 is 180 degrees.
-        error_type computeNormalDeviationOnEdgeCollapse(Edge* edge,Point* pNew) const
-        {
-            const Point* p1 = (_p1==edge->_p1 || _p1==edge->_p2) ? pNew : _p1.get();
-            const Point* p2 = (_p2==edge->_p1 || _p2==edge->_p2) ? pNew : _p2.get();
-            const Point* p3 = (_p3==edge->_p1 || _p3==edge->_p2) ? pNew : _p3.get();
-
-            osg::Vec3 new_normal = (p2->_vertex - p1->_vertex) ^ (p3->_vertex - p2->_vertex);
-            new_normal.normalize();
-
-            error_type result = 1.0 - (new_normal.x() * _plane[0] + new_normal.y() * _plane[1] + new_normal.z() * _plane[2]);
-            return result;
-        }
-
-        error_type distance(const osg::Vec3& vertex) const
-        {
-            return error_type(_plane[0])*error_type(vertex.x())+
-                   error_type(_plane[1])*error_type(vertex.y())+
-                   error_type(_plane[2])*error_type(vertex.z())+
-                   error_type(_plane[3]);
-        }
-
-        bool isBoundaryTriangle() const
-        {
-            return (_e1->isBoundaryEdge() || _e2->isBoundaryEdge() ||  _e3->isBoundaryEdge());
-        }
-
-
         osg::ref_ptr<Point> _p1;
         osg::ref_ptr<Point> _p2;
         osg::ref_ptr<Point> _p3;
@@ -512,9 +341,6 @@ public:
         osg::ref_ptr<Edge> _e1;
         osg::ref_ptr<Edge> _e2;
         osg::ref_ptr<Edge> _e3;
-
-        osg::Plane _plane;
-
     };
 
 
@@ -545,8 +371,6 @@ public:
         triangle->_e2 = addEdge(triangle, triangle->_p2.get(), triangle->_p3.get());
         triangle->_e3 = addEdge(triangle, triangle->_p3.get(), triangle->_p1.get());
 
-        triangle->update();
-
         _triangleSet.insert(triangle);
 
         return triangle;
@@ -583,8 +407,6 @@ public:
         triangle->_e2 = addEdge(triangle, triangle->_p2.get(), triangle->_p3.get());
         triangle->_e3 = addEdge(triangle, triangle->_p3.get(), triangle->_p1.get());
 
-        triangle->update();
-
         _triangleSet.insert(triangle);
 
         return triangle;
@@ -710,7 +532,7 @@ public:
             edge->_p2 = p1;
         }
 
-        edge->setErrorMetric( computeErrorMetric( edge.get(), edge->_proposedPoint.get()));
+        edge->setErrorMetric( computeErrorMetric( edge.get() ));
 
         EdgeSet::iterator itr = _edgeSet.find(edge);
         if (itr==_edgeSet.end())
@@ -788,200 +610,6 @@ public:
     }
 
 
-    bool collapseEdge(Edge* edge, Point* pNew)
-    {
-        //if (edge->_triangles.size()<2) return false;
-        //if (edge->_triangles.size()>2) return false;
-
-#ifdef ORIGIANAL_CODE
-        if (edge->getMaxNormalDeviationOnEdgeCollapse()>1.0)
-        {
-            OSG_NOTICE<<"collapseEdge("<<edge<<") refused due to edge->getMaxNormalDeviationOnEdgeCollapse() = "<<edge->getMaxNormalDeviationOnEdgeCollapse()<<std::endl;
-           return false;
-        }
-        else
-        {
-            //OSG_NOTICE<<"collapseEdge("<<edge<<") edge->getMaxNormalDeviationOnEdgeCollapse() = "<<edge->getMaxNormalDeviationOnEdgeCollapse()<<std::endl;
-        }
-#endif
-
-        typedef std::set< osg::ref_ptr<Edge> > LocalEdgeList;
-
-        osg::ref_ptr<Edge> keep_edge_locally_referenced_to_prevent_premature_deletion = edge;
-        osg::ref_ptr<Point> keep_point_locally_referenced_to_prevent_premature_deletion = pNew;
-        osg::ref_ptr<Point> edge_p1 = edge->_p1;
-        osg::ref_ptr<Point> edge_p2 = edge->_p2;
-
-        TriangleMap  triangleMap;
-        TriangleList triangles_p1;
-        TriangleList triangles_p2;
-        LocalEdgeList oldEdges;
-
-
-        if (edge_p1 != pNew)
-        {
-            for(TriangleSet::iterator itr=edge_p1->_triangles.begin();
-                itr!=edge_p1->_triangles.end();
-                ++itr)
-            {
-                if (edge->_triangles.count(*itr)==0)
-                {
-                    Triangle* triangle = const_cast<Triangle*>(itr->get());
-                    triangles_p1.push_back(triangle);
-                    oldEdges.insert(triangle->_e1);
-                    oldEdges.insert(triangle->_e2);
-                    oldEdges.insert(triangle->_e3);
-                }
-            }
-
-            //triangles_p1 = edge_p1->_triangles;
-        }
-
-        if (edge_p2 != pNew)
-        {
-            for(TriangleSet::iterator itr=edge_p2->_triangles.begin();
-                itr!=edge_p2->_triangles.end();
-                ++itr)
-            {
-                if (edge->_triangles.count(*itr)==0)
-                {
-                    Triangle* triangle = const_cast<Triangle*>(itr->get());
-                    triangles_p2.push_back(triangle);
-                    oldEdges.insert(triangle->_e1);
-                    oldEdges.insert(triangle->_e2);
-                    oldEdges.insert(triangle->_e3);
-                }
-            }
-            //triangles_p2 = edge_p2->_triangles;
-        }
-
-        for(LocalEdgeList::iterator oeitr=oldEdges.begin();
-            oeitr!=oldEdges.end();
-            ++oeitr)
-        {
-            _edgeSet.erase(*oeitr);
-
-            const_cast<Edge*>(oeitr->get())->setErrorMetric(0.0f);
-
-            _edgeSet.insert(*oeitr);
-        }
-
-        TriangleList::iterator titr_p1, titr_p2;
-
-        for(titr_p1 = triangles_p1.begin();
-            titr_p1 != triangles_p1.end();
-            ++titr_p1)
-        {
-            removeTriangle(const_cast<Triangle*>(titr_p1->get()));
-        }
-
-        for(titr_p2 = triangles_p2.begin();
-            titr_p2 != triangles_p2.end();
-            ++titr_p2)
-        {
-            removeTriangle(const_cast<Triangle*>(titr_p2->get()));
-        }
-
-        //OSG_NOTICE<<"  pNew="<<pNew<<"\tedge_p1"<<edge_p1.get()<<"\tedge_p2"<<edge_p2.get()<<std::endl;
-
-        // we copy the edge's _triangles and interate the copy of the triangle set to avoid invalidating iterators.
-        TriangleSet trianglesToRemove = edge->_triangles;
-        for(TriangleSet::iterator teitr=trianglesToRemove.begin();
-            teitr!=trianglesToRemove.end();
-            ++teitr)
-        {
-            Triangle* triangle = const_cast<Triangle*>(teitr->get());
-            removeTriangle(triangle);
-        }
-
-        LocalEdgeList newEdges;
-
-
-        for(titr_p1 = triangles_p1.begin();
-            titr_p1 != triangles_p1.end();
-            ++titr_p1)
-        {
-            Triangle* triangle = const_cast<Triangle*>(titr_p1->get());
-
-            Point* p1 = (triangle->_p1==edge_p1 || triangle->_p1==edge_p2)? pNew : triangle->_p1.get();
-            Point* p2 = (triangle->_p2==edge_p1 || triangle->_p2==edge_p2)? pNew : triangle->_p2.get();
-            Point* p3 = (triangle->_p3==edge_p1 || triangle->_p3==edge_p2)? pNew : triangle->_p3.get();
-
-            Triangle* newTri = addTriangle(p1,p2,p3);
-
-            if (newTri)
-            {
-                newEdges.insert(newTri->_e1);
-                newEdges.insert(newTri->_e2);
-                newEdges.insert(newTri->_e3);
-            }
-        }
-
-
-        for(titr_p2 = triangles_p2.begin();
-            titr_p2 != triangles_p2.end();
-            ++titr_p2)
-        {
-            Triangle* triangle = const_cast<Triangle*>(titr_p2->get());
-
-            Point* p1 = (triangle->_p1==edge_p1 || triangle->_p1==edge_p2)? pNew : triangle->_p1.get();
-            Point* p2 = (triangle->_p2==edge_p1 || triangle->_p2==edge_p2)? pNew : triangle->_p2.get();
-            Point* p3 = (triangle->_p3==edge_p1 || triangle->_p3==edge_p2)? pNew : triangle->_p3.get();
-
-            Triangle* newTri = addTriangle(p1,p2,p3);
-
-            if (newTri)
-            {
-                newEdges.insert(newTri->_e1);
-                newEdges.insert(newTri->_e2);
-                newEdges.insert(newTri->_e3);
-            }
-        }
-
-        LocalEdgeList edges2UpdateErrorMetric;
-
-        LocalEdgeList::const_iterator newEdgeIt(newEdges.begin());
-        while (newEdgeIt != newEdges.end())
-        {
-            const Point* p = 0;
-            if (newEdgeIt->get()->_p1.get() != pNew)
-                p = newEdgeIt->get()->_p1.get();
-            else
-                p = newEdgeIt->get()->_p2.get();
-
-            TriangleSet::const_iterator triangleIt(p->_triangles.begin());
-            while (triangleIt != p->_triangles.end())
-            {
-                const Triangle* triangle = triangleIt->get();
-                if (triangle->_e1->_p1 == p || triangle->_e1->_p2 == p)
-                    edges2UpdateErrorMetric.insert(triangle->_e1);
-                if (triangle->_e2->_p1 == p || triangle->_e2->_p2 == p)
-                    edges2UpdateErrorMetric.insert(triangle->_e2);
-                if (triangle->_e3->_p1 == p || triangle->_e3->_p2 == p)
-                    edges2UpdateErrorMetric.insert(triangle->_e3);
-
-                ++triangleIt;
-            }
-
-            ++newEdgeIt;
-        }
-
-        edges2UpdateErrorMetric.insert(newEdges.begin(), newEdges.end());
-
-        // OSG_NOTICE<<"Edges to recalibarate "<<edges2UpdateErrorMetric.size()<<std::endl;
-
-        for(LocalEdgeList::iterator itr=edges2UpdateErrorMetric.begin();
-            itr!=edges2UpdateErrorMetric.end();
-            ++itr)
-        {
-            //OSG_NOTICE<<"updateErrorMetricForEdge("<<itr->get()<<")"<<std::endl;
-            updateErrorMetricForEdge(const_cast<Edge*>(itr->get()));
-        }
-
-        return true;
-    }
-
-
     bool divideEdge(Edge* edge, Point* pNew)
     {
          // OSG_NOTICE<<"divideEdge("<<edge<<") before _edgeSet.size()="<<_edgeSet.size()<<" _triangleSet.size()="<<_triangleSet.size()<<std::endl;
@@ -1232,7 +860,6 @@ public:
 
     osg::Geometry*                  _geometry;
 
-    bool                            _computeErrorMetricUsingLength;
     EdgeSet                         _edgeSet;
     TriangleSet                     _triangleSet;
     PointSet                        _pointSet;
@@ -1415,7 +1042,7 @@ class CopyVertexArrayToPointsVisitor : public osg::ArrayVisitor
 
 };
 
-void EdgeCollapse::setGeometry(osg::Geometry* geometry, const Simplifier::IndexList& protectedPoints)
+void EdgeCollapse::setGeometry(osg::Geometry* geometry)
 {
     _geometry = geometry;
 
@@ -1462,14 +1089,6 @@ void EdgeCollapse::setGeometry(osg::Geometry* geometry, const Simplifier::IndexL
             geometry->getVertexAttribArray(vi)->accept(copyArrayToPoints);
     }
 
-    // now set the protected points up.
-    for(Simplifier::IndexList::const_iterator pitr=protectedPoints.begin();
-        pitr!=protectedPoints.end();
-        ++pitr)
-    {
-        _originalPointList[*pitr]->_protected = true;
-    }
-
 
     CollectTriangleIndexFunctor collectTriangles;
     collectTriangles.setEdgeCollapse(this);
@@ -1720,78 +1339,1605 @@ void EdgeCollapse::copyBackToGeometry()
 }
 
 
-Simplifier::Simplifier(double sampleRatio, double maximumError, double maximumLength):
-            osg::NodeVisitor(osg::NodeVisitor::TRAVERSE_ALL_CHILDREN),
-            _sampleRatio(sampleRatio),
-            _maximumError(maximumError),
-            _maximumLength(maximumLength),
-            _triStrip(true),
-            _smoothing(true)
-
+////////////////////////////////////////////////////////////////////////////
+// Quadric error metric edge collapse on flat arrays
+////////////////////////////////////////////////////////////////////////////
+namespace
 {
-}
 
-void Simplifier::simplify(osg::Geometry& geometry)
+const unsigned int INVALID_INDEX = 0xffffffff;
+
+/** Meshes are only divided into clusters for parallel simplification when each cluster would have at least this many triangles.*/
+const unsigned int MINIMUM_CLUSTER_SIZE = 4096;
+
+/** Weight of the planes constraining texture seams and normal creases, relative to the area weighting of the planes of the triangles.*/
+const double SEAM_WEIGHT = 1.0;
+
+unsigned int getNumArrayComponents(const osg::Array* array)
 {
-    // pass an empty list of indices to simply(Geometry,IndexList)
-    // so that this one method handle both cases of non protected indices
-    // and specified indices.
-    IndexList emptyList;
-    simplify(geometry,emptyList);
+    switch(array->getType())
+    {
+        case(osg::Array::ByteArrayType):
+        case(osg::Array::ShortArrayType):
+        case(osg::Array::IntArrayType):
+        case(osg::Array::UByteArrayType):
+        case(osg::Array::UShortArrayType):
+        case(osg::Array::UIntArrayType):
+        case(osg::Array::FloatArrayType): return 1;
+        case(osg::Array::Vec2ArrayType): return 2;
+        case(osg::Array::Vec3ArrayType): return 3;
+        case(osg::Array::Vec4ArrayType):
+        case(osg::Array::Vec4ubArrayType): return 4;
+        default: return 0;
+    }
 }
 
-void Simplifier::simplify(osg::Geometry& geometry, const IndexList& protectedPoints)
+/** Copy the elements of an array into consecutive columns of a table with one row per vertex.*/
+class CopyArrayToTableVisitor : public osg::ArrayVisitor
 {
-    OSG_INFO<<"++++++++++++++simplifier************"<<std::endl;
-
-    EdgeCollapse ec;
-    ec.setComputeErrorMetricUsingLength(getSampleRatio()>=1.0);
-    ec.setGeometry(&geometry, protectedPoints);
-    ec.updateErrorMetricForAllEdges();
+    public:
+        CopyArrayToTableVisitor(std::vector<float>& table, unsigned int stride, unsigned int column):
+            _table(table),
+            _stride(stride),
+            _column(column) {}
 
-    unsigned int numOriginalPrimitives = ec._triangleSet.size();
+        template<class A>
+        void copyScalars(A& array)
+        {
+            for(unsigned int i=0;i<array.size();++i)
+                _table[i*_stride+_column] = static_cast<float>(array[i]);
+        }
 
-    if (getSampleRatio()<1.0)
-    {
-        while (!ec._edgeSet.empty() &&
-               continueSimplification((*ec._edgeSet.begin())->getErrorMetric() , numOriginalPrimitives, ec._triangleSet.size()) &&
-               ec.collapseMinimumErrorEdge())
+        template<class A>
+        void copyVectors(A& array)
         {
-           //OSG_INFO<<"   Collapsed edge ec._triangleSet.size()="<<ec._triangleSet.size()<<" error="<<(*ec._edgeSet.begin())->getErrorMetric()<<" vs "<<getMaximumError()<<std::endl;
+            const unsigned int numComponents = A::ElementDataType::num_components;
+            for(unsigned int i=0;i<array.size();++i)
+                for(unsigned int c=0;c<numComponents;++c)
+                    _table[i*_stride+_column+c] = static_cast<float>(array[i][c]);
         }
 
-        OSG_INFO<<"******* AFTER EDGE COLLAPSE *********"<<ec._triangleSet.size()<<std::endl;
-    }
-    else
-    {
+        virtual void apply(osg::Array&) {}
+        virtual void apply(osg::ByteArray& array) { copyScalars(array); }
+        virtual void apply(osg::ShortArray& array) { copyScalars(array); }
+        virtual void apply(osg::IntArray& array) { copyScalars(array); }
+        virtual void apply(osg::UByteArray& array) { copyScalars(array); }
+        virtual void apply(osg::UShortArray& array) { copyScalars(array); }
+        virtual void apply(osg::UIntArray& array) { copyScalars(array); }
+        virtual void apply(osg::FloatArray& array) { copyScalars(array); }
+        virtual void apply(osg::Vec2Array& array) { copyVectors(array); }
+        virtual void apply(osg::Vec3Array& array) { copyVectors(array); }
+        virtual void apply(osg::Vec4Array& array) { copyVectors(array); }
+        virtual void apply(osg::Vec4ubArray& array) { copyVectors(array); }
+
+        std::vector<float>& _table;
+        unsigned int        _stride;
+        unsigned int        _column;
 
-        // up sampling...
-        while (!ec._edgeSet.empty() &&
-               continueSimplification((*ec._edgeSet.rbegin())->getErrorMetric() , numOriginalPrimitives, ec._triangleSet.size()) &&
-//               ec._triangleSet.size() < targetNumTriangles  &&
-               ec.divideLongestEdge())
+    protected:
+
+        CopyArrayToTableVisitor& operator = (const CopyArrayToTableVisitor&) { return *this; }
+};
+
+/** Replace the elements of an array with the listed rows of a table.*/
+class CopyTableToArrayVisitor : public osg::ArrayVisitor
+{
+    public:
+        CopyTableToArrayVisitor(const std::vector<float>& table, unsigned int stride, unsigned int column, const std::vector<unsigned int>& rows):
+            _table(table),
+            _stride(stride),
+            _column(column),
+            _rows(rows) {}
+
+        template<class A>
+        void copyScalars(A& array)
         {
-           //OSG_INFO<<"   Edge divided ec._triangleSet.size()="<<ec._triangleSet.size()<<" error="<<(*ec._edgeSet.rbegin())->getErrorMetric()<<" vs "<<getMaximumError()<<std::endl;
+            typedef typename A::ElementDataType value_type;
+            array.resize(_rows.size());
+            for(unsigned int i=0;i<_rows.size();++i)
+                array[i] = static_cast<value_type>(_table[_rows[i]*_stride+_column]);
+            array.dirty();
+        }
+
+        template<class A>
+        void copyVectors(A& array)
+        {
+            typedef typename A::ElementDataType::value_type value_type;
+            const unsigned int numComponents = A::ElementDataType::num_components;
+            array.resize(_rows.size());
+            for(unsigned int i=0;i<_rows.size();++i)
+                for(unsigned int c=0;c<numComponents;++c)
+                    array[i][c] = static_cast<value_type>(_table[_rows[i]*_stride+_column+c]);
+            array.dirty();
         }
-        OSG_INFO<<"******* AFTER EDGE DIVIDE *********"<<ec._triangleSet.size()<<std::endl;
-    }
 
-    OSG_INFO<<"Number of triangle errors after edge collapse= "<<ec.testAllTriangles()<<std::endl;
-    OSG_INFO<<"Number of edge errors before edge collapse= "<<ec.testAllEdges()<<std::endl;
-    OSG_INFO<<"Number of point errors after edge collapse= "<<ec.testAllPoints()<<std::endl;
-    OSG_INFO<<"Number of triangles= "<<ec._triangleSet.size()<<std::endl;
-    OSG_INFO<<"Number of points= "<<ec._pointSet.size()<<std::endl;
-    OSG_INFO<<"Number of edges= "<<ec._edgeSet.size()<<std::endl;
-    OSG_INFO<<"Number of boundary edges= "<<ec.computeNumBoundaryEdges()<<std::endl;
+        virtual void apply(osg::Array&) {}
+        virtual void apply(osg::ByteArray& array) { copyScalars(array); }
+        virtual void apply(osg::ShortArray& array) { copyScalars(array); }
+        virtual void apply(osg::IntArray& array) { copyScalars(array); }
+        virtual void apply(osg::UByteArray& array) { copyScalars(array); }
+        virtual void apply(osg::UShortArray& array) { copyScalars(array); }
+        virtual void apply(osg::UIntArray& array) { copyScalars(array); }
+        virtual void apply(osg::FloatArray& array) { copyScalars(array); }
+        virtual void apply(osg::Vec2Array& array) { copyVectors(array); }
+        virtual void apply(osg::Vec3Array& array) { copyVectors(array); }
+        virtual void apply(osg::Vec4Array& array) { copyVectors(array); }
+        virtual void apply(osg::Vec4ubArray& array) { copyVectors(array); }
+
+        const std::vector<float>&           _table;
+        unsigned int                        _stride;
+        unsigned int                        _column;
+        const std::vector<unsigned int>&    _rows;
 
-    if (!ec._edgeSet.empty())
-    {
-        OSG_INFO<<std::endl<<"Simplifier, in = "<<numOriginalPrimitives<<"\tout = "<<ec._triangleSet.size()<<"\terror="<<(*ec._edgeSet.begin())->getErrorMetric()<<"\tvs "<<getMaximumError()<<std::endl<<std::endl;
-        OSG_INFO<<           "        !ec._edgeSet.empty()  = "<<!ec._edgeSet.empty()<<std::endl;
-        OSG_INFO<<           "        continueSimplification(,,)  = "<<continueSimplification((*ec._edgeSet.begin())->getErrorMetric() , numOriginalPrimitives, ec._triangleSet.size())<<std::endl;
-    }
+    protected:
+
+        CopyTableToArrayVisitor& operator = (const CopyTableToArrayVisitor&) { return *this; }
+};
 
-    ec.copyBackToGeometry();
+/** Orders the rows of a table lexicographically, so that identical vertices are adjacent once sorted.*/
+struct LessTableRow
+{
+    LessTableRow(const std::vector<float>& table, unsigned int stride, unsigned int firstColumn, unsigned int numColumns):
+        _table(&table),
+        _stride(stride),
+        _firstColumn(firstColumn),
+        _numColumns(numColumns) {}
+
+    bool operator() (unsigned int lhs, unsigned int rhs) const
+    {
+        const float* l = &(*_table)[lhs*_stride+_firstColumn];
+        const float* r = &(*_table)[rhs*_stride+_firstColumn];
+        for(unsigned int c=0;c<_numColumns;++c)
+        {
+            if (l[c]<r[c]) return true;
+            if (r[c]<l[c]) return false;
+        }
+        return false;
+    }
+
+    const std::vector<float>*   _table;
+    unsigned int                _stride;
+    unsigned int                _firstColumn;
+    unsigned int                _numColumns;
+};
+
+/** Number the rows of a table that compare equal in the order in which they first appear, returning the number of unique rows.*/
+unsigned int mergeTableRows(unsigned int numRows, const LessTableRow& lessTableRow, std::vector<unsigned int>& remap)
+{
+    std::vector<unsigned int> sorted(numRows);
+    for(unsigned int i=0;i<numRows;++i) sorted[i] = i;
+
+    std::sort(sorted.begin(), sorted.end(), lessTableRow);
+
+    std::vector<unsigned int> representatives(numRows);
+    for(unsigned int i=0;i<numRows;)
+    {
+        unsigned int end = i+1;
+        unsigned int first = sorted[i];
+        while(end<numRows && !lessTableRow(sorted[i], sorted[end]))
+        {
+            first = osg::minimum(first, sorted[end]);
+            ++end;
+        }
+        for(;i<end;++i) representatives[sorted[i]] = first;
+    }
+
+    remap.assign(numRows, INVALID_INDEX);
+    unsigned int numUniqueRows = 0;
+    for(unsigned int i=0;i<numRows;++i)
+    {
+        if (representatives[i]==i) remap[i] = numUniqueRows++;
+    }
+    for(unsigned int i=0;i<numRows;++i)
+    {
+        remap[i] = remap[representatives[i]];
+    }
+    return numUniqueRows;
+}
+
+struct CollectQuadricTriangleOperator
+{
+    CollectQuadricTriangleOperator():
+        _remap(0),
+        _wedgeVertices(0),
+        _corners(0),
+        _cornerWedges(0) {}
+
+    // for use in the triangle functor.
+    inline void operator()(unsigned int p1, unsigned int p2, unsigned int p3)
+    {
+        if (p1>=_remap->size() || p2>=_remap->size() || p3>=_remap->size()) return;
+
+        unsigned int w1 = (*_remap)[p1];
+        unsigned int w2 = (*_remap)[p2];
+        unsigned int w3 = (*_remap)[p3];
+        unsigned int v1 = (*_wedgeVertices)[w1];
+        unsigned int v2 = (*_wedgeVertices)[w2];
+        unsigned int v3 = (*_wedgeVertices)[w3];
+
+        // discard triangles that are degenerate once the vertices are welded.
+        if (v1==v2 || v2==v3 || v1==v3) return;
+
+        _corners->push_back(v1);
+        _corners->push_back(v2);
+        _corners->push_back(v3);
+        _cornerWedges->push_back(w1);
+        _cornerWedges->push_back(w2);
+        _cornerWedges->push_back(w3);
+    }
+
+    const std::vector<unsigned int>*    _remap;
+    const std::vector<unsigned int>*    _wedgeVertices;
+    std::vector<unsigned int>*          _corners;
+    std::vector<unsigned int>*          _cornerWedges;
+};
+
+typedef osg::TriangleIndexFunctor<CollectQuadricTriangleOperator> CollectQuadricTriangleIndexFunctor;
+
+/** Simplifies a triangle mesh by collapsing edges in the order of increasing quadric error, after Garland and Heckbert,
+  * "Simplifying Surfaces with Color and Texture using Quadric Error Metrics".
+  *
+  * The mesh is held in flat arrays. Triangle t is made of the half-edges 3t, 3t+1 and 3t+2, half-edge h starts at vertex
+  * _corners[h] and ends at the start of the next half-edge of the triangle, and the half-edges leaving each vertex are
+  * linked in a list, so the triangles around a vertex can be visited and merged without any per element allocation.
+  * Removed triangles are only flagged, their half-edges being dropped from the lists of the vertices as they are visited.
+  *
+  * The vertices are welded by position, so the mesh stays connected across texture seams and normal creases, each corner
+  * of a triangle also referring to a wedge, one of the distinct sets of attributes of its vertex. Each wedge has a quadric
+  * measuring the area weighted squared distance of a point, made up of the position and the weighted normal and texture
+  * coordinates, to the planes of the triangles that have been merged into the wedge, plus planes through the seams
+  * perpendicular to their triangles that keep the seams in place. A vertex only moves to the optimal point of a collapse
+  * when both vertices of the edge have a single wedge, otherwise it moves onto the other vertex, its wedges merging with
+  * the wedges of the other vertex on the same side of each seam.
+  * Vertices on the boundary of the mesh, on non manifold edges or protected by the caller are locked, edges may only be
+  * collapsed onto them, so borders between tiles are preserved.*/
+class QuadricEdgeCollapse
+{
+public:
+
+    QuadricEdgeCollapse(const Simplifier& simplifier):
+        _simplifier(simplifier),
+        _geometry(0),
+        _stride(0),
+        _vertexColumn(0),
+        _numVertexComponents(0),
+        _dimension(3),
+        _quadricStride(0),
+        _scale(1.0),
+        _numOriginalTriangles(0),
+        _numTriangles(0) {}
+
+    struct Collapse
+    {
+        float           error;
+        unsigned int    v0;
+        unsigned int    v1;
+        unsigned int    version0;
+        unsigned int    version1;
+
+        bool operator > (const Collapse& rhs) const { return error > rhs.error; }
+    };
+
+    /** A wedge of the removed vertex and the wedge of the kept vertex it merges with.*/
+    typedef std::pair<unsigned int, unsigned int> WedgePair;
+
+    /** Collapses applied to the whole mesh or, when simplifying in parallel, to one cluster of it.*/
+    struct Context
+    {
+        Context(unsigned int in_cluster):
+            cluster(in_cluster),
+            numOriginalTriangles(0),
+            numTriangles(0),
+            targetNumTriangles(0),
+            optimal(false) {}
+
+        unsigned int                cluster;
+        unsigned int                numOriginalTriangles;
+        unsigned int                numTriangles;
+        unsigned int                targetNumTriangles;
+
+        std::vector<Collapse>       heap;
+
+        // scratch space reused by each collapse.
+        bool                        optimal;
+        std::vector<WedgePair>      wedgePairs;
+        std::vector<unsigned int>   wedges;
+        std::vector<unsigned int>   neighbours0;
+        std::vector<unsigned int>   neighbours1;
+        std::vector<unsigned int>   corners;
+        std::vector<double>         quadric;
+        std::vector<double>         expanded;
+        std::vector<double>         point;
+        std::vector<double>         candidate;
+        std::vector<double>         matrix;
+        std::vector<double>         product;
+    };
+
+    bool setGeometry(osg::Geometry* geometry, const Simplifier::IndexList& protectedPoints);
+
+    unsigned int getNumOriginalTriangles() const { return _numOriginalTriangles; }
+    unsigned int getNumTriangles() const { return _numTriangles; }
+
+    /** Simplify spatial clusters of the mesh independently on numThreads threads, keeping the vertices on the borders
+      * between clusters fixed. Each cluster is only simplified to the square root of the sample ratio, within the maximum
+      * error, so that simplify() has the freedom to remove the triangles along the borders and balance the error between clusters.*/
+    void simplifyClusters(unsigned int numThreads);
+
+    /** Simplify the whole mesh using Simplifier::continueSimplification(), returning the error of the next collapse.*/
+    float simplify();
+
+    void copyBackToGeometry();
+
+    /** Simplify the clusters until all have been taken by this or the other threads.*/
+    void processClusters();
+
+protected:
+
+    inline unsigned int getQuadricIndex(unsigned int i, unsigned int j) const
+    {
+        // upper triangle of the symmetric matrix stored row by row.
+        return i*_dimension - (i*(i+1))/2 + j;
+    }
+
+    inline double* getQuadric(unsigned int w) { return &_quadrics[w*_quadricStride]; }
+    inline const double* getQuadric(unsigned int w) const { return &_quadrics[w*_quadricStride]; }
+
+    static inline unsigned int getNextCornerOfTriangle(unsigned int h) { return (h%3==2) ? h-2 : h+1; }
+
+    void initContext(Context& context) const;
+
+    void getQuadricPoint(unsigned int w, double* point) const;
+
+    void computeQuadrics(const std::vector<unsigned int>& seams);
+
+    void expandQuadric(Context& context) const;
+
+    void multiplyQuadric(const Context& context, const double* x, double* result) const;
+
+    double evaluateQuadric(Context& context, const double* x) const;
+
+    bool solveQuadric(Context& context, double* x) const;
+
+    unsigned int getSingleWedge(unsigned int v) const;
+
+    bool computeWedgePairs(Context& context, unsigned int keep, unsigned int remove) const;
+
+    bool computeCollapseOnto(Context& context, unsigned int keep, unsigned int remove, double& error) const;
+
+    bool computeCollapse(Context& context, unsigned int v0, unsigned int v1, unsigned int& keep, double& error);
+
+    inline bool isClusterMember(const Context& context, unsigned int v) const
+    {
+        return context.cluster==INVALID_INDEX || (_clusters[v]==context.cluster && _clusterInteriors[v]!=0);
+    }
+
+    inline bool triangleContains(unsigned int t, unsigned int v) const
+    {
+        return _corners[t*3]==v || _corners[t*3+1]==v || _corners[t*3+2]==v;
+    }
+
+    void pushCollapse(Context& context, unsigned int v0, unsigned int v1);
+
+    void pushCollapsesAroundVertex(Context& context, unsigned int v);
+
+    void collectNeighbours(unsigned int v, std::vector<unsigned int>& neighbours) const;
+
+    bool checkTriangleFlips(unsigned int v, unsigned int other, const osg::Vec3d& position) const;
+
+    bool collapseEdge(Context& context, const Collapse& collapse);
+
+    void collapseEdges(Context& context);
+
+    void assignClusters(unsigned int numClusters);
+
+    typedef std::vector<osg::Array*> ArrayList;
+    typedef std::vector<unsigned int> ColumnList;
+    typedef std::vector< std::pair<unsigned int, double> > WeightedColumnList;
+
+    const Simplifier&           _simplifier;
+    osg::Geometry*              _geometry;
+
+    // per wedge attributes, one row per distinct vertex of the geometry and the columns of each array in turn.
+    std::vector<float>          _table;
+    unsigned int                _stride;
+    ArrayList                   _arrays;
+    ColumnList                  _arrayColumns;
+    unsigned int                _vertexColumn;
+    unsigned int                _numVertexComponents;
+    ColumnList                  _interpolatedColumns;
+    WeightedColumnList          _quadricColumns;
+
+    // the vertex of each wedge, and the per vertex data.
+    std::vector<unsigned int>   _wedgeVertices;
+    std::vector<osg::Vec3d>     _positions;
+    std::vector<unsigned char>  _locked;
+    std::vector<unsigned char>  _collapsed;
+    std::vector<unsigned int>   _versions;
+
+    unsigned int                _dimension;
+    unsigned int                _quadricStride;
+    std::vector<double>         _quadrics;
+    osg::Vec3d                  _origin;
+    double                      _scale;
+
+    std::vector<unsigned int>   _corners;
+    std::vector<unsigned int>   _cornerWedges;
+    std::vector<unsigned int>   _firstCorner;
+    std::vector<unsigned int>   _nextCorner;
+    std::vector<unsigned char>  _removed;
+
+    unsigned int                _numOriginalTriangles;
+    unsigned int                _numTriangles;
+
+    // spatial clusters simplified in parallel.
+    std::vector<unsigned int>   _clusters;
+    std::vector<unsigned char>  _clusterInteriors;
+    std::vector<unsigned int>   _clusterTriangleOffsets;
+    std::vector<unsigned int>   _clusterTriangles;
+    std::vector<unsigned int>   _clusterOrder;
+    std::vector<unsigned int>   _clusterNumRemoved;
+    OpenThreads::Atomic         _nextCluster;
+};
+
+struct SimplifyClustersOperation : public ThreadPool::Work
+{
+    SimplifyClustersOperation(QuadricEdgeCollapse* qec):
+        _qec(qec) {}
+
+    virtual void operator () (unsigned int)
+    {
+        _qec->processClusters();
+    }
+
+    QuadricEdgeCollapse*                _qec;
+};
+
+bool QuadricEdgeCollapse::setGeometry(osg::Geometry* geometry, const Simplifier::IndexList& protectedPoints)
+{
+    _geometry = geometry;
+
+    osg::Array* vertices = _geometry->getVertexArray();
+    if (!vertices || vertices->getNumElements()==0) return false;
+
+    _numVertexComponents = getNumArrayComponents(vertices);
+    if (_numVertexComponents<2 || vertices->getType()==osg::Array::Vec4ubArrayType)
+    {
+        OSG_NOTICE<<"Warning: Simplifier::simplify(..) vertex array type not supported."<<std::endl;
+        return false;
+    }
+
+    // check to see if vertex attributes indices exists, if so expand them to remove them
+    if (_geometry->containsSharedArrays())
+    {
+        OSG_INFO<<"QuadricEdgeCollapse::setGeometry(..): Duplicate shared arrays"<<std::endl;
+        _geometry->duplicateSharedArrays();
+        vertices = _geometry->getVertexArray();
+    }
+
+    unsigned int numVertices = vertices->getNumElements();
+
+    // gather the per vertex arrays, and the columns of the normals and texture coordinates weighted in the quadrics.
+    _arrays.push_back(vertices);
+
+    osg::Array* normals = _geometry->getNormalArray();
+    osg::Array* texcoords = _geometry->getTexCoordArray(0);
+
+    ArrayList attributes;
+    for(unsigned int ti=0;ti<_geometry->getNumTexCoordArrays();++ti)
+        attributes.push_back(_geometry->getTexCoordArray(ti));
+    attributes.push_back(normals);
+    attributes.push_back(_geometry->getColorArray());
+    attributes.push_back(_geometry->getSecondaryColorArray());
+    attributes.push_back(_geometry->getFogCoordArray());
+    for(unsigned int vi=0;vi<_geometry->getNumVertexAttribArrays();++vi)
+        attributes.push_back(_geometry->getVertexAttribArray(vi));
+
+    for(ArrayList::iterator itr = attributes.begin();
+        itr != attributes.end();
+        ++itr)
+    {
+        osg::Array* array = *itr;
+        if (array &&
+            array->getBinding()==osg::Array::BIND_PER_VERTEX &&
+            array->getNumElements()==numVertices &&
+            getNumArrayComponents(array)>0)
+        {
+            _arrays.push_back(array);
+        }
+    }
+
+    _stride = 0;
+    for(ArrayList::iterator itr = _arrays.begin();
+        itr != _arrays.end();
+        ++itr)
+    {
+        osg::Array* array = *itr;
+        unsigned int numComponents = getNumArrayComponents(array);
+        _arrayColumns.push_back(_stride);
+
+        double weight = 0.0;
+        if (array==normals && array->getType()==osg::Array::Vec3ArrayType) weight = _simplifier.getNormalWeight();
+        else if (array==texcoords && array->getType()==osg::Array::Vec2ArrayType) weight = _simplifier.getTexCoordWeight();
+
+        for(unsigned int c=0;c<numComponents;++c)
+        {
+            if (itr==_arrays.begin()) continue;
+
+            if (weight>0.0) _quadricColumns.push_back(WeightedColumnList::value_type(_stride+c, weight));
+            else _interpolatedColumns.push_back(_stride+c);
+        }
+
+        _stride += numComponents;
+    }
+    _vertexColumn = _arrayColumns.front();
+
+    std::vector<float> table(numVertices*_stride);
+    for(unsigned int i=0;i<_arrays.size();++i)
+    {
+        CopyArrayToTableVisitor copyArrayToTable(table, _stride, _arrayColumns[i]);
+        _arrays[i]->accept(copyArrayToTable);
+    }
+
+    // merge identical vertices into wedges, keeping the order in which they first appear.
+    std::vector<unsigned int> remap;
+    unsigned int numWedges = mergeTableRows(numVertices, LessTableRow(table, _stride, 0, _stride), remap);
+
+    _table.resize(numWedges*_stride);
+    for(unsigned int i=0;i<numVertices;++i)
+    {
+        std::copy(&table[i*_stride], &table[i*_stride]+_stride, &_table[remap[i]*_stride]);
+    }
+    table.clear();
+
+    // weld the wedges that share a position into the vertices of the mesh.
+    unsigned int numPositions = mergeTableRows(numWedges, LessTableRow(_table, _stride, _vertexColumn, _numVertexComponents), _wedgeVertices);
+
+    _positions.resize(numPositions);
+    for(unsigned int w=0;w<numWedges;++w)
+    {
+        const float* row = &_table[w*_stride+_vertexColumn];
+        osg::Vec3d& position = _positions[_wedgeVertices[w]];
+        if (_numVertexComponents==2) position.set(row[0], row[1], 0.0);
+        else if (_numVertexComponents==3) position.set(row[0], row[1], row[2]);
+        else position.set(row[0]/row[3], row[1]/row[3], row[2]/row[3]);
+    }
+
+    // collect the triangles.
+    CollectQuadricTriangleIndexFunctor collectTriangles;
+    collectTriangles._remap = &remap;
+    collectTriangles._wedgeVertices = &_wedgeVertices;
+    collectTriangles._corners = &_corners;
+    collectTriangles._cornerWedges = &_cornerWedges;
+    _geometry->accept(collectTriangles);
+
+    unsigned int numTriangles = _corners.size()/3;
+    _numOriginalTriangles = numTriangles;
+    _numTriangles = numTriangles;
+
+    _removed.resize(numTriangles, 0);
+    _collapsed.resize(numPositions, 0);
+    _versions.resize(numPositions, 0);
+
+    // link the half-edges leaving each vertex.
+    _firstCorner.resize(numPositions, INVALID_INDEX);
+    _nextCorner.resize(_corners.size(), INVALID_INDEX);
+    for(unsigned int h=_corners.size();h>0;--h)
+    {
+        unsigned int v = _corners[h-1];
+        _nextCorner[h-1] = _firstCorner[v];
+        _firstCorner[v] = h-1;
+    }
+
+    // lock the vertices on boundary and non manifold edges by pairing each half-edge with its opposite,
+    // and collect the half-edges of the seams, where the triangles on either side use different wedges.
+    _locked.resize(numPositions, 0);
+
+    std::vector< std::pair<unsigned long long, unsigned int> > edges(_corners.size());
+    for(unsigned int h=0;h<_corners.size();++h)
+    {
+        unsigned int v0 = _corners[h];
+        unsigned int v1 = _corners[getNextCornerOfTriangle(h)];
+        unsigned long long key = (static_cast<unsigned long long>(osg::minimum(v0,v1))<<32) | osg::maximum(v0,v1);
+        edges[h] = std::pair<unsigned long long, unsigned int>(key, h);
+    }
+    std::sort(edges.begin(), edges.end());
+
+    std::vector<unsigned int> seams;
+    for(unsigned int i=0;i<edges.size();)
+    {
+        unsigned int end = i+1;
+        while(end<edges.size() && edges[end].first==edges[i].first) ++end;
+
+        unsigned int h0 = edges[i].second;
+        unsigned int h1 = edges[end-1].second;
+        bool manifold = (end-i==2) && _corners[h0]!=_corners[h1];
+        if (!manifold)
+        {
+            _locked[static_cast<unsigned int>(edges[i].first>>32)] = 1;
+            _locked[static_cast<unsigned int>(edges[i].first & 0xffffffff)] = 1;
+        }
+        else if (_cornerWedges[h0]!=_cornerWedges[getNextCornerOfTriangle(h1)] ||
+                 _cornerWedges[getNextCornerOfTriangle(h0)]!=_cornerWedges[h1])
+        {
+            seams.push_back(h0);
+            seams.push_back(h1);
+        }
+        i = end;
+    }
+
+    for(Simplifier::IndexList::const_iterator pitr=protectedPoints.begin();
+        pitr!=protectedPoints.end();
+        ++pitr)
+    {
+        if (*pitr<numVertices) _locked[_wedgeVertices[remap[*pitr]]] = 1;
+    }
+
+    computeQuadrics(seams);
+
+    return true;
+}
+
+void QuadricEdgeCollapse::computeQuadrics(const std::vector<unsigned int>& seams)
+{
+    // scale positions into a unit box so that the attribute weights are independent of the size of the model.
+    osg::BoundingBoxd bb;
+    for(std::vector<osg::Vec3d>::const_iterator itr = _positions.begin();
+        itr != _positions.end();
+        ++itr)
+    {
+        bb.expandBy(*itr);
+    }
+
+    double extent = osg::maximum(bb.xMax()-bb.xMin(), osg::maximum(bb.yMax()-bb.yMin(), bb.zMax()-bb.zMin()));
+    _origin = bb._min;
+    _scale = extent>0.0 ? 1.0/extent : 1.0;
+
+    _dimension = 3 + _quadricColumns.size();
+    _quadricStride = (_dimension*(_dimension+1))/2 + _dimension + 2;
+    _quadrics.clear();
+    _quadrics.resize(_wedgeVertices.size()*_quadricStride, 0.0);
+
+    const unsigned int n = _dimension;
+    std::vector<double> points(n*3);
+    std::vector<double> e1(n), e2(n);
+
+    for(unsigned int t=0;t<_corners.size()/3;++t)
+    {
+        double* p = &points[0];
+        double* q = &points[n];
+        double* r = &points[n*2];
+        getQuadricPoint(_cornerWedges[t*3], p);
+        getQuadricPoint(_cornerWedges[t*3+1], q);
+        getQuadricPoint(_cornerWedges[t*3+2], r);
+
+        osg::Vec3d pq(q[0]-p[0], q[1]-p[1], q[2]-p[2]);
+        osg::Vec3d pr(r[0]-p[0], r[1]-p[1], r[2]-p[2]);
+        double area = (pq^pr).length()*0.5;
+        if (area<=0.0) continue;
+
+        // orthonormal basis of the plane of the triangle in position and attribute space.
+        double length1 = 0.0;
+        for(unsigned int i=0;i<n;++i) { e1[i] = q[i]-p[i]; length1 += e1[i]*e1[i]; }
+        length1 = sqrt(length1);
+        if (length1<=0.0) continue;
+        for(unsigned int i=0;i<n;++i) e1[i] /= length1;
+
+        double dot = 0.0;
+        for(unsigned int i=0;i<n;++i) dot += e1[i]*(r[i]-p[i]);
+        double length2 = 0.0;
+        for(unsigned int i=0;i<n;++i) { e2[i] = r[i]-p[i]-e1[i]*dot; length2 += e2[i]*e2[i]; }
+        length2 = sqrt(length2);
+        if (length2<=0.0) continue;
+        for(unsigned int i=0;i<n;++i) e2[i] /= length2;
+
+        double pe1 = 0.0, pe2 = 0.0, pp = 0.0;
+        for(unsigned int i=0;i<n;++i)
+        {
+            pe1 += p[i]*e1[i];
+            pe2 += p[i]*e2[i];
+            pp += p[i]*p[i];
+        }
+
+        // A = I - e1.e1' - e2.e2',  b = (p.e1)e1 + (p.e2)e2 - p,  c = p.p - (p.e1)^2 - (p.e2)^2
+        for(unsigned int c=0;c<3;++c)
+        {
+            double* quadric = getQuadric(_cornerWedges[t*3+c]);
+            for(unsigned int i=0;i<n;++i)
+            {
+                for(unsigned int j=i;j<n;++j)
+                {
+                    quadric[getQuadricIndex(i,j)] += area*(((i==j) ? 1.0 : 0.0) - e1[i]*e1[j] - e2[i]*e2[j]);
+                }
+            }
+
+            double* b = quadric + (n*(n+1))/2;
+            for(unsigned int i=0;i<n;++i)
+            {
+                b[i] += area*(pe1*e1[i] + pe2*e2[i] - p[i]);
+            }
+
+            b[n] += area*(pp - pe1*pe1 - pe2*pe2);
+            b[n+1] += area;
+        }
+    }
+
+    // constrain the wedges on each side of a seam to the plane through the edge perpendicular to their triangle,
+    // weighted by the squared length of the edge but not counted in the area the errors are divided by.
+    for(std::vector<unsigned int>::const_iterator itr = seams.begin();
+        itr != seams.end();
+        ++itr)
+    {
+        unsigned int h = *itr;
+        unsigned int t = h/3;
+        unsigned int next = getNextCornerOfTriangle(h);
+
+        osg::Vec3d p0 = (_positions[_corners[t*3]]-_origin)*_scale;
+        osg::Vec3d p1 = (_positions[_corners[t*3+1]]-_origin)*_scale;
+        osg::Vec3d p2 = (_positions[_corners[t*3+2]]-_origin)*_scale;
+        osg::Vec3d start = (_positions[_corners[h]]-_origin)*_scale;
+        osg::Vec3d edge = (_positions[_corners[next]]-_origin)*_scale - start;
+
+        osg::Vec3d normal = edge^((p1-p0)^(p2-p0));
+        if (normal.normalize()<=0.0) continue;
+
+        double weight = edge.length2()*SEAM_WEIGHT;
+        double d = -(normal*start);
+
+        unsigned int wedges[2] = { _cornerWedges[h], _cornerWedges[next] };
+        for(unsigned int c=0;c<2;++c)
+        {
+            double* quadric = getQuadric(wedges[c]);
+            for(unsigned int i=0;i<3;++i)
+            {
+                for(unsigned int j=i;j<3;++j)
+                {
+                    quadric[getQuadricIndex(i,j)] += weight*normal[i]*normal[j];
+                }
+            }
+
+            double* b = quadric + (n*(n+1))/2;
+            for(unsigned int i=0;i<3;++i)
+            {
+                b[i] += weight*d*normal[i];
+            }
+
+            b[n] += weight*d*d;
+        }
+    }
+}
+
+void QuadricEdgeCollapse::getQuadricPoint(unsigned int w, double* point) const
+{
+    const osg::Vec3d& position = _positions[_wedgeVertices[w]];
+    point[0] = (position.x()-_origin.x())*_scale;
+    point[1] = (position.y()-_origin.y())*_scale;
+    point[2] = (position.z()-_origin.z())*_scale;
+
+    const float* row = &_table[w*_stride];
+    for(unsigned int i=0;i<_quadricColumns.size();++i)
+    {
+        point[3+i] = static_cast<double>(row[_quadricColumns[i].first])*_quadricColumns[i].second;
+    }
+}
+
+void QuadricEdgeCollapse::initContext(Context& context) const
+{
+    context.quadric.resize(_quadricStride);
+    context.expanded.resize(_dimension*_dimension);
+    context.point.resize(_dimension);
+    context.candidate.resize(_dimension);
+    context.matrix.resize(_dimension*(_dimension+1));
+    context.product.resize(_dimension);
+}
+
+void QuadricEdgeCollapse::expandQuadric(Context& context) const
+{
+    // copy the upper triangle of the context's quadric into a full matrix.
+    const unsigned int n = _dimension;
+    const double* quadric = &context.quadric[0];
+    double* a = &context.expanded[0];
+    for(unsigned int i=0;i<n;++i)
+    {
+        for(unsigned int j=i;j<n;++j)
+        {
+            a[i*n+j] = a[j*n+i] = quadric[getQuadricIndex(i,j)];
+        }
+    }
+}
+
+void QuadricEdgeCollapse::multiplyQuadric(const Context& context, const double* x, double* result) const
+{
+    const unsigned int n = _dimension;
+    const double* a = &context.expanded[0];
+    for(unsigned int i=0;i<n;++i)
+    {
+        double sum = 0.0;
+        for(unsigned int j=0;j<n;++j) sum += a[i*n+j]*x[j];
+        result[i] = sum;
+    }
+}
+
+double QuadricEdgeCollapse::evaluateQuadric(Context& context, const double* x) const
+{
+    const unsigned int n = _dimension;
+    const double* b = &context.quadric[(n*(n+1))/2];
+
+    double* ax = &context.product[0];
+    multiplyQuadric(context, x, ax);
+
+    double error = b[n];
+    for(unsigned int i=0;i<n;++i)
+    {
+        error += x[i]*ax[i] + 2.0*b[i]*x[i];
+    }
+    return osg::maximum(error, 0.0);
+}
+
+bool QuadricEdgeCollapse::solveQuadric(Context& context, double* x) const
+{
+    const unsigned int n = _dimension;
+    const unsigned int columns = n+1;
+    const double* a = &context.expanded[0];
+    const double* b = &context.quadric[(n*(n+1))/2];
+
+    // solve A.x = -b by Gaussian elimination with partial pivoting.
+    double* m = &context.matrix[0];
+    double trace = 0.0;
+    for(unsigned int i=0;i<n;++i)
+    {
+        std::copy(a+i*n, a+i*n+n, m+i*columns);
+        m[i*columns+n] = -b[i];
+        trace += a[i*n+i];
+    }
+
+    const double epsilon = trace*1e-8/double(n);
+    if (epsilon<=0.0) return false;
+
+    for(unsigned int k=0;k<n;++k)
+    {
+        unsigned int pivot = k;
+        for(unsigned int i=k+1;i<n;++i)
+        {
+            if (fabs(m[i*columns+k])>fabs(m[pivot*columns+k])) pivot = i;
+        }
+        if (fabs(m[pivot*columns+k])<epsilon) return false;
+
+        if (pivot!=k)
+        {
+            for(unsigned int j=k;j<columns;++j) std::swap(m[k*columns+j], m[pivot*columns+j]);
+        }
+
+        for(unsigned int i=k+1;i<n;++i)
+        {
+            double f = m[i*columns+k]/m[k*columns+k];
+            for(unsigned int j=k;j<columns;++j) m[i*columns+j] -= f*m[k*columns+j];
+        }
+    }
+
+    for(unsigned int k=n;k>0;--k)
+    {
+        unsigned int i = k-1;
+        double sum = m[i*columns+n];
+        for(unsigned int j=i+1;j<n;++j) sum -= m[i*columns+j]*x[j];
+        x[i] = sum/m[i*columns+i];
+    }
+    return true;
+}
+
+unsigned int QuadricEdgeCollapse::getSingleWedge(unsigned int v) const
+{
+    unsigned int wedge = INVALID_INDEX;
+    for(unsigned int h=_firstCorner[v]; h!=INVALID_INDEX; h=_nextCorner[h])
+    {
+        if (_removed[h/3]) continue;
+
+        if (wedge==INVALID_INDEX) wedge = _cornerWedges[h];
+        else if (_cornerWedges[h]!=wedge) return INVALID_INDEX;
+    }
+    return wedge;
+}
+
+bool QuadricEdgeCollapse::computeWedgePairs(Context& context, unsigned int keep, unsigned int remove) const
+{
+    // pair the wedges of the two vertices in the triangles on the edge.
+    std::vector<WedgePair>& wedgePairs = context.wedgePairs;
+    wedgePairs.clear();
+    for(unsigned int h=_firstCorner[remove]; h!=INVALID_INDEX; h=_nextCorner[h])
+    {
+        unsigned int t = h/3;
+        if (_removed[t]) continue;
+
+        for(unsigned int c=0;c<3;++c)
+        {
+            if (_corners[t*3+c]==keep) wedgePairs.push_back(WedgePair(_cornerWedges[h], _cornerWedges[t*3+c]));
+        }
+    }
+    if (wedgePairs.empty()) return false;
+
+    std::sort(wedgePairs.begin(), wedgePairs.end());
+    wedgePairs.erase(std::unique(wedgePairs.begin(), wedgePairs.end()), wedgePairs.end());
+
+    // each wedge of remove must merge with a single wedge of keep,
+    for(unsigned int i=1;i<wedgePairs.size();++i)
+    {
+        if (wedgePairs[i].first==wedgePairs[i-1].first) return false;
+    }
+
+    // and every wedge of remove must be used by a triangle on the edge, otherwise the collapse would cross a seam.
+    for(unsigned int h=_firstCorner[remove]; h!=INVALID_INDEX; h=_nextCorner[h])
+    {
+        if (_removed[h/3]) continue;
+
+        std::vector<WedgePair>::const_iterator itr = std::lower_bound(wedgePairs.begin(), wedgePairs.end(), WedgePair(_cornerWedges[h], 0));
+        if (itr==wedgePairs.end() || itr->first!=_cornerWedges[h]) return false;
+    }
+    return true;
+}
+
+bool QuadricEdgeCollapse::computeCollapseOnto(Context& context, unsigned int keep, unsigned int remove, double& error) const
+{
+    if (!computeWedgePairs(context, keep, remove)) return false;
+
+    context.wedges.clear();
+    for(std::vector<WedgePair>::const_iterator itr = context.wedgePairs.begin();
+        itr != context.wedgePairs.end();
+        ++itr)
+    {
+        context.wedges.push_back(itr->second);
+    }
+    std::sort(context.wedges.begin(), context.wedges.end());
+    context.wedges.erase(std::unique(context.wedges.begin(), context.wedges.end()), context.wedges.end());
+
+    // sum the errors of the wedges of keep, with the quadrics of the wedges of remove merged in, at their current points.
+    double* quadric = &context.quadric[0];
+    double* point = &context.point[0];
+    double sum = 0.0, weight = 0.0;
+    for(std::vector<unsigned int>::const_iterator witr = context.wedges.begin();
+        witr != context.wedges.end();
+        ++witr)
+    {
+        const double* keepQuadric = getQuadric(*witr);
+        std::copy(keepQuadric, keepQuadric+_quadricStride, quadric);
+        for(std::vector<WedgePair>::const_iterator itr = context.wedgePairs.begin();
+            itr != context.wedgePairs.end();
+            ++itr)
+        {
+            if (itr->second!=*witr) continue;
+
+            const double* removeQuadric = getQuadric(itr->first);
+            for(unsigned int i=0;i<_quadricStride;++i) quadric[i] += removeQuadric[i];
+        }
+
+        expandQuadric(context);
+        getQuadricPoint(*witr, point);
+        sum += evaluateQuadric(context, point);
+        weight += quadric[_quadricStride-1];
+    }
+
+    error = sum/osg::maximum(weight, 1e-30);
+    return true;
+}
+
+bool QuadricEdgeCollapse::computeCollapse(Context& context, unsigned int v0, unsigned int v1, unsigned int& keep, double& error)
+{
+    if (_locked[v0] && _locked[v1]) return false;
+
+    context.optimal = false;
+
+    if (_locked[v0] || _locked[v1])
+    {
+        // the free vertex moves onto the locked one.
+        keep = _locked[v0] ? v0 : v1;
+        return computeCollapseOnto(context, keep, (keep==v0) ? v1 : v0, error);
+    }
+
+    unsigned int w0 = getSingleWedge(v0);
+    unsigned int w1 = getSingleWedge(v1);
+    if (w0==INVALID_INDEX || w1==INVALID_INDEX)
+    {
+        // a vertex on a seam moves onto the other vertex, in the direction with the least error that keeps the seams.
+        double error1;
+        bool valid0 = computeCollapseOnto(context, v0, v1, error);
+        bool valid1 = computeCollapseOnto(context, v1, v0, error1);
+        if (valid1 && (!valid0 || error1<error))
+        {
+            keep = v1;
+            error = error1;
+            return true;
+        }
+
+        // recompute the wedge pairs of the collapse onto v0.
+        keep = v0;
+        return valid0 && computeCollapseOnto(context, v0, v1, error);
+    }
+
+    const unsigned int n = _dimension;
+    double* quadric = &context.quadric[0];
+    double* point = &context.point[0];
+    const double* q0 = getQuadric(w0);
+    const double* q1 = getQuadric(w1);
+    for(unsigned int i=0;i<_quadricStride;++i) quadric[i] = q0[i]+q1[i];
+
+    double weight = osg::maximum(quadric[_quadricStride-1], 1e-30);
+    expandQuadric(context);
+
+    keep = v0;
+    context.optimal = true;
+    context.wedgePairs.clear();
+    context.wedgePairs.push_back(WedgePair(w1, w0));
+
+    // minimize the quadric along the edge, which bounds the error of the optimal point.
+    double* x0 = &context.candidate[0];
+    getQuadricPoint(w0, x0);
+    getQuadricPoint(w1, point);
+
+    double* d = &context.matrix[0];
+    for(unsigned int i=0;i<n;++i) d[i] = point[i]-x0[i];
+
+    const double* b = quadric + (n*(n+1))/2;
+    double* ad = &context.product[0];
+    multiplyQuadric(context, d, ad);
+    double denominator = 0.0, numerator = 0.0;
+    for(unsigned int i=0;i<n;++i)
+    {
+        denominator += d[i]*ad[i];
+    }
+    multiplyQuadric(context, x0, ad);
+    for(unsigned int i=0;i<n;++i)
+    {
+        numerator += d[i]*(ad[i]+b[i]);
+    }
+
+    double s = denominator>0.0 ? osg::clampBetween(-numerator/denominator, 0.0, 1.0) : 0.5;
+    double edgeLength2 = 0.0;
+    for(unsigned int i=0;i<n;++i)
+    {
+        if (i<3) edgeLength2 += d[i]*d[i];
+        point[i] = x0[i] + d[i]*s;
+    }
+    error = evaluateQuadric(context, point);
+
+    // use the optimal point if it lies close to the edge.
+    double* x = &context.candidate[0];
+    if (solveQuadric(context, x))
+    {
+        double distance2 = 0.0;
+        for(unsigned int i=0;i<3;++i)
+        {
+            double delta = x[i] - point[i];
+            distance2 += delta*delta;
+        }
+
+        if (distance2<=edgeLength2)
+        {
+            double optimalError = evaluateQuadric(context, x);
+            if (optimalError<error)
+            {
+                error = optimalError;
+                std::copy(x, x+n, point);
+            }
+        }
+    }
+
+    error /= weight;
+    return true;
+}
+
+void QuadricEdgeCollapse::pushCollapse(Context& context, unsigned int v0, unsigned int v1)
+{
+    if (!isClusterMember(context, v0) || !isClusterMember(context, v1)) return;
+
+    unsigned int keep;
+    double error;
+    if (!computeCollapse(context, v0, v1, keep, error)) return;
+
+    Collapse collapse;
+    collapse.error = static_cast<float>(sqrt(error)/_scale);
+    collapse.v0 = v0;
+    collapse.v1 = v1;
+    collapse.version0 = _versions[v0];
+    collapse.version1 = _versions[v1];
+
+    context.heap.push_back(collapse);
+    std::push_heap(context.heap.begin(), context.heap.end(), std::greater<Collapse>());
+}
+
+void QuadricEdgeCollapse::pushCollapsesAroundVertex(Context& context, unsigned int v)
+{
+    for(unsigned int h=_firstCorner[v]; h!=INVALID_INDEX; h=_nextCorner[h])
+    {
+        if (_removed[h/3]) continue;
+
+        // each edge of a manifold one ring leaves v in exactly one triangle.
+        pushCollapse(context, v, _corners[getNextCornerOfTriangle(h)]);
+    }
+}
+
+void QuadricEdgeCollapse::collectNeighbours(unsigned int v, std::vector<unsigned int>& neighbours) const
+{
+    neighbours.clear();
+    for(unsigned int h=_firstCorner[v]; h!=INVALID_INDEX; h=_nextCorner[h])
+    {
+        unsigned int t = h/3;
+        if (_removed[t]) continue;
+
+        for(unsigned int c=0;c<3;++c)
+        {
+            if (_corners[t*3+c]!=v) neighbours.push_back(_corners[t*3+c]);
+        }
+    }
+    std::sort(neighbours.begin(), neighbours.end());
+    neighbours.erase(std::unique(neighbours.begin(), neighbours.end()), neighbours.end());
+}
+
+bool QuadricEdgeCollapse::checkTriangleFlips(unsigned int v, unsigned int other, const osg::Vec3d& position) const
+{
+    for(unsigned int h=_firstCorner[v]; h!=INVALID_INDEX; h=_nextCorner[h])
+    {
+        unsigned int t = h/3;
+        if (_removed[t] || triangleContains(t, other)) continue;
+
+        const osg::Vec3d& p0 = _positions[_corners[t*3]];
+        const osg::Vec3d& p1 = _positions[_corners[t*3+1]];
+        const osg::Vec3d& p2 = _positions[_corners[t*3+2]];
+        osg::Vec3d normal = (p1-p0)^(p2-p0);
+
+        osg::Vec3d moved[3] = { p0, p1, p2 };
+        moved[h%3] = position;
+        osg::Vec3d movedNormal = (moved[1]-moved[0])^(moved[2]-moved[0]);
+
+        if (normal*movedNormal<=0.0) return false;
+    }
+    return true;
+}
+
+bool QuadricEdgeCollapse::collapseEdge(Context& context, const Collapse& collapse)
+{
+    unsigned int keep;
+    double error;
+    if (!computeCollapse(context, collapse.v0, collapse.v1, keep, error)) return false;
+
+    unsigned int remove = (keep==collapse.v0) ? collapse.v1 : collapse.v0;
+
+    // link condition, the vertices common to both one rings must be those of the triangles on the edge,
+    // otherwise the collapse would make the mesh non manifold.
+    unsigned int numSharedTriangles = 0;
+    for(unsigned int h=_firstCorner[remove]; h!=INVALID_INDEX; h=_nextCorner[h])
+    {
+        if (!_removed[h/3] && triangleContains(h/3, keep)) ++numSharedTriangles;
+    }
+    if (numSharedTriangles==0) return false;
+
+    collectNeighbours(keep, context.neighbours0);
+    collectNeighbours(remove, context.neighbours1);
+    unsigned int numCommon = 0;
+    std::vector<unsigned int>::const_iterator itr0 = context.neighbours0.begin();
+    std::vector<unsigned int>::const_iterator itr1 = context.neighbours1.begin();
+    while(itr0!=context.neighbours0.end() && itr1!=context.neighbours1.end())
+    {
+        if (*itr0<*itr1) ++itr0;
+        else if (*itr1<*itr0) ++itr1;
+        else { ++numCommon; ++itr0; ++itr1; }
+    }
+    if (numCommon!=numSharedTriangles) return false;
+
+    const double* point = &context.point[0];
+    osg::Vec3d position = !context.optimal ? _positions[keep] :
+                          osg::Vec3d(point[0]/_scale+_origin.x(), point[1]/_scale+_origin.y(), point[2]/_scale+_origin.z());
+
+    if (!checkTriangleFlips(keep, remove, position) || !checkTriangleFlips(remove, keep, position)) return false;
+
+    // move the half-edges of remove over to keep, removing the triangles on the edge.
+    context.corners.clear();
+    for(unsigned int h=_firstCorner[remove]; h!=INVALID_INDEX; h=_nextCorner[h])
+    {
+        unsigned int t = h/3;
+        if (_removed[t]) continue;
+
+        if (triangleContains(t, keep))
+        {
+            _removed[t] = 1;
+            --context.numTriangles;
+        }
+        else
+        {
+            std::vector<WedgePair>::const_iterator itr = std::lower_bound(context.wedgePairs.begin(), context.wedgePairs.end(), WedgePair(_cornerWedges[h], 0));
+            _corners[h] = keep;
+            _cornerWedges[h] = itr->second;
+            context.corners.push_back(h);
+        }
+    }
+    for(unsigned int h=_firstCorner[keep]; h!=INVALID_INDEX; h=_nextCorner[h])
+    {
+        if (!_removed[h/3]) context.corners.push_back(h);
+    }
+
+    _firstCorner[remove] = INVALID_INDEX;
+    _firstCorner[keep] = INVALID_INDEX;
+    for(std::vector<unsigned int>::reverse_iterator itr = context.corners.rbegin();
+        itr != context.corners.rend();
+        ++itr)
+    {
+        _nextCorner[*itr] = _firstCorner[keep];
+        _firstCorner[keep] = *itr;
+    }
+
+    if (context.optimal)
+    {
+        // interpolate the attributes that are not part of the quadric by the position along the edge.
+        osg::Vec3d edge = _positions[remove]-_positions[keep];
+        double length2 = edge.length2();
+        float r = length2>0.0 ? static_cast<float>(osg::clampBetween(((position-_positions[keep])*edge)/length2, 0.0, 1.0)) : 0.5f;
+
+        float* row = &_table[context.wedgePairs.front().second*_stride];
+        const float* removedRow = &_table[context.wedgePairs.front().first*_stride];
+        for(ColumnList::const_iterator citr = _interpolatedColumns.begin();
+            citr != _interpolatedColumns.end();
+            ++citr)
+        {
+            row[*citr] = row[*citr]*(1.0f-r) + removedRow[*citr]*r;
+        }
+
+        for(unsigned int i=0;i<_quadricColumns.size();++i)
+        {
+            row[_quadricColumns[i].first] = static_cast<float>(point[3+i]/_quadricColumns[i].second);
+        }
+
+        _positions[keep] = position;
+    }
+
+    for(std::vector<WedgePair>::const_iterator itr = context.wedgePairs.begin();
+        itr != context.wedgePairs.end();
+        ++itr)
+    {
+        double* keepQuadric = getQuadric(itr->second);
+        const double* removeQuadric = getQuadric(itr->first);
+        for(unsigned int i=0;i<_quadricStride;++i) keepQuadric[i] += removeQuadric[i];
+    }
+
+    _collapsed[remove] = 1;
+    ++_versions[keep];
+
+    pushCollapsesAroundVertex(context, keep);
+
+    return true;
+}
+
+void QuadricEdgeCollapse::collapseEdges(Context& context)
+{
+    while(!context.heap.empty())
+    {
+        Collapse collapse = context.heap.front();
+        std::pop_heap(context.heap.begin(), context.heap.end(), std::greater<Collapse>());
+        context.heap.pop_back();
+
+        // discard collapses computed before either vertex was last modified.
+        if (_collapsed[collapse.v0] || _collapsed[collapse.v1] ||
+            _versions[collapse.v0]!=collapse.version0 || _versions[collapse.v1]!=collapse.version1) continue;
+
+        // clusters also stop at their own target, leaving the rest of the reduction to the pass over the whole mesh.
+        bool continueSimplification = (context.cluster==INVALID_INDEX || context.numTriangles>context.targetNumTriangles) &&
+            _simplifier.continueSimplification(collapse.error, context.numOriginalTriangles, context.numTriangles);
+
+        if (!continueSimplification)
+        {
+            // leave the collapse on the heap so its error can be reported.
+            context.heap.push_back(collapse);
+            std::push_heap(context.heap.begin(), context.heap.end(), std::greater<Collapse>());
+            break;
+        }
+
+        collapseEdge(context, collapse);
+    }
+}
+
+void QuadricEdgeCollapse::assignClusters(unsigned int numClusters)
+{
+    osg::BoundingBoxd bb;
+    for(std::vector<osg::Vec3d>::const_iterator itr = _positions.begin();
+        itr != _positions.end();
+        ++itr)
+    {
+        bb.expandBy(*itr);
+    }
+
+    // shrink the cells of a regular grid until there are about numClusters of them over the bounding box.
+    osg::Vec3d extents = bb._max - bb._min;
+    double cellSize = osg::maximum(extents.x(), osg::maximum(extents.y(), extents.z()));
+    if (cellSize<=0.0) cellSize = 1.0;
+
+    unsigned int dimensions[3] = { 1, 1, 1 };
+    for(unsigned int iteration=0; iteration<64; ++iteration)
+    {
+        for(unsigned int i=0;i<3;++i)
+        {
+            dimensions[i] = osg::maximum(1u, static_cast<unsigned int>(ceil(extents[i]/cellSize)));
+        }
+        if (dimensions[0]*dimensions[1]*dimensions[2]>=numClusters) break;
+        cellSize *= 0.8;
+    }
+
+    std::vector<unsigned int> cells(dimensions[0]*dimensions[1]*dimensions[2], INVALID_INDEX);
+    unsigned int numOccupiedCells = 0;
+
+    _clusters.resize(_positions.size());
+    for(unsigned int v=0;v<_positions.size();++v)
+    {
+        unsigned int index[3];
+        for(unsigned int i=0;i<3;++i)
+        {
+            double position = (_positions[v][i]-bb._min[i])/cellSize;
+            index[i] = osg::minimum(dimensions[i]-1, static_cast<unsigned int>(osg::maximum(position, 0.0)));
+        }
+
+        unsigned int& cell = cells[index[0] + dimensions[0]*(index[1] + dimensions[1]*index[2])];
+        if (cell==INVALID_INDEX) cell = numOccupiedCells++;
+        _clusters[v] = cell;
+    }
+
+    // vertices with triangles reaching into other clusters stay fixed while the clusters are simplified.
+    _clusterInteriors.clear();
+    _clusterInteriors.resize(_positions.size(), 1);
+
+    unsigned int numTriangles = _corners.size()/3;
+    std::vector<unsigned int> triangleClusters(numTriangles, INVALID_INDEX);
+    _clusterTriangleOffsets.clear();
+    _clusterTriangleOffsets.resize(numOccupiedCells+1, 0);
+
+    for(unsigned int t=0;t<numTriangles;++t)
+    {
+        unsigned int c0 = _clusters[_corners[t*3]];
+        unsigned int c1 = _clusters[_corners[t*3+1]];
+        unsigned int c2 = _clusters[_corners[t*3+2]];
+        if (c0==c1 && c1==c2)
+        {
+            triangleClusters[t] = c0;
+            ++_clusterTriangleOffsets[c0+1];
+        }
+        else
+        {
+            _clusterInteriors[_corners[t*3]] = 0;
+            _clusterInteriors[_corners[t*3+1]] = 0;
+            _clusterInteriors[_corners[t*3+2]] = 0;
+        }
+    }
+
+    for(unsigned int c=0;c<numOccupiedCells;++c)
+    {
+        _clusterTriangleOffsets[c+1] += _clusterTriangleOffsets[c];
+    }
+
+    _clusterTriangles.resize(_clusterTriangleOffsets.back());
+    std::vector<unsigned int> positions(_clusterTriangleOffsets.begin(), _clusterTriangleOffsets.end()-1);
+    for(unsigned int t=0;t<numTriangles;++t)
+    {
+        if (triangleClusters[t]!=INVALID_INDEX) _clusterTriangles[positions[triangleClusters[t]]++] = t;
+    }
+
+    // simplify the largest clusters first to balance the work between threads.
+    std::vector< std::pair<unsigned int, unsigned int> > sizes(numOccupiedCells);
+    for(unsigned int c=0;c<numOccupiedCells;++c)
+    {
+        sizes[c] = std::pair<unsigned int, unsigned int>(_clusterTriangleOffsets[c+1]-_clusterTriangleOffsets[c], c);
+    }
+    std::sort(sizes.begin(), sizes.end(), std::greater< std::pair<unsigned int, unsigned int> >());
+
+    _clusterOrder.resize(numOccupiedCells);
+    for(unsigned int c=0;c<numOccupiedCells;++c) _clusterOrder[c] = sizes[c].second;
+
+    _clusterNumRemoved.clear();
+    _clusterNumRemoved.resize(numOccupiedCells, 0);
+}
+
+void QuadricEdgeCollapse::processClusters()
+{
+    for(;;)
+    {
+        unsigned int index = (++_nextCluster)-1;
+        if (index>=_clusterOrder.size()) break;
+
+        unsigned int cluster = _clusterOrder[index];
+
+        Context context(cluster);
+        initContext(context);
+        context.numOriginalTriangles = _clusterTriangleOffsets[cluster+1]-_clusterTriangleOffsets[cluster];
+        context.numTriangles = context.numOriginalTriangles;
+        context.targetNumTriangles = static_cast<unsigned int>(context.numOriginalTriangles*sqrt(_simplifier.getSampleRatio()));
+
+        for(unsigned int i=_clusterTriangleOffsets[cluster]; i<_clusterTriangleOffsets[cluster+1]; ++i)
+        {
+            unsigned int t = _clusterTriangles[i];
+            for(unsigned int c=0;c<3;++c)
+            {
+                unsigned int v0 = _corners[t*3+c];
+                unsigned int v1 = _corners[t*3+(c+1)%3];
+                if (v0<v1) pushCollapse(context, v0, v1);
+            }
+        }
+
+        collapseEdges(context);
+
+        _clusterNumRemoved[cluster] = context.numOriginalTriangles-context.numTriangles;
+    }
+}
+
+void QuadricEdgeCollapse::simplifyClusters(unsigned int numThreads)
+{
+    unsigned int numClusters = _numTriangles/MINIMUM_CLUSTER_SIZE;
+    if (numThreads<2 || numClusters<2) return;
+
+    // the clusters depend only on the mesh, so the result is the same for any number of threads.
+    assignClusters(numClusters);
+
+    numThreads = osg::minimum(numThreads, static_cast<unsigned int>(_clusterOrder.size()));
+
+    _nextCluster.exchange(0);
+
+    // simplify clusters in this thread too, then wait for the other threads to complete theirs.
+    SimplifyClustersOperation operation(this);
+    ThreadPool::instance()->run(operation, numThreads);
+
+    for(unsigned int c=0;c<_clusterNumRemoved.size();++c)
+    {
+        _numTriangles -= _clusterNumRemoved[c];
+    }
+
+    OSG_INFO<<"QuadricEdgeCollapse::simplifyClusters("<<numThreads<<") "<<_clusterOrder.size()<<" clusters, triangles = "<<_numTriangles<<std::endl;
+
+    _clusters.clear();
+    _clusterInteriors.clear();
+    _clusterTriangles.clear();
+}
+
+float QuadricEdgeCollapse::simplify()
+{
+    Context context(INVALID_INDEX);
+    initContext(context);
+    context.numOriginalTriangles = _numOriginalTriangles;
+    context.numTriangles = _numTriangles;
+
+    for(unsigned int t=0;t<_corners.size()/3;++t)
+    {
+        if (_removed[t]) continue;
+
+        for(unsigned int c=0;c<3;++c)
+        {
+            unsigned int v0 = _corners[t*3+c];
+            unsigned int v1 = _corners[t*3+(c+1)%3];
+            if (v0<v1) pushCollapse(context, v0, v1);
+        }
+    }
+
+    collapseEdges(context);
+
+    _numTriangles = context.numTriangles;
+
+    return context.heap.empty() ? 0.0f : context.heap.front().error;
+}
+
+void QuadricEdgeCollapse::copyBackToGeometry()
+{
+    // compact the wedges still used by triangles, keeping their original order.
+    std::vector<unsigned int> indices(_wedgeVertices.size(), INVALID_INDEX);
+    std::vector<unsigned int> rows;
+
+    osg::ref_ptr<osg::DrawElementsUInt> primitives = new osg::DrawElementsUInt(GL_TRIANGLES);
+    primitives->reserve(_numTriangles*3);
+
+    for(unsigned int t=0;t<_corners.size()/3;++t)
+    {
+        if (_removed[t]) continue;
+
+        for(unsigned int c=0;c<3;++c)
+        {
+            unsigned int w = _cornerWedges[t*3+c];
+            if (indices[w]==INVALID_INDEX)
+            {
+                indices[w] = rows.size();
+                rows.push_back(w);
+            }
+            primitives->push_back(indices[w]);
+        }
+    }
+
+    for(std::vector<unsigned int>::const_iterator itr = rows.begin();
+        itr != rows.end();
+        ++itr)
+    {
+        float* row = &_table[(*itr)*_stride+_vertexColumn];
+        const osg::Vec3d& position = _positions[_wedgeVertices[*itr]];
+        for(unsigned int i=0;i<osg::minimum(_numVertexComponents, 3u);++i) row[i] = static_cast<float>(position[i]);
+        if (_numVertexComponents==4) row[3] = 1.0f;
+    }
+
+    for(unsigned int i=0;i<_arrays.size();++i)
+    {
+        CopyTableToArrayVisitor copyTableToArray(_table, _stride, _arrayColumns[i], rows);
+        _arrays[i]->accept(copyTableToArray);
+    }
+
+    if (_geometry->getNormalArray() && _geometry->getNormalArray()->getBinding()==osg::Array::BIND_PER_VERTEX)
+    {
+        // now normalize the normals.
+        NormalizeArrayVisitor nav;
+        _geometry->getNormalArray()->accept(nav);
+    }
+
+    _geometry->getPrimitiveSetList().clear();
+    _geometry->addPrimitiveSet(primitives.get());
+    _geometry->dirtyBound();
+}
+
+}
+
+Simplifier::Simplifier(double sampleRatio, double maximumError, double maximumLength):
+            osg::NodeVisitor(osg::NodeVisitor::TRAVERSE_ALL_CHILDREN),
+            _sampleRatio(sampleRatio),
+            _maximumError(maximumError),
+            _maximumLength(maximumLength),
+            _triStrip(true),
+            _smoothing(true),
+            _normalWeight(0.5),
+            _texCoordWeight(1.0),
+            _numThreads(1)
+
+{
+}
+
+void Simplifier::simplify(osg::Geometry& geometry)
+{
+    // pass an empty list of indices to simply(Geometry,IndexList)
+    // so that this one method handle both cases of non protected indices
+    // and specified indices.
+    IndexList emptyList;
+    simplify(geometry,emptyList);
+}
+
+void Simplifier::simplify(osg::Geometry& geometry, const IndexList& protectedPoints)
+{
+    OSG_INFO<<"++++++++++++++simplifier************"<<std::endl;
+
+    if (getSampleRatio()<1.0)
+    {
+        QuadricEdgeCollapse qec(*this);
+        if (!qec.setGeometry(&geometry, protectedPoints)) return;
+
+        unsigned int numThreads = _numThreads>0 ? _numThreads : OpenThreads::GetNumberOfProcessors();
+        qec.simplifyClusters(numThreads);
+
+        float nextError = qec.simplify();
+
+        OSG_INFO<<std::endl<<"Simplifier, in = "<<qec.getNumOriginalTriangles()<<"\tout = "<<qec.getNumTriangles()<<"\terror="<<nextError<<"\tvs "<<getMaximumError()<<std::endl<<std::endl;
+
+        qec.copyBackToGeometry();
+    }
+    else
+    {
+        EdgeCollapse ec;
+        ec.setGeometry(&geometry);
+        ec.updateErrorMetricForAllEdges();
+
+        unsigned int numOriginalPrimitives = ec._triangleSet.size();
+
+        // up sampling...
+        while (!ec._edgeSet.empty() &&
+               continueSimplification((*ec._edgeSet.rbegin())->getErrorMetric() , numOriginalPrimitives, ec._triangleSet.size()) &&
+               ec.divideLongestEdge())
+        {
+           //OSG_INFO<<"   Edge divided ec._triangleSet.size()="<<ec._triangleSet.size()<<" error="<<(*ec._edgeSet.rbegin())->getErrorMetric()<<" vs "<<getMaximumError()<<std::endl;
+        }
+        OSG_INFO<<"******* AFTER EDGE DIVIDE *********"<<ec._triangleSet.size()<<std::endl;
+
+        OSG_INFO<<"Number of triangle errors after edge divide= "<<ec.testAllTriangles()<<std::endl;
+        OSG_INFO<<"Number of edge errors after edge divide= "<<ec.testAllEdges()<<std::endl;
+        OSG_INFO<<"Number of point errors after edge divide= "<<ec.testAllPoints()<<std::endl;
+        OSG_INFO<<"Number of triangles= "<<ec._triangleSet.size()<<std::endl;
+        OSG_INFO<<"Number of points= "<<ec._pointSet.size()<<std::endl;
+        OSG_INFO<<"Number of edges= "<<ec._edgeSet.size()<<std::endl;
+        OSG_INFO<<"Number of boundary edges= "<<ec.computeNumBoundaryEdges()<<std::endl;
+
+        ec.copyBackToGeometry();
+    }
 
     if (_smoothing)
     {
@@ -666,7 +666,9 @@ static void smooth_new(osg::Geometry& geom, double creaseAngle)
 
 
 SmoothingVisitor::SmoothingVisitor():
-    _creaseAngle(osg::PI)
+    _creaseAngle(osg::PI),
+    _numThreads(1),
+    _traversalDepth(0)
 {
     setTraversalMode(osg::NodeVisitor::TRAVERSE_ALL_CHILDREN);
 }
@@ -693,6 +695,44 @@ void SmoothingVisitor::apply(osg::Geode& geode)
     for(unsigned int i = 0; i < geode.getNumDrawables(); i++ )
     {
         osg::Geometry* geom = dynamic_cast<osg::Geometry*>(geode.getDrawable(i));
-        if (geom) smooth(*geom, _creaseAngle);
+        if (geom)
+        {
+            if (_numThreads==1) smooth(*geom, _creaseAngle);
+            else _collectedGeometries.add(geom);
+        }
     }
+
+    if (_traversalDepth==0) smoothCollectedGeometries();
+}
+
+void SmoothingVisitor::apply(osg::Node& node)
+{
+    ++_traversalDepth;
+    traverse(node);
+    --_traversalDepth;
+
+    if (_traversalDepth==0) smoothCollectedGeometries();
+}
+
+namespace
+{
+
+struct SmoothFunctor : public ParallelSubgraphProcessor::Functor
+{
+    SmoothFunctor(double creaseAngle) : _creaseAngle(creaseAngle) {}
+
+    virtual void operator() (osg::Node& node) { SmoothingVisitor::smooth(*node.asGeometry(), _creaseAngle); }
+
+    double _creaseAngle;
+};
+
+}
+
+void SmoothingVisitor::smoothCollectedGeometries()
+{
+    if (_collectedGeometries.getNumNodes()==0) return;
+
+    SmoothFunctor functor(_creaseAngle);
+    _collectedGeometries.setNumThreads(_numThreads);
+    _collectedGeometries.run(functor);
 }
@@ -47,17 +47,18 @@ void StateGraph::clean()
 }
 
 /** recursively prune the StateGraph of empty children.*/
-void StateGraph::prune()
+void StateGraph::prune(FrameArena* arena)
 {
     // call prune on all children.
     ChildList::iterator citr=_children.begin();
     while(citr!=_children.end())
     {
-        citr->second->prune();
+        citr->second->prune(arena);
 
         if (citr->second->empty())
         {
             ChildList::iterator ditr= citr++;
+            if (arena) arena->releaseStateGraph(ditr->second.get());
             _children.erase(ditr);
         }
         else ++citr;
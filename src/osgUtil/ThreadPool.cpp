@@ -0,0 +1,102 @@
+/* -*-c++-*- OpenSceneGraph - Copyright (C) 1998-2006 Robert Osfield
+ *
+ * This library is open source and may be redistributed and/or modified under
+ * the terms of the OpenSceneGraph Public License (OSGPL) version 0.0 or
+ * (at your option) any later version.  The full license is in LICENSE file
+ * included with this distribution, and on the openscenegraph.org website.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * OpenSceneGraph Public License for more details.
+*/
+#include "ThreadPool.h"
+
+#include <osg/Math>
+
+#include <OpenThreads/ScopedLock>
+#include <OpenThreads/Thread>
+
+using namespace osgUtil;
+
+struct ThreadPool::WorkOperation : public osg::Operation
+{
+    WorkOperation(ThreadPool* pool, Work& work, unsigned int threadIndex, osg::RefBlockCount* block):
+        osg::Operation("ThreadPoolWork", false),
+        _pool(pool),
+        _work(work),
+        _threadIndex(threadIndex),
+        _block(block) {}
+
+    virtual void operator () (osg::Object*)
+    {
+        _work(_threadIndex);
+        --(_pool->_numPending);
+        _block->completed();
+    }
+
+    ThreadPool*                         _pool;
+    Work&                               _work;
+    unsigned int                        _threadIndex;
+    osg::ref_ptr<osg::RefBlockCount>    _block;
+};
+
+ThreadPool* ThreadPool::instance()
+{
+    static osg::ref_ptr<ThreadPool> s_threadPool = new ThreadPool;
+    return s_threadPool.get();
+}
+
+ThreadPool::ThreadPool():
+    _operationQueue(new osg::OperationQueue),
+    _maxNumThreads(osg::maximum(OpenThreads::GetNumberOfProcessors(), 1))
+{
+}
+
+void ThreadPool::run(Work& work, unsigned int numThreads)
+{
+    if (numThreads<2)
+    {
+        work(0);
+        return;
+    }
+
+    osg::ref_ptr<osg::RefBlockCount> block = new osg::RefBlockCount(numThreads-1);
+    block->reset();
+    for(unsigned int i=1; i<numThreads; ++i)
+    {
+        add(new WorkOperation(this, work, i, block.get()));
+    }
+
+    // work in this thread too, then help with the queued operations until the other threads have completed theirs,
+    // as with the number of threads capped some of them may still be waiting for a thread to run them.
+    work(0);
+    while(block->getCurrentCount()>0)
+    {
+        osg::ref_ptr<osg::Operation> operation = _operationQueue->getNextOperation();
+        if (!operation)
+        {
+            block->block();
+            break;
+        }
+        (*operation)(0);
+    }
+}
+
+void ThreadPool::add(osg::Operation* operation)
+{
+    unsigned int numPending = ++_numPending;
+
+    {
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+        while(_threads.size()<numPending && _threads.size()<_maxNumThreads)
+        {
+            osg::ref_ptr<osg::OperationThread> thread = new osg::OperationThread;
+            thread->setOperationQueue(_operationQueue.get());
+            thread->startThread();
+            _threads.push_back(thread);
+        }
+    }
+
+    _operationQueue->add(operation);
+}
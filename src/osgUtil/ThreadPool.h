@@ -0,0 +1,70 @@
+/* -*-c++-*- OpenSceneGraph - Copyright (C) 1998-2006 Robert Osfield
+ *
+ * This library is open source and may be redistributed and/or modified under
+ * the terms of the OpenSceneGraph Public License (OSGPL) version 0.0 or
+ * (at your option) any later version.  The full license is in LICENSE file
+ * included with this distribution, and on the openscenegraph.org website.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * OpenSceneGraph Public License for more details.
+*/
+
+#ifndef OSGUTIL_THREADPOOL
+#define OSGUTIL_THREADPOOL 1
+
+#include <osg/OperationThread>
+
+#include <OpenThreads/Atomic>
+#include <OpenThreads/Mutex>
+
+#include <vector>
+
+namespace osgUtil
+{
+
+/** Pool of threads shared by the parallel code paths of osgUtil, such as the parallel cull of
+  * CullVisitor, the Optimizer, Simplifier and PagedLODBuilder. Threads are started on demand so
+  * that every pending operation has a thread to run it, up to one thread per processor. Once the
+  * pool is saturated the threads calling run() process queued operations themselves while they wait,
+  * so work run by one user still makes progress when the pool is busy with work of another.*/
+class ThreadPool : public osg::Referenced
+{
+public:
+
+    /** Work run concurrently by several threads, each calling operator() with its own thread index.*/
+    struct Work
+    {
+        virtual ~Work() {}
+        virtual void operator () (unsigned int threadIndex) = 0;
+    };
+
+    static ThreadPool* instance();
+
+    ThreadPool();
+
+    /** Run the work on numThreads threads, the calling thread being thread index 0 and the others
+      * taken from the pool, returning once all of them have completed.*/
+    void run(Work& work, unsigned int numThreads);
+
+protected:
+
+    virtual ~ThreadPool() {}
+
+    struct WorkOperation;
+
+    void add(osg::Operation* operation);
+
+    typedef std::vector< osg::ref_ptr<osg::OperationThread> > OperationThreads;
+
+    OpenThreads::Mutex                  _mutex;
+    osg::ref_ptr<osg::OperationQueue>   _operationQueue;
+    OperationThreads                    _threads;
+    unsigned int                        _maxNumThreads;
+    OpenThreads::Atomic                 _numPending;
+};
+
+}
+
+#endif
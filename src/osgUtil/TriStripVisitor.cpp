@@ -563,17 +563,35 @@ void TriStripVisitor::stripify(Geometry& geom)
 
 }
 
+namespace
+{
+
+struct StripifyFunctor : public ParallelSubgraphProcessor::Functor
+{
+    StripifyFunctor(TriStripVisitor& visitor) : _visitor(visitor) {}
+
+    virtual void operator() (osg::Node& node) { _visitor.stripify(*node.asGeometry()); }
+
+    TriStripVisitor& _visitor;
+};
+
+}
+
 void TriStripVisitor::stripify()
 {
+    ParallelSubgraphProcessor processor(_numThreads);
     for(GeometryList::iterator itr=_geometryList.begin();
         itr!=_geometryList.end();
         ++itr)
     {
-        stripify(*(*itr));
+        processor.add(*itr);
 
         // osgUtil::SmoothingVisitor sv;
         // sv.smooth(*(*itr));
     }
+
+    StripifyFunctor functor(*this);
+    processor.run(functor);
 }
 
 void TriStripVisitor::apply(Geode& geode)
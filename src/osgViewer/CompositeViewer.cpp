@@ -14,6 +14,7 @@
 #include <osg/GLExtensions>
 #include <osg/TextureRectangle>
 #include <osg/TextureCubeMap>
+#include <osg/DeleteHandler>
 
 #include <osgGA/TrackballManipulator>
 #include <osgViewer/CompositeViewer>
@@ -702,6 +703,12 @@ void CompositeViewer::advance(double simulationTime)
         getViewerStats()->setAttribute(_frameStamp->getFrameNumber(), "Reference time", _frameStamp->getReferenceTime());
     }
 
+    if (osg::Referenced::getDeleteHandler())
+    {
+        osg::Referenced::getDeleteHandler()->flush();
+        osg::Referenced::getDeleteHandler()->setFrameNumber(_frameStamp->getFrameNumber());
+    }
+
 }
 
 void CompositeViewer::setCameraWithFocus(osg::Camera* camera)
@@ -1288,6 +1295,16 @@ void CompositeViewer::updateTraversal()
     {
         Scene* scene = *sitr;
         scene->updateSceneGraph(*_updateVisitor);
+
+        if (scene->getDatabasePager() && getViewerStats() && getViewerStats()->collectStats("update"))
+        {
+            scene->getDatabasePager()->reportStats(_frameStamp->getFrameNumber(), *getViewerStats());
+        }
+    }
+
+    if (_incrementalCompileOperation.valid() && getViewerStats() && getViewerStats()->collectStats("update"))
+    {
+        _incrementalCompileOperation->reportStats(_frameStamp->getFrameNumber(), *getViewerStats());
     }
 
     // if we have a shared state manager prune any unused entries
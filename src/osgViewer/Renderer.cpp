@@ -14,6 +14,8 @@
 #include <stdio.h>
 
 #include <osg/GLExtensions>
+#include <osg/BufferObject>
+#include <osg/Texture>
 #include <OpenThreads/ReentrantMutex>
 
 #include <osgUtil/Optimizer>
@@ -35,6 +37,35 @@ using namespace osgViewer;
 //#define DEBUG_MESSAGE OSG_NOTICE
 #define DEBUG_MESSAGE OSG_DEBUG
 
+/** Snapshot of the running totals kept by a context's buffer and texture object managers,
+  * used to report how much they changed over a draw traversal.*/
+struct GLObjectPoolCounters
+{
+    GLObjectPoolCounters(unsigned int contextID)
+    {
+        osg::GLBufferObjectManager* bom = osg::GLBufferObjectManager::getGLBufferObjectManager(contextID).get();
+        osg::Texture::TextureObjectManager* tom = osg::Texture::getTextureObjectManager(contextID).get();
+
+        bytesStreamed = bom->getNumberBytesStreamed();
+        texturePoolHits = tom->getNumberPoolHits();
+        texturePoolAllocations = tom->getNumberAllocated();
+        texturePoolEvictions = tom->getNumberEvicted();
+    }
+
+    void reportDelta(const GLObjectPoolCounters& previous, unsigned int frameNumber, osg::Stats* stats) const
+    {
+        stats->setAttribute(frameNumber, "Bytes streamed", static_cast<double>(bytesStreamed - previous.bytesStreamed));
+        stats->setAttribute(frameNumber, "Texture pool hits", static_cast<double>(texturePoolHits - previous.texturePoolHits));
+        stats->setAttribute(frameNumber, "Texture pool allocations", static_cast<double>(texturePoolAllocations - previous.texturePoolAllocations));
+        stats->setAttribute(frameNumber, "Texture pool evictions", static_cast<double>(texturePoolEvictions - previous.texturePoolEvictions));
+    }
+
+    unsigned long long  bytesStreamed;
+    unsigned int        texturePoolHits;
+    unsigned int        texturePoolAllocations;
+    unsigned int        texturePoolEvictions;
+};
+
 OpenGLQuerySupport::OpenGLQuerySupport():
     _extensions(0)
 {
@@ -604,6 +635,59 @@ static void collectSceneViewStats(unsigned int frameNumber, osgUtil::SceneView*
     stats->setAttribute(frameNumber, "Visible number of GL_POLYGON", static_cast<double>(pcm[GL_POLYGON]));
 }
 
+static void collectParallelCullStats(unsigned int frameNumber, osgUtil::SceneView* sceneView, osg::Stats* stats)
+{
+    unsigned int numSubgraphs = 0;
+    double mergeTime = 0.0;
+
+    osgUtil::CullVisitor* cullVisitors[2] = { sceneView->getCullVisitor(), 0 };
+    if (sceneView->getDisplaySettings() && sceneView->getDisplaySettings()->getStereo())
+    {
+        cullVisitors[0] = sceneView->getCullVisitorLeft();
+        cullVisitors[1] = sceneView->getCullVisitorRight();
+    }
+
+    for(unsigned int i=0; i<2; ++i)
+    {
+        if (cullVisitors[i])
+        {
+            numSubgraphs += cullVisitors[i]->getNumParallelCullSubgraphs();
+            mergeTime += cullVisitors[i]->getParallelCullMergeTime();
+        }
+    }
+
+    if (numSubgraphs>0)
+    {
+        stats->setAttribute(frameNumber, "Parallel cull subgraphs", static_cast<double>(numSubgraphs));
+        stats->setAttribute(frameNumber, "Parallel cull merge time taken", mergeTime);
+    }
+}
+
+static void collectCullAllocationStats(unsigned int frameNumber, osgUtil::SceneView* sceneView, osg::Stats* stats)
+{
+    unsigned int numAllocations = 0;
+    unsigned int numReuses = 0;
+
+    osgUtil::CullVisitor* cullVisitors[2] = { sceneView->getCullVisitor(), 0 };
+    if (sceneView->getDisplaySettings() && sceneView->getDisplaySettings()->getStereo())
+    {
+        cullVisitors[0] = sceneView->getCullVisitorLeft();
+        cullVisitors[1] = sceneView->getCullVisitorRight();
+    }
+
+    for(unsigned int i=0; i<2; ++i)
+    {
+        if (cullVisitors[i])
+        {
+            numAllocations += cullVisitors[i]->getNumberOfFrameAllocations();
+            numReuses += cullVisitors[i]->getNumberOfFrameReuses();
+        }
+    }
+
+    stats->setAttribute(frameNumber, "Cull allocations", static_cast<double>(numAllocations));
+    stats->setAttribute(frameNumber, "Cull reuses", static_cast<double>(numReuses));
+}
+
 void Renderer::cull()
 {
     DEBUG_MESSAGE<<"cull()"<<std::endl;
@@ -652,6 +736,9 @@ void Renderer::cull()
             stats->setAttribute(frameNumber, "Cull traversal begin time", osg::Timer::instance()->delta_s(_startTick, beforeCullTick));
             stats->setAttribute(frameNumber, "Cull traversal end time", osg::Timer::instance()->delta_s(_startTick, afterCullTick));
             stats->setAttribute(frameNumber, "Cull traversal time taken", osg::Timer::instance()->delta_s(beforeCullTick, afterCullTick));
+
+            collectParallelCullStats(frameNumber, sceneView, stats);
+            collectCullAllocationStats(frameNumber, sceneView, stats);
         }
 
         if (stats && stats->collectStats("scene"))
@@ -737,6 +824,7 @@ void Renderer::draw()
 
         osg::Timer_t beforeDrawTick;
 
+        GLObjectPoolCounters countersBeforeDraw(state->getContextID());
 
         if (_serializeDraw)
         {
@@ -770,6 +858,7 @@ void Renderer::draw()
             stats->setAttribute(frameNumber, "Draw traversal begin time", osg::Timer::instance()->delta_s(_startTick, beforeDrawTick));
             stats->setAttribute(frameNumber, "Draw traversal end time", osg::Timer::instance()->delta_s(_startTick, afterDrawTick));
             stats->setAttribute(frameNumber, "Draw traversal time taken", osg::Timer::instance()->delta_s(beforeDrawTick, afterDrawTick));
+            GLObjectPoolCounters(state->getContextID()).reportDelta(countersBeforeDraw, frameNumber, stats);
         }
 
         sceneView->clearReferencesToDependentCameras();
@@ -852,6 +941,8 @@ void Renderer::cull_draw()
 
     osg::Timer_t beforeDrawTick;
 
+    GLObjectPoolCounters countersBeforeDraw(state->getContextID());
+
     if (_serializeDraw)
     {
         OpenThreads::ScopedLock<OpenThreads::ReentrantMutex> lock(s_drawSerializerMutex);
@@ -881,9 +972,13 @@ void Renderer::cull_draw()
         stats->setAttribute(frameNumber, "Cull traversal end time", osg::Timer::instance()->delta_s(_startTick, afterCullTick));
         stats->setAttribute(frameNumber, "Cull traversal time taken", osg::Timer::instance()->delta_s(beforeCullTick, afterCullTick));
 
+        collectParallelCullStats(frameNumber, sceneView, stats);
+        collectCullAllocationStats(frameNumber, sceneView, stats);
+
         stats->setAttribute(frameNumber, "Draw traversal begin time", osg::Timer::instance()->delta_s(_startTick, beforeDrawTick));
         stats->setAttribute(frameNumber, "Draw traversal end time", osg::Timer::instance()->delta_s(_startTick, afterDrawTick));
         stats->setAttribute(frameNumber, "Draw traversal time taken", osg::Timer::instance()->delta_s(beforeDrawTick, afterDrawTick));
+        GLObjectPoolCounters(state->getContextID()).reportDelta(countersBeforeDraw, frameNumber, stats);
     }
 
     DEBUG_MESSAGE<<"end cull_draw() "<<this<<std::endl;
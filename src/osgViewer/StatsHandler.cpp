@@ -522,6 +522,38 @@ struct CameraSceneStatsTextDrawCallback : public virtual osg::Drawable::DrawCall
                 STATS_ATTRIBUTE("Visible number of GL_QUAD_STRIP")
                 STATS_ATTRIBUTE("Visible number of GL_POLYGON")
 
+                STATS_ATTRIBUTE("Parallel cull subgraphs")
+
+                if (stats->getAttribute(frameNumber, "Parallel cull merge time taken", value))
+                {
+                    viewStr.precision(2);
+                    viewStr << std::setw(8) << value*1000.0 << std::endl;
+                }
+                else
+                {
+                    viewStr << std::setw(8) << "." << std::endl;
+                }
+
+                viewStr.precision(0);
+                STATS_ATTRIBUTE("Cull allocations")
+
+                double hits = 0.0, allocations = 0.0;
+                if (stats->getAttribute(frameNumber, "Texture pool hits", hits) &&
+                    stats->getAttribute(frameNumber, "Texture pool allocations", allocations) &&
+                    (hits+allocations)>0.0)
+                {
+                    viewStr.precision(0);
+                    viewStr << std::setw(8) << hits/(hits+allocations)*100.0 << std::endl;
+                }
+                else
+                {
+                    viewStr << std::setw(8) << "." << std::endl;
+                }
+
+                viewStr.precision(0);
+                STATS_ATTRIBUTE("Texture pool allocations")
+                STATS_ATTRIBUTE("Texture pool evictions")
+
                 text->setText(viewStr.str());
             }
         }
@@ -942,6 +974,8 @@ struct PagerCallback : public virtual osg::NodeCallback
                     osgText::Text* averageValue,
                     osgText::Text* filerequestlist,
                     osgText::Text* compilelist,
+                    osg::Stats* viewerStats,
+                    osgText::Text* stageTimes,
                     double multiplier):
         _dp(dp),
         _minValue(minValue),
@@ -949,6 +983,8 @@ struct PagerCallback : public virtual osg::NodeCallback
         _averageValue(averageValue),
         _filerequestlist(filerequestlist),
         _compilelist(compilelist),
+        _viewerStats(viewerStats),
+        _stageTimes(stageTimes),
         _multiplier(multiplier)
     {
     }
@@ -997,6 +1033,26 @@ struct PagerCallback : public virtual osg::NodeCallback
 
             sprintf(tmpText,"%4d", _dp->getDataToCompileListSize());
             _compilelist->setText(tmpText);
+
+            if (_viewerStats.valid() && _stageTimes.valid())
+            {
+                std::string text;
+                for(unsigned int i=0; i<osgDB::DatabasePager::NUMBER_OF_PAGING_STAGES; ++i)
+                {
+                    const char* stageName = osgDB::DatabasePager::getPagingStageName(static_cast<osgDB::DatabasePager::PagingStage>(i));
+                    double stageTime = 0.0;
+                    if (_viewerStats->getAveragedAttribute(std::string("DatabasePager ")+stageName+" time taken", stageTime))
+                    {
+                        sprintf(tmpText,"%s: %6.2f    ", stageName, stageTime * _multiplier);
+                    }
+                    else
+                    {
+                        sprintf(tmpText,"%s:      -    ", stageName);
+                    }
+                    text += tmpText;
+                }
+                _stageTimes->setText(text);
+            }
         }
 
         traverse(node,nv);
@@ -1009,6 +1065,8 @@ struct PagerCallback : public virtual osg::NodeCallback
     osg::ref_ptr<osgText::Text> _averageValue;
     osg::ref_ptr<osgText::Text> _filerequestlist;
     osg::ref_ptr<osgText::Text> _compilelist;
+    osg::ref_ptr<osg::Stats>    _viewerStats;
+    osg::ref_ptr<osgText::Text> _stageTimes;
     double                      _multiplier;
 };
 
@@ -1447,9 +1505,35 @@ void StatsHandler::setUpScene(osgViewer::ViewerBase* viewer)
                 compileList->setPosition(pos);
                 compileList->setText("0");
 
-                pos.x() = maxLabel->getBoundingBox().xMax();
+                pos.x() = _leftPos;
+                pos.y() -= (_characterSize + backgroundSpacing);
+
+                _statsGeode->addDrawable(createBackgroundRectangle(    pos + osg::Vec3(-backgroundMargin, _characterSize + backgroundMargin, 0),
+                                                                       _statsWidth - 2 * backgroundMargin,
+                                                                       _characterSize + 2 * backgroundMargin,
+                                                                       backgroundColor));
+
+                osg::ref_ptr<osgText::Text> stageLabel = new osgText::Text;
+                _statsGeode->addDrawable( stageLabel.get() );
+
+                stageLabel->setColor(colorDP);
+                stageLabel->setFont(_font);
+                stageLabel->setCharacterSize(_characterSize);
+                stageLabel->setPosition(pos);
+                stageLabel->setText("DatabasePager time per tile (ms) - ");
+
+                pos.x() = stageLabel->getBoundingBox().xMax();
+
+                osg::ref_ptr<osgText::Text> stageTimes = new osgText::Text;
+                _statsGeode->addDrawable( stageTimes.get() );
+
+                stageTimes->setColor(colorDP);
+                stageTimes->setFont(_font);
+                stageTimes->setCharacterSize(_characterSize);
+                stageTimes->setPosition(pos);
+                stageTimes->setText("");
 
-                _statsGeode->setCullCallback(new PagerCallback(dp, minValue.get(), maxValue.get(), averageValue.get(), requestList.get(), compileList.get(), 1000.0));
+                _statsGeode->setCullCallback(new PagerCallback(dp, minValue.get(), maxValue.get(), averageValue.get(), requestList.get(), compileList.get(), viewer->getViewerStats(), stageTimes.get(), 1000.0));
             }
 
             pos.x() = _leftPos;
@@ -1469,7 +1553,7 @@ void StatsHandler::setUpScene(osgViewer::ViewerBase* viewer)
         group->addChild(geode);
         geode->addDrawable(createBackgroundRectangle(pos + osg::Vec3(-backgroundMargin, _characterSize + backgroundMargin, 0),
                                                         10 * _characterSize + 2 * backgroundMargin,
-                                                        22 * _characterSize + 2 * backgroundMargin,
+                                                        28 * _characterSize + 2 * backgroundMargin,
                                                         backgroundColor));
 
         // Camera scene & primitive stats static text
@@ -1506,6 +1590,12 @@ void StatsHandler::setUpScene(osgViewer::ViewerBase* viewer)
         viewStr << "Quads" << std::endl;
         viewStr << "Quad strips" << std::endl;
         viewStr << "Polygons" << std::endl;
+        viewStr << "Cull subgraphs" << std::endl;
+        viewStr << "Cull merge ms" << std::endl;
+        viewStr << "Cull allocs" << std::endl;
+        viewStr << "Tex pool hit %" << std::endl;
+        viewStr << "Tex allocs" << std::endl;
+        viewStr << "Tex evictions" << std::endl;
         viewStr.setf(std::ios::right,std::ios::adjustfield);
         camStaticText->setText(viewStr.str());
 
@@ -1518,7 +1608,7 @@ void StatsHandler::setUpScene(osgViewer::ViewerBase* viewer)
         {
             geode->addDrawable(createBackgroundRectangle(pos + osg::Vec3(-backgroundMargin, _characterSize + backgroundMargin, 0),
                                                             5 * _characterSize + 2 * backgroundMargin,
-                                                            22 * _characterSize + 2 * backgroundMargin,
+                                                            28 * _characterSize + 2 * backgroundMargin,
                                                             backgroundColor));
 
             // Camera scene stats
@@ -1127,6 +1127,16 @@ void Viewer::updateTraversal()
 
     _scene->updateSceneGraph(*_updateVisitor);
 
+    if (_scene->getDatabasePager() && getViewerStats() && getViewerStats()->collectStats("update"))
+    {
+        _scene->getDatabasePager()->reportStats(_frameStamp->getFrameNumber(), *getViewerStats());
+    }
+
+    if (_incrementalCompileOperation.valid() && getViewerStats() && getViewerStats()->collectStats("update"))
+    {
+        _incrementalCompileOperation->reportStats(_frameStamp->getFrameNumber(), *getViewerStats());
+    }
+
     // if we have a shared state manager prune any unused entries
     if (osgDB::Registry::instance()->getSharedStateManager())
         osgDB::Registry::instance()->getSharedStateManager()->prune();
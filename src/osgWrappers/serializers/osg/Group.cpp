@@ -16,7 +16,7 @@ static bool readChildren( osgDB::InputStream& is, osg::Group& node )
     {
         osg::ref_ptr<osg::Object> obj = is.readObject();
         osg::Node* child = dynamic_cast<osg::Node*>( obj.get() );
-        if ( child ) node.addChild( child );
+        if ( child && is.childRead(node, *child) ) node.addChild( child );
     }
     is >> is.END_BRACKET;
     return true;
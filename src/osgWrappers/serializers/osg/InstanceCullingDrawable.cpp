@@ -0,0 +1,47 @@
+#include <osg/InstanceCullingDrawable>
+#include <osgDB/ObjectWrapper>
+#include <osgDB/InputStream>
+#include <osgDB/OutputStream>
+
+// _instanceMatrices
+static bool checkInstanceMatrices( const osg::InstanceCullingDrawable& icd )
+{
+    return icd.getNumInstances()>0;
+}
+
+static bool readInstanceMatrices( osgDB::InputStream& is, osg::InstanceCullingDrawable& icd )
+{
+    unsigned int size = is.readSize(); is >> is.BEGIN_BRACKET;
+    osg::InstanceCullingDrawable::InstanceMatrixList matrices(size);
+    for ( unsigned int i=0; i<size; ++i )
+    {
+        is >> matrices[i];
+    }
+    is >> is.END_BRACKET;
+    icd.setInstanceMatrices( matrices );
+    return true;
+}
+
+static bool writeInstanceMatrices( osgDB::OutputStream& os, const osg::InstanceCullingDrawable& icd )
+{
+    const osg::InstanceCullingDrawable::InstanceMatrixList& matrices = icd.getInstanceMatrices();
+    os.writeSize(matrices.size()); os << os.BEGIN_BRACKET << std::endl;
+    for ( osg::InstanceCullingDrawable::InstanceMatrixList::const_iterator itr=matrices.begin();
+          itr!=matrices.end(); ++itr )
+    {
+        os << *itr << std::endl;
+    }
+    os << os.END_BRACKET << std::endl;
+    return true;
+}
+
+REGISTER_OBJECT_WRAPPER( InstanceCullingDrawable,
+                         new osg::InstanceCullingDrawable,
+                         osg::InstanceCullingDrawable,
+                         "osg::Object osg::Drawable osg::InstanceCullingDrawable" )
+{
+    ADD_OBJECT_SERIALIZER( Geometry, osg::Geometry, NULL );  // _geometry
+    ADD_USER_SERIALIZER( InstanceMatrices );  // _instanceMatrices
+    ADD_BOOL_SERIALIZER( OcclusionCulling, true );  // _occlusionCulling
+    ADD_UINT_SERIALIZER( MatrixAttributeLocation, 12 );  // _matrixAttributeLocation
+}